@@ -25,11 +25,17 @@ using moab::DagMC;
 #include <sstream>
 #include <set>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 
 #ifdef CUBIT_LIBS_PRESENT
 #include <fenv.h>
 #endif
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 // globals
 
 #define DAG DagMC::instance()
@@ -67,15 +73,96 @@ int MAX_MATERIAL_NAME_SIZE = 32;
 
 bool debug = false; //true ;
 
-/* Static values used by dagmctrack_ */
+/* State of the particle being tracked, used by g_step, g_fire, f_normal,
+ * boundary_test and the volume locator.  Every thread that tracks particles
+ * has its own NavigatorState, which is found by navigator_state(). */
+struct NavigatorState
+{
+  DagMC::RayHistory history;
+  bool on_boundary;
+  double old_direction[3];
+  MBEntityHandle next_surf; // the next suface the ray will hit
+  MBEntityHandle prev_surf; // the last value of next surface
+  MBEntityHandle PrevRegion; // the integer region that the particle was in previously
+
+  /* values used by g_fire to stream along a ray after physics-limited steps */
+  bool stream_valid;         // true if the ray below can be reused
+  int stream_region;         // region the ray was fired in
+  double stream_point[3];    // start of the ray
+  double stream_dir[3];      // direction of the ray
+  double stream_dist;        // distance from stream_point to next_surf
+  bool uncrossed_hit;        // true if the last hit in history was not crossed
+
+  /* values used by locate_volume */
+  int last_region;                     // region found by the last lookup
+  std::vector<unsigned int> tested_in; // last lookup that tested each region
+  unsigned int lookup_number;
+
+  NavigatorState() : on_boundary(false), next_surf(0), prev_surf(0), PrevRegion(0),
+		     stream_valid(false), stream_region(0), stream_dist(0.0), uncrossed_hit(false),
+		     last_region(0), lookup_number(0)
+  {
+    for (int j = 0 ; j < 3 ; j++)
+      {
+	old_direction[j] = 0.0;
+	stream_point[j] = 0.0;
+	stream_dir[j] = 0.0;
+      }
+  }
+
+  // forgets all facets hit by previous rays
+  void reset_history()
+  {
+    history.reset();
+    uncrossed_hit = false;
+  }
+};
+
+static std::vector<NavigatorState> navigator_states(1);
+static bool locator_built = false;      // set by build_volume_locator()
+
+//---------------------------------------------------------------------------//
+// navigator_state()
+//---------------------------------------------------------------------------//
+// Returns the navigator state of the calling thread.  The states are set up
+// by build_volume_locator(), which must be called before any lookups and
+// after the number of threads is set.
+static NavigatorState& navigator_state()
+{
+#ifdef _OPENMP
+  unsigned int thread = omp_get_thread_num();
+
+  // threads of a nested team would share the states of the outer team
+  if ( omp_get_active_level() > 1 ) 
+    {
+      std::cerr << "FluDAG cannot track particles in nested OpenMP parallel regions" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+#else
+  unsigned int thread = 0;
+#endif
+
+  if ( !locator_built || thread >= navigator_states.size() ) 
+    {
+      std::cerr << "FluDAG has no navigator state for thread " << thread
+		<< "; build_volume_locator() must be called after the number"
+		<< " of threads is set and before particles are tracked" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  return navigator_states[thread];
+}
 
-static DagMC::RayHistory history;
+/* Static values used by the volume locator */
 
-bool on_boundary;
-double old_direction[3];
-MBEntityHandle next_surf; // the next suface the ray will hit
-MBEntityHandle prev_surf; // the last value of next surface
-MBEntityHandle PrevRegion; // the integer region that the particle was in previously
+static int locator_dims[3];             // number of grid cells in x, y and z
+static double locator_min[3];           // lower corner of the grid
+static double locator_width[3];         // width of a grid cell in x, y and z
+static double locator_tol;              // tolerance for box containment
+static std::vector<double> volume_box;  // min and max corners, 6 per region
+static std::vector<int> cell_start;     // first candidate of each grid cell
+static std::vector<int> cell_regions;   // candidates, smallest box first
+static std::vector<int> neighbor_start; // first neighbor of each region
+static std::vector<int> neighbor_regions; // regions that share a surface
 
 
 /**************************************************************************************************/
@@ -130,6 +217,7 @@ void g_step(double& pSx,
           double* sLt,         // .
           int* jrLt)           // .
 {
+  NavigatorState& state = navigator_state();
   double safety; // safety parameter
 
   if(debug)
@@ -151,7 +239,7 @@ void g_step(double& pSx,
       std::cout << " prop = " << propStep ;
     }
   g_fire(oldReg, point, dir, propStep, retStep, saf, newReg); // fire a ray 
-  old_direction[0]=dir[0],old_direction[1]=dir[1],old_direction[2]=dir[2];
+  state.old_direction[0]=dir[0],state.old_direction[1]=dir[1],state.old_direction[2]=dir[2];
   if(debug)
     {
       std::cout << " ret = " << retStep;
@@ -176,8 +264,11 @@ void g_step(double& pSx,
 // retStep   - returned as the distance from the particle's current location, along its ray, to the next boundary
 // newRegion - gotten from the value returned by DAG->next_vol
 // newRegion is gotten from the volue returned by DAG->next_vol
+// After a step that was limited by physics, no ray is fired while the particle
+// keeps moving along the same ray in the same region.
 void g_fire(int &oldRegion, double point[], double dir[], double &propStep, double &retStep, double &safety,  int &newRegion)
 {
+  NavigatorState& state = navigator_state();
 
   MBEntityHandle vol = DAG->entity_by_index(3,oldRegion);
   double next_surf_dist;
@@ -187,17 +278,17 @@ void g_fire(int &oldRegion, double point[], double dir[], double &propStep, doub
   /*
   if(!check_vol(point,dir,oldRegion))
     {
-      history.reset();
+      state.history.reset();
     }
   */
     
-  if( dir[0] == old_direction[0] && dir[1] == old_direction[1] && dir[2] == old_direction[2] ) // direction changed reset history
+  if( dir[0] == state.old_direction[0] && dir[1] == state.old_direction[1] && dir[2] == state.old_direction[2] ) // direction changed reset history
     //   history.reset(); // this is a new particle or direction has changed
     {   
     }
   else
     {
-      history.reset();
+      state.reset_history();
     }
 
 
@@ -205,24 +296,68 @@ void g_fire(int &oldRegion, double point[], double dir[], double &propStep, doub
   // 
    
   oldRegion = DAG->index_by_handle(vol); // convert oldRegion int into MBHandle to the volume
-  if(on_boundary)
+  if(state.on_boundary)
     {
       if(boundary_test(vol,point,dir)==0) // if ray not on leaving vol
 	{
-	  history.reset(); // reset history
-	  on_boundary = false; // reset on boundary
+	  state.reset_history(); // reset history
+	  state.on_boundary = false; // reset on boundary
 	}
     }
-  
 
-  MBErrorCode result = DAG->ray_fire(vol, point, dir, next_surf, next_surf_dist,&history); // fire a ray 
-  if ( result != MB_SUCCESS )
+  // If the last step was limited by physics, then the particle is still
+  // streaming along the ray that was fired before.  In that case the distance
+  // to the next surface is the distance that was found for that ray, minus
+  // the distance travelled since, so no new ray needs to be fired.
+  bool streaming = false;
+  if ( state.stream_valid && state.stream_region == oldRegion &&
+       std::equal(dir, dir + 3, state.stream_dir) )
     {
-      std::cout << "DAG ray fire error" << std::endl;
-      exit(0);
+      double moved[3], travelled = 0.0;
+      for (int j = 0 ; j < 3 ; j++)
+	{
+	  moved[j] = point[j] - state.stream_point[j];
+	  travelled += moved[j] * dir[j];
+	}
+
+      // distance of the point from the ray
+      double off_ray = 0.0;
+      for (int j = 0 ; j < 3 ; j++)
+	{
+	  double d = moved[j] - travelled * dir[j];
+	  off_ray += d * d;
+	}
+
+      double tol = 1.0e-9 * (1.0 + fabs(travelled));
+      if ( travelled >= 0.0 && travelled < state.stream_dist && off_ray <= tol * tol )
+	{
+	  next_surf_dist = state.stream_dist - travelled;
+	  streaming = true;
+	}
+    }
+
+  if ( !streaming )
+    {
+      // the surface hit by the last ray was not crossed, so it must not be skipped
+      if ( state.uncrossed_hit )
+	state.history.rollback_last_intersection();
+
+      MBErrorCode result = DAG->ray_fire(vol, point, dir, state.next_surf, next_surf_dist,&state.history); // fire a ray 
+      if ( result != MB_SUCCESS )
+	{
+	  std::cout << "DAG ray fire error" << std::endl;
+	  exit(0);
+	}
+
+      state.stream_valid = false;
+      state.stream_region = oldRegion;
+      std::copy(point, point + 3, state.stream_point);
+      std::copy(dir, dir + 3, state.stream_dir);
+      state.stream_dist = next_surf_dist;
+      state.uncrossed_hit = false;
     }
 
-  if ( next_surf == 0 ) // if next_surface is 0 then we are lost
+  if ( state.next_surf == 0 ) // if next_surface is 0 then we are lost
     {
       std::cout << "!!! Lost Particle !!! " << std::endl;
       std::cout << "in region, " << oldRegion << " aka " << DAG->entity_by_index(3,oldRegion) << std::endl;  
@@ -240,24 +375,28 @@ void g_fire(int &oldRegion, double point[], double dir[], double &propStep, doub
   retStep = next_surf_dist; // the returned step length is the distance to next surf
   if ( propStep >= retStep ) // will cross into next volume next step
     {
-      MBErrorCode rval = DAG->next_vol(next_surf,vol,newvol);
+      MBErrorCode rval = DAG->next_vol(state.next_surf,vol,newvol);
       newRegion = DAG->index_by_handle(newvol);
       retStep = retStep; //+1.0e-9 ; // path limited by geometry
-      next_surf = next_surf;
-      on_boundary=true;
+      state.next_surf = state.next_surf;
+      state.on_boundary=true;
+      state.stream_valid = false;
+      state.uncrossed_hit = false;
       // history is preserved
     }
   else // step less than the distance to surface
     {
       newRegion = oldRegion; // dont leave the current region
       retStep = propStep; //physics limits step
-      next_surf = prev_surf; // still hit the previous surface
-      history.reset();
-	//_to_last_intersection();
-      on_boundary=false;
+      // next_surf is kept, since the ray will still hit it if the direction
+      // does not change; history is also kept, but the hit on next_surf is
+      // rolled back before another ray is fired
+      state.on_boundary=false;
+      state.stream_valid = true;
+      state.uncrossed_hit = true;
     }
 
-  PrevRegion = newRegion; // particle will be moving to PrevRegion upon next entry.
+  state.PrevRegion = newRegion; // particle will be moving to PrevRegion upon next entry.
 
   if(debug)
   {
@@ -265,7 +404,7 @@ void g_fire(int &oldRegion, double point[], double dir[], double &propStep, doub
                   ", Distance to next surf is " << retStep << std::endl;
   }
 
-  prev_surf = next_surf; // update the surface
+  state.prev_surf = state.next_surf; // update the surface
 
   return;
 }
@@ -301,13 +440,14 @@ int  normal (double& posx, double& posy, double& posz, double *norml, int& curRe
 //     norml vector
 //     flagErr = 0 if ok, !=0 otherwise
 // Does NOT set any region, point or direction vector.
-// Globals used:
+// Navigator state used:
 //     next_surf, set by ray_fire 
 void f_normal(double& pSx, double& pSy, double& pSz,
             double& pVx, double& pVy, double& pVz,
 	    double* norml, const int& oldRegion, 
 	    const int& newReg, int& flagErr)
 {
+  NavigatorState& state = navigator_state();
   if(debug)
   {
       std::cout << "============ NRMLWR =============" << std::endl;
@@ -318,8 +458,8 @@ void f_normal(double& pSx, double& pSy, double& pSz,
   double uvw[3] = {pVx,pVy,pVz}; //particl directoin
   int result; // particle is entering or leaving
 
-  MBErrorCode ErrorCode = DAG->test_volume_boundary( OldReg, next_surf,xyz,uvw, result, &history);  // see if we are on boundary
-  ErrorCode = DAG->get_angle(next_surf,xyz,norml); 
+  MBErrorCode ErrorCode = DAG->test_volume_boundary( OldReg, state.next_surf,xyz,uvw, result, &state.history);  // see if we are on boundary
+  ErrorCode = DAG->get_angle(state.next_surf,xyz,norml); 
   // result = 1 entering, 0 leaving
   if ( result == 0 ) // vector should point towards OldReg
     {
@@ -395,48 +535,37 @@ void f_look(double& pSx, double& pSy, double& pSz,
           double* pV, const int& oldReg, const int& oldLttc,
           int& nextRegion, int& flagErr, int& newLttc)
 {
+  NavigatorState& state = navigator_state();
   if(debug)
   {
       std::cout << "======= LKWR =======" << std::endl;
       std::cout << "position is " << pSx << " " << pSy << " " << pSz << std::endl; 
   }
   
-  history.reset();
+  state.reset_history();
 
   double xyz[] = {pSx, pSy, pSz};       // location of the particle (xyz)
   const double dir[] = {pV[0],pV[1],pV[2]};
-  // Initialize to outside boundary.  This value can be 0 or +/-1 for ouside, inside, or on boundary.
-  // ToDo:  Should this be initialized at all?  Or should it be initialized to an invalide number?
-  int is_inside = 0;                    
-  int num_vols = DAG->num_entities(3);  // number of volumes
+  int region = 0;
 
-  for (int i = 1 ; i <= num_vols ; i++) // loop over all volumes
-    {
-      MBEntityHandle volume = DAG->entity_by_index(3, i); // get the volume by index
-      // No ray history 
-      MBErrorCode code = DAG->point_in_volume(volume, xyz, is_inside);
+  // No ray history or ray direction.
+  MBErrorCode code = locate_volume(xyz, NULL, oldReg, region);
 
-      // check for non error
-      if(MB_SUCCESS != code) 
-	{
-	  std::cout << "Error return from point_in_volume!" << std::endl;
-	  flagErr = -3;
-	  return;
-	}
+  // check for non error
+  if(MB_SUCCESS != code) 
+    {
+      std::cout << "Error return from point_in_volume!" << std::endl;
+      flagErr = -3;
+      return;
+    }
 
-      if ( is_inside == 1 ) // we are inside the cell tested
-	{
-	  nextRegion = i;
-          //BIZARRELY - WHEN WE ARE INSIDE A VOLUME, BOTH, nextRegion has to equal flagErr
-	  flagErr = nextRegion;
-	  return;	  
-	}
-      else if ( is_inside == -1 )
-	{
-	  std::cout << "We cannot be here" << std::endl;
-	  exit(0);
-	}
-    }  // end loop over all volumes
+  if ( region > 0 ) // we are inside the cell found
+    {
+      nextRegion = region;
+      //BIZARRELY - WHEN WE ARE INSIDE A VOLUME, BOTH, nextRegion has to equal flagErr
+      flagErr = nextRegion;
+      return;	  
+    }
 
   // if we are here do slow check
   // slow_check(xyz,dir,nextRegion);
@@ -457,8 +586,9 @@ void f_lostlook(double& pSx, double& pSy, double& pSz,
  */
 int boundary_test(MBEntityHandle vol, double xyz[3], double uvw[3])
 {
+  NavigatorState& state = navigator_state();
   int result;
-  MBErrorCode ErrorCode = DAG->test_volume_boundary(vol,next_surf,xyz,uvw, result,&history);  // see if we are on boundary
+  MBErrorCode ErrorCode = DAG->test_volume_boundary(vol,state.next_surf,xyz,uvw, result,&state.history);  // see if we are on boundary
   return result;
 }
 //---------------------------------------------------------------------------//
@@ -469,28 +599,327 @@ void slow_check(double pos[3], const double dir[3], int &oldReg)
 {
   std::cout << pos[0] << " " << pos[1] << " " << pos[2] << std::endl;
   std::cout << dir[0] << " " << dir[1] << " " << dir[2] << std::endl;
+  int region = 0;
+  MBErrorCode code = locate_volume(pos, dir, oldReg, region); 
+  if ( code != MB_SUCCESS)
+    {
+      std::cout << "Failure from point in volume" << std::endl;
+      exit(0);
+    }
+
+  if ( region > 0 ) // if in volume
+    {
+      oldReg = region; //set oldReg
+      std::cout << pos[0] << " " << pos[1] << " " << pos[2] << " " << oldReg << std::endl;
+      return;
+    }
+
+  std::cout << "FAILED SLOW CHECK" << std::endl;
+  exit(0);
+}
+
+//---------------------------------------------------------------------------//
+// build_volume_locator()
+//---------------------------------------------------------------------------//
+// Sets up the volume locator used by f_look, lkmgwr and slow_check.  The
+// axis-aligned bounding box of every region is stored, and a uniform grid is
+// laid over all of the boxes.  Each grid cell lists the regions whose boxes
+// overlap that cell, sorted so that regions with smaller boxes come first;
+// nested regions are therefore tested before the regions that surround them.
+// Called once the OBB trees exist, i.e. right after DAG->init_OBBTree().
+// Also sets up a navigator state for every thread that may track particles,
+// so it must be called once, after the number of threads is set and before
+// any particles are tracked.
+void build_volume_locator()
+{
   int num_vols = DAG->num_entities(3);  // number of volumes
-  int is_inside = 0;
+  const double huge = 1.0e38;
+  double bounds[6] = {huge, huge, huge, -huge, -huge, -huge};
+
+  volume_box.assign(6 * (num_vols + 1), 0.0);
+  std::vector< std::pair<double,int> > box_sizes;
+
   for (int i = 1 ; i <= num_vols ; i++) // loop over all volumes
     {
       MBEntityHandle volume = DAG->entity_by_index(3, i); // get the volume by index
-      MBErrorCode code = DAG->point_in_volume(volume, pos, is_inside,dir); 
-      if ( code != MB_SUCCESS)
+      double* box = &volume_box[6 * i];
+      MBErrorCode code = DAG->getobb(volume, box, box + 3);
+
+      if ( code != MB_SUCCESS ) // no box, so region is a candidate everywhere
 	{
-	 std::cout << "Failure from point in volume" << std::endl;
-	 exit(0);
+	  for (int j = 0 ; j < 3 ; j++)
+	    {
+	      box[j] = -huge;
+	      box[j+3] = huge;
+	    }
+	  box_sizes.push_back(std::make_pair(huge, i));
+	  continue;
 	}
 
-      if ( is_inside == 1) // if in volume
+      double size = 1.0;
+      for (int j = 0 ; j < 3 ; j++)
 	{
-	  oldReg = DAG->index_by_handle(volume); //set oldReg
-	  std::cout << pos[0] << " " << pos[1] << " " << pos[2] << " " << oldReg << std::endl;
-	  return;
+	  bounds[j] = std::min(bounds[j], box[j]);
+	  bounds[j+3] = std::max(bounds[j+3], box[j+3]);
+	  size *= box[j+3] - box[j];
 	}
+      box_sizes.push_back(std::make_pair(size, i));
     }
 
-  std::cout << "FAILED SLOW CHECK" << std::endl;
-  exit(0);
+  // use about one grid cell per region, with at most 64 cells in each direction
+  int cells_per_dim = (int) ceil(pow((double) std::max(num_vols, 1), 1.0/3.0));
+  cells_per_dim = std::min(cells_per_dim, 64);
+  double diagonal = 0.0;
+
+  for (int j = 0 ; j < 3 ; j++)
+    {
+      if ( bounds[j] > bounds[j+3] ) // no regions have a box
+	{
+	  bounds[j] = 0.0;
+	  bounds[j+3] = 0.0;
+	}
+      locator_dims[j] = cells_per_dim;
+      locator_min[j] = bounds[j];
+      locator_width[j] = (bounds[j+3] - bounds[j]) / cells_per_dim;
+      if ( locator_width[j] <= 0.0 ) 
+	locator_width[j] = 1.0;
+      diagonal += (bounds[j+3] - bounds[j]) * (bounds[j+3] - bounds[j]);
+    }
+  locator_tol = 1.0e-8 * sqrt(diagonal);
+
+  // add regions to the cells that their boxes overlap, smallest boxes first
+  std::sort(box_sizes.begin(), box_sizes.end());
+
+  int num_cells = locator_dims[0] * locator_dims[1] * locator_dims[2];
+  std::vector< std::vector<int> > cells(num_cells);
+
+  for (unsigned int k = 0 ; k < box_sizes.size() ; k++)
+    {
+      int i = box_sizes[k].second;
+      const double* box = &volume_box[6 * i];
+      int first[3], last[3];
+
+      for (int j = 0 ; j < 3 ; j++)
+	{
+	  double lower = (box[j] - locator_tol - locator_min[j]) / locator_width[j];
+	  double upper = (box[j+3] + locator_tol - locator_min[j]) / locator_width[j];
+	  first[j] = (int) std::max(0.0, std::min(floor(lower), locator_dims[j] - 1.0));
+	  last[j] = (int) std::max(0.0, std::min(floor(upper), locator_dims[j] - 1.0));
+	}
+
+      for (int x = first[0] ; x <= last[0] ; x++)
+	for (int y = first[1] ; y <= last[1] ; y++)
+	  for (int z = first[2] ; z <= last[2] ; z++)
+	    cells[(z * locator_dims[1] + y) * locator_dims[0] + x].push_back(i);
+    }
+
+  // copy candidates into one array for all cells
+  cell_start.assign(num_cells + 1, 0);
+  cell_regions.clear();
+
+  for (int c = 0 ; c < num_cells ; c++)
+    {
+      cell_regions.insert(cell_regions.end(), cells[c].begin(), cells[c].end());
+      cell_start[c+1] = cell_regions.size();
+    }
+
+  build_region_neighbors();
+
+#ifdef _OPENMP
+  // every thread that may track particles needs its own navigator state
+  navigator_states.resize(omp_get_max_threads());
+#endif
+
+  for (unsigned int t = 0 ; t < navigator_states.size() ; t++)
+    {
+      navigator_states[t] = NavigatorState();
+      navigator_states[t].tested_in.assign(num_vols + 1, 0);
+    }
+  locator_built = true;
+}
+//---------------------------------------------------------------------------//
+// build_region_neighbors()
+//---------------------------------------------------------------------------//
+// Finds the regions that share a surface with each region, using the parent
+// volumes of the child surfaces of every region.  A particle that crosses a
+// surface always enters one of these regions.
+void build_region_neighbors()
+{
+  int num_vols = DAG->num_entities(3);  // number of volumes
+  std::vector< std::vector<int> > neighbors(num_vols + 1);
+
+  for (int i = 1 ; i <= num_vols ; i++) // loop over all volumes
+    {
+      MBEntityHandle volume = DAG->entity_by_index(3, i);
+      std::vector<MBEntityHandle> surfaces;
+      MBErrorCode code = DAG->moab_instance()->get_child_meshsets(volume, surfaces);
+      if ( code != MB_SUCCESS ) 
+	continue;
+
+      for (unsigned int k = 0 ; k < surfaces.size() ; k++)
+	{
+	  MBEntityHandle other = 0;
+	  code = DAG->next_vol(surfaces[k], volume, other);
+	  if ( code != MB_SUCCESS || other == 0 ) 
+	    continue;
+
+	  int j = DAG->index_by_handle(other);
+	  if ( j > 0 && j != i ) 
+	    neighbors[i].push_back(j);
+	}
+
+      std::sort(neighbors[i].begin(), neighbors[i].end());
+      neighbors[i].erase(std::unique(neighbors[i].begin(), neighbors[i].end()),
+			 neighbors[i].end());
+    }
+
+  // copy neighbors into one array for all regions
+  neighbor_start.assign(num_vols + 2, 0);
+  neighbor_regions.clear();
+
+  for (int i = 1 ; i <= num_vols ; i++)
+    {
+      neighbor_regions.insert(neighbor_regions.end(), neighbors[i].begin(), neighbors[i].end());
+      neighbor_start[i+1] = neighbor_regions.size();
+    }
+}
+//---------------------------------------------------------------------------//
+// region_neighbors(..)
+//---------------------------------------------------------------------------//
+// Returns the regions that share a surface with region, or NULL if it has none
+const int* region_neighbors(int region, int& num_neighbors)
+{
+  num_neighbors = 0;
+  if ( region <= 0 || region + 1 >= (int) neighbor_start.size() ) 
+    return NULL;
+
+  num_neighbors = neighbor_start[region+1] - neighbor_start[region];
+  return num_neighbors > 0 ? &neighbor_regions[neighbor_start[region]] : NULL;
+}
+//---------------------------------------------------------------------------//
+// box_contains(..)
+//---------------------------------------------------------------------------//
+// Returns true if the point is inside the bounding box of the region
+static bool box_contains(int region, const double xyz[3])
+{
+  const double* box = &volume_box[6 * region];
+
+  for (int j = 0 ; j < 3 ; j++)
+    {
+      if ( xyz[j] < box[j] - locator_tol || xyz[j] > box[j+3] + locator_tol )
+	return false;
+    }
+  return true;
+}
+//---------------------------------------------------------------------------//
+// test_region(..)
+//---------------------------------------------------------------------------//
+// Sets region to the candidate if the point is inside it.  Candidates that
+// were already tested during the current lookup are skipped.
+static MBErrorCode test_region(NavigatorState& state, int candidate, const double xyz[3], const double* dir, int& region)
+{
+  if ( state.tested_in[candidate] == state.lookup_number ) 
+    return MB_SUCCESS;
+  state.tested_in[candidate] = state.lookup_number;
+
+  int is_inside = 0;
+  MBEntityHandle volume = DAG->entity_by_index(3, candidate); // get the volume by index
+  MBErrorCode code = DAG->point_in_volume(volume, xyz, is_inside, dir);
+
+  if ( code == MB_SUCCESS && is_inside == 1 ) // we are inside the cell tested
+    {
+      region = candidate;
+      state.last_region = candidate;
+    }
+  return code;
+}
+//---------------------------------------------------------------------------//
+// locate_volume(..)
+//---------------------------------------------------------------------------//
+// Finds the region that contains the point xyz, which is set to 0 if the
+// point is not inside any region.  The previous region of the particle is
+// tested first, followed by the regions that share a surface with it, since
+// most lookups happen right after a surface crossing.  If previous is not a
+// valid region, then the region found by the last lookup is used instead.
+// Next come the other regions listed in the grid cell that contains the
+// point.  Only regions whose bounding boxes contain the point are tested.
+// Points outside of the grid can still be inside a region without a box,
+// such as the implicit complement, so all regions are tested for these
+// points.
+// dir may be NULL, and is passed on to point_in_volume.
+MBErrorCode locate_volume(const double xyz[3], const double* dir, int previous, int& region)
+{
+  NavigatorState& state = navigator_state();
+
+  region = 0;
+  MBErrorCode code = MB_SUCCESS;
+  int num_vols = DAG->num_entities(3);  // number of volumes
+
+  // start a new lookup, in which no regions have been tested
+  if ( ++state.lookup_number == 0 ) 
+    {
+      std::fill(state.tested_in.begin(), state.tested_in.end(), 0);
+      state.lookup_number = 1;
+    }
+
+  if ( previous <= 0 || previous > num_vols ) 
+    previous = state.last_region;
+
+  if ( previous > 0 )
+    {
+      if ( box_contains(previous, xyz) ) 
+	{
+	  code = test_region(state, previous, xyz, dir, region);
+	  if ( code != MB_SUCCESS || region > 0 ) 
+	    return code;
+	}
+
+      for (int k = neighbor_start[previous] ; k < neighbor_start[previous+1] ; k++)
+	{
+	  int candidate = neighbor_regions[k];
+	  if ( !box_contains(candidate, xyz) ) 
+	    continue;
+
+	  code = test_region(state, candidate, xyz, dir, region);
+	  if ( code != MB_SUCCESS || region > 0 ) 
+	    return code;
+	}
+    }
+
+  // find the grid cell that contains the point
+  int cell = 0;
+  bool in_grid = true;
+  for (int j = 2 ; j >= 0 ; j--)
+    {
+      double index = floor((xyz[j] - locator_min[j]) / locator_width[j]);
+      if ( index < 0.0 || index >= locator_dims[j] ) 
+	in_grid = false;
+      index = std::max(0.0, std::min(index, locator_dims[j] - 1.0));
+      cell = cell * locator_dims[j] + (int) index;
+    }
+
+  for (int k = cell_start[cell] ; k < cell_start[cell+1] ; k++)
+    {
+      int candidate = cell_regions[k];
+      if ( !box_contains(candidate, xyz) ) 
+	continue;
+
+      code = test_region(state, candidate, xyz, dir, region);
+      if ( code != MB_SUCCESS || region > 0 ) 
+	return code;
+    }
+
+  if ( in_grid ) 
+    return MB_SUCCESS;
+
+  // if we are here test all of the other regions
+  for (int i = 1 ; i <= num_vols ; i++) // loop over all volumes
+    {
+      code = test_region(state, i, xyz, dir, region);
+      if ( code != MB_SUCCESS || region > 0 ) 
+	return code;
+    }
+  return MB_SUCCESS;
 }
 
 /*
@@ -503,34 +932,29 @@ void lkmgwr(double& pSx, double& pSy, double& pSz,
   
 
     const double xyz[] = {pSx, pSy, pSz}; // location of the particle (xyz)
-    int is_inside = 0; // logical inside or outside of volume
-    int num_vols = DAG->num_entities(3); // number of volumes
+    int region = 0; // region containing the point, if any
 
-    for (int i = 1 ; i <= num_vols ; i++) // loop over all volumes
-      {
-	MBEntityHandle volume = DAG->entity_by_index(3, i); // get the volume by index
-	// No ray history or ray direction.
-	MBErrorCode code = DAG->point_in_volume(volume, xyz, is_inside);
+    // No ray history or ray direction.
+    MBErrorCode code = locate_volume(xyz, NULL, oldReg, region);
 
-	// check for non error
-	if(MB_SUCCESS != code) 
-	  {
-	    std::cout << "Error return from point_in_volume!" << std::endl;
-	    flagErr = 1;
-	    return;
-	  }
+    // check for non error
+    if(MB_SUCCESS != code) 
+      {
+	std::cout << "Error return from point_in_volume!" << std::endl;
+	flagErr = 1;
+	return;
+      }
 
-	if ( is_inside == 1 ) // we are inside the cell tested
+    if ( region > 0 ) // we are inside the cell found
+      {
+	newReg = region;
+	flagErr = region+1;
+	if(debug)
 	  {
-	    newReg = i;
-	    flagErr = i+1;
-	    if(debug)
-	      {
-		std::cout << "point is in region = " << newReg << std::endl;
-	      }
-	    return;
+	    std::cout << "point is in region = " << newReg << std::endl;
 	  }
-      }  // end loop over all volumes
+	return;
+      }
 
     std::cout << "particle is nowhere!" << std::endl;
     newReg = -100;
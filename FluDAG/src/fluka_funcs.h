@@ -28,6 +28,31 @@ extern "C" {
                 int max_pbl);
 
   void slow_check(double pos[3], const double dir[3], int &oldReg);
+
+  /* 
+   * Set up the volume locator, a grid of region bounding boxes that is used
+   * to find the region containing a point.  Also sets up the navigator state
+   * of every thread.  Must be called once, after init_OBBTree() and after the
+   * number of OpenMP threads is set, but before any particles are tracked;
+   * FluDAG exits with an error if a lookup is made without it.
+   */
+  void build_volume_locator();
+  /*
+   * Find the regions that share a surface with each region.  Called by
+   * build_volume_locator().
+   */
+  void build_region_neighbors();
+  /*
+   * Get the regions that share a surface with region, or NULL if there are none
+   */
+  const int* region_neighbors(int region, int& num_neighbors);
+  /*
+   * Find the region containing the point xyz, or 0 if there is none.  The
+   * previous region and its neighbors are tested first; if previous is 0 the
+   * region found by the last lookup is used instead.  dir may be NULL.  Used
+   * by f_look, lkmgwr and slow_check.
+   */
+  MBErrorCode locate_volume(const double xyz[3], const double* dir, int previous, int& region);
   // check we are where we say we are
   MBEntityHandle check_reg(MBEntityHandle volume, double point[3], double dir[3]); 
 
@@ -91,6 +91,9 @@ int main(int argc, char* argv[])
       exit(EXIT_FAILURE);
     }
 
+  // set up the grid used to find the region containing a point
+  build_volume_locator();
+
   time(&time_after);
 
   seconds = difftime(time_after,time_before);
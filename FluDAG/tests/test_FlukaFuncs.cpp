@@ -9,6 +9,7 @@
 
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 
 
 #define DAG moab::DagMC::instance()
@@ -53,6 +54,9 @@ class FluDAGTest : public ::testing::Test
        rval = DAG->init_OBBTree();
        assert (rval == MB_SUCCESS);
 
+       // Set up the volume locator for the new geometry
+       build_volume_locator();
+
        // Initialize point and dir
        point[0] = 0.0;
        point[1] = 0.0; 
@@ -253,6 +257,140 @@ TEST_F(FluDAGTest, GFireGoodPropStep)
   EXPECT_DOUBLE_EQ(5.0/dir_norm, retStep);
 }
 
+//---------------------------------------------------------------------------//
+// Test physics-limited steps along a ray, with changes in direction and
+// position that require new rays, followed by a surface crossing
+TEST_F(FluDAGTest, GStepStreaming)
+{
+  oldReg   = 2;
+  point[2] = 5.0;
+  dir[2]   = 1.0;
+  propStep = 0.75;
+
+  // g_step arguments that are not used by FluDAG
+  int oldLttc = 0, nascFlag = 0, newLttc = 0, LttcFlag = 0, jrLt = 0;
+  double sLt = 0.0;
+
+  // steps along the same ray are limited by physics
+  for (int i = 0; i < 3; i++)
+  {
+    g_step(point[0], point[1], point[2], dir, oldReg, oldLttc, propStep, nascFlag,
+           retStep, newReg, safety, newLttc, LttcFlag, &sLt, &jrLt);
+    EXPECT_EQ(oldReg, newReg);
+    EXPECT_DOUBLE_EQ(propStep, retStep);
+    point[2] += retStep;
+  }
+
+  // change direction
+  dir[2] = -1.0;
+  propStep = 0.5;
+  g_step(point[0], point[1], point[2], dir, oldReg, oldLttc, propStep, nascFlag,
+         retStep, newReg, safety, newLttc, LttcFlag, &sLt, &jrLt);
+  EXPECT_EQ(oldReg, newReg);
+  EXPECT_DOUBLE_EQ(0.5, retStep);
+  point[2] -= retStep;
+
+  // change direction back, then move off the ray after a physics-limited step
+  dir[2] = 1.0;
+  propStep = 0.75;
+  g_step(point[0], point[1], point[2], dir, oldReg, oldLttc, propStep, nascFlag,
+         retStep, newReg, safety, newLttc, LttcFlag, &sLt, &jrLt);
+  EXPECT_DOUBLE_EQ(0.75, retStep);
+  point[0] = 1.0;
+  point[2] += retStep;
+
+  // new ray must still hit the surface that was not crossed
+  for (int i = 0; i < 3; i++)
+  {
+    g_step(point[0], point[1], point[2], dir, oldReg, oldLttc, propStep, nascFlag,
+           retStep, newReg, safety, newLttc, LttcFlag, &sLt, &jrLt);
+    EXPECT_EQ(oldReg, newReg);
+    EXPECT_DOUBLE_EQ(propStep, retStep);
+    point[2] += retStep;
+  }
+
+  g_step(point[0], point[1], point[2], dir, oldReg, oldLttc, propStep, nascFlag,
+         retStep, newReg, safety, newLttc, LttcFlag, &sLt, &jrLt);
+  EXPECT_NE(oldReg, newReg);
+  EXPECT_DOUBLE_EQ(0.25, retStep);
+}
+//---------------------------------------------------------------------------//
+// Test that the volume locator finds the same region as testing every volume
+TEST_F(FluDAGTest, LookMatchesAllVolumes)
+{
+  int num_vols = DAG->num_entities(3);
+  dir[2] = 1.0;
+
+  // points near the center and corners of every slab, and outside the slabs
+  for (int k = -1; k <= 10; k++)
+  {
+    for (int c = 0; c < 5; c++)
+    {
+      point[0] = (c == 0) ? 0.0 : ((c % 2) ? 4.9 : -4.9);
+      point[1] = (c == 0) ? 0.0 : ((c < 3) ? 4.9 : -4.9);
+      point[2] = 10.0 * k + 5.0;
+
+      int expected = 0;
+      for (int i = 1; i <= num_vols; i++)
+      {
+        int ret;
+        rval = DAG->point_in_volume(DAG->entity_by_index(3, i), point, ret);
+        EXPECT_EQ(MB_SUCCESS, rval);
+        if (ret == 1)
+        {
+          expected = i;
+          break;
+        }
+      }
+
+      // result should not depend on the previous region
+      for (int previous = 0; previous <= num_vols; previous++)
+      {
+        int region = 0;
+        EXPECT_EQ(MB_SUCCESS, locate_volume(point, NULL, previous, region));
+        EXPECT_EQ(expected, region);
+      }
+
+      if (expected > 0)
+      {
+        EXPECT_EQ(expected, look(point[0], point[1], point[2], dir, oldReg));
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------//
+// Test that regions sharing a surface are neighbors of each other
+TEST_F(FluDAGTest, RegionNeighbors)
+{
+  int num_vols = DAG->num_entities(3);
+  int total_neighbors = 0;
+
+  for (int i = 1; i <= num_vols; i++)
+  {
+    int num_neighbors = 0;
+    const int* neighbors = region_neighbors(i, num_neighbors);
+    total_neighbors += num_neighbors;
+
+    for (int k = 0; k < num_neighbors; k++)
+    {
+      int j = neighbors[k];
+      EXPECT_NE(i, j);
+      ASSERT_GE(j, 1);
+      ASSERT_LE(j, num_vols);
+
+      // i should also be a neighbor of j
+      int num_other = 0;
+      const int* other = region_neighbors(j, num_other);
+      EXPECT_NE(other + num_other, std::find(other, other + num_other, i));
+    }
+  }
+
+  EXPECT_GT(total_neighbors, 0);
+
+  int num_neighbors = 1;
+  EXPECT_TRUE(NULL == region_neighbors(0, num_neighbors));
+  EXPECT_EQ(0, num_neighbors);
+}
 //---------------------------------------------------------------------------//
 // Test that for particles with a -z component exit(0) is called
 // Death Tests require special handling and naming recommendation
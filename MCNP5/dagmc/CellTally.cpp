@@ -56,6 +56,41 @@ void CellTally::compute_score(const TallyEvent& event)
     data->add_score_to_tally(tally_index, event_score, ebin);
 }
 //---------------------------------------------------------------------------//
+void CellTally::compute_scores(const TallyEventBatch& batch)
+{
+    // Return if event type is incompatible with CellTally
+    if (batch.type == TallyEvent::NONE || batch.type != expected_type)
+    {
+        return;
+    }
+
+    int tally_index = 0;
+    unsigned int ebin = 0;
+
+    for (unsigned int i = 0; i < batch.size(); ++i)
+    {
+        // Skip events not in the current cell or outside energy bounds
+        if (batch.current_cell[i] != cell_id ||
+            !get_energy_bin(batch.particle_energy[i], ebin))
+        {
+            continue;
+        }
+
+        double event_score = batch.get_score_multiplier(i, input_data.multiplier_id);
+
+        if (expected_type == TallyEvent::TRACK)
+        {
+            event_score *= batch.track_length[i];
+        }
+        else // expected_type == TallyEvent::COLLISION
+        {
+            event_score /= batch.total_cross_section[i];
+        }
+
+        data->add_score_to_tally(tally_index, event_score, ebin);
+    }
+}
+//---------------------------------------------------------------------------//
 void CellTally::write_data(double num_histories)
 {
     std::cout << "Writing data for CellTally " << input_data.tally_id
@@ -106,6 +141,11 @@ void CellTally::write_data(double num_histories)
     }
 }
 //---------------------------------------------------------------------------//
+bool CellTally::is_thread_safe() const
+{
+    return true;
+}
+//---------------------------------------------------------------------------//
 int CellTally::get_cell_id()
 {
     return cell_id;
@@ -66,6 +66,15 @@ class CellTally : public Tally
      */
     virtual void compute_score(const TallyEvent& event);
 
+    /**
+     * \brief Computes scores for this CellTally based on a batch of events
+     * \param[in] batch the parameters needed to compute the scores
+     *
+     * Scores are computed directly from the batch arrays, skipping all of the
+     * events that did not occur in the cell being tallied.
+     */
+    virtual void compute_scores(const TallyEventBatch& batch);
+
     /**
      * \brief Write results for this CellTally
      * \param[in] num_histories the number of particle histories tracked
@@ -77,6 +86,12 @@ class CellTally : public Tally
      */
     virtual void write_data(double num_histories);
 
+    /**
+     * \brief Check if this CellTally can score events from multiple threads
+     * \return true, as all scores are added to per-thread TallyData arrays
+     */
+    virtual bool is_thread_safe() const;
+
     /**
      * \brief get_cell_id() 
      * 
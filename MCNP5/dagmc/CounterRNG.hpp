@@ -0,0 +1,145 @@
+// MCNP5/dagmc/CounterRNG.hpp
+
+#ifndef DAGMC_COUNTER_RNG_HPP
+#define DAGMC_COUNTER_RNG_HPP
+
+#include <stdint.h>
+
+//===========================================================================//
+/**
+ * \class CounterRNG
+ * \brief Counter-based random number generator for reproducible tallies
+ *
+ * CounterRNG is a random number generator based on the Philox4x32-10 block
+ * function described in
+ *
+ *     J. K. Salmon, M. A. Moraes, R. O. Dror and D. E. Shaw, "Parallel Random
+ *     Numbers: As Easy as 1, 2, 3," Proceedings of the International
+ *     Conference for High Performance Computing, Networking, Storage and
+ *     Analysis (SC11), Seattle, Washington, November 12-18 (2011)
+ *
+ * Unlike a conventional generator, the random numbers are not produced by
+ * updating a shared internal state.  Instead, each block of four 32-bit
+ * random words is a function of a 64-bit key and a 128-bit counter only.  The
+ * key is defined by a stream number and a seed, whereas the counter is
+ * defined by the particle history number, the index of the event within that
+ * history and the number of blocks already used for that event.  This means
+ * that the random numbers for any event can be generated independently of
+ * all other events, so the results do not depend on the order in which the
+ * events were scored, or on how histories were divided between threads or
+ * MPI tasks.
+ *
+ * CounterRNG objects are small enough to be created on the stack whenever
+ * random numbers are needed, which means that separate threads never share
+ * the same generator.
+ */
+//===========================================================================//
+class CounterRNG
+{
+  public:
+    /**
+     * \brief Constructor
+     * \param[in] stream the number of the random number stream, e.g. tally ID
+     * \param[in] seed the seed value that selects one set of streams
+     */
+    CounterRNG(unsigned int stream, unsigned int seed)
+    {
+        key[0] = stream;
+        key[1] = seed;
+        set_position(0, 0);
+    }
+
+    // >>> PUBLIC INTERFACE
+
+    /**
+     * \brief Moves to the start of the random numbers for an event
+     * \param[in] history the number of the particle history
+     * \param[in] event the index of the event within the history
+     */
+    void set_position(unsigned long long int history, unsigned int event)
+    {
+        counter[0] = static_cast<uint32_t>(history);
+        counter[1] = static_cast<uint32_t>(history >> 32);
+        counter[2] = event;
+        counter[3] = 0;
+
+        // no random words are available until the first block is generated
+        num_used = 4;
+    }
+
+    /**
+     * \brief Generates the next random number for the current event
+     * \return random number uniformly distributed on [0, 1)
+     *
+     * Each random number uses two 32-bit random words to obtain 53 random
+     * bits, which is the full precision of a double.
+     */
+    double uniform()
+    {
+        if (num_used == 4)
+        {
+            philox(counter, key, output);
+            ++counter[3];
+            num_used = 0;
+        }
+
+        uint32_t a = output[num_used] >> 5;
+        uint32_t b = output[num_used + 1] >> 6;
+        num_used += 2;
+
+        return (a * 67108864.0 + b) / 9007199254740992.0;
+    }
+
+    /**
+     * \brief Computes one block of random words using Philox4x32-10
+     * \param[in] counter the four 32-bit words of the counter
+     * \param[in] key the two 32-bit words of the key
+     * \param[out] output the four 32-bit random words
+     */
+    static void philox(const uint32_t counter[4],
+                       const uint32_t key[2],
+                       uint32_t output[4])
+    {
+        uint32_t c0 = counter[0], c1 = counter[1];
+        uint32_t c2 = counter[2], c3 = counter[3];
+        uint32_t k0 = key[0], k1 = key[1];
+
+        for (int round = 0; round < 10; ++round)
+        {
+            // bump the key for every round except the first
+            if (round > 0)
+            {
+                k0 += 0x9E3779B9;
+                k1 += 0xBB67AE85;
+            }
+
+            uint64_t product0 = static_cast<uint64_t>(0xD2511F53) * c0;
+            uint64_t product1 = static_cast<uint64_t>(0xCD9E8D57) * c2;
+
+            c0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+            c1 = static_cast<uint32_t>(product1);
+            c2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+            c3 = static_cast<uint32_t>(product0);
+        }
+
+        output[0] = c0;
+        output[1] = c1;
+        output[2] = c2;
+        output[3] = c3;
+    }
+
+  private:
+    // Key defined by the stream number and seed
+    uint32_t key[2];
+
+    // Counter defined by the history, event and number of blocks used
+    uint32_t counter[4];
+
+    // Random words from the last block, and how many have been used
+    uint32_t output[4];
+    unsigned int num_used;
+};
+
+#endif // DAGMC_COUNTER_RNG_HPP
+
+// end of MCNP5/dagmc/CounterRNG.hpp
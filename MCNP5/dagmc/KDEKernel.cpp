@@ -1,6 +1,8 @@
 // MCNP5/dagmc/KDEKernel.cpp
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
 
 #include "KDEKernel.hpp"
@@ -50,7 +52,7 @@ double KDEKernel::boundary_correction(const double* u,
     assert(num_corrections > 0);
 
     // compute partial moments ai(p) for first dimension
-    std::vector <double> ai_u;
+    double ai_u[3];
     bool valid_moments = compute_moments(u[0], p[0], side[0], ai_u);
 
     // check within boundary kernel domain
@@ -66,36 +68,31 @@ double KDEKernel::boundary_correction(const double* u,
     else  // correction needed in more than one dimension
     {
         // compute partial moments ai(p) for second dimension
-        std::vector<double> ai_v;
+        double ai_v[3];
         valid_moments = compute_moments(u[1], p[1], side[1], ai_v);
 
         // check still within boundary kernel domain
         if (!valid_moments) return 0.0;
 
-        // create coefficients vector initially with right-hand side values
-        std::vector<double> coefficients;
-        coefficients.push_back(1.0);
-        coefficients.push_back(0.0);
-        coefficients.push_back(0.0);
+        // create coefficients array initially with right-hand side values
+        double coefficients[4] = {1.0, 0.0, 0.0, 0.0};
 
         // solve for the coefficients of the boundary correction factor
         bool solved = false;
-        std::vector<double> correction_matrix;
+        double correction_matrix[16];
 
         if (num_corrections == 2)
         {
             // solve 3x3 matrix system to get coefficients
             get_correction_matrix2D(ai_u, ai_v, correction_matrix);
-            solved = solve_symmetric_matrix(correction_matrix, coefficients);
+            solved = solve_symmetric_matrix(correction_matrix, coefficients, 3);
 
             if (!solved) return 0.0;
         }
         else  // correction needed in all three dimensions
         {
-            coefficients.push_back(0.0);
-
             // compute partial moments ai(p) for third dimension
-            std::vector<double> ai_w;
+            double ai_w[3];
             valid_moments = compute_moments(u[2], p[2], side[2], ai_w); 
 
             // check still within boundary kernel domain
@@ -103,7 +100,7 @@ double KDEKernel::boundary_correction(const double* u,
 
             // solve 4x4 matrix system to get coefficients
             get_correction_matrix3D(ai_u, ai_v, ai_w, correction_matrix);
-            solved = solve_symmetric_matrix(correction_matrix, coefficients);
+            solved = solve_symmetric_matrix(correction_matrix, coefficients, 4);
 
             if (!solved) return 0.0;
         }
@@ -120,15 +117,44 @@ double KDEKernel::boundary_correction(const double* u,
     }
 }
 //---------------------------------------------------------------------------//
+void KDEKernel::evaluate_product(const double* x,
+                                 const double* y,
+                                 const double* z,
+                                 unsigned int n,
+                                 const double* observation,
+                                 const double* bandwidth,
+                                 double* values) const
+{
+    const double* coords[3] = {x, y, z};
+
+    for (unsigned int j = 0; j < n; ++j)
+    {
+        double value = 1.0;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            double u = (coords[i][j] - observation[i]) / bandwidth[i];
+            value *= evaluate(u) / bandwidth[i];
+        }
+
+        values[j] = value;
+    }
+}
+//---------------------------------------------------------------------------//
+bool KDEKernel::get_polynomial(std::vector<double>& /* coefficients */) const
+{
+    // general kernel functions are not assumed to be polynomials
+    return false;
+}
+//---------------------------------------------------------------------------//
 // PROTECTED METHODS
 //---------------------------------------------------------------------------//
 bool KDEKernel::compute_moments(double u,
                                 double p,
                                 unsigned int side,
-                                std::vector<double>& moments) const
+                                double* moments) const
 {
     assert(side <= 1);
-    assert(moments.empty());
 
     // make sure p is not negative
     if (p < 0.0) return false;
@@ -152,73 +178,115 @@ bool KDEKernel::compute_moments(double u,
     // test if outside domain u = [u_min, u_max]
     if (u < u_min || u > u_max) return false;
 
-    // evaluate the partial moment functions ai(p) and add to moments vector
-    moments.push_back(this->integrate_moment(u_min, u_max, 0));
-    moments.push_back(this->integrate_moment(u_min, u_max, 1));
-    moments.push_back(this->integrate_moment(u_min, u_max, 2));
+    // evaluate the partial moment functions ai(p)
+    moments[0] = this->integrate_moment(u_min, u_max, 0);
+    moments[1] = this->integrate_moment(u_min, u_max, 1);
+    moments[2] = this->integrate_moment(u_min, u_max, 2);
 
     return true;
 }
 //---------------------------------------------------------------------------//
-void KDEKernel::get_correction_matrix2D(const std::vector<double>& ai_u,
-                                        const std::vector<double>& ai_v,
-                                        std::vector<double>& matrix) const
+void KDEKernel::get_correction_matrix2D(const double* ai_u,
+                                        const double* ai_v,
+                                        double* matrix) const
 {
-    assert(matrix.empty());
-
-    // populate matrix elements in lower triangular format using moments
-    matrix.push_back(ai_u[0] * ai_v[0]);
-    matrix.push_back(ai_u[1] * ai_v[0]);
-    matrix.push_back(ai_u[0] * ai_v[1]);
-    matrix.push_back(ai_u[2] * ai_v[0]);
-    matrix.push_back(ai_u[1] * ai_v[1]);
-    matrix.push_back(ai_u[0] * ai_v[2]);
+    // powers of u and v in each term of a0 + a1*u + a2*v
+    const unsigned int powers[3][2] = {{0, 0}, {1, 0}, {0, 1}};
+
+    // populate matrix elements using moments of the product of two terms
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            matrix[3 * i + j] = ai_u[powers[i][0] + powers[j][0]]
+                              * ai_v[powers[i][1] + powers[j][1]];
+        }
+    }
 }
 //---------------------------------------------------------------------------//
-void KDEKernel::get_correction_matrix3D(const std::vector<double>& ai_u,
-                                        const std::vector<double>& ai_v,
-                                        const std::vector<double>& ai_w,
-                                        std::vector<double>& matrix) const
+void KDEKernel::get_correction_matrix3D(const double* ai_u,
+                                        const double* ai_v,
+                                        const double* ai_w,
+                                        double* matrix) const
 {
-    assert(matrix.empty());
-
-    // populate matrix elements in lower triangular format using moments
-    matrix.push_back(ai_u[0] * ai_v[0] * ai_w[0]);
-    matrix.push_back(ai_u[1] * ai_v[0] * ai_w[0]);
-    matrix.push_back(ai_u[0] * ai_v[1] * ai_w[0]);
-    matrix.push_back(ai_u[0] * ai_v[0] * ai_w[1]);
-    matrix.push_back(ai_u[2] * ai_v[0] * ai_w[0]);
-    matrix.push_back(ai_u[1] * ai_v[1] * ai_w[0]);
-    matrix.push_back(ai_u[1] * ai_v[0] * ai_w[1]);
-    matrix.push_back(ai_u[0] * ai_v[2] * ai_w[0]);
-    matrix.push_back(ai_u[0] * ai_v[1] * ai_w[1]);
-    matrix.push_back(ai_u[0] * ai_v[0] * ai_w[2]);
+    // powers of u, v and w in each term of a0 + a1*u + a2*v + a3*w
+    const unsigned int powers[4][3] = {{0, 0, 0}, {1, 0, 0},
+                                       {0, 1, 0}, {0, 0, 1}};
+
+    // populate matrix elements using moments of the product of two terms
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        for (unsigned int j = 0; j < 4; ++j)
+        {
+            matrix[4 * i + j] = ai_u[powers[i][0] + powers[j][0]]
+                              * ai_v[powers[i][1] + powers[j][1]]
+                              * ai_w[powers[i][2] + powers[j][2]];
+        }
+    }
 }
 //---------------------------------------------------------------------------//
-bool KDEKernel::solve_symmetric_matrix(std::vector<double>& A,
-                                       std::vector<double>& b) const
+bool KDEKernel::solve_symmetric_matrix(double* A,
+                                       double* b,
+                                       unsigned int n) const
 {
-    int n = b.size();
+    assert(n <= 4);
 
-    // LAPACK routine DSPSV input variables
-    char uplo = 'L';  // store symmetric matrix in lower triangular format    
-    int nrhs = 1;
-    int ldb = n;
-    int info = 0;
-    std::vector<int> ipiv(n, 0);
+    // reduce A to upper triangular form
+    for (unsigned int k = 0; k < n; ++k)
+    {
+        // choose the row with the largest pivot
+        unsigned int pivot = k;
 
-    dspsv_(&uplo, &n, &nrhs, &A[0], &ipiv[0], &b[0], &ldb, &info);
+        for (unsigned int i = k + 1; i < n; ++i)
+        {
+            if (fabs(A[n * i + k]) > fabs(A[n * pivot + k])) pivot = i;
+        }
 
-    if (info == 0)
-    {
-        return true;
+        if (A[n * pivot + k] == 0.0)
+        {
+            std::cerr << "Warning: could not solve symmetric matrix system"
+                      << std::endl;
+            return false;
+        }
+
+        if (pivot != k)
+        {
+            for (unsigned int j = k; j < n; ++j)
+            {
+                std::swap(A[n * k + j], A[n * pivot + j]);
+            }
+
+            std::swap(b[k], b[pivot]);
+        }
+
+        // eliminate column k from the remaining rows
+        for (unsigned int i = k + 1; i < n; ++i)
+        {
+            double factor = A[n * i + k] / A[n * k + k];
+
+            for (unsigned int j = k; j < n; ++j)
+            {
+                A[n * i + j] -= factor * A[n * k + j];
+            }
+
+            b[i] -= factor * b[k];
+        }
     }
-    else  // matrix system could not be solved
+
+    // solve for x using back substitution
+    for (unsigned int k = n; k > 0; --k)
     {
-        std::cerr << "Warning: LAPACK could not solve symmetric matrix system"
-                  << std::endl;
-        return false;
+        unsigned int i = k - 1;
+
+        for (unsigned int j = k; j < n; ++j)
+        {
+            b[i] -= A[n * i + j] * b[j];
+        }
+
+        b[i] /= A[n * i + i];
     }
+
+    return true;
 }
 //---------------------------------------------------------------------------//
 double KDEKernel::MomentFunction::evaluate(double x) const
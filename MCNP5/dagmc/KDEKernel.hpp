@@ -8,12 +8,6 @@
 
 #include "Quadrature.hpp"
 
-// LAPACK routine for solving Ax = b using symmetric matrix with packed storage
-extern "C" {
-    void dspsv_(char* UPLO, int* N, int* NRHS, double* AP, int* IPIV, double* B,
-                int* LDB, int* INFO); 
-}
-
 //===========================================================================//
 /**
  * \class KDEKernel
@@ -36,6 +30,15 @@ extern "C" {
  * by the boundary_correction method.  This fixes the boundary bias issue that
  * would otherwise occur, but is currently only valid for 2nd-order kernels.
  *
+ * The 3D product kernel K(u) * K(v) * K(w) can also be evaluated for many
+ * calculation points at once through the evaluate_product method.  Derived
+ * classes may override this method to provide a faster implementation.
+ *
+ * Kernels that are polynomials over their domain u = [-1, 1] should also
+ * override the get_polynomial method.  This allows integrals of products of
+ * kernel functions, such as those needed by the integral-track estimator, to
+ * be computed exactly instead of using a quadrature rule.
+ *
  * =======================
  * Derived Class Interface
  * =======================
@@ -51,8 +54,15 @@ extern "C" {
  * To assist Derived classes in implementing method 5, there is a protected
  * MomentFunction class defined within KDEKernel that implements the Function
  * interface.  This class can be used to create general moment functions that
- * can be integrated using the integrate method in the Quadrature class.  See
- * the PolynomialKernel implementation for an example.
+ * can be integrated using the integrate method in the Quadrature class.  The
+ * PolynomialKernel class does not need it, as it integrates its moment
+ * functions exactly.
+ *
+ * A single KDEKernel may be used by several threads that are computing scores
+ * at the same time, so none of these methods should change the state of the
+ * kernel.  In particular, a Derived class that integrates moment functions
+ * using quadrature should set up every Quadrature it needs in its constructor,
+ * rather than calling change_quadrature_set() from integrate_moment().
  */
 //===========================================================================//
 class KDEKernel
@@ -124,6 +134,9 @@ class KDEKernel
      * \param[in] a, b the lower and upper integration limits
      * \param[in] i the index representing the ith moment function
      * \return definite integral of the ith moment function for [a, b]
+     *
+     * The result should depend only on a, b and i, so that this method can
+     * be called by several threads at once.
      */
     virtual double integrate_moment(double a, double b, unsigned int i) const = 0;
 
@@ -163,13 +176,48 @@ class KDEKernel
                                        const unsigned int* side,
                                        unsigned int num_corrections) const;
 
+    /**
+     * \brief Evaluates the 3D product kernel for a batch of calculation points
+     * \param[in] x, y, z the coordinates of the n calculation points
+     * \param[in] n the number of calculation points
+     * \param[in] observation the observation point (Xi, Yi, Zi)
+     * \param[in] bandwidth the bandwidth vector (hx, hy, hz)
+     * \param[out] values array of size n that will store the kernel values
+     *
+     * Computes K(u) * K(v) * K(w) / (hx * hy * hz) for every calculation
+     * point, where u = (x - Xi) / hx and similarly for v and w.  Coordinates
+     * are passed as three separate arrays so that Derived classes can
+     * evaluate several calculation points at once using vector instructions.
+     * The default implementation simply calls evaluate() for each dimension.
+     *
+     * Note that this method does not apply any boundary correction.
+     */
+    virtual void evaluate_product(const double* x,
+                                  const double* y,
+                                  const double* z,
+                                  unsigned int n,
+                                  const double* observation,
+                                  const double* bandwidth,
+                                  double* values) const;
+
+    /**
+     * \brief Gets the coefficients of this kernel function as a polynomial
+     * \param[out] coefficients stores (c0, c1, ..., cn) for the polynomial
+     * \return true if K(u) is a polynomial over its domain; false otherwise
+     *
+     * If K(u) = c0 + c1*u + ... + cn*u^n for all u in the domain [-1, 1],
+     * then the coefficients are copied into the given vector.  The default
+     * implementation returns false and leaves the vector unchanged.
+     */
+    virtual bool get_polynomial(std::vector<double>& coefficients) const;
+
   protected:
     /**
      * \brief Computes partial moments ai(p) for this kernel up to i = 2
      * \param[in] u the value at which the kernel is to be evaluated
      * \param[in] p ratio of the distance from the boundary divided by bandwidth
      * \param[in] side the location of the boundary (0 = LOWER, 1 = UPPER)
-     * \param[out] moments an empty vector that will store the new ai(p) values
+     * \param[out] moments array of size 3 that will store the ai(p) values
      * \return true if moments are defined for boundary kernel; false otherwise
      *
      * The partial moments ai(p) are integrals of the ith moment function of a
@@ -185,44 +233,45 @@ class KDEKernel
     bool compute_moments(double u,
                          double p,
                          unsigned int side,
-                         std::vector<double>& moments) const;
+                         double* moments) const;
 
     /**
      * \brief Sets up the 3x3 matrix needed to solve for the 2D boundary kernel
      * \param[in] ai_u the set of moments for the u-dimension
      * \param[in] ai_v the set of moments for the v-dimension
-     * \param[out] matrix the 3x3 correction matrix
+     * \param[out] matrix array of size 9 that will store the correction matrix
      */
-    void get_correction_matrix2D(const std::vector<double>& ai_u,
-                                 const std::vector<double>& ai_v,
-                                 std::vector<double>& matrix) const;
+    void get_correction_matrix2D(const double* ai_u,
+                                 const double* ai_v,
+                                 double* matrix) const;
 
     /**
      * \brief Sets up the 4x4 matrix needed to solve for the 3D boundary kernel
      * \param[in] ai_u the set of moments for the u-dimension
      * \param[in] ai_v the set of moments for the v-dimension
      * \param[in] ai_w the set of moments for the w-dimension
-     * \param[out] matrix the 4x4 correction matrix
+     * \param[out] matrix array of size 16 that will store the correction matrix
      */
-    void get_correction_matrix3D(const std::vector<double>& ai_u,
-                                 const std::vector<double>& ai_v,
-                                 const std::vector<double>& ai_w,
-                                 std::vector<double>& matrix) const;
+    void get_correction_matrix3D(const double* ai_u,
+                                 const double* ai_v,
+                                 const double* ai_w,
+                                 double* matrix) const;
 
     /**
-     * \brief Solve a symmetric matrix system Ax = b
-     * \param[in/out] A an NxN symmetric matrix
+     * \brief Solve a small symmetric matrix system Ax = b
+     * \param[in/out] A an NxN symmetric matrix, stored by rows
      * \param[in/out] b the right-hand side vector
+     * \param[in] n the size of the matrix system (N <= 4)
      * \return true if matrix system was solved; false otherwise
      *
-     * The matrix A should be in lower triangular format, stored by columns.
+     * Uses Gaussian elimination with partial pivoting, which is exact enough
+     * for the small correction matrices and needs no memory to be allocated.
      *
-     * On exit, A will be overwritten by the diagonal matrix obtained through
-     * the factorization method that was used to solve the matrix system.  The
-     * vector b will also be overwritten with the solution x.
+     * On exit, A will be overwritten by the upper triangular matrix obtained
+     * through the elimination.  The vector b will also be overwritten with
+     * the solution x.
      */
-    bool solve_symmetric_matrix(std::vector<double>& A,
-                                std::vector<double>& b) const; 
+    bool solve_symmetric_matrix(double* A, double* b, unsigned int n) const;
 
     /**
      * \class MomentFunction
@@ -1,10 +1,10 @@
 // MCNP5/dagmc/KDEMeshTally.cpp
 
+#include <algorithm>
 #include <cassert>
 #include <climits>
 #include <cmath>
 #include <iostream>
-#include <set>
 #include <sstream>
 #include <string>
 
@@ -12,9 +12,13 @@
 #include "moab/Range.hpp"
 
 #include "KDEMeshTally.hpp"
+#include "CounterRNG.hpp"
+
+// maximum number of kernel polynomial coefficients for exact integral-track
+// scores, which allows kernels of up to degree 16 (e.g. 6th-order, s = 6)
+static const unsigned int MAX_POLYNOMIAL_SIZE = 17;
 
 // initialize static variables
-bool KDEMeshTally::seed_is_set = false;
 const char* const KDEMeshTally::kde_estimator_names[] = {"collision",
                                                          "integral-track",
                                                          "sub-track"};
@@ -28,12 +32,15 @@ KDEMeshTally::KDEMeshTally(const TallyInput& input,
       estimator(type),
       bandwidth(moab::CartVect(0.01, 0.01, 0.01)),
       kernel(NULL),
-      use_kd_tree(true),
+      search_method(KDENeighborhood::GRID),
       region(NULL),
       use_boundary_correction(false),
       num_subtracks(3),
+      seed(0),
       quadrature(NULL),
-      mbi(new moab::Core())
+      mbi(new moab::Core()),
+      workspaces(1),
+      warmup_histories(0)
 {
     std::cout << "Creating KDE " << kde_estimator_names[estimator]
               << " mesh tally " << input.tally_id << std::endl;
@@ -61,20 +68,29 @@ KDEMeshTally::KDEMeshTally(const TallyInput& input,
         // set up quadrature rule for the integral_track estimator
         // NOTE: this will only work correctly for polynomial kernel functions
         int num_points = 3 * kernel->get_min_quadrature(0) - 2;
-        std::cout << "    using " << num_points << "-pt quadrature scheme\n";
         quadrature = new Quadrature(num_points);
+
+        // integrate exactly if kernel is a polynomial of low enough degree
+        if (kernel->get_polynomial(kernel_polynomial) &&
+            kernel_polynomial.size() <= MAX_POLYNOMIAL_SIZE)
+        {
+            std::cout << "    using exact integration of polynomial kernel\n";
+        }
+        else
+        {
+            kernel_polynomial.clear();
+        }
+
+        // quadrature is still needed for any boundary correction
+        if (kernel_polynomial.empty() || use_boundary_correction)
+        {
+            std::cout << "    using " << num_points << "-pt quadrature scheme\n";
+        }
     }
     else if (estimator == SUB_TRACK)
     {
         std::cout << "    splitting full tracks into "
                   << num_subtracks << " sub-tracks" << std::endl;
-
-        // set seed value if not already set by another instance
-        if (!seed_is_set)
-        {
-            srand(time(NULL));
-            seed_is_set = true;
-        }
     }
 
     // initialize MeshTally member variables representing the mesh data
@@ -88,11 +104,10 @@ KDEMeshTally::KDEMeshTally(const TallyInput& input,
         exit(EXIT_FAILURE);
     }
 
-    // initialize running variance variables
-    max_collisions = false;
-    num_collisions = 0;
-    mean = moab::CartVect(0, 0, 0);
-    variance = moab::CartVect(0, 0, 0);
+    // initialize adaptive bandwidth variables
+    histories_completed = 0;
+    bandwidth_fixed = (warmup_histories == 0);
+    discarded_histories = 0;
 }
 //---------------------------------------------------------------------------//
 // DESTRUCTOR
@@ -109,90 +124,130 @@ KDEMeshTally::~KDEMeshTally()
 //---------------------------------------------------------------------------//
 void KDEMeshTally::compute_score(const TallyEvent& event)
 {
-    double weight = event.get_score_multiplier(input_data.multiplier_id);
-
-    // set up tally event based on KDE mesh tally type
-    std::vector<moab::CartVect> subtrack_points;
-
-    if (event.type == TallyEvent::TRACK && estimator != COLLISION)
+    score_event(event, event.get_score_multiplier(input_data.multiplier_id));
+}
+//---------------------------------------------------------------------------//
+void KDEMeshTally::compute_scores(const TallyEventBatch& batch)
+{
+    // only the type of event used by the estimator is scored
+    if (estimator == COLLISION && batch.type != TallyEvent::COLLISION) return;
+    if (estimator != COLLISION && batch.type != TallyEvent::TRACK) return;
+
+    // reuse one TallyEvent for each event in the batch; its multipliers are
+    // not needed because the weight is taken from the batch directly
+    TallyEvent event;
+    event.type = batch.type;
+    event.particle = batch.particle;
+    event.history = batch.history;
+
+    for (unsigned int i = 0; i < batch.size(); ++i)
     {
-        if (estimator == SUB_TRACK)
+        event.current_cell = batch.current_cell[i];
+        event.position = moab::CartVect(batch.x[i], batch.y[i], batch.z[i]);
+        event.particle_energy = batch.particle_energy[i];
+        event.particle_weight = batch.particle_weight[i];
+        event.event_index = batch.event_index + i;
+
+        if (batch.type == TallyEvent::TRACK)
         {
-            // multiply weight by track length and set up sub-track points
-            weight *= event.track_length;
-            subtrack_points = choose_points(num_subtracks, event);
+            event.direction = moab::CartVect(batch.u[i], batch.v[i], batch.w[i]);
+            event.track_length = batch.track_length[i];
+        }
+        else
+        {
+            event.total_cross_section = batch.total_cross_section[i];
         }
-    }
-    else if (event.type == TallyEvent::COLLISION && estimator == COLLISION)
-    {
-        // divide weight by cross section and update optimal bandwidth
-        weight /= event.total_cross_section;
-        update_variance(event.position);
-    }
-    else // NONE, return from this method
-    {
- 	return;
-    }
 
-    unsigned int ebin;
-    if (!get_energy_bin(event.particle_energy, ebin))
-    {  
-        return;
+        score_event(event, batch.get_score_multiplier(i, input_data.multiplier_id));
     }
+}
+//---------------------------------------------------------------------------//
+void KDEMeshTally::end_history()
+{
+    Tally::end_history();
 
-    // update the neighborhood region and find all of the calculations points
-    region->update_neighborhood(event, bandwidth);
-    const std::set<moab::EntityHandle>& calculation_points = region->get_points();
+    // NOTE: the TallyManager only lets one thread at a time call this method
+    // until the bandwidth is fixed, see is_thread_safe()
+    if (bandwidth_fixed) return;
 
-    // iterate through calculation points and compute their final scores
-    std::set<moab::EntityHandle>::iterator i;
-    CalculationPoint X;
+    // switch to the optimal bandwidth once all warm-up histories are done
+    if (++histories_completed != warmup_histories) return;
+
+    RunningVariance observations = merge_observations();
 
-    for (i = calculation_points.begin(); i != calculation_points.end(); ++i)
+    if (observations.num_observations < 2)
     {
-        // get coordinates of this point
-        moab::EntityHandle point = *i;
-        moab::ErrorCode rval = mbi->get_coords(&point, 1, X.coords);
+        std::cerr << "Warning: not enough observation points to compute the "
+                  << "optimal bandwidth for KDE mesh tally "
+                  << input_data.tally_id << std::endl;
+        std::cerr << "    using bandwidth " << bandwidth << std::endl;
+        set_bandwidth_fixed();
+        return;
+    }
 
-        assert(rval == moab::MB_SUCCESS);
+    moab::CartVect optimal_bandwidth = get_optimal_bandwidth(observations);
 
-        // get tag data for this point if user requested boundary correction
-        if (use_boundary_correction)
+    for (int i = 0; i < 3; ++i)
+    {
+        // keep the initial value if the observation points do not vary
+        if (optimal_bandwidth[i] > 0.0)
         {
-            rval = mbi->tag_get_data(boundary_tag, &point, 1, X.boundary_data);
-            assert(rval == moab::MB_SUCCESS);
-
-            rval = mbi->tag_get_data(distance_tag, &point, 1, X.distance_data);
-            assert(rval == moab::MB_SUCCESS);
+            bandwidth[i] = optimal_bandwidth[i];
         }
+    }
 
-        // compute the final contribution to the tally for this point
-        double score = 0.0;
+    // discard the warm-up scores so that all results use the same bandwidth
+    int length = 0;
+    double* tally_data = data->get_tally_data(length);
+    std::fill(tally_data, tally_data + length, 0.0);
 
-        if (estimator == INTEGRAL_TRACK)
-        {
-            score = integral_track_score(X, event);
-        }
-        else if (estimator == SUB_TRACK)
-        {
-            score = subtrack_score(X, subtrack_points);
-        }
-        else // estimator == COLLISION
-        {
-            score = evaluate_kernel(X, event.position);
-        }
+    double* error_data = data->get_error_data(length);
+    std::fill(error_data, error_data + length, 0.0);
 
-        add_score_to_mesh_tally(point, weight, score,  ebin);
-    }  // end calculation_points iteration
+    discarded_histories = histories_completed;
+
+    std::cout << "KDE mesh tally " << input_data.tally_id
+              << " switching to optimal bandwidth " << bandwidth
+              << " after " << histories_completed << " histories" << std::endl;
+    std::cout << "    scores from these histories are discarded" << std::endl;
+
+    set_bandwidth_fixed();
+}
+//---------------------------------------------------------------------------//
+bool KDEMeshTally::is_thread_safe() const
+{
+    bool fixed;
+
+#ifdef _OPENMP
+    #pragma omp atomic read
+#endif
+    fixed = bandwidth_fixed;
+
+    // make sure the new bandwidth is seen by the calling thread
+#ifdef _OPENMP
+    #pragma omp flush
+#endif
+
+    return fixed;
+}
+//---------------------------------------------------------------------------//
+void KDEMeshTally::set_num_threads(unsigned int num_threads)
+{
+    MeshTally::set_num_threads(num_threads);
+    workspaces.resize(num_threads);
 }
 //---------------------------------------------------------------------------//
 void KDEMeshTally::write_data(double num_histories)
 {
     // display the optimal bandwidth if it was computed
-    if (estimator == COLLISION)
+    RunningVariance observations = merge_observations();
+
+    if (observations.num_observations > 1)
     {
-        std::cout << std::endl << "optimal bandwidth for " << num_collisions
-                  << " collisions is: " << get_optimal_bandwidth() << std::endl;
+        std::cout << std::endl << "optimal bandwidth for "
+                  << observations.num_observations
+                  << " observation points is: "
+                  << get_optimal_bandwidth(observations) << std::endl;
     }
 
     // tag tally and relative error results to the mesh for each tally point
@@ -202,40 +257,10 @@ void KDEMeshTally::write_data(double num_histories)
 	std::cout << "This can't fail" << std::endl;
 	exit(1);
       }
-    moab::Range::iterator i;
+    // results only include histories completed after the warm-up histories
+    rval = set_result_tags(mbi, num_histories - discarded_histories);
 
-    for (i = tally_points.begin(); i != tally_points.end(); ++i)
-    {
-        moab::EntityHandle point = *i;
-        unsigned int point_index = get_entity_index(point);
-
-        for (unsigned int j = 0; j < data->get_num_energy_bins(); ++ j)
-        {
-            std::pair <double,double> tally_data = data->get_data(point_index,j);
-            double tally = tally_data.first;
-            double error = tally_data.second;
-
-            // compute relative error for the tally result
-            double rel_error = 0.0;
-
-            if (error != 0.0)
-            {
-                rel_error = sqrt(error / (tally * tally) - 1.0 / num_histories);
-            }
-
-            // normalize mesh tally result by the number of source particles
-            tally /= num_histories;
-
-            // set tally and error tag values for this entity
-            rval = mbi->tag_set_data(tally_tags[j], &point, 1, &tally);
-
-            assert(moab::MB_SUCCESS == rval);
-      
-            rval = mbi->tag_set_data(error_tags[j], &point, 1, &rel_error);
-
-            assert(moab::MB_SUCCESS == rval);
-        }
-    }
+    assert(moab::MB_SUCCESS == rval);
 
     // create a global tag to store the bandwidth value
     moab::Tag bandwidth_tag;
@@ -268,6 +293,116 @@ void KDEMeshTally::write_data(double num_histories)
 //---------------------------------------------------------------------------//
 // PRIVATE METHODS
 //---------------------------------------------------------------------------//
+void KDEMeshTally::score_event(const TallyEvent& event, double weight)
+{
+    Workspace& workspace = workspaces.at(TallyData::get_thread_id());
+    std::vector<moab::CartVect>& subtrack_points = workspace.subtrack_points;
+    std::vector<unsigned int>& calculation_points = workspace.calculation_points;
+
+    // set up tally event based on KDE mesh tally type
+    if (event.type == TallyEvent::TRACK && estimator != COLLISION)
+    {
+        if (estimator == SUB_TRACK)
+        {
+            // multiply weight by track length and set up sub-track points
+            weight *= event.track_length;
+            choose_points(num_subtracks, event, subtrack_points);
+
+            // update optimal bandwidth using all of the sub-track points
+            for (unsigned int i = 0; i < subtrack_points.size(); ++i)
+            {
+                update_variance(subtrack_points[i], workspace.observations);
+            }
+        }
+        else // estimator == INTEGRAL_TRACK
+        {
+            // update optimal bandwidth using the midpoint of the track
+            update_variance(event.position +
+                            0.5 * event.track_length * event.direction,
+                            workspace.observations);
+        }
+    }
+    else if (event.type == TallyEvent::COLLISION && estimator == COLLISION)
+    {
+        // divide weight by cross section and update optimal bandwidth
+        weight /= event.total_cross_section;
+        update_variance(event.position, workspace.observations);
+    }
+    else // NONE, return from this method
+    {
+ 	return;
+    }
+
+    unsigned int ebin;
+    if (!get_energy_bin(event.particle_energy, ebin))
+    {  
+        return;
+    }
+
+    // update the neighborhood region and find all of the calculations points
+    region->update_neighborhood(event, bandwidth, calculation_points);
+
+    // compute scores for all points at once if no correction is needed
+    if (estimator != INTEGRAL_TRACK && !use_boundary_correction)
+    {
+        if (estimator == SUB_TRACK)
+        {
+            if (subtrack_points.empty()) return;
+
+            compute_batch_scores(calculation_points,
+                                 &subtrack_points[0],
+                                 subtrack_points.size(),
+                                 weight, ebin, workspace);
+        }
+        else // estimator == COLLISION
+        {
+            compute_batch_scores(calculation_points,
+                                 &event.position,
+                                 1, weight, ebin, workspace);
+        }
+
+        return;
+    }
+
+    // iterate through calculation points and compute their final scores
+    CalculationPoint X;
+
+    for (unsigned int i = 0; i < calculation_points.size(); ++i)
+    {
+        // copy stored data for this point into the calculation point
+        unsigned int point_index = calculation_points[i];
+
+        for (int j = 0; j < 3; ++j)
+        {
+            X.coords[j] = node_coords[3 * point_index + j];
+
+            if (use_boundary_correction)
+            {
+                X.boundary_data[j] = boundary_data[3 * point_index + j];
+                X.distance_data[j] = distance_data[3 * point_index + j];
+            }
+        }
+
+        // compute the final contribution to the tally for this point
+        double score = 0.0;
+
+        if (estimator == INTEGRAL_TRACK)
+        {
+            score = integral_track_score(X, event);
+        }
+        else if (estimator == SUB_TRACK)
+        {
+            score = subtrack_score(X, subtrack_points);
+        }
+        else // estimator == COLLISION
+        {
+            score = evaluate_kernel(X, event.position);
+        }
+
+        data->add_score_to_tally(point_index, weight * score, ebin);
+    }  // end calculation_points iteration
+}
+//---------------------------------------------------------------------------//
 void KDEMeshTally::set_bandwidth_value(const std::string& key,
                                        const std::string& value,
                                        unsigned int i)
@@ -326,7 +461,17 @@ void KDEMeshTally::parse_tally_options()
         else if (key == "neighborhood" && value == "off")
         {
             std::cout << "    using neighborhood-search: " << value << std::endl;
-            use_kd_tree = false;
+            search_method = KDENeighborhood::ALL_POINTS;
+        }
+        else if (key == "neighborhood" && value == "kdtree")
+        {
+            std::cout << "    using neighborhood-search: " << value << std::endl;
+            search_method = KDENeighborhood::KD_TREE;
+        }
+        else if (key == "neighborhood" && value == "grid")
+        {
+            std::cout << "    using neighborhood-search: " << value << std::endl;
+            search_method = KDENeighborhood::GRID;
         }
         else if (key == "boundary" && value == "default")
         {
@@ -336,9 +481,7 @@ void KDEMeshTally::parse_tally_options()
         else if (key == "seed" && estimator == SUB_TRACK)
         {
             // override random number seed if requested by user
-            unsigned long int seed = strtol(value.c_str(), NULL, 10);
-            srand(seed);
-            seed_is_set = true;
+            seed = strtoul(value.c_str(), NULL, 10);
             std::cout << "    setting random seed to " << seed
                       << " for choosing sub-track points" << std::endl;
         }
@@ -357,6 +500,26 @@ void KDEMeshTally::parse_tally_options()
             
             num_subtracks = subtracks;
         }
+        else if (key == "adaptive")
+        {
+            char* end;
+            long int histories = strtol(value.c_str(), &end, 10);
+
+            if (value.c_str() == end || histories <= 0)
+            {
+                std::cerr << "Warning: '" << value << "' is an invalid value"
+                          << " for the number of warm-up histories" << std::endl;
+                std::cerr << "    using fixed bandwidth" << std::endl;
+                histories = 0;
+            }
+            else
+            {
+                std::cout << "    using optimal bandwidth after "
+                          << histories << " warm-up histories" << std::endl;
+            }
+
+            warmup_histories = histories;
+        }
         else // invalid tally option
         {
             std::cerr << "Warning: input data for KDE mesh tally "
@@ -392,8 +555,15 @@ moab::ErrorCode KDEMeshTally::initialize_mesh_data()
     // initialize MeshTally::tally_points to include all mesh nodes
     set_tally_points(mesh_nodes);
 
-    // set up the KDE neighborhood region from the mesh nodes
-    region = new KDENeighborhood(mbi, mesh_nodes, use_kd_tree);
+    // store coordinates of all mesh nodes by tally point index
+    node_coords.resize(3 * mesh_nodes.size());
+    rval = mbi->get_coords(mesh_nodes, &node_coords[0]);
+
+    if (rval != moab::MB_SUCCESS) return rval;
+
+    // set up the KDE neighborhood region from the mesh nodes, which shares
+    // the same array of node coordinates
+    region = new KDENeighborhood(mbi, mesh_nodes, search_method, &node_coords);
 
     // reduce the loaded MOAB mesh set to include only 3D elements
     moab::Range mesh_cells;
@@ -407,9 +577,11 @@ moab::ErrorCode KDEMeshTally::initialize_mesh_data()
 
     if (rval != moab::MB_SUCCESS) return rval;
 
-    // if requested, set up tags for boundary correction method
+    // if requested, store boundary data needed for boundary correction method
     if (use_boundary_correction)
     {
+        moab::Tag boundary_tag, distance_tag;
+
         moab::ErrorCode tag1 = mbi->tag_get_handle("BOUNDARY", 3,
                                                    moab::MB_TYPE_INTEGER,
                                                    boundary_tag);
@@ -428,54 +600,126 @@ moab::ErrorCode KDEMeshTally::initialize_mesh_data()
         {
             return moab::MB_FAILURE;
         }
+        else // copy tag data for all mesh nodes by tally point index
+        {
+            boundary_data.resize(3 * mesh_nodes.size());
+            rval = mbi->tag_get_data(boundary_tag, mesh_nodes, &boundary_data[0]);
+
+            if (rval != moab::MB_SUCCESS) return rval;
+
+            distance_data.resize(3 * mesh_nodes.size());
+            rval = mbi->tag_get_data(distance_tag, mesh_nodes, &distance_data[0]);
+
+            if (rval != moab::MB_SUCCESS) return rval;
+        }
     }
 
     return moab::MB_SUCCESS; 
 }
 //---------------------------------------------------------------------------//
-void KDEMeshTally::update_variance(const moab::CartVect& collision_point)
+KDEMeshTally::RunningVariance KDEMeshTally::merge_observations() const
+{
+    RunningVariance total;
+
+    for (unsigned int k = 0; k < workspaces.size(); ++k)
+    {
+        const RunningVariance& part = workspaces[k].observations;
+
+        if (part.num_observations == 0) continue;
+
+        total.max_observations = total.max_observations || part.max_observations;
+
+        if (total.num_observations == 0)
+        {
+            total.num_observations = part.num_observations;
+            total.mean = part.mean;
+            total.variance = part.variance;
+            continue;
+        }
+
+        // stop adding observation points once the maximum is reached
+        if (part.num_observations > LLONG_MAX - total.num_observations)
+        {
+            total.max_observations = true;
+            continue;
+        }
+
+        double n1 = total.num_observations;
+        double n2 = part.num_observations;
+        double n = n1 + n2;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            double delta = part.mean[i] - total.mean[i];
+            total.mean[i] += delta * n2 / n;
+            total.variance[i] += part.variance[i] + delta * delta * n1 * n2 / n;
+        }
+
+        total.num_observations += part.num_observations;
+    }
+
+    return total;
+}
+//---------------------------------------------------------------------------//
+void KDEMeshTally::set_bandwidth_fixed()
+{
+    // make sure the new bandwidth is seen before the flag is set
+#ifdef _OPENMP
+    #pragma omp flush
+    #pragma omp atomic write
+#endif
+    bandwidth_fixed = true;
+}
+//---------------------------------------------------------------------------//
+void KDEMeshTally::update_variance(const moab::CartVect& observation,
+                                   RunningVariance& observations) const
 {
-    if (num_collisions != LLONG_MAX)
+    long long int& num_observations = observations.num_observations;
+    moab::CartVect& mean = observations.mean;
+    moab::CartVect& variance = observations.variance;
+
+    if (num_observations != LLONG_MAX)
     {
-        ++num_collisions;
+        ++num_observations;
 
         // compute new values for the mean and variance
-        if (num_collisions == 1)
+        if (num_observations == 1)
         {
-            mean = collision_point;
+            mean = observation;
         }
         else
         {
             for (int i = 0; i < 3; ++i)
             {
                 // get difference between point and previous mean
-                double value = collision_point[i] - mean[i];
+                double value = observation[i] - mean[i];
 
                 // update mean and variance variables
-                mean[i] += value / num_collisions;
-                variance[i] += value * (collision_point[i] - mean[i]);
+                mean[i] += value / num_observations;
+                variance[i] += value * (observation[i] - mean[i]);
             }
         }
     }
-    else if (!max_collisions)
+    else if (!observations.max_observations)
     {
-        std::cerr << "Warning: number of collisions exceeds maximum\n"
+        std::cerr << "Warning: number of observation points exceeds maximum\n"
                   << "    optimal bandwidth will be based on "
-                  << num_collisions << " collisions" << std::endl;
+                  << num_observations << " points" << std::endl;
 
-        max_collisions = true;
+        observations.max_observations = true;
     }
 }
 //---------------------------------------------------------------------------//
-moab::CartVect KDEMeshTally::get_optimal_bandwidth() const
+moab::CartVect KDEMeshTally::get_optimal_bandwidth(const RunningVariance& observations) const
 {
     double stdev = 0.0;
     moab::CartVect optimal_bandwidth;
+    long long int num_observations = observations.num_observations;
 
     for (int i = 0; i < 3; ++i)
     {
-        stdev = sqrt(variance[i] / (num_collisions - 1));
-        optimal_bandwidth[i] = 0.968625 * stdev * pow(num_collisions, -1.0/7.0);
+        stdev = sqrt(observations.variance[i] / (num_observations - 1));
+        optimal_bandwidth[i] = 0.968625 * stdev * pow(num_observations, -1.0/7.0);
     }
 
     return optimal_bandwidth;
@@ -493,10 +737,10 @@ double KDEMeshTally::evaluate_kernel(const CalculationPoint& X,
                                      const moab::CartVect& observation) const
 {
     // define variables needed for boundary correction
-    bool is_boundary_point = false;
-    std::vector<double> ui;
-    std::vector<double> pi;
-    std::vector<unsigned int> si;
+    unsigned int num_corrections = 0;
+    double ui[3];
+    double pi[3];
+    unsigned int si[3];
 
     // evaluate the 3D kernel function
     double kernel_value = 1.0;
@@ -510,23 +754,80 @@ double KDEMeshTally::evaluate_kernel(const CalculationPoint& X,
         // update boundary correction data if needed for this dimension
         if (use_boundary_correction && X.boundary_data[i] != -1)
         {
-            is_boundary_point = true;
-            ui.push_back(u);
-            pi.push_back(X.distance_data[i] / bandwidth[i]);
-            si.push_back(X.boundary_data[i]);
+            ui[num_corrections] = u;
+            pi[num_corrections] = X.distance_data[i] / bandwidth[i];
+            si[num_corrections] = X.boundary_data[i];
+            ++num_corrections;
         }
     }
 
     // multiply by boundary correction factor only if X is a boundary point
-    if (is_boundary_point)
+    if (num_corrections > 0)
     {
-        unsigned int n = ui.size();
-        kernel_value *= kernel->boundary_correction(&ui[0], &pi[0], &si[0], n);
+        kernel_value *= kernel->boundary_correction(ui, pi, si, num_corrections);
     }
 
     return kernel_value;
 }                    
 //---------------------------------------------------------------------------//
+void KDEMeshTally::compute_batch_scores(const std::vector<unsigned int>& points,
+                                        const moab::CartVect* observations,
+                                        unsigned int num_observations,
+                                        double weight,
+                                        unsigned int ebin,
+                                        Workspace& workspace)
+{
+    unsigned int num_points = points.size();
+
+    if (num_points == 0) return;
+
+    std::vector<double>& x_coords = workspace.x_coords;
+    std::vector<double>& y_coords = workspace.y_coords;
+    std::vector<double>& z_coords = workspace.z_coords;
+    std::vector<double>& kernel_values = workspace.kernel_values;
+    std::vector<double>& batch_scores = workspace.batch_scores;
+
+    // copy coordinates of all calculation points into x, y and z arrays
+    x_coords.resize(num_points);
+    y_coords.resize(num_points);
+    z_coords.resize(num_points);
+
+    for (unsigned int i = 0; i < num_points; ++i)
+    {
+        const double* coords = &node_coords[3 * points[i]];
+        x_coords[i] = coords[0];
+        y_coords[i] = coords[1];
+        z_coords[i] = coords[2];
+    }
+
+    // add kernel contribution for every observation point to the scores
+    kernel_values.resize(num_points);
+    batch_scores.assign(num_points, 0.0);
+
+    for (unsigned int k = 0; k < num_observations; ++k)
+    {
+        kernel->evaluate_product(&x_coords[0],
+                                 &y_coords[0],
+                                 &z_coords[0],
+                                 num_points,
+                                 observations[k].array(),
+                                 bandwidth.array(),
+                                 &kernel_values[0]);
+
+        for (unsigned int i = 0; i < num_points; ++i)
+        {
+            batch_scores[i] += kernel_values[i];
+        }
+    }
+
+    // normalize by the number of observation points and add to the tally
+    for (unsigned int i = 0; i < num_points; ++i)
+    {
+        double score = batch_scores[i] / num_observations;
+        data->add_score_to_tally(points[i], weight * score, ebin);
+    }
+}
+//---------------------------------------------------------------------------//
 double KDEMeshTally::integral_track_score(const CalculationPoint& X,
                                           const TallyEvent& event) const
 {
@@ -539,6 +840,22 @@ double KDEMeshTally::integral_track_score(const CalculationPoint& X,
     // compute value of the integral only if valid limits exist
     if (valid_limits)
     {
+        // integrate exactly unless X needs boundary correction
+        bool is_boundary_point = false;
+
+        if (use_boundary_correction)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                if (X.boundary_data[i] != -1) is_boundary_point = true;
+            }
+        }
+
+        if (!kernel_polynomial.empty() && !is_boundary_point)
+        {
+            return polynomial_track_score(X, event, limits);
+        }
+
         // construct a PathKernel and return value of its integral
         PathKernel path_kernel(*this, event, X);
         return quadrature->integrate(limits.first, limits.second, path_kernel);
@@ -549,6 +866,75 @@ double KDEMeshTally::integral_track_score(const CalculationPoint& X,
     }
 }
 //---------------------------------------------------------------------------//
+double KDEMeshTally::polynomial_track_score(const CalculationPoint& X,
+                                            const TallyEvent& event,
+                                            const std::pair<double, double>& limits) const
+{
+    unsigned int n = kernel_polynomial.size();
+    assert(n > 0 && n <= MAX_POLYNOMIAL_SIZE);
+
+    // s = center + half_length * t maps t = [-1, 1] onto the limits
+    double center = 0.5 * (limits.first + limits.second);
+    double half_length = 0.5 * (limits.second - limits.first);
+
+    // product of polynomials in t, which starts as the constant 1 / hx*hy*hz
+    double product[3 * MAX_POLYNOMIAL_SIZE];
+    unsigned int product_size = 1;
+    product[0] = 1.0 / (bandwidth[0] * bandwidth[1] * bandwidth[2]);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        // kernel value u = a + b * t is a linear function of t
+        double a = (X.coords[i] - event.position[i]
+                    - center * event.direction[i]) / bandwidth[i];
+        double b = -half_length * event.direction[i] / bandwidth[i];
+
+        // find coefficients of K(a + b * t) using Horner's method
+        double poly[MAX_POLYNOMIAL_SIZE];
+        poly[0] = kernel_polynomial[n - 1];
+
+        for (unsigned int j = n - 1; j > 0; --j)
+        {
+            // multiply current polynomial by (a + b * t) and add next term
+            unsigned int degree = n - 1 - j;
+            poly[degree + 1] = b * poly[degree];
+
+            for (unsigned int k = degree; k > 0; --k)
+            {
+                poly[k] = a * poly[k] + b * poly[k - 1];
+            }
+
+            poly[0] = a * poly[0] + kernel_polynomial[j - 1];
+        }
+
+        // multiply the product by this polynomial
+        double temp[3 * MAX_POLYNOMIAL_SIZE];
+        unsigned int temp_size = product_size + n - 1;
+        std::fill(temp, temp + temp_size, 0.0);
+
+        for (unsigned int j = 0; j < product_size; ++j)
+        {
+            for (unsigned int k = 0; k < n; ++k)
+            {
+                temp[j + k] += product[j] * poly[k];
+            }
+        }
+
+        std::copy(temp, temp + temp_size, product);
+        product_size = temp_size;
+    }
+
+    // integrate over t = [-1, 1], for which only even powers contribute
+    double sum = 0.0;
+
+    for (unsigned int j = 0; j < product_size; j += 2)
+    {
+        sum += 2.0 * product[j] / (j + 1);
+    }
+
+    return half_length * sum;
+}
+//---------------------------------------------------------------------------//
 bool KDEMeshTally::set_integral_limits(const TallyEvent& event,
                                        const moab::CartVect& coords,
                                        std::pair<double, double>& limits) const
@@ -626,8 +1012,9 @@ double KDEMeshTally::subtrack_score(const CalculationPoint& X,
     return score;
 }
 //---------------------------------------------------------------------------//
-std::vector<moab::CartVect> KDEMeshTally::choose_points(unsigned int p,
-                                                        const TallyEvent& event) const
+void KDEMeshTally::choose_points(unsigned int p,
+                                 const TallyEvent& event,
+                                 std::vector<moab::CartVect>& points) const
 {
     // make sure the number of sub-tracks is valid
     assert(p > 0);
@@ -638,21 +1025,23 @@ std::vector<moab::CartVect> KDEMeshTally::choose_points(unsigned int p,
     // set the starting point to the beginning of the track segment
     moab::CartVect start_point = event.position;
 
+    // set up the random numbers for this event
+    CounterRNG rng(input_data.tally_id, seed);
+    rng.set_position(event.history, event.event_index);
+
     // choose a random position along each sub-track
-    std::vector<moab::CartVect> random_points;
+    points.clear();
 
     for (unsigned int i = 0; i < p; ++i)
     {
-        double path_length = rand() * sub_track_length / RAND_MAX;
+        double path_length = rng.uniform() * sub_track_length;
         
         // add the coordinates of the corresponding point
-        random_points.push_back(start_point + path_length * event.direction);
+        points.push_back(start_point + path_length * event.direction);
 
         // shift starting point to the next sub-track
         start_point += sub_track_length * event.direction;
     }
- 
-    return random_points;
 }
 //---------------------------------------------------------------------------//
 
@@ -78,11 +78,14 @@ namespace moab {
  * the default is "epanechnikov".  Similarly, if "order" is omitted or invalid,
  * then the default is 2nd-order.
  *
- * 4) "neighborhood"="off"
- * -----------------------
- * Turns off the neighborhood-search and computes scores for all calculation
- * points.  This key will also be used to request different neighborhood-search
- * methods in the future.  The default is the kd-tree method.
+ * 4) "neighborhood"="off", "neighborhood"="kdtree", "neighborhood"="grid"
+ * ---------------------------------------------------------------------
+ * Sets the neighborhood-search method.  The "off" value turns off the
+ * neighborhood-search and computes scores for all calculation points.  The
+ * "kdtree" value always uses the kd-tree method, whereas the "grid" value
+ * uses a faster grid method if the mesh nodes form a regular lattice (such as
+ * a structured mesh) and the kd-tree method otherwise.  The default is "grid".
+ * See KDENeighborhood.hpp for more information.
  *
  * 5) "boundary"="default"
  * -----------------------
@@ -94,9 +97,57 @@ namespace moab {
  * 6) "seed"="value", "subtracks"="value"
  * --------------------------------------
  * These two options are only available for KDE sub-track mesh tallies.  The
- * "seed" option overrides the random number seed value that is used for
- * determining sub-track points.  The "subtracks" option sets the number
- * of sub-tracks to use for computing scores.
+ * "seed" option sets the seed value of the random numbers that are used for
+ * determining sub-track points.  The default value is 0.  The "subtracks"
+ * option sets the number of sub-tracks to use for computing scores.
+ *
+ * 7) "adaptive"="value"
+ * ---------------------
+ * Turns on adaptive bandwidth selection.  The value is the number of warm-up
+ * histories, after which the bandwidth is replaced by the optimal bandwidth
+ * (see below).  Scores from the warm-up histories were computed using the
+ * initial bandwidth defined by "hx", "hy" and "hz", so they are discarded
+ * when the bandwidth is changed.  The final results are then normalized by
+ * the number of histories tracked after the warm-up histories.  If threads
+ * are used, then histories that are still in progress when the bandwidth is
+ * changed may keep a few scores computed with the initial bandwidth.
+ *
+ * ==============
+ * Thread Safety
+ * ==============
+ *
+ * Each thread computes its scores using its own Workspace, which stores the
+ * calculation points, sub-track points and running variance for the events
+ * scored by that thread.  The mesh data and the KDENeighborhood are only read
+ * while scoring, so KDEMeshTally is thread-safe once the bandwidth is fixed.
+ * If the "adaptive" option is used, then is_thread_safe() returns false until
+ * the bandwidth has been changed, so that only one thread at a time can
+ * compute scores during the warm-up histories.
+ *
+ * =================
+ * Optimal Bandwidth
+ * =================
+ *
+ * All KDE mesh tallies keep a running estimate of the optimal bandwidth, which
+ * is reported when the results are written.  This estimate depends on the
+ * variance of the observation points used by the estimator, which are the
+ * collision points for COLLISION, the midpoints of the tracks for
+ * INTEGRAL_TRACK, and the sub-track points for SUB_TRACK.  If the "adaptive"
+ * option is used, then the bandwidth is only changed once, so that all scores
+ * computed after the warm-up histories use the same bandwidth.
+ *
+ * ========================
+ * Sub-track Random Numbers
+ * ========================
+ *
+ * The random sub-track points are chosen using a counter-based generator,
+ * which computes the random numbers for each track from the tally ID, the
+ * seed value, the history number and the index of the track event within
+ * that history (see CounterRNG.hpp).  This means that sub-track results are
+ * reproducible no matter how many threads or MPI tasks are used, as long as
+ * the physics code sets the history number through the TallyManager.  If it
+ * does not, then the TallyManager numbers each history itself, and results
+ * depend on how histories are divided between threads.
  */
 //===========================================================================//
 class KDEMeshTally : public MeshTally
@@ -132,6 +183,42 @@ class KDEMeshTally : public MeshTally
      */
     virtual void compute_score(const TallyEvent& event);
 
+    /**
+     * \brief Computes scores for this KDEMeshTally based on a batch of events
+     * \param[in] batch the parameters needed to compute the scores
+     *
+     * Skips the whole batch if its type is not used by the estimator, and
+     * takes the score multiplier for each event directly from the batch.
+     */
+    virtual void compute_scores(const TallyEventBatch& batch);
+
+    /**
+     * \brief Updates this KDEMeshTally when a particle history ends
+     *
+     * If the "adaptive" option was requested, this also changes the bandwidth
+     * to the optimal bandwidth at the end of the last warm-up history and
+     * discards all of the scores from the warm-up histories.
+     */
+    virtual void end_history();
+
+    /**
+     * \brief Check if this KDEMeshTally can score events from multiple threads
+     * \return true unless the bandwidth is still adaptive
+     *
+     * Returns false during the warm-up histories of an adaptive KDEMeshTally,
+     * so that the TallyManager will not change the bandwidth while another
+     * thread is computing scores.
+     */
+    virtual bool is_thread_safe() const;
+
+    /**
+     * \brief Sets the number of threads that can score this KDEMeshTally
+     * \param[in] num_threads the number of threads (must be at least 1)
+     *
+     * Sets up a Workspace for each thread in addition to the TallyData.
+     */
+    virtual void set_num_threads(unsigned int num_threads);
+
     /**
      * \brief Write results to the output file for this KDEMeshTally
      * \param[in] num_histories the number of particle histories tracked
@@ -139,7 +226,8 @@ class KDEMeshTally : public MeshTally
      * The write_data() method writes the current tally and relative standard
      * error results for all of the mesh nodes to the output_filename set for
      * this KDEMeshTally.  These values are normalized only by the number of
-     * particle histories that were tracked.
+     * particle histories that were tracked, not including any warm-up
+     * histories that were discarded.
      */
     virtual void write_data(double num_histories);
 
@@ -159,31 +247,80 @@ class KDEMeshTally : public MeshTally
     KDEKernel* kernel;
 
     // Defines neighborhood region for computing scores
-    bool use_kd_tree;
+    KDENeighborhood::SearchMethod search_method;
     KDENeighborhood* region;
 
+    // Coordinates of all mesh nodes, stored as (x, y, z) by tally point index;
+    // region uses the same array, so it must not change once region exists
+    std::vector<double> node_coords;
+
     // Variables used if boundary correction method is requested by user
     bool use_boundary_correction;
-    moab::Tag boundary_tag;
-    moab::Tag distance_tag;
+    std::vector<int> boundary_data;
+    std::vector<double> distance_data;
 
     // Number of sub-tracks used to compute KDE sub-track mesh tally scores
     unsigned int num_subtracks;
 
+    // Seed value for the random numbers used to choose sub-track points
+    unsigned int seed;
+
     // Quadrature used to compute KDE integral-track mesh tally scores
     Quadrature* quadrature;
 
+    // Coefficients of the kernel function if it is a polynomial, which are
+    // used to compute KDE integral-track mesh tally scores exactly
+    std::vector<double> kernel_polynomial;
+
     // MOAB instance that stores all of the mesh data
     moab::Interface* mbi;
 
     // Running variance variables for computing optimal bandwidth at runtime
-    bool max_collisions;
-    long long int num_collisions;       
-    moab::CartVect mean;
-    moab::CartVect variance;
+    struct RunningVariance
+    {
+        bool max_observations;
+        long long int num_observations;
+        moab::CartVect mean;
+        moab::CartVect variance;
+
+        RunningVariance()
+            : max_observations(false), num_observations(0),
+              mean(0.0, 0.0, 0.0), variance(0.0, 0.0, 0.0) {}
+    };
 
-    // If true, another instance already set the random number generator seed
-    static bool seed_is_set;
+    // Data that changes while one thread computes its scores
+    struct Workspace
+    {
+        // Calculation points in the neighborhood region of the current event
+        std::vector<unsigned int> calculation_points;
+
+        // Random points chosen along the current track for SUB_TRACK
+        std::vector<moab::CartVect> subtrack_points;
+
+        // Arrays for computing scores for all calculation points at once
+        std::vector<double> x_coords;
+        std::vector<double> y_coords;
+        std::vector<double> z_coords;
+        std::vector<double> kernel_values;
+        std::vector<double> batch_scores;
+
+        // Observation points of the events scored by this thread
+        RunningVariance observations;
+    };
+
+    // One Workspace for each thread, indexed by TallyData::get_thread_id()
+    std::vector<Workspace> workspaces;
+
+    // Number of warm-up histories used if the bandwidth is adaptive, or zero
+    // if the bandwidth is fixed, and the number of histories completed so far
+    long long int warmup_histories;
+    long long int histories_completed;
+
+    // Set once the bandwidth can no longer be changed by end_history()
+    bool bandwidth_fixed;
+
+    // Number of warm-up histories whose scores were discarded
+    long long int discarded_histories;
 
     // >>> PRIVATE METHODS
 
@@ -202,6 +339,34 @@ class KDEMeshTally : public MeshTally
      */
     void parse_tally_options();
 
+    /**
+     * \brief Computes scores for a single event with the given weight
+     * \param[in] event the parameters needed to compute the scores
+     * \param[in] weight the score multiplier for the event
+     *
+     * Shared by compute_score() and compute_scores(), which only differ in
+     * how the score multiplier is found.
+     */
+    void score_event(const TallyEvent& event, double weight);
+
+    /**
+     * \brief Combines the running variance of all threads
+     * \return the running variance of all observation points
+     *
+     * Uses the pairwise formula of Chan et al. to combine the mean and
+     * variance of each Workspace, which gives the same result as a single
+     * running variance if only one thread was used.
+     */
+    RunningVariance merge_observations() const;
+
+    /**
+     * \brief Fixes the bandwidth at the end of the warm-up histories
+     *
+     * After this is called, is_thread_safe() returns true and the bandwidth
+     * will not be changed again.
+     */
+    void set_bandwidth_fixed();
+
     /**
      * \brief Initializes MeshTally member variables representing the mesh data
      * \return the MOAB ErrorCode value
@@ -210,22 +375,31 @@ class KDEMeshTally : public MeshTally
      * tally_mesh_set.  The tally_points will be defined as the set of mesh
      * nodes, whereas tally_mesh_set stores the set of all 3D mesh elements.
      * This method also calls MeshTally::setup_tags() to set the tag names for
-     * the energy bins, and initializes tag handles for boundary correction.
+     * the energy bins.
+     *
+     * The coordinates of all mesh nodes are copied into node_coords, along
+     * with the BOUNDARY and DISTANCE_TO_BOUNDARY tag data if boundary
+     * correction was requested.  These arrays are indexed by tally point, so
+     * that scores can be computed without accessing the MOAB instance.  The
+     * KDENeighborhood is given node_coords rather than making its own copy.
      */
     moab::ErrorCode initialize_mesh_data();
 
     /**
-     * \brief Adds the collision point to the running variance formula
-     * \param[in] collision_point the coordinates of the collision point
+     * \brief Adds the observation point to the running variance formula
+     * \param[in] observation the coordinates of the observation point
+     * \param[in, out] observations the running variance of the calling thread
      *
      * The update_variance() method updates mean and variance variables with
-     * the coordinates of the new collision point, which can then be used by
+     * the coordinates of the new observation point, which can then be used by
      * get_optimal_bandwidth() to compute the optimal bandwidth vector.
      */
-    void update_variance(const moab::CartVect& collision_point);
+    void update_variance(const moab::CartVect& observation,
+                         RunningVariance& observations) const;
 
     /**
      * \brief Computes the optimal bandwidth vector
+     * \param[in] observations the running variance of all observation points
      * \return h_optimal = (hx_optimal, hy_optimal, hz_optimal)
      *
      * The get_optimal_bandwidth() method determines what the bandwidth should
@@ -235,13 +409,13 @@ class KDEMeshTally : public MeshTally
      *     h_optimal[i] = 0.968625 * stdev[i] * N^(-1.0/7.0)
      *
      * where stdev[i] is the standard deviation of the ith component of the
-     * collision point locations, and N is the number of collisions that have
-     * occurred.
+     * observation point locations, and N is the number of observation points.
      *
      * NOTE: stdev is calculated during runtime by calling update_variance()
-     * whenever a collision occurs.
+     * for every observation point.  At least two observation points are
+     * needed to compute the optimal bandwidth.
      */
-    moab::CartVect get_optimal_bandwidth() const;
+    moab::CartVect get_optimal_bandwidth(const RunningVariance& observations) const;
   
     // >>> KDE ESTIMATOR METHODS
 
@@ -300,6 +474,29 @@ class KDEMeshTally : public MeshTally
     double evaluate_kernel(const CalculationPoint& X,
                            const moab::CartVect& observation) const;                    
 
+    /**
+     * \brief Computes and adds scores for all calculation points at once
+     * \param[in] points the tally point indices of the calculation points
+     * \param[in] observations array of random observation points
+     * \param[in] num_observations the number of observation points
+     * \param[in] weight the weight of the tally event
+     * \param[in] ebin the energy bin to which the scores will be added
+     * \param[in, out] workspace the Workspace of the calling thread
+     *
+     * Used by the collision and sub-track estimators when boundary correction
+     * is not needed.  The coordinates of the calculation points are copied
+     * into separate x, y and z arrays, so that the kernel can evaluate many
+     * points at once using KDEKernel::evaluate_product().  The score for each
+     * calculation point is the average kernel contribution over all of the
+     * observation points.
+     */
+    void compute_batch_scores(const std::vector<unsigned int>& points,
+                              const moab::CartVect* observations,
+                              unsigned int num_observations,
+                              double weight,
+                              unsigned int ebin,
+                              Workspace& workspace);
+
     /**
      * \brief Computes tally score based on the integral-track estimator
      * \param[in] X the calculation point
@@ -310,10 +507,33 @@ class KDEMeshTally : public MeshTally
      * path-length dependent kernel function K(X, s) with respect to path-
      * length s for the given calculation point X, using the limits of
      * integration as determined by the set_integral_limits() method.
+     *
+     * If the kernel function is a polynomial, then the integral is computed
+     * exactly by polynomial_track_score().  Otherwise, or if X needs boundary
+     * correction, the integral is computed using the quadrature rule.
      */
     double integral_track_score(const CalculationPoint& X,
                                 const TallyEvent& event) const;
 
+    /**
+     * \brief Computes integral-track score exactly for a polynomial kernel
+     * \param[in] X the calculation point
+     * \param[in] event the tally event containing the track segment data
+     * \param[in] limits the integration limits in form of pair<lower, upper>
+     * \return the tally score for the calculation point
+     *
+     * Between the integration limits, the kernel in each dimension is the
+     * polynomial defined by kernel_polynomial, evaluated at a value that is
+     * a linear function of s.  Their product K(X, s) is therefore also a
+     * polynomial in s, which is formed and then integrated analytically.  To
+     * keep the result accurate, s is first mapped onto t = [-1, 1].
+     *
+     * NOTE: this method does not apply any boundary correction.
+     */
+    double polynomial_track_score(const CalculationPoint& X,
+                                  const TallyEvent& event,
+                                  const std::pair<double, double>& limits) const;
+
     /**
      * \brief Determines integration limits for the integral-track estimator
      * \param[in] event the tally event containing the track segment data
@@ -352,14 +572,16 @@ class KDEMeshTally : public MeshTally
      * \brief Chooses p random points along a track segment
      * \param[in] p the number of random points requested
      * \param[in] event the tally event containing the track segment data
-     * \return the vector of p random points
+     * \param[out] points stores the p random points
      *
      * The choose_points() method sub-divides the track segment into p
      * sub-tracks of equal length and randomly chooses the coordinates of
-     * one point from each sub-track.
+     * one point from each sub-track.  The random numbers only depend on this
+     * KDEMeshTally and the history number and event index of the event.
      */
-    std::vector<moab::CartVect> choose_points(unsigned int p,
-                                              const TallyEvent& event) const;
+    void choose_points(unsigned int p,
+                       const TallyEvent& event,
+                       std::vector<moab::CartVect>& points) const;
 };
 
 #endif // DAGMC_KDE_MESH_TALLY_HPP
@@ -1,10 +1,11 @@
 // MCNP5/dagmc/KDENeighborhood.cpp
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
-#include <set>
+#include <utility>
 #include <vector>
 
 #include "moab/AdaptiveKDTree.hpp"
@@ -18,36 +19,71 @@
 //---------------------------------------------------------------------------//
 KDENeighborhood::KDENeighborhood(moab::Interface* mbi,
                                  const moab::Range& mesh_nodes,
-                                 bool build_kd_tree)
-    : kd_tree(NULL), kd_tree_root(0), radius(0.0)
+                                 SearchMethod method,
+                                 const std::vector<double>* coords)
+    : num_nodes(mesh_nodes.size()),
+      method(method),
+      node_coords(NULL),
+      kd_tree(NULL),
+      kd_tree_root(0)
 {
-    if (build_kd_tree)
+    if (method == ALL_POINTS)
     {
-        if (mbi == NULL)
+        std::cout << "Using all nodes to construct neighborhood" << std::endl;
+        return;
+    }
+
+    if (mbi == NULL)
+    {
+        std::cerr << "\nError: invalid moab::Interface for building KD-tree";
+        std::cerr << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // use the given coordinates of all mesh nodes, or store a copy
+    moab::ErrorCode rval = moab::MB_SUCCESS;
+
+    if (coords != NULL)
+    {
+        if (coords->size() != 3 * mesh_nodes.size())
         {
-            std::cerr << "\nError: invalid moab::Interface for building KD-tree";
+            std::cerr << "\nError: wrong number of mesh node coordinates";
             std::cerr << std::endl;
             exit(EXIT_FAILURE);
         }
 
-        std::cout << "Using KD-tree to construct neighborhood" << std::endl;
-
-        // build the kd-tree from the mesh nodes
-        kd_tree = new moab::AdaptiveKDTree(mbi);
-
-        moab::ErrorCode rval = moab::MB_SUCCESS;
-        rval = kd_tree->build_tree(mesh_nodes, kd_tree_root);
-
+        if (!coords->empty()) node_coords = &(*coords)[0];
+    }
+    else if (!mesh_nodes.empty())
+    {
+        stored_coords.resize(3 * mesh_nodes.size());
+        rval = mbi->get_coords(mesh_nodes, &stored_coords[0]);
         assert(rval == moab::MB_SUCCESS);
+        node_coords = &stored_coords[0];
     }
-    else
+
+    // use grid search only if the mesh nodes form a regular lattice
+    if (method == GRID)
     {
-        std::cout << "Using all nodes to construct neighborhood" << std::endl;
+        if (store_grid_points())
+        {
+            std::cout << "Using grid to construct neighborhood" << std::endl;
+            return;
+        }
 
-        // convert range into a default set of calculation points
-        points = std::set<moab::EntityHandle>(mesh_nodes.begin(),
-                                              mesh_nodes.end());
+        this->method = KD_TREE;
     }
+
+    std::cout << "Using KD-tree to construct neighborhood" << std::endl;
+
+    // build the kd-tree from the mesh nodes
+    kd_tree = new moab::AdaptiveKDTree(mbi);
+    rval = kd_tree->build_tree(mesh_nodes, kd_tree_root);
+    assert(rval == moab::MB_SUCCESS);
+
+    // store the mesh nodes contained in each leaf
+    rval = store_leaf_points(mesh_nodes);
+    assert(rval == moab::MB_SUCCESS);
 }
 //---------------------------------------------------------------------------//
 // DESTRUCTOR
@@ -59,28 +95,43 @@ KDENeighborhood::~KDENeighborhood()
 //---------------------------------------------------------------------------//
 // PUBLIC INTERFACE
 //---------------------------------------------------------------------------//
-const std::set<moab::EntityHandle>& KDENeighborhood::get_points() const
+KDENeighborhood::SearchMethod KDENeighborhood::get_search_method() const
 {
-    return points;
+    return method;
 }
 //---------------------------------------------------------------------------//
 void KDENeighborhood::update_neighborhood(const TallyEvent& event,
-                                          const moab::CartVect& bandwidth)
+                                          const moab::CartVect& bandwidth,
+                                          std::vector<unsigned int>& points) const
 {
-    // do nothing if there is no kd-tree defined
-    if (kd_tree == NULL) return;
+    // reset the calculation points, keeping the memory already allocated
+    points.clear();
+
+    // use all mesh nodes if no search method is defined
+    if (method == ALL_POINTS)
+    {
+        for (unsigned int i = 0; i < num_nodes; ++i)
+        {
+            points.push_back(i);
+        }
+
+        return;
+    }
+
+    // otherwise define the neighborhood region based on this tally event
+    Region region;
 
-    // otherwise redefine the neighborhood region based on this tally event
     if (event.type == TallyEvent::COLLISION)
     {
-        set_neighborhood(event.position, bandwidth);
+        set_neighborhood(event.position, bandwidth, region);
     }
     else if (event.type == TallyEvent::TRACK)
     {
         set_neighborhood(event.track_length,
                          event.position,
                          event.direction,
-                         bandwidth);
+                         bandwidth,
+                         region);
     }
     else
     {
@@ -90,91 +141,277 @@ void KDENeighborhood::update_neighborhood(const TallyEvent& event,
         exit(EXIT_FAILURE);
     }
 
-    // update the set of calculation points for this neighborhood
-    points_in_box();
+    // find the calculation points for this neighborhood
+    if (method == GRID)
+    {
+        points_in_grid(region, points);
+    }
+    else
+    {
+        points_in_box(region, points);
+    }
 }
 //---------------------------------------------------------------------------//
-bool KDENeighborhood::is_calculation_point(const moab::EntityHandle& point) const
+// PRIVATE METHODS
+//---------------------------------------------------------------------------//
+moab::ErrorCode KDENeighborhood::store_leaf_points(const moab::Range& mesh_nodes)
 {
-    std::set<moab::EntityHandle>::iterator it = points.find(point);
+    assert(kd_tree != NULL);
+
+    // get all of the leaves in the kd-tree
+    moab::AdaptiveKDTreeIter iter;
+    moab::ErrorCode rval = kd_tree->get_tree_iterator(kd_tree_root, iter);
+
+    if (rval != moab::MB_SUCCESS) return rval;
+
+    // sort leaves by handle, keeping the index of their bounding boxes
+    std::vector<double> boxes;
+    std::vector<std::pair<moab::EntityHandle, unsigned int> > leaf_order;
 
-    if (it == points.end())
+    do
     {
-        return false;
+        leaf_order.push_back(std::make_pair(iter.handle(), leaf_order.size()));
+        boxes.insert(boxes.end(), iter.box_min(), iter.box_min() + 3);
+        boxes.insert(boxes.end(), iter.box_max(), iter.box_max() + 3);
     }
+    while (iter.step() == moab::MB_SUCCESS);
 
-    return true;
+    std::sort(leaf_order.begin(), leaf_order.end());
+
+    for (unsigned int i = 0; i < leaf_order.size(); ++i)
+    {
+        const double* box = &boxes[6 * leaf_order[i].second];
+        leaf_handles.push_back(leaf_order[i].first);
+        leaf_boxes.insert(leaf_boxes.end(), box, box + 6);
+    }
+
+    // copy mesh nodes into a sorted list for finding their indices
+    std::vector<moab::EntityHandle> nodes(mesh_nodes.begin(), mesh_nodes.end());
+    moab::Interface* mb = kd_tree->moab();
+
+    leaf_offsets.push_back(0);
+
+    for (unsigned int i = 0; i < leaf_handles.size(); ++i)
+    {
+        moab::Range leaf_nodes;
+        rval = mb->get_entities_by_type(leaf_handles[i], moab::MBVERTEX, leaf_nodes);
+
+        if (rval != moab::MB_SUCCESS) return rval;
+
+        moab::Range::iterator j;
+
+        for (j = leaf_nodes.begin(); j != leaf_nodes.end(); ++j)
+        {
+            std::vector<moab::EntityHandle>::iterator node;
+            node = std::lower_bound(nodes.begin(), nodes.end(), *j);
+            assert(node != nodes.end() && *node == *j);
+
+            leaf_points.push_back(node - nodes.begin());
+        }
+
+        leaf_offsets.push_back(leaf_points.size());
+    }
+
+    return moab::MB_SUCCESS;
 }
 //---------------------------------------------------------------------------//
-// PRIVATE METHODS
+bool KDENeighborhood::store_grid_points()
+{
+    if (num_nodes == 0) return false;
+
+    // set tolerance for matching coordinates based on the size of the mesh
+    double max_size = 0.0;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        double min = node_coords[i];
+        double max = node_coords[i];
+
+        for (unsigned int j = 1; j < num_nodes; ++j)
+        {
+            min = std::min(min, node_coords[3 * j + i]);
+            max = std::max(max, node_coords[3 * j + i]);
+        }
+
+        max_size = std::max(max_size, max - min);
+    }
+
+    double tolerance = 1e-10 * max_size;
+
+    // find the unique coordinates of the mesh nodes in each dimension
+    std::vector<double> values(num_nodes);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        for (unsigned int j = 0; j < num_nodes; ++j)
+        {
+            values[j] = node_coords[3 * j + i];
+        }
+
+        std::sort(values.begin(), values.end());
+        grid_coords[i].assign(1, values[0]);
+        grid_upper_coords[i].assign(1, values[0]);
+
+        for (unsigned int j = 1; j < num_nodes; ++j)
+        {
+            if (values[j] - grid_coords[i].back() > tolerance)
+            {
+                grid_coords[i].push_back(values[j]);
+                grid_upper_coords[i].push_back(values[j]);
+            }
+            else // same lattice coordinate, but may be a slightly larger value
+            {
+                grid_upper_coords[i].back() = values[j];
+            }
+        }
+    }
+
+    // a lattice has one mesh node for every combination of coordinates
+    unsigned int nx = grid_coords[0].size();
+    unsigned int ny = grid_coords[1].size();
+    unsigned int nz = grid_coords[2].size();
+    bool is_lattice = (double(nx) * ny * nz == num_nodes);
+
+    if (is_lattice)
+    {
+        // num_nodes marks a lattice point that has no mesh node yet
+        grid_points.assign(num_nodes, num_nodes);
+
+        for (unsigned int j = 0; j < num_nodes && is_lattice; ++j)
+        {
+            unsigned int index[3];
+
+            for (int i = 0; i < 3; ++i)
+            {
+                std::vector<double>& coords = grid_coords[i];
+                double value = node_coords[3 * j + i];
+                index[i] = std::lower_bound(coords.begin(), coords.end(),
+                                            value - tolerance) - coords.begin();
+            }
+
+            unsigned int& point = grid_points[(index[2] * ny + index[1]) * nx
+                                              + index[0]];
+
+            // two mesh nodes at the same lattice point means some are missing
+            if (point != num_nodes) is_lattice = false;
+
+            point = j;
+        }
+    }
+
+    // discard lattice data if the mesh nodes do not form a regular lattice
+    if (!is_lattice)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            std::vector<double>().swap(grid_coords[i]);
+            std::vector<double>().swap(grid_upper_coords[i]);
+        }
+
+        std::vector<unsigned int>().swap(grid_points);
+    }
+
+    return is_lattice;
+}
 //---------------------------------------------------------------------------//
 void KDENeighborhood::set_neighborhood(const moab::CartVect& collision_point,
-                                       const moab::CartVect& bandwidth)
+                                       const moab::CartVect& bandwidth,
+                                       Region& region) const
 {
     for (int i = 0; i < 3; ++i)
     {
-        min_corner[i] = collision_point[i] - bandwidth[i];
-        max_corner[i] = collision_point[i] + bandwidth[i];
+        region.min_corner[i] = collision_point[i] - bandwidth[i];
+        region.max_corner[i] = collision_point[i] + bandwidth[i];
     }
 
-    // maximum radius is not used for collision events so reset it to 0.0
-    radius = 0.0;
+    // swept region is not used for collision events
+    region.is_track = false;
 }
 //---------------------------------------------------------------------------//
 void KDENeighborhood::set_neighborhood(double track_length,
                                        const moab::CartVect& start_point,
                                        const moab::CartVect& direction,
-                                       const moab::CartVect& bandwidth)
+                                       const moab::CartVect& bandwidth,
+                                       Region& region) const
 {
     for (int i = 0; i < 3; ++i)
     {
         // default case where coordinate of direction vector is zero
-        min_corner[i] = start_point[i] - bandwidth[i];
-        max_corner[i] = start_point[i] + bandwidth[i];
+        region.min_corner[i] = start_point[i] - bandwidth[i];
+        region.max_corner[i] = start_point[i] + bandwidth[i];
 
         // adjust for direction being positive or negative
         if (direction[i] > 0)
         {
-            max_corner[i] += track_length * direction[i];
+            region.max_corner[i] += track_length * direction[i];
         }
         else if (direction[i] < 0)
         {
-            min_corner[i] += track_length * direction[i];
+            region.min_corner[i] += track_length * direction[i];
         }
     }
 
-    // set maximum radius around the track to sqrt(hx^2 + hy^2 + hz^2)
-    radius = bandwidth.length();
-}                              
+    // store the track and bandwidth that define the swept region
+    region.is_track = true;
+    region.track_length = track_length;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        region.track_start[i] = start_point[i];
+        region.track_direction[i] = direction[i];
+        region.track_bandwidth[i] = bandwidth[i];
+    }
+}
 //---------------------------------------------------------------------------//
-bool KDENeighborhood::point_within_max_radius(const TallyEvent& event,
-                                              const moab::CartVect& coords) const
+void KDENeighborhood::clip_track(const Region& region,
+                                 int i, double min, double max,
+                                 double& s_min, double& s_max) const
 {
-    // process track-based tally event only
-    if (event.type == TallyEvent::TRACK)
+    // get range of coordinates for the center of an overlapping bandwidth box
+    double lower = min - region.track_bandwidth[i] - 1e-12
+                 - region.track_start[i];
+    double upper = max + region.track_bandwidth[i] + 1e-12
+                 - region.track_start[i];
+    double direction = region.track_direction[i];
+
+    if (direction > 0)
     {
-        // create a vector from starting position to point being tested
-        moab::CartVect temp;
-
-        for (int i = 0; i < 3; ++i)
-        {
-            temp[i] = coords[i] - event.position[i];
-        }
-
-        // compute perpendicular distance from point being tested to line
-        // defined by track segment using the cross-product method
-        double distance_to_track = (event.direction * temp).length();
+        s_min = std::max(s_min, lower / direction);
+        s_max = std::min(s_max, upper / direction);
+    }
+    else if (direction < 0)
+    {
+        s_min = std::max(s_min, upper / direction);
+        s_max = std::min(s_max, lower / direction);
+    }
+    else if (lower > 0.0 || upper < 0.0)
+    {
+        // track is parallel to this range and never close enough to it
+        s_max = s_min - 1.0;
+    }
+}
+//---------------------------------------------------------------------------//
+bool KDENeighborhood::box_near_track(const Region& region,
+                                     const double* box_min,
+                                     const double* box_max) const
+{
+    double s_min = 0.0;
+    double s_max = region.track_length;
 
-        // return true if distance is less than radius of cylindrical region
-        if (distance_to_track < radius) return true;
+    for (int i = 0; i < 3 && s_min <= s_max; ++i)
+    {
+        clip_track(region, i, box_min[i], box_max[i], s_min, s_max);
     }
 
-    // otherwise return false
-    return false;
+    return s_min <= s_max;
 }
 //---------------------------------------------------------------------------//
-bool KDENeighborhood::point_inside_box(const moab::CartVect& coords) const
+bool KDENeighborhood::point_inside_box(const Region& region,
+                                       const double* coords) const
 {
+    const double* min_corner = region.min_corner;
+    const double* max_corner = region.max_corner;
+
     // check point is in the rectangular neighborhood region
     for (int i = 0; i < 3; ++i)
     {
@@ -196,12 +433,12 @@ bool KDENeighborhood::point_inside_box(const moab::CartVect& coords) const
     return true;
 }
 //---------------------------------------------------------------------------//
-void KDENeighborhood::points_in_box()
+void KDENeighborhood::points_in_box(const Region& region,
+                                    std::vector<unsigned int>& points) const
 {
     assert(kd_tree != NULL);
-
-    // reset the set of calculation points
-    points.clear();
+    const double* min_corner = region.min_corner;
+    const double* max_corner = region.max_corner;
 
     // determine the center point of the box
     double box_center[3];
@@ -219,43 +456,172 @@ void KDENeighborhood::points_in_box()
 
     // find all leaves of the kd-tree within the given radius
     std::vector<moab::EntityHandle> leaves;
-    moab::ErrorCode rval = moab::MB_SUCCESS;
-    if(rval != moab::MB_SUCCESS)
-      {
-	std::cout << "this can't fail" << std::endl;
-	exit(1);
-      }
-
-    rval = kd_tree->leaves_within_distance(kd_tree_root, box_center, radius, leaves);
+    moab::ErrorCode rval = kd_tree->leaves_within_distance(kd_tree_root,
+                                                           box_center,
+                                                           radius,
+                                                           leaves);
     assert(rval == moab::MB_SUCCESS);
 
-    // obtain the set of unique points in the box
-    std::vector<moab::EntityHandle>::iterator i; 
-    moab::Interface* mb = kd_tree->moab();
-    moab::CartVect coords(0.0, 0.0, 0.0);
-    moab::Range::iterator j;
+    // obtain the points in the box, each of which is in exactly one leaf
+    std::vector<moab::EntityHandle>::iterator i;
 
     for (i = leaves.begin(); i != leaves.end(); ++i)
     {
-        moab::Range leaf_points;
-        rval = mb->get_entities_by_type(*i, moab::MBVERTEX, leaf_points);
-        assert(rval == moab::MB_SUCCESS);
-  
-        // iterate through the points in each leaf  
-        for (j = leaf_points.begin(); j != leaf_points.end(); ++j)
+        // find the mesh nodes that were stored for this leaf
+        std::vector<moab::EntityHandle>::const_iterator leaf;
+        leaf = std::lower_bound(leaf_handles.begin(), leaf_handles.end(), *i);
+        assert(leaf != leaf_handles.end() && *leaf == *i);
+
+        unsigned int leaf_index = leaf - leaf_handles.begin();
+        unsigned int end = leaf_offsets[leaf_index + 1];
+
+        // skip leaves that do not intersect the swept region of a track
+        const double* box = &leaf_boxes[6 * leaf_index];
+
+        if (region.is_track && !box_near_track(region, box, box + 3)) continue;
+
+        // iterate through the points in each leaf
+        for (unsigned int j = leaf_offsets[leaf_index]; j < end; ++j)
         {
-            // get coordinates of the point
-            moab::EntityHandle point = *j;
-            rval = mb->get_coords(&point, 1, coords.array());
-            assert(rval == moab::MB_SUCCESS);
+            // add the point to the list if it is in the neighborhood region
+            unsigned int point = leaf_points[j];
+            const double* coords = &node_coords[3 * point];
 
-            // add the point to the set if it is in the box
-            if (point_inside_box(coords))
+            if (point_inside_box(region, coords) &&
+                (!region.is_track || box_near_track(region, coords, coords)))
             {
-                points.insert(point);
+                points.push_back(point);
             }
         }
     }
+
+    // sort by index so that tally data is accessed in order
+    std::sort(points.begin(), points.end());
+}
+//---------------------------------------------------------------------------//
+void KDENeighborhood::points_in_grid(const Region& region,
+                                     std::vector<unsigned int>& points) const
+{
+    const double* min_corner = region.min_corner;
+    const double* max_corner = region.max_corner;
+
+    // find the range [first, last) of lattice indices that may be inside the
+    // box, and the range [inner_first, inner_last) of lattice indices for
+    // which all mesh nodes are strictly inside the box
+    unsigned int first[3];
+    unsigned int last[3];
+    unsigned int inner_first[3];
+    unsigned int inner_last[3];
+
+    for (int i = 0; i < 3; ++i)
+    {
+        const std::vector<double>& lower = grid_coords[i];
+        const std::vector<double>& upper = grid_upper_coords[i];
+
+        // includes lattice points within +/- 2e-12 of a box boundary, which
+        // are then checked using the exact coordinates of each mesh node
+        first[i] = std::upper_bound(upper.begin(), upper.end(),
+                                    min_corner[i] - 2e-12) - upper.begin();
+
+        last[i] = std::lower_bound(lower.begin(), lower.end(),
+                                   max_corner[i] + 2e-12) - lower.begin();
+
+        // no lattice points exist inside the box
+        if (first[i] >= last[i]) return;
+
+        inner_first[i] = std::upper_bound(lower.begin(), lower.end(),
+                                          min_corner[i]) - lower.begin();
+
+        inner_last[i] = std::lower_bound(upper.begin(), upper.end(),
+                                         max_corner[i]) - upper.begin();
+
+        inner_last[i] = std::max(inner_first[i], inner_last[i]);
+    }
+
+    // add the lattice points in the range to the list
+    const std::vector<double>& x_lower = grid_coords[0];
+    const std::vector<double>& x_upper = grid_upper_coords[0];
+    unsigned int nx = x_lower.size();
+    unsigned int ny = grid_coords[1].size();
+
+    for (unsigned int k = first[2]; k < last[2]; ++k)
+    {
+        bool inner_z = (k >= inner_first[2] && k < inner_last[2]);
+
+        for (unsigned int j = first[1]; j < last[1]; ++j)
+        {
+            const unsigned int* row = &grid_points[(k * ny + j) * nx];
+            bool inner_y = (j >= inner_first[1] && j < inner_last[1]);
+
+            // for tracks, only check the part of the row in the swept region
+            if (region.is_track)
+            {
+                double s_min = 0.0;
+                double s_max = region.track_length;
+                clip_track(region, 2, grid_coords[2][k] - 1e-12,
+                           grid_upper_coords[2][k] + 1e-12, s_min, s_max);
+                clip_track(region, 1, grid_coords[1][j] - 1e-12,
+                           grid_upper_coords[1][j] + 1e-12, s_min, s_max);
+
+                if (s_min > s_max) continue;
+
+                // find the x coordinates swept by that part of the track
+                const double* start = region.track_start;
+                const double* direction = region.track_direction;
+                double x1 = start[0] + s_min * direction[0];
+                double x2 = start[0] + s_max * direction[0];
+                double x_min = std::min(x1, x2) - region.track_bandwidth[0];
+                double x_max = std::max(x1, x2) + region.track_bandwidth[0];
+
+                unsigned int row_first = std::max(first[0], (unsigned int)(
+                    std::upper_bound(x_upper.begin(), x_upper.end(),
+                                     x_min - 2e-12) - x_upper.begin()));
+
+                unsigned int row_last = std::min(last[0], (unsigned int)(
+                    std::lower_bound(x_lower.begin(), x_lower.end(),
+                                     x_max + 2e-12) - x_lower.begin()));
+
+                add_points_in_region(region, row, row_first, row_last,
+                                     points);
+            }
+            else if (inner_y && inner_z)
+            {
+                // only the ends of the row can have mesh nodes outside the box
+                add_points_in_region(region, row, first[0], inner_first[0],
+                                     points);
+                points.insert(points.end(), row + inner_first[0],
+                                            row + inner_last[0]);
+                add_points_in_region(region, row, inner_last[0], last[0],
+                                     points);
+            }
+            else // row is on the boundary of the box
+            {
+                add_points_in_region(region, row, first[0], last[0], points);
+            }
+        }
+    }
+
+    // sort by index so that tally data is accessed in order
+    std::sort(points.begin(), points.end());
+}
+//---------------------------------------------------------------------------//
+void KDENeighborhood::add_points_in_region(const Region& region,
+                                           const unsigned int* row,
+                                           unsigned int first,
+                                           unsigned int last,
+                                           std::vector<unsigned int>& points) const
+{
+    for (unsigned int i = first; i < last; ++i)
+    {
+        unsigned int point = row[i];
+        const double* coords = &node_coords[3 * point];
+
+        if (point_inside_box(region, coords) &&
+            (!region.is_track || box_near_track(region, coords, coords)))
+        {
+            points.push_back(point);
+        }
+    }
 }
 //---------------------------------------------------------------------------//
 
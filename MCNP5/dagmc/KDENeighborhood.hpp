@@ -3,7 +3,7 @@
 #ifndef DAGMC_KDE_NEIGHBORHOOD_HPP
 #define DAGMC_KDE_NEIGHBORHOOD_HPP
 
-#include <set>
+#include <vector>
 
 #include "moab/Interface.hpp"
 
@@ -28,100 +28,213 @@ namespace moab {
  * set of calculation points for the KDEMeshTally.
  *
  * In general, it is not always easy to define the exact neighborhood region.
- * Therefore, the default behavior of KDENeighborhood is to use a kd-tree
- * search method to locate all possible calculation points for each TallyEvent.
- * This kd-tree approach produces an exact neighborhood region for collision
- * events, but only an approximation for track-based events.
+ * Therefore, KDENeighborhood uses a rectangular box to locate all possible
+ * calculation points for each TallyEvent.  This approach produces an exact
+ * neighborhood region for collision events, but only an approximation for
+ * track-based events.
+ *
+ * For track-based events, the exact neighborhood region is the volume swept
+ * out by the bandwidth box (x +/- hx, y +/- hy, z +/- hz) as its center moves
+ * along the track.  The rectangular box around the whole track contains this
+ * region, but for diagonal tracks it is mostly empty space.  Each search
+ * method therefore also checks that every calculation point is inside the
+ * swept region, so that points for which the kernel function can only produce
+ * a zero result are not included.  The KD_TREE method also skips the points
+ * in any kd-tree leaf whose bounding box does not intersect the swept region.
+ *
+ * ==============
+ * Search Methods
+ * ==============
+ *
+ * Three different methods are available for finding the calculation points
+ * that exist inside the box
+ *
+ *     0) ALL_POINTS does not search, but uses all mesh nodes for every event
+ *     1) KD_TREE uses a kd-tree search to find the mesh nodes in the box
+ *     2) GRID uses a grid search if the mesh nodes form a regular lattice
+ *
+ * The GRID method is the default.  A regular lattice exists if the mesh nodes
+ * are located at every combination of a set of x, y and z coordinates, such
+ * as the nodes of a structured mesh.  In that case, the range of lattice
+ * indices in each dimension that are inside the box can be found directly,
+ * and every lattice point in that range is a calculation point.  Mesh nodes
+ * near the box boundaries are checked using their own coordinates, since the
+ * nodes that share a lattice coordinate may differ slightly, so that GRID and
+ * KD_TREE always find the same calculation points.  If the mesh nodes do not
+ * form a regular lattice, then the KD_TREE method is used.
  *
  * =============================
  * KDENeighborhood Functionality
  * =============================
  *
- * Once a KDENeighborhood has been created, there are two steps that are
- * needed to get its calculation points.  Since the dimensions of the exact
- * neighborhood region usually changes with each TallyEvent, it is first
- * necessary to call update_neighborhood().  Once the neighborhood has been
- * updated, then the set of calculation points associated with that event can
- * be obtained by get_points().
+ * Once a KDENeighborhood has been created, its calculation points can be
+ * obtained for each TallyEvent by calling update_neighborhood().  Since the
+ * dimensions of the exact neighborhood region usually changes with each
+ * TallyEvent, this method redefines the region and then copies the calculation
+ * points into a buffer that is owned by the caller.  The buffer is cleared
+ * first but keeps its capacity, so the same buffer should be reused for every
+ * TallyEvent to avoid allocating memory.
+ *
+ * Calculation points are identified by their index in the moab::Range of mesh
+ * nodes that was used to construct the KDENeighborhood, which is the same as
+ * the tally point index used by a KDEMeshTally.  They are always sorted by
+ * index, so that tally data for nearby points is accessed in order.
+ *
+ * When the kd-tree is built, the coordinates of all mesh nodes and the mesh
+ * nodes contained in each leaf of the kd-tree are also stored, so that
+ * update_neighborhood() only needs MOAB to find the leaves that are close to
+ * the neighborhood region.  The GRID method does not use MOAB at all once the
+ * lattice has been stored.
+ *
+ * The neighborhood region for each TallyEvent is only stored while
+ * update_neighborhood() is running, so it does not change the KDENeighborhood.
+ * Several threads can therefore find calculation points at the same time, as
+ * long as each one uses its own buffer.
  */
 //===========================================================================//
 class KDENeighborhood
 {
   public:
+    /**
+     * \brief Defines method used to find the calculation points
+     *
+     *     0) ALL_POINTS uses all mesh nodes as calculation points
+     *     1) KD_TREE uses a kd-tree search
+     *     2) GRID uses a grid search, or a kd-tree if there is no lattice
+     */
+    enum SearchMethod {ALL_POINTS = 0, KD_TREE = 1, GRID = 2};
+
     /**
      * \brief Constructor
      * \param[in] mbi pointer to a pre-loaded MOAB instance
      * \param[in] mesh_nodes the total set of potential calculation points
-     * \param[in] build_kd_tree if true, creates kd-tree based on mesh nodes
+     * \param[in] method the search method used to find calculation points
+     * \param[in] coords optional coordinates of mesh_nodes by index
      *
-     * Note that setting build_kd_tree to false forces the KDENeighborhood to
+     * Note that setting method to ALL_POINTS forces the KDENeighborhood to
      * always use all calculation points with every TallyEvent that occurs.
+     *
+     * If coords is not NULL, then it must store the (x, y, z) coordinates of
+     * every mesh node in the same order as mesh_nodes.  The KDENeighborhood
+     * then uses this array instead of its own copy of the coordinates, so it
+     * must not be changed or destroyed while the KDENeighborhood exists.
      */
     KDENeighborhood(moab::Interface* mbi,
                     const moab::Range& mesh_nodes,
-                    bool build_kd_tree = true);
-
-    /**
-     * \brief Destructor
-     */
-    ~KDENeighborhood();
+                    SearchMethod method = GRID,
+                    const std::vector<double>* coords = NULL);
 
     // >>> PUBLIC INTERFACE
 
     /**
-     * \brief Gets the calculation points for this neighborhood region
-     * \return set of calculation points currently in the neighborhood region
+     * \brief get_search_method()
+     * \return the search method used to find the calculation points
      *
-     * Provides read-only access to the current set of calculation points.
+     * If the GRID method was requested but the mesh nodes do not form a
+     * regular lattice, then this will return KD_TREE.
      */
-    const std::set<moab::EntityHandle>& get_points() const;
+    SearchMethod get_search_method() const;
+
+    /**
+     * \brief Destructor
+     */
+    ~KDENeighborhood();
 
     /**
      * \brief Updates the neighborhood region based on the given tally event
      * \param[in] event the tally event for which the neighborhood is desired
      * \param[in] bandwidth the bandwidth vector (hx, hy, hz)
+     * \param[out] points the calculation points in the neighborhood region
      *
      * This method redefines the neighborhood region based on the parameters of
-     * the tally event, then updates the set of calculation points that now
-     * exist within this region.
+     * the tally event, then replaces the contents of points with the sorted
+     * indices of all calculation points that now exist within this region.
+     * If no kd-tree was built, then points will include every mesh node.
      */
     void update_neighborhood(const TallyEvent& event,
-                             const moab::CartVect& bandwidth);
-
-    /**
-     * \brief Checks if point belongs to the set of calculation points
-     * \param[in] point the moab::EntityHandle of the point to check
-     * \return true if point is a calculation point; false otherwise
-     *
-     * Searches the set of calculation points currently stored in this
-     * neighborhood region.
-     */
-    bool is_calculation_point(const moab::EntityHandle& point) const;
+                             const moab::CartVect& bandwidth,
+                             std::vector<unsigned int>& points) const;
 
   private:
-    // Set of calculation points currently in this neighborhood region
-    std::set<moab::EntityHandle> points;
+    // Total number of mesh nodes that can be calculation points
+    unsigned int num_nodes;
+
+    // Search method used to find the calculation points
+    SearchMethod method;
+
+    // Coordinates of all mesh nodes, stored as (x, y, z) for each index
+    const double* node_coords;
+
+    // Copy of the coordinates if none were given to the constructor
+    std::vector<double> stored_coords;
+
+    // Sorted kd-tree leaves, with the mesh nodes in leaf_handles[i] stored
+    // from leaf_points[leaf_offsets[i]] to leaf_points[leaf_offsets[i+1] - 1]
+    std::vector<moab::EntityHandle> leaf_handles;
+    std::vector<unsigned int> leaf_offsets;
+    std::vector<unsigned int> leaf_points;
+
+    // Sorted x, y and z coordinates of a regular lattice of mesh nodes, with
+    // the index of the mesh node at lattice point (i, j, k) stored in
+    // grid_points[(k * ny + j) * nx + i].  Mesh nodes that share a lattice
+    // coordinate may differ slightly, so grid_coords stores the smallest and
+    // grid_upper_coords the largest value of that coordinate.
+    std::vector<double> grid_coords[3];
+    std::vector<double> grid_upper_coords[3];
+    std::vector<unsigned int> grid_points;
 
     // KD-Tree containing all mesh nodes in the input mesh
     moab::AdaptiveKDTree* kd_tree;
     moab::EntityHandle kd_tree_root;
 
-    // Minimum and maximum corner of a rectangular neighborhood region
-    double min_corner[3];
-    double max_corner[3];
+    // Bounding boxes of the kd-tree leaves in the same order as leaf_handles,
+    // stored as (xmin, ymin, zmin, xmax, ymax, zmax) for each leaf
+    std::vector<double> leaf_boxes;
+
+    // Neighborhood region for a single tally event
+    struct Region
+    {
+        // Minimum and maximum corner of a rectangular neighborhood region
+        double min_corner[3];
+        double max_corner[3];
 
-    // Radius of a cylindrical neighborhood region
-    double radius;
+        // Track segment and bandwidth that define a swept neighborhood
+        // region, which is only used if the tally event is track-based
+        bool is_track;
+        double track_length;
+        double track_start[3];
+        double track_direction[3];
+        double track_bandwidth[3];
+    };
 
     // >>> PRIVATE METHODS
 
+    /**
+     * \brief Stores the mesh nodes that are contained in each kd-tree leaf
+     * \param[in] mesh_nodes the set of mesh nodes used to build the kd-tree
+     * \return the MOAB ErrorCode value
+     */
+    moab::ErrorCode store_leaf_points(const moab::Range& mesh_nodes);
+
+    /**
+     * \brief Stores the mesh nodes as a regular lattice if possible
+     * \return true if the mesh nodes form a regular lattice; false otherwise
+     *
+     * Requires node_coords to be set.  Coordinates that differ by less than
+     * 1e-10 times the size of the mesh are treated as the same value.  If
+     * false is returned, then no lattice data is stored.
+     */
+    bool store_grid_points();
+
     /**
      * \brief Sets the neighborhood region for a collision event
      * \param[in] collision_point the location of the collision (x, y, z)
      * \param[in] bandwidth the bandwidth vector (hx, hy, hz)
+     * \param[out] region the neighborhood region for the collision
      */
     void set_neighborhood(const moab::CartVect& collision_point,
-                          const moab::CartVect& bandwidth);
+                          const moab::CartVect& bandwidth,
+                          Region& region) const;
 
     /**
      * \brief Sets the neighborhood region for a track-based event
@@ -129,41 +242,97 @@ class KDENeighborhood
      * \param[in] start_point the starting location of the particle (xo, yo, zo)
      * \param[in] direction the direction the particle is traveling (uo, vo, wo)
      * \param[in] bandwidth the bandwidth vector (hx, hy, hz)
+     * \param[out] region the neighborhood region for the track
      */
     void set_neighborhood(double track_length,
                           const moab::CartVect& start_point,
                           const moab::CartVect& direction,
-                          const moab::CartVect& bandwidth);
+                          const moab::CartVect& bandwidth,
+                          Region& region) const;
 
     /**
-     * \brief Determines if point lies within radius of cylindrical region
-     * \param[in] coords the coordinates of the point to check
-     * \return true if point is inside the region; false otherwise
+     * \brief Limits the track to where it is near a range of coordinates
+     * \param[in] region the swept neighborhood region of a track
+     * \param[in] i the dimension of the coordinates (0, 1 or 2)
+     * \param[in] min, max the range of coordinates in dimension i
+     * \param[in, out] s_min, s_max the range of distances along the track
      *
-     * TODO currently unused, may integrate into update_neighborhood to
-     * refine neighborhood region for a track-based event.
+     * Reduces [s_min, s_max] to the distances s along the track for which
+     * the bandwidth box centered at start + s * direction overlaps [min, max]
+     * in dimension i, within +/- 1e-12.  If no such distances exist, then
+     * s_min will be greater than s_max on return.
      */
-    bool point_within_max_radius(const TallyEvent& event,
-                                 const moab::CartVect& coords) const;
+    void clip_track(const Region& region,
+                    int i, double min, double max,
+                    double& s_min, double& s_max) const;
+
+    /**
+     * \brief Determines if a box intersects the swept neighborhood region
+     * \param[in] region the swept neighborhood region of a track
+     * \param[in] box_min, box_max the (x, y, z) corners of the box to check
+     * \return true if box intersects the region; false otherwise
+     *
+     * This is used for track-based events only.  A point can be checked by
+     * setting both corners of the box to the coordinates of that point.
+     */
+    bool box_near_track(const Region& region,
+                        const double* box_min,
+                        const double* box_max) const;
 
     /**
      * \brief Determines if point lies within min/max corners of box
-     * \param[in] coords the coordinates of the point to check
+     * \param[in] region the neighborhood region
+     * \param[in] coords the (x, y, z) coordinates of the point to check
      * \return true if point is inside box; false otherwise
      *
      * This is a helper method used by points_in_box to determine if a point
      * should be added to the set of calculation points.
      */
-    bool point_inside_box(const moab::CartVect& coords) const;
+    bool point_inside_box(const Region& region, const double* coords) const;
 
     /**
      * \brief Finds the vertices that exist inside a rectangular region
+     * \param[in] region the neighborhood region
+     * \param[out] points the calculation points in the neighborhood region
      *
      * Includes vertices that are within +/- 1e-12 of a box boundary.  This
-     * method updates the set of calculation points with all vertices that
-     * were located within the current neighborhood region.
+     * method adds the indices of all vertices that were located within the
+     * given neighborhood region to points, then sorts them.  For track-based
+     * events, only the vertices inside the swept region are included.
+     */
+    void points_in_box(const Region& region,
+                       std::vector<unsigned int>& points) const;
+
+    /**
+     * \brief Finds the lattice points that exist inside a rectangular region
+     * \param[in] region the neighborhood region
+     * \param[out] points the calculation points in the neighborhood region
+     *
+     * This is the GRID version of points_in_box, which gives the same result
+     * by finding the range of lattice points inside the box in each dimension.
+     * For track-based events, the range of x indices is found separately for
+     * each row of lattice points from the part of the track near that row.
+     *
+     * Lattice points whose coordinates are all strictly inside the box are
+     * added directly.  Mesh nodes near a box boundary, and all mesh nodes for
+     * track-based events, are checked using their own coordinates with the
+     * same tests as points_in_box.
+     */
+    void points_in_grid(const Region& region,
+                        std::vector<unsigned int>& points) const;
+
+    /**
+     * \brief Adds the mesh nodes in part of a lattice row that are in region
+     * \param[in] region the neighborhood region
+     * \param[in] row the indices of the mesh nodes in a row of the lattice
+     * \param[in] first, last the range [first, last) of the row to check
+     * \param[out] points the calculation points in the neighborhood region
      */
-    void points_in_box();
+    void add_points_in_region(const Region& region,
+                              const unsigned int* row,
+                              unsigned int first,
+                              unsigned int last,
+                              std::vector<unsigned int>& points) const;
 };
 
 #endif // DAGMC_KDE_NEIGHBORHOOD_HPP
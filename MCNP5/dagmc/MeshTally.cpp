@@ -1,6 +1,7 @@
 // MCNP5/dagmc/MeshTally.cpp
 
-#include <cassert>
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
 #include <sstream>
@@ -48,10 +49,46 @@ MeshTally::MeshTally(const TallyInput& input)
 //---------------------------------------------------------------------------//
 // PROTECTED METHODS
 //---------------------------------------------------------------------------//
-unsigned int MeshTally::get_entity_index(moab::EntityHandle tally_point)
+unsigned int MeshTally::get_entity_index(moab::EntityHandle tally_point) const
 {
-    unsigned int ret = tally_points.index(tally_point);
-    assert(ret < tally_points.size());
+    unsigned int ret = tally_points.size();
+
+    if (!entity_index_table.empty())
+    {
+        if (tally_point >= tally_points.front() &&
+            tally_point <= tally_points.back())
+        {
+            ret = entity_index_table[tally_point - tally_points.front()];
+        }
+    }
+    else if (!block_first_handle.empty())
+    {
+        // find the last block that starts at or before this handle
+        std::vector<moab::EntityHandle>::const_iterator it;
+        it = std::upper_bound(block_first_handle.begin(),
+                              block_first_handle.end(), tally_point);
+
+        if (it != block_first_handle.begin())
+        {
+            unsigned int block = (it - block_first_handle.begin()) - 1;
+            moab::EntityHandle offset = tally_point - block_first_handle[block];
+
+            if (offset < block_index[block + 1] - block_index[block])
+            {
+                ret = block_index[block] + offset;
+            }
+        }
+    }
+
+    // handles in the gaps between blocks are not tally points
+    if (ret >= tally_points.size())
+    {
+        std::cerr << "Error: entity handle " << tally_point
+                  << " is not a tally point for mesh tally "
+                  << input_data.tally_id << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
     return ret;
 }
 //---------------------------------------------------------------------------//
@@ -83,12 +120,49 @@ void MeshTally::set_tally_points(const moab::Range& mesh_elements)
 
     std::cout << "    Tally range has psize: " << psize << std::endl;
 
-    // print warning about performance compromise if there are many divisions
-    // (for some rather arbitrary definition of "many")
-    if (psize > 4)
+    entity_index_table.clear();
+    block_first_handle.clear();
+    block_index.clear();
+
+    if (tally_points.empty()) return;
+
+    moab::Range::const_pair_iterator it;
+
+    // only build lookup table if it is not much larger than the tally points
+    // (for some rather arbitrary definition of "much larger")
+    moab::EntityHandle first_handle = tally_points.front();
+    moab::EntityHandle num_handles = tally_points.back() - first_handle + 1;
+
+    if (num_handles > 4 * tally_points.size() + 1024)
+    {
+        // store the first handle and entity index of each block instead
+        block_first_handle.reserve(psize);
+        block_index.reserve(psize + 1);
+        unsigned int index = 0;
+
+        for (it = tally_points.const_pair_begin();
+             it != tally_points.const_pair_end(); ++it)
+        {
+            block_first_handle.push_back(it->first);
+            block_index.push_back(index);
+            index += it->second - it->first + 1;
+        }
+
+        block_index.push_back(index);
+        return;
+    }
+
+    // handles in the gaps between blocks are marked with an invalid index
+    entity_index_table.assign(num_handles, tally_points.size());
+    unsigned int index = 0;
+
+    for (it = tally_points.const_pair_begin();
+         it != tally_points.const_pair_end(); ++it)
     {
-        std::cerr << "Warning: large tally range psize " << psize
-                  << ", may reduce performance" << std::endl;
+        for (moab::EntityHandle h = it->first; h <= it->second; ++h)
+        {
+            entity_index_table[h - first_handle] = index++;
+        }
     }
 }
 //---------------------------------------------------------------------------//
@@ -159,6 +233,59 @@ moab::ErrorCode MeshTally::setup_tags(moab::Interface* mbi, const char* prefix)
     return moab::MB_SUCCESS;
 }
 //---------------------------------------------------------------------------//
+moab::ErrorCode MeshTally::set_result_tags(moab::Interface* mbi,
+                                           double num_histories,
+                                           const double* volumes)
+{
+    int length;
+    const double* tally_data = data->get_tally_data(length);
+    const double* error_data = data->get_error_data(length);
+
+    unsigned int num_bins = data->get_num_energy_bins();
+    unsigned int num_points = tally_points.size();
+
+    // tally points are stored in the data arrays in the same order as the range
+    std::vector<double> tally_values(num_points);
+    std::vector<double> error_values(num_points);
+
+    for (unsigned int j = 0; j < num_bins; ++j)
+    {
+        for (unsigned int i = 0; i < num_points; ++i)
+        {
+            double tally = tally_data[i * num_bins + j];
+            double error = error_data[i * num_bins + j];
+
+            // Use 0 as the error output value if nothing has been computed;
+            // this reflects MCNP's approach to avoid a divide-by-zero error
+            double rel_error = 0.0;
+
+            if (error != 0.0)
+            {
+                rel_error = sqrt(error / (tally * tally) - 1.0 / num_histories);
+            }
+
+            // normalize mesh tally result by the number of source particles
+            tally /= num_histories;
+            if (volumes != NULL) tally /= volumes[i];
+
+            tally_values[i] = tally;
+            error_values[i] = rel_error;
+        }
+
+        // set tally and error tag values for all tally points at once
+        moab::ErrorCode rval;
+        rval = mbi->tag_set_data(tally_tags[j], tally_points, &tally_values[0]);
+
+        if (rval != moab::MB_SUCCESS) return rval;
+
+        rval = mbi->tag_set_data(error_tags[j], tally_points, &error_values[0]);
+
+        if (rval != moab::MB_SUCCESS) return rval;
+    }
+
+    return moab::MB_SUCCESS;
+}
+//---------------------------------------------------------------------------//
 void MeshTally::add_score_to_mesh_tally(const moab::EntityHandle& tally_point, 
                                         double weight, double score,
                                         unsigned int ebin)
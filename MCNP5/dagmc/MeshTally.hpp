@@ -51,6 +51,20 @@ namespace moab {
  * meshtal<tally_id>.h5m.  To write to a different file format that is
  * supported by MOAB, simply add the desired extension to the output filename
  * (i.e. "out"="filename.vtk" will write results to the VTK format).
+ *
+ * ============
+ * Tally Points
+ * ============
+ *
+ * Each MeshTally stores the mesh entities it tallies as a set of tally points,
+ * which are defined through set_tally_points().  This also builds a dense
+ * lookup table that maps every entity handle between the first and last tally
+ * point to its entity index, so get_entity_index() takes constant time no
+ * matter how fragmented the loaded mesh handles are.  If the tally points are
+ * so sparse that this table would be much larger than the number of tally
+ * points, then an offset table with one entry for each contiguous block of
+ * handles is built instead, which get_entity_index() searches in time
+ * proportional to the logarithm of the number of blocks.
  */
 //===========================================================================//
 class MeshTally : public Tally
@@ -81,6 +95,14 @@ class MeshTally : public Tally
     /// Set of tally points (cells, nodes, etc) for this mesh tally
     moab::Range tally_points;
 
+    /// Entity index for every handle from tally_points.front() to back()
+    std::vector<unsigned int> entity_index_table;
+
+    /// First handle and entity index of each contiguous block of tally points,
+    /// used if entity_index_table is empty; block_index ends with the size
+    std::vector<moab::EntityHandle> block_first_handle;
+    std::vector<unsigned int> block_index;
+
     /// Tag arrays for storing energy bin labels
     std::vector<moab::Tag> tally_tags, error_tags;
 
@@ -90,8 +112,10 @@ class MeshTally : public Tally
      * \brief Determines entity index corresponding to tally point
      * \param[in] tally_point entity handle representing tally point
      * \return entity index for given tally point
+     *
+     * Exits with an error if the handle is not one of the tally points.
      */
-    unsigned int get_entity_index(moab::EntityHandle tally_point);
+    unsigned int get_entity_index(moab::EntityHandle tally_point) const;
 
     /**
      * \brief Loads the MOAB mesh data from the input file for this mesh tally
@@ -107,7 +131,8 @@ class MeshTally : public Tally
      * \param[in] mesh_elements the set of mesh elements to use as tally points
      *
      * Note that this method calls resize_data_arrays() to set the tally
-     * data arrays for the given number of tally points.
+     * data arrays for the given number of tally points.  It also builds the
+     * lookup table used by get_entity_index().
      */
     void set_tally_points(const moab::Range& mesh_elements);
 
@@ -135,6 +160,21 @@ class MeshTally : public Tally
      */
     moab::ErrorCode setup_tags(moab::Interface* mbi, const char* prefix="");
 
+    /**
+     * \brief Sets tally value and error tags for all tally points
+     * \param[in] mbi the MOAB interface for this mesh tally
+     * \param[in] num_histories the number of particle histories tracked
+     * \param[in] volumes optional volume of each tally point by entity index
+     * \return the MOAB ErrorCode value
+     *
+     * Tally results are normalized by the number of particle histories, and
+     * also by the volume of each tally point if volumes is not NULL.  Each tag
+     * is set for all tally points at once from a contiguous array.
+     */
+    moab::ErrorCode set_result_tags(moab::Interface* mbi,
+                                    double num_histories,
+                                    const double* volumes = NULL);
+
     /**
      * \brief Adds weight * score to the mesh tally for the tally point
      * \param[in] tally_point entity handle representing tally point
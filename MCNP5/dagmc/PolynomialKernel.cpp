@@ -5,6 +5,63 @@
 
 #include "PolynomialKernel.hpp"
 
+//---------------------------------------------------------------------------//
+// 2ND-ORDER PRODUCT KERNEL SPECIALIZATIONS
+//---------------------------------------------------------------------------//
+// Computes t^S at compile time for the (1 - u^2)^s term of K_s(u)
+template <unsigned int S>
+struct Power
+{
+    static inline double of(double t) { return t * Power<S - 1>::of(t); }
+};
+
+template <>
+struct Power<0>
+{
+    static inline double of(double) { return 1.0; }
+};
+//---------------------------------------------------------------------------//
+// Evaluates K_s(u) * K_s(v) * K_s(w) / (hx * hy * hz) for a 2nd-order kernel
+// with smoothness factor S.  The loop body has no branches or function calls
+// so that the compiler can evaluate several points per vector instruction.
+template <unsigned int S>
+static void evaluate_product_kernel(double multiplier,
+                                    const double* x,
+                                    const double* y,
+                                    const double* z,
+                                    unsigned int n,
+                                    const double* observation,
+                                    const double* bandwidth,
+                                    double* values)
+{
+    const double xo = observation[0];
+    const double yo = observation[1];
+    const double zo = observation[2];
+    const double hx = bandwidth[0];
+    const double hy = bandwidth[1];
+    const double hz = bandwidth[2];
+    const double scale = multiplier * multiplier * multiplier / (hx * hy * hz);
+
+    for (unsigned int j = 0; j < n; ++j)
+    {
+        double u = (x[j] - xo) / hx;
+        double v = (y[j] - yo) / hy;
+        double w = (z[j] - zo) / hz;
+
+        // 1 - u^2 is negative if u is outside the domain [-1, 1]
+        double tu = 1.0 - u * u;
+        double tv = 1.0 - v * v;
+        double tw = 1.0 - w * w;
+
+        double value = scale * Power<S>::of(tu)
+                             * Power<S>::of(tv)
+                             * Power<S>::of(tw);
+
+        bool in_domain = (tu >= 0.0) & (tv >= 0.0) & (tw >= 0.0);
+        values[j] = in_domain ? value : 0.0;
+    }
+}
+//---------------------------------------------------------------------------//
 //---------------------------------------------------------------------------//
 // CONSTRUCTOR
 //---------------------------------------------------------------------------//
@@ -32,15 +89,8 @@ PolynomialKernel::PolynomialKernel(unsigned int s, unsigned int r)
         assert(coefficients.size() == r);
     }
 
-    // set quadrature for integrating the 0th moment function
-    quadrature = new Quadrature(get_min_quadrature(0));
-}
-//---------------------------------------------------------------------------//
-// DESTRUCTOR
-//---------------------------------------------------------------------------//
-PolynomialKernel::~PolynomialKernel()
-{
-    delete quadrature;
+    // store coefficients for the expanded form of this kernel function
+    expand_polynomial();
 }
 //---------------------------------------------------------------------------//
 // DERIVED PUBLIC INTERFACE from KDEKernel.hpp
@@ -85,6 +135,45 @@ double PolynomialKernel::evaluate(double u) const
     return value;
 }
 //---------------------------------------------------------------------------//
+void PolynomialKernel::evaluate_product(const double* x,
+                                        const double* y,
+                                        const double* z,
+                                        unsigned int n,
+                                        const double* observation,
+                                        const double* bandwidth,
+                                        double* values) const
+{
+    // use a specialized version for the common 2nd-order kernels
+    if (r == 1)
+    {
+        switch (s)
+        {
+          case 0:
+            evaluate_product_kernel<0>(multiplier, x, y, z, n,
+                                       observation, bandwidth, values);
+            return;
+
+          case 1:
+            evaluate_product_kernel<1>(multiplier, x, y, z, n,
+                                       observation, bandwidth, values);
+            return;
+
+          case 2:
+            evaluate_product_kernel<2>(multiplier, x, y, z, n,
+                                       observation, bandwidth, values);
+            return;
+
+          case 3:
+            evaluate_product_kernel<3>(multiplier, x, y, z, n,
+                                       observation, bandwidth, values);
+            return;
+        }
+    }
+
+    // otherwise use the general version for all other polynomial kernels
+    KDEKernel::evaluate_product(x, y, z, n, observation, bandwidth, values);
+}
+//---------------------------------------------------------------------------//
 std::string PolynomialKernel::get_kernel_name() const
 {
     // determine the order of this kernel and add to kernel name
@@ -125,6 +214,12 @@ int PolynomialKernel::get_order() const
     return 2 * r;
 }
 //---------------------------------------------------------------------------//
+bool PolynomialKernel::get_polynomial(std::vector<double>& coefficients) const
+{
+    coefficients = polynomial;
+    return true;
+}
+//---------------------------------------------------------------------------//
 int PolynomialKernel::get_min_quadrature(unsigned int i) const
 {
     return s + r + (i/2);
@@ -134,30 +229,32 @@ double PolynomialKernel::integrate_moment(double a,
                                           double b,
                                           unsigned int i) const
 {
-    assert(quadrature != NULL);
-
     double value = 0.0;
 
     // check if integral limits are within the domain u = [-1, 1]
     if (a < 1.0 && b > -1.0)
     {
-        // create the ith moment function
-        MomentFunction moment(i, *this);
+        // modify integration limits if needed
+        if (a < -1.0) a = -1.0;
+        if (b > 1.0) b = 1.0;
 
-        // define the quadrature set for integrating the ith moment function
-        unsigned int n = get_min_quadrature(i);
+        // set a_power = a^(i+1) and b_power = b^(i+1)
+        double a_power = a;
+        double b_power = b;
 
-        if (quadrature->get_num_quad_points() != n)
+        for (unsigned int k = 0; k < i; ++k)
         {
-            quadrature->change_quadrature_set(n);
+            a_power *= a;
+            b_power *= b;
         }
 
-        // modify integration limits if needed
-        if (a < -1.0) a = -1.0;
-        if (b > 1.0) b = 1.0;
-
-        // evaluate the integral
-        value = quadrature->integrate(a, b, moment);
+        // integrate u^i * K_2r,s(u) exactly, one polynomial term at a time
+        for (unsigned int k = 0; k < polynomial.size(); ++k)
+        {
+            value += polynomial[k] * (b_power - a_power) / (k + i + 1);
+            a_power *= a;
+            b_power *= b;
+        }
     }
 
     return value;
@@ -181,6 +278,35 @@ double PolynomialKernel::compute_multiplier()
     return value;
 }
 //---------------------------------------------------------------------------//
+void PolynomialKernel::expand_polynomial()
+{
+    // expand multiplier * (1 - u^2)^s using binomial coefficients
+    polynomial.assign(2 * s + 1, 0.0);
+    double binomial = multiplier;
+
+    for (unsigned int j = 0; j <= s; ++j)
+    {
+        polynomial[2 * j] = (j%2 == 1) ? -binomial : binomial;
+        binomial *= double(s - j) / (j + 1);
+    }
+
+    // multiply by B_r,s(u) for kernels of higher order
+    if (r > 1)
+    {
+        std::vector<double> product(polynomial.size() + 2 * (r - 1), 0.0);
+
+        for (unsigned int i = 0; i < polynomial.size(); ++i)
+        {
+            for (unsigned int k = 0; k < r; ++k)
+            {
+                product[i + 2 * k] += polynomial[i] * coefficients[k];
+            }
+        }
+
+        polynomial.swap(product);
+    }
+}
+//---------------------------------------------------------------------------//
 double PolynomialKernel::pochhammer(double x, unsigned int n) const
 {
     // set default result for (x)_0 = 1
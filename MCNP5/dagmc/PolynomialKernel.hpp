@@ -52,11 +52,6 @@ class PolynomialKernel : public KDEKernel
      */
     PolynomialKernel(unsigned int s, unsigned int r);
 
-    /**
-     * \brief Destructor
-     */
-    ~PolynomialKernel();
-
     // >>> DERIVED PUBLIC INTERFACE from KDEKernel.hpp
 
     /**
@@ -66,6 +61,37 @@ class PolynomialKernel : public KDEKernel
      */
     virtual double evaluate(double u) const;
 
+    /**
+     * \brief Evaluates the 3D product kernel for a batch of calculation points
+     * \param[in] x, y, z the coordinates of the n calculation points
+     * \param[in] n the number of calculation points
+     * \param[in] observation the observation point (Xi, Yi, Zi)
+     * \param[in] bandwidth the bandwidth vector (hx, hy, hz)
+     * \param[out] values array of size n that will store the kernel values
+     *
+     * Uncorrected 2nd-order uniform, epanechnikov, biweight and triweight
+     * kernels are evaluated by versions specialized at compile time, which
+     * can be vectorized by the compiler.  All other polynomial kernels use
+     * the general KDEKernel implementation.
+     */
+    virtual void evaluate_product(const double* x,
+                                  const double* y,
+                                  const double* z,
+                                  unsigned int n,
+                                  const double* observation,
+                                  const double* bandwidth,
+                                  double* values) const;
+
+    /**
+     * \brief Gets the coefficients of this kernel function as a polynomial
+     * \param[out] coefficients stores (c0, c1, ..., cn) for the polynomial
+     * \return true, since K_2r,s(u) is always a polynomial on [-1, 1]
+     *
+     * The polynomial has degree n = 2s + 2(r - 1), and only coefficients of
+     * even powers of u are non-zero.
+     */
+    virtual bool get_polynomial(std::vector<double>& coefficients) const;
+
     /**
      * \brief get_kernel_name()
      * \return string representing polynomial kernel name
@@ -90,6 +116,9 @@ class PolynomialKernel : public KDEKernel
      * \param[in] a, b the lower and upper integration limits
      * \param[in] i the index representing the ith moment function
      * \return definite integral of the ith moment function for [a, b]
+     *
+     * The integral is computed exactly from the expanded polynomial, so no
+     * quadrature is needed and no memory is allocated.
      */
     virtual double integrate_moment(double a, double b, unsigned int i) const;
   
@@ -106,8 +135,8 @@ class PolynomialKernel : public KDEKernel
     /// Coefficients of the polynomial generated for kernels of order > 2
     std::vector<double> coefficients;
 
-    /// Quadrature set for integrating moment functions
-    Quadrature* quadrature;
+    /// Coefficients of K_2r,s(u) expanded as a polynomial in u
+    std::vector<double> polynomial;
 
     // >>> PRIVATE METHODS
 
@@ -117,6 +146,14 @@ class PolynomialKernel : public KDEKernel
      */
     double compute_multiplier();
 
+    /**
+     * \brief Expands this kernel function into a polynomial in u
+     *
+     * Multiplies out the (1 - u^2)^s and B_r,s(u) terms, including the
+     * common multiplier, and stores the result in polynomial.
+     */
+    void expand_polynomial();
+
     /**
      * \brief Evaluates the Pochhammer symbol
      * \param[in] x the value for which to evaluate the Pochhammer symbol
@@ -1,14 +1,54 @@
 // MCNP5/dagmc/Quadrature.cpp
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstddef>
 #include <iostream>
+#include <map>
 
 #include "Quadrature.hpp"
 
+// number of points that integrate() maps and evaluates at once
+static const unsigned int BLOCK_SIZE = 64;
+
+//---------------------------------------------------------------------------//
+// evaluates the Legendre polynomial P_n(x) and its derivative at x
+static void evaluate_legendre(unsigned int n,
+                              double x,
+                              double& value,
+                              double& derivative)
+{
+    // use the recurrence relation to find P_n(x) and P_n-1(x)
+    double p_n = 1.0;
+    double p_n_minus_1 = 0.0;
+
+    for (unsigned int j = 1; j <= n; ++j)
+    {
+        double p_n_minus_2 = p_n_minus_1;
+        p_n_minus_1 = p_n;
+        p_n = ((2 * j - 1) * x * p_n_minus_1 - (j - 1) * p_n_minus_2) / j;
+    }
+
+    value = p_n;
+    derivative = n * (x * p_n - p_n_minus_1) / (x * x - 1.0);
+}
+//---------------------------------------------------------------------------//
+// FUNCTION INTERFACE
+//---------------------------------------------------------------------------//
+void Function::evaluate_batch(const double* x,
+                              unsigned int n,
+                              double* values) const
+{
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        values[i] = evaluate(x[i]);
+    }
+}
 //---------------------------------------------------------------------------//
 // CONSTRUCTOR
 //---------------------------------------------------------------------------//
-Quadrature::Quadrature(unsigned int n) : num_quad_points(n)
+Quadrature::Quadrature(unsigned int n) : num_quad_points(n), rule(NULL)
 {
     // set quadrature points and weights
     set_up_quadrature();
@@ -18,10 +58,6 @@ Quadrature::Quadrature(unsigned int n) : num_quad_points(n)
 //---------------------------------------------------------------------------//
 void Quadrature::change_quadrature_set(unsigned int new_n)
 {
-    // reset the original quadrature points and weights
-    quad_points.clear();
-    quad_weights.clear();
-
     // set the new quadrature points and weights
     num_quad_points = new_n;
     set_up_quadrature();
@@ -30,22 +66,37 @@ void Quadrature::change_quadrature_set(unsigned int new_n)
 double Quadrature::integrate(double a, double b, const Function& f) const
 {
     assert(b > a);
+    assert(rule != NULL);
 
     // define scaling constants
     double c1 = 0.5 * (b - a);
     double c2 = 0.5 * (b + a);
 
-    // sum contributions for all quadrature points
+    // sum contributions for all quadrature points, one block at a time
+    const double* points = rule->points;
+    const double* weights = rule->weights;
+    double x[BLOCK_SIZE];
+    double values[BLOCK_SIZE];
     double sum = 0;
 
-    for (unsigned int i = 0; i < quad_points.size(); ++i)
+    for (unsigned int i = 0; i < num_quad_points; i += BLOCK_SIZE)
     {
-        // defined scaled quadrature point
-        double x = c1 * quad_points[i] + c2;
+        unsigned int n = std::min(BLOCK_SIZE, num_quad_points - i);
+
+        // define scaled quadrature points for this block
+        for (unsigned int j = 0; j < n; ++j)
+        {
+            x[j] = c1 * points[i + j] + c2;
+        }
 
-        // add contribution for this quadrature point to the sum
-        sum += quad_weights[i] * f.evaluate(x);
-    } 
+        // add contributions for this block of quadrature points to the sum
+        f.evaluate_batch(x, n, values);
+
+        for (unsigned int j = 0; j < n; ++j)
+        {
+            sum += weights[i + j] * values[j];
+        }
+    }
 
     // return the value of the definite integral of f(x) from a to b
     return c1 * sum;
@@ -56,172 +107,95 @@ unsigned int Quadrature::get_num_quad_points() const
     return num_quad_points;
 }
 //---------------------------------------------------------------------------//
+const double* Quadrature::get_quad_points() const
+{
+    return rule->points;
+}
+//---------------------------------------------------------------------------//
+const double* Quadrature::get_quad_weights() const
+{
+    return rule->weights;
+}
+//---------------------------------------------------------------------------//
 // PRIVATE METHODS
 //---------------------------------------------------------------------------//
 void Quadrature::set_up_quadrature()
 {
-    switch (num_quad_points)
+    if (num_quad_points == 0)
     {
-      case 1:
-        quad_points.push_back(0.0000000000000000);
-        quad_weights.push_back(2.0000000000000000);
-        break;
-
-      case 2:
-        quad_points.push_back(-0.5773502691896257);
-        quad_points.push_back(0.5773502691896257);
-
-        quad_weights.push_back(1.0000000000000000);
-        quad_weights.push_back(1.0000000000000000);
-        break;
-
-      case 3:
-        quad_points.push_back(0.0000000000000000);
-        quad_points.push_back(-0.7745966692414834);
-        quad_points.push_back(0.7745966692414834);
-
-        quad_weights.push_back(0.8888888888888888);
-        quad_weights.push_back(0.5555555555555556);
-        quad_weights.push_back(0.5555555555555556);
-        break;
-
-      case 4:
-        quad_points.push_back(-0.3399810435848563);
-        quad_points.push_back(0.3399810435848563);
-        quad_points.push_back(-0.8611363115940526);
-        quad_points.push_back(0.8611363115940526);
-
-        quad_weights.push_back(0.6521451548625461);
-        quad_weights.push_back(0.6521451548625461);
-        quad_weights.push_back(0.3478548451374538);
-        quad_weights.push_back(0.3478548451374538);
-        break;
-
-      case 5:
-        quad_points.push_back(0.0000000000000000);
-        quad_points.push_back(-0.5384693101056831);
-        quad_points.push_back(0.5384693101056831);
-        quad_points.push_back(-0.9061798459386640);
-        quad_points.push_back(0.9061798459386640);
-
-        quad_weights.push_back(0.5688888888888889);
-        quad_weights.push_back(0.4786286704993665);
-        quad_weights.push_back(0.4786286704993665);
-        quad_weights.push_back(0.2369268850561891);
-        quad_weights.push_back(0.2369268850561891);
-        break;
-
-      case 6:
-        quad_points.push_back(0.6612093864662645);
-        quad_points.push_back(-0.6612093864662645);
-        quad_points.push_back(-0.2386191860831969);
-        quad_points.push_back(0.2386191860831969);
-        quad_points.push_back(-0.9324695142031521);
-        quad_points.push_back(0.9324695142031521);
-
-        quad_weights.push_back(0.3607615730481386);
-        quad_weights.push_back(0.3607615730481386);
-        quad_weights.push_back(0.4679139345726910);
-        quad_weights.push_back(0.4679139345726910);
-        quad_weights.push_back(0.1713244923791704);
-        quad_weights.push_back(0.1713244923791704);
-        break;
-
-      case 7:
-        quad_points.push_back(0.0000000000000000);
-        quad_points.push_back(0.4058451513773972);
-        quad_points.push_back(-0.4058451513773972);
-        quad_points.push_back(-0.7415311855993945);
-        quad_points.push_back(0.7415311855993945);
-        quad_points.push_back(-0.9491079123427585);
-        quad_points.push_back(0.9491079123427585);
-
-        quad_weights.push_back(0.4179591836734694);
-        quad_weights.push_back(0.3818300505051189);
-        quad_weights.push_back(0.3818300505051189);
-        quad_weights.push_back(0.2797053914892766);
-        quad_weights.push_back(0.2797053914892766);
-        quad_weights.push_back(0.1294849661688697);
-        quad_weights.push_back(0.1294849661688697);
-        break;
-
-      case 8:
-        quad_points.push_back(-0.1834346424956498);
-        quad_points.push_back(0.1834346424956498);
-        quad_points.push_back(-0.5255324099163290);
-        quad_points.push_back(0.5255324099163290);
-        quad_points.push_back(-0.7966664774136267);
-        quad_points.push_back(0.7966664774136267);
-        quad_points.push_back(-0.9602898564975363);
-        quad_points.push_back(0.9602898564975363);
-
-        quad_weights.push_back(0.3626837833783620);
-        quad_weights.push_back(0.3626837833783620);
-        quad_weights.push_back(0.3137066458778873);
-        quad_weights.push_back(0.3137066458778873);
-        quad_weights.push_back(0.2223810344533745);
-        quad_weights.push_back(0.2223810344533745);
-        quad_weights.push_back(0.1012285362903763);
-        quad_weights.push_back(0.1012285362903763);
-        break;
-
-      case 9:
-        quad_points.push_back(0.0000000000000000);
-        quad_points.push_back(-0.8360311073266358);
-        quad_points.push_back(0.8360311073266358);
-        quad_points.push_back(-0.9681602395076261);
-        quad_points.push_back(0.9681602395076261);
-        quad_points.push_back(-0.3242534234038089);
-        quad_points.push_back(0.3242534234038089);
-        quad_points.push_back(-0.6133714327005904);
-        quad_points.push_back(0.6133714327005904);
-
-        quad_weights.push_back(0.3302393550012598);
-        quad_weights.push_back(0.1806481606948574);
-        quad_weights.push_back(0.1806481606948574);
-        quad_weights.push_back(0.0812743883615744);
-        quad_weights.push_back(0.0812743883615744);
-        quad_weights.push_back(0.3123470770400029);
-        quad_weights.push_back(0.3123470770400029);
-        quad_weights.push_back(0.2606106964029354);
-        quad_weights.push_back(0.2606106964029354);
-        break;
-
-      case 10:
-        quad_points.push_back(-0.1488743389816312);
-        quad_points.push_back(0.1488743389816312);
-        quad_points.push_back(-0.4333953941292472);
-        quad_points.push_back(0.4333953941292472);
-        quad_points.push_back(-0.6794095682990244);
-        quad_points.push_back(0.6794095682990244);
-        quad_points.push_back(-0.8650633666889845);
-        quad_points.push_back(0.8650633666889845);
-        quad_points.push_back(-0.9739065285171717);
-        quad_points.push_back(0.9739065285171717);
-
-        quad_weights.push_back(0.2955242247147529);
-        quad_weights.push_back(0.2955242247147529);
-        quad_weights.push_back(0.2692667193099963);
-        quad_weights.push_back(0.2692667193099963);
-        quad_weights.push_back(0.2190863625159820);
-        quad_weights.push_back(0.2190863625159820);
-        quad_weights.push_back(0.1494513491505806);
-        quad_weights.push_back(0.1494513491505806);
-        quad_weights.push_back(0.0666713443086881);
-        quad_weights.push_back(0.0666713443086881);
-        break;
-
-      default:
         std::cerr << "Warning: " << num_quad_points << " quadrature points "
                   << "is not supported" << std::endl;
         std::cerr << "    using default value of n = 10" << std::endl;
 
         num_quad_points = 10;
-        set_up_quadrature();
-    } 
+    }
 
-    assert(quad_points.size() == num_quad_points);
-    assert(quad_points.size() == quad_weights.size());   
+    rule = get_rule(num_quad_points);
+    assert(rule != NULL);
+}
+//---------------------------------------------------------------------------//
+const Quadrature::Rule* Quadrature::get_rule(unsigned int n)
+{
+    assert(n > 0);
+
+    Rule* rule = NULL;
+
+#ifdef _OPENMP
+    #pragma omp critical(quadrature_rules)
+#endif
+    {
+        // process-wide cache of rules, which are never changed once generated
+        static std::map<unsigned int, Rule> rules;
+        rule = &rules[n];
+
+        if (rule->storage.empty())
+        {
+            // allocate both arrays with room to align each one to 64 bytes
+            unsigned int padded_n = (n + 7) / 8 * 8;
+            rule->storage.assign(2 * padded_n + 8, 0.0);
+
+            double* start = &rule->storage[0];
+            std::size_t offset = reinterpret_cast<std::size_t>(start) % 64;
+            double* points = start + (64 - offset) % 64 / sizeof(double);
+            double* weights = points + padded_n;
+
+            // find roots of the Legendre polynomial P_n in pairs (-x, x)
+            const double PI = 3.14159265358979323846;
+
+            for (unsigned int i = 0; i < (n + 1) / 2; ++i)
+            {
+                // initial approximation to the ith largest root
+                double x = cos(PI * (i + 0.75) / (n + 0.5));
+                double value = 0.0;
+                double derivative = 1.0;
+
+                // update x using Newton's method until it converges
+                for (int iteration = 0; iteration < 100; ++iteration)
+                {
+                    evaluate_legendre(n, x, value, derivative);
+                    double dx = value / derivative;
+                    x -= dx;
+
+                    if (fabs(dx) < 1e-15) break;
+                }
+
+                // weight depends on the derivative at the final root
+                evaluate_legendre(n, x, value, derivative);
+
+                // store points in increasing order with symmetric weights
+                double weight = 2.0 / ((1.0 - x * x) * derivative * derivative);
+                points[i] = -x;
+                points[n - 1 - i] = x;
+                weights[i] = weight;
+                weights[n - 1 - i] = weight;
+            }
+
+            rule->points = points;
+            rule->weights = weights;
+        }
+    }
+
+    return rule;
 }
 //---------------------------------------------------------------------------//
 
@@ -28,6 +28,20 @@ class Function
      * \return f(x)
      */
     virtual double evaluate(double x) const = 0;
+
+    /**
+     * \brief Evaluate this Function f for several values at once
+     * \param[in] x array of n values at which f will be evaluated
+     * \param[in] n the number of values
+     * \param[out] values array of size n that will store f(x) for each value
+     *
+     * The default implementation calls evaluate() for each value.  Derived
+     * classes may override this method to evaluate all values at once, which
+     * is how the Quadrature class evaluates a Function.
+     */
+    virtual void evaluate_batch(const double* x,
+                                unsigned int n,
+                                double* values) const;
 };
 
 //===========================================================================//
@@ -41,9 +55,27 @@ class Function
  *
  * NOTE: Polynomials of order 2n - 1 or less are integrated exactly by an
  * n-point Quadrature.  However, the quadrature points and weights are only
- * exact to 16 significant figures.  This may limit the final accuracy of
- * the results due to floating point arithmetic.  Use a higher order
+ * exact to about 16 significant figures.  This may limit the final accuracy
+ * of the results due to floating point arithmetic.  Use a higher order
  * Quadrature if you need more accuracy.
+ *
+ * ====================
+ * Gauss-Legendre Rules
+ * ====================
+ *
+ * The points and weights for an n-point Quadrature are generated the first
+ * time that n points are requested, by using Newton iteration to find the
+ * roots of the Legendre polynomial of degree n.  Any number of points can be
+ * used.  Each rule is then stored in a process-wide cache that is shared by
+ * every Quadrature object, so that creating a Quadrature or changing its
+ * quadrature set only needs to look up the rule.  Rules in the cache are never
+ * changed, which means that the same rule can be used by several threads.
+ *
+ * The points and weights of each rule are stored as two separate arrays that
+ * are aligned to 64 bytes.  The integrate() method maps blocks of up to 64
+ * points onto the integration limits using vector instructions, then calls
+ * Function::evaluate_batch() to evaluate the Function for the whole block at
+ * once.  No memory is allocated by integrate().
  */
 //===========================================================================//
 class Quadrature
@@ -77,17 +109,48 @@ class Quadrature
      */
     unsigned int get_num_quad_points() const;
 
+    /**
+     * \brief get_quad_points(), get_quad_weights()
+     * \return pointer to the array of quadrature points or weights
+     *
+     * Provides direct access to the quadrature points on [-1, 1] and their
+     * weights, which are sorted by point in increasing order.  Both arrays
+     * are aligned to 64 bytes and shared by all Quadrature objects that use
+     * the same number of points.
+     */
+    const double* get_quad_points() const;
+    const double* get_quad_weights() const;
+
   private:
+    // Points and weights of one Gauss-Legendre rule
+    struct Rule
+    {
+        // stores both arrays, with padding to align each one
+        std::vector<double> storage;
+        const double* points;
+        const double* weights;
+    };
+
     unsigned int num_quad_points;
-    std::vector<double> quad_points;
-    std::vector<double> quad_weights;
+    const Rule* rule;
 
     // >>> PRIVATE METHODS
 
     /**
      * \brief Set up the quadrature points and weights for this Quadrature
+     *
+     * Uses the default value of n = 10 if num_quad_points is not valid.
      */
     void set_up_quadrature();
+
+    /**
+     * \brief Gets the Gauss-Legendre rule with n points from the cache
+     * \param[in] n the number of quadrature points (n > 0)
+     * \return pointer to the rule, which remains valid for the whole program
+     *
+     * Generates the rule and adds it to the cache if it does not exist yet.
+     */
+    static const Rule* get_rule(unsigned int n);
 };
 
 #endif // DAGMC_QUADRATURE_HPP
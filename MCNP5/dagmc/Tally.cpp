@@ -1,10 +1,12 @@
 // MCNP5/dagmc/Tally.cpp
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <cmath>
 
 #include "Tally.hpp"
+#include "TallyEvent.hpp"
 #include "TrackLengthMeshTally.hpp"
 #include "KDEMeshTally.hpp"
 #include "CellTally.hpp"
@@ -89,6 +91,18 @@ Tally *Tally::create_tally(const TallyInput& input)
 //---------------------------------------------------------------------------//
 // PUBLIC INTERFACE
 //---------------------------------------------------------------------------//
+void Tally::compute_scores(const TallyEventBatch& batch)
+{
+    // reuse a single TallyEvent for all events in the batch
+    TallyEvent event;
+
+    for (unsigned int i = 0; i < batch.size(); ++i)
+    {
+        batch.get_event(i, event);
+        compute_score(event);
+    }
+}
+//---------------------------------------------------------------------------//
 void Tally::end_history()
 {
     data->end_history();
@@ -104,6 +118,16 @@ std::string Tally::get_tally_type()
     return input_data.tally_type;
 }
 //---------------------------------------------------------------------------//
+bool Tally::is_thread_safe() const
+{
+    return false;
+}
+//---------------------------------------------------------------------------//
+void Tally::set_num_threads(unsigned int num_threads)
+{
+    data->set_num_threads(num_threads);
+}
+//---------------------------------------------------------------------------//
 // PROTECTED INTERFACE
 //---------------------------------------------------------------------------//
 bool Tally::get_energy_bin(double energy, unsigned int& ebin)
@@ -121,21 +145,16 @@ bool Tally::get_energy_bin(double energy, unsigned int& ebin)
         }
         else  // in bounds and more than one energy bin
         {
-            unsigned int max_ebound = input_data.energy_bin_bounds.size() - 1;
+            const std::vector<double>& bounds = input_data.energy_bin_bounds;
+            unsigned int max_ebound = bounds.size() - 1;
 
-            // Pre-load ebin with maximum bin as default
-            ebin =  max_ebound - 1;
+            // find first boundary above energy; bins are [lower, upper)
+            std::vector<double>::const_iterator it;
+            it = std::upper_bound(bounds.begin(), bounds.end(), energy);
+            ebin = (it - bounds.begin()) - 1;
 
-            // find ebin if not maximum bin
-	    for (unsigned int i=0; i < max_ebound; ++i)
-            {
-                if (input_data.energy_bin_bounds.at(i) <= energy &&
-                    energy < input_data.energy_bin_bounds.at(i+1))
-                {
-                    ebin = i;
-		    break;
-                }
-            }  // end for
+            // energy equal to maximum boundary belongs to the maximum bin
+            if (ebin >= max_ebound) ebin = max_ebound - 1;
         }  // end else in bounds and >1 energy bin
     }  // end if in bounds
 
@@ -11,6 +11,7 @@
 
 // Forward declare because it's only referenced here
 struct TallyEvent;
+struct TallyEventBatch;
 
 //===========================================================================//
 /**
@@ -72,6 +73,11 @@ struct TallyInput
  * sufficient for most Tally objects that use the TallyData structure for
  * storing their data.  If a different data structure is used, or alternative
  * behavior is desired, then Derived classes can override this method.
+ *
+ * Tally also provides a default compute_scores(const TallyEventBatch& batch)
+ * method that calls compute_score() once for every event in the batch.
+ * Derived classes can override this method to score a whole batch of events
+ * at once, avoiding the per-event virtual call and TallyEvent copy.
  */
 //===========================================================================//
 class Tally
@@ -108,6 +114,15 @@ class Tally
      */
     virtual void compute_score(const TallyEvent& event) = 0;
 
+    /**
+     * \brief Computes scores for this Tally based on a batch of events
+     * \param[in] batch the parameters needed to compute the scores
+     *
+     * The default implementation copies each event in the batch into a
+     * TallyEvent and calls compute_score() for it.
+     */
+    virtual void compute_scores(const TallyEventBatch& batch);
+
     /**
      * \brief Updates Tally when a particle history ends
      */
@@ -136,6 +151,25 @@ class Tally
      */
     virtual std::string get_tally_type();
 
+    /**
+     * \brief Check if this Tally can score events from multiple threads
+     * \return true if compute_score() and end_history() are thread-safe
+     *
+     * The default is false, which means the TallyManager will only allow
+     * one thread at a time to compute scores for this Tally.
+     */
+    virtual bool is_thread_safe() const;
+
+    /**
+     * \brief Sets the number of threads that can compute scores for this Tally
+     * \param[in] num_threads the number of threads (must be at least 1)
+     *
+     * The default only sets the number of threads for the TallyData.  Tally
+     * implementations that need a workspace for each thread should override
+     * this method to set up their workspaces as well.
+     */
+    virtual void set_num_threads(unsigned int num_threads);
+
   protected:
     /// Input data defined by user for this tally
     TallyInput input_data;
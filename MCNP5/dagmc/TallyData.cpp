@@ -2,6 +2,10 @@
 
 #include <cassert>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "TallyData.hpp"
 
 //---------------------------------------------------------------------------//
@@ -33,6 +37,9 @@ TallyData::TallyData(unsigned int num_energy_bins, bool total_energy_bin)
     }
     
     this->num_tally_points = 0;
+
+    // store scratch data for a single thread by default
+    scratch.resize(1);
 }
 //---------------------------------------------------------------------------//
 // PUBLIC INTERFACE
@@ -66,6 +73,8 @@ double* TallyData::get_error_data(int& length)
 //---------------------------------------------------------------------------//
 double* TallyData::get_scratch_data(int& length)
 {
+    std::vector<double>& temp_tally_data = scratch[0].temp_tally_data;
+
     assert(temp_tally_data.size() != 0);
     length = temp_tally_data.size();
     return &(temp_tally_data[0]);
@@ -75,7 +84,16 @@ void TallyData::zero_tally_data()
 {
     std::fill(tally_data.begin(), tally_data.end(), 0);
     std::fill(error_data.begin(), error_data.end(), 0);
-    std::fill(temp_tally_data.begin(), temp_tally_data.end(), 0);
+
+    for (unsigned int i = 0; i < scratch.size(); ++i)
+    {
+        std::vector<double>& temp_tally_data = scratch[i].temp_tally_data;
+        std::vector<char>& visited_flags = scratch[i].visited_flags;
+
+        std::fill(temp_tally_data.begin(), temp_tally_data.end(), 0);
+        std::fill(visited_flags.begin(), visited_flags.end(), 0);
+        scratch[i].visited_this_history.clear();
+    }
 }
 //---------------------------------------------------------------------------//
 void TallyData::resize_data_arrays(unsigned int tally_points)
@@ -86,7 +104,11 @@ void TallyData::resize_data_arrays(unsigned int tally_points)
 
     tally_data.resize(new_size, 0);
     error_data.resize(new_size, 0);
-    temp_tally_data.resize(new_size, 0);
+
+    for (unsigned int i = 0; i < scratch.size(); ++i)
+    {
+        resize_scratch(scratch[i]);
+    }
 }
 //---------------------------------------------------------------------------//
 unsigned int TallyData::get_num_energy_bins() const
@@ -99,31 +121,72 @@ bool TallyData::has_total_energy_bin() const
     return total_energy_bin;
 }
 //---------------------------------------------------------------------------//
+void TallyData::set_num_threads(unsigned int num_threads)
+{
+    assert(num_threads >= 1);
+    scratch.resize(num_threads);
+
+    // new threads need scratch data of the same size as existing threads
+    for (unsigned int i = 0; i < num_threads; ++i)
+    {
+        resize_scratch(scratch[i]);
+    }
+}
+//---------------------------------------------------------------------------//
+unsigned int TallyData::get_num_threads() const
+{
+    return scratch.size();
+}
+//---------------------------------------------------------------------------//
+unsigned int TallyData::get_thread_id()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+//---------------------------------------------------------------------------//
 // TALLY ACTION METHODS
 //---------------------------------------------------------------------------//
 void TallyData::end_history()
 {
-    std::set<unsigned int>::iterator it;
+    HistoryScratch& thread_scratch = scratch.at(get_thread_id());
+    std::vector<double>& temp_tally_data = thread_scratch.temp_tally_data;
+    std::vector<char>& visited_flags = thread_scratch.visited_flags;
+    std::vector<unsigned int>& visited_this_history = thread_scratch.visited_this_history;
 
     // add sum of scores for this history to mesh tally for each tally point
-    for (it = visited_this_history.begin(); it != visited_this_history.end(); ++it)
+    for (unsigned int i = 0; i < visited_this_history.size(); ++i)
     {
+        unsigned int tally_point_index = visited_this_history[i];
+        visited_flags[tally_point_index] = 0;
+
         for (unsigned int j = 0; j < num_energy_bins; ++j)
         {
-            int index = (*it) * num_energy_bins + j;
+            int index = tally_point_index * num_energy_bins + j;
             double& history_score = temp_tally_data.at(index);
             double& tally         = tally_data.at(index); 
             double& error         = error_data.at(index);
+            double  error_score   = history_score * history_score;
 
+            // other threads may be ending histories for the same tally point
+#ifdef _OPENMP
+            #pragma omp atomic
+#endif
             tally += history_score;
-            error += history_score * history_score;
+
+#ifdef _OPENMP
+            #pragma omp atomic
+#endif
+            error += error_score;
 
             // reset temp_tally_data array for the next particle history
             history_score = 0;
         }
     }
 
-    // reset set of tally points for next particle history
+    // reset list of tally points for next particle history
     visited_this_history.clear();
 }
 //---------------------------------------------------------------------------//
@@ -134,6 +197,9 @@ void TallyData::add_score_to_tally(unsigned int tally_point_index,
     assert(tally_point_index < num_tally_points);
     assert(energy_bin < num_energy_bins);
 
+    HistoryScratch& thread_scratch = scratch.at(get_thread_id());
+    std::vector<double>& temp_tally_data = thread_scratch.temp_tally_data;
+
     // update tally for this history with new score
     int index = tally_point_index * num_energy_bins + energy_bin;;
     temp_tally_data.at(index) += score; 
@@ -145,7 +211,36 @@ void TallyData::add_score_to_tally(unsigned int tally_point_index,
         temp_tally_data.at(index) += score;
     }
 
-    visited_this_history.insert(tally_point_index);
+    // only record each tally point once per history
+    char& visited = thread_scratch.visited_flags[tally_point_index];
+
+    if (!visited)
+    {
+        visited = 1;
+        thread_scratch.visited_this_history.push_back(tally_point_index);
+    }
+}
+//---------------------------------------------------------------------------//
+// PRIVATE METHODS
+//---------------------------------------------------------------------------//
+void TallyData::resize_scratch(HistoryScratch& thread_scratch)
+{
+    thread_scratch.temp_tally_data.resize(tally_data.size(), 0);
+    thread_scratch.visited_flags.resize(num_tally_points, 0);
+
+    // discard visited tally points that were removed by resizing
+    std::vector<unsigned int>& visited = thread_scratch.visited_this_history;
+    unsigned int num_visited = 0;
+
+    for (unsigned int i = 0; i < visited.size(); ++i)
+    {
+        if (visited[i] < num_tally_points)
+        {
+            visited[num_visited++] = visited[i];
+        }
+    }
+
+    visited.resize(num_visited);
 }
 //---------------------------------------------------------------------------//
 
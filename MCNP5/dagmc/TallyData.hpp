@@ -4,7 +4,6 @@
 #define DAGMC_TALLY_DATA_HPP
 
 #include <vector>
-#include <set>
 #include <utility>
 
 /**
@@ -19,6 +18,10 @@
  *    2) error_data: stores data needed to determine error in tally results
  *    3) temp_tally_data: stores sum of scores for a single history
  *
+ * Only one copy of the tally_data and error_data arrays exists, but a separate
+ * temp_tally_data array is stored for every thread that is scoring particle
+ * histories (see Threaded Tallies below).
+ *
  * Each element in these data arrays represents one tally point and one energy
  * bin.  They are ordered first by tally point, and then by energy bin.
  *
@@ -42,6 +45,23 @@
  * are needed, then get_tally_data(), get_error_data() and get_scratch_data()
  * can be used instead.  However, most functionality can be implemented through
  * use of other TallyData methods and direct access is not typically needed.
+ *
+ * ================
+ * Threaded Tallies
+ * ================
+ *
+ * By default, TallyData stores the scratch data for one thread.  If particle
+ * histories are tracked by more than one thread, then set_num_threads() must
+ * be called before any scores are added.  Each thread then adds scores to its
+ * own temp_tally_data array and list of visited tally points, which means that
+ * add_score_to_tally() needs no locks.  When end_history() is called, only
+ * the scratch data for the calling thread is added to the shared tally_data
+ * and error_data arrays, using atomic updates for each value.
+ *
+ * The calling thread is identified through get_thread_id(), which returns the
+ * OpenMP thread number when compiled with OpenMP support and 0 otherwise.
+ * Note that get_scratch_data() always returns the scratch data for the first
+ * thread, which should only be accessed when no histories are being tracked.
  */
 class TallyData
 {
@@ -103,10 +123,34 @@ class TallyData
      */
     bool has_total_energy_bin() const;
 
+    /**
+     * \brief Sets the number of threads that can add scores to this TallyData
+     * \param[in] num_threads the number of threads (must be at least 1)
+     *
+     * Stores separate scratch data for each thread.  This method should only
+     * be called when no particle histories are being tracked.
+     */
+    void set_num_threads(unsigned int num_threads);
+
+    /**
+     * \brief get_num_threads()
+     * \return Number of threads that can add scores to this TallyData
+     */
+    unsigned int get_num_threads() const;
+
+    /**
+     * \brief get_thread_id()
+     * \return Index of the calling thread, from 0 to number of threads - 1
+     */
+    static unsigned int get_thread_id();
+
     // >>> TALLY ACTION METHODS
 
     /**
      * \brief Process TallyData when a particle history is completed
+     *
+     * Adds the scratch data for the calling thread to the tally and error
+     * data, then resets it for the next particle history.
      */
     void end_history();
 
@@ -125,11 +169,21 @@ class TallyData
     // Data array for determining error in tally results
     std::vector<double> error_data;
 
-    // Data array for storing sum of scores for a single history
-    std::vector<double> temp_tally_data;
+    // Scratch data for the particle history being tracked by one thread
+    struct HistoryScratch
+    {
+        // Data array for storing sum of scores for a single history
+        std::vector<double> temp_tally_data;
+
+        // flags tally points updated in current history, one per tally point
+        std::vector<char> visited_flags;
+
+        // tally points updated in current history; cleared by end_history()
+        std::vector<unsigned int> visited_this_history;
+    };
 
-    // tally points updated in current history; cleared by end_history()
-    std::set<unsigned int> visited_this_history;
+    // Scratch data for every thread, indexed by get_thread_id()
+    std::vector<HistoryScratch> scratch;
 
     // Number of energy bins implemented in the data arrays
     unsigned int num_energy_bins;
@@ -139,6 +193,16 @@ class TallyData
 
     // Number of tally points = tally_data.size()/num_energy_bins
     unsigned int num_tally_points;
+
+    // >>> PRIVATE METHODS
+
+    /**
+     * \brief Resize scratch data for one thread to match the data arrays
+     * \param[in, out] thread_scratch the scratch data to be resized
+     *
+     * Any visited tally points that no longer exist are discarded.
+     */
+    void resize_scratch(HistoryScratch& thread_scratch);
 };
 
 #endif // DAGMC_TALLY_DATA_HPP
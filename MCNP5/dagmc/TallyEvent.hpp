@@ -23,6 +23,11 @@
  * corresponds to an index in this vector.  This multiplier_id can then be
  * used with get_score_multiplier() to return the product of the appropriate
  * multiplier and the particle_weight.
+ *
+ * Every event is also identified by the number of the particle history in
+ * which it occurred and its index within that history.  These are set by
+ * TallyManager, and can be used by tallies that need random numbers to make
+ * their results independent of how histories are divided between threads.
  */
 //===========================================================================//
 struct TallyEvent
@@ -63,6 +68,12 @@ struct TallyEvent
     /// Energy-dependent tally multipliers: variable with each event
     std::vector<double> multipliers; 
 
+    /// Number of the particle history in which the event occurred
+    unsigned long long int history;
+
+    /// Index of the event within its particle history, starting from zero
+    unsigned int event_index;
+
     /**
      * \brief returns multiplier * particle_weight for the current tally event
      * \param[in] multiplier_index the index of the multipliers vector to access
@@ -84,6 +95,174 @@ struct TallyEvent
     }
 };
 
+//===========================================================================//
+/**
+ * \struct TallyEventBatch
+ * \brief Data structure for passing a batch of events to be tallied
+ *
+ * TallyEventBatch refers to many events of the same type and particle that
+ * are stored in a structure-of-arrays layout, so that a Tally can compute all
+ * of their scores in a single call to Tally::compute_scores().  Event i is
+ * defined by the ith element of each array.  The arrays are not owned or
+ * copied by the batch, so they must remain valid while it is being used.
+ *
+ * All batches set x, y, z, particle_energy, particle_weight and current_cell.
+ * Track batches add u, v, w and track_length, whereas collision batches add
+ * total_cross_section.  Arrays that are not needed for the batch type may be
+ * NULL.  Directions in a track batch are assumed to be unit vectors.
+ *
+ * Energy-dependent tally multipliers are found for event i starting at
+ * multipliers[i * multiplier_stride], with num_multipliers values per event.
+ * A multiplier_stride of zero means that all events share the same values.
+ * If num_multipliers is zero, then only the particle weight is used as the
+ * score multiplier.
+ *
+ * All events in a batch belong to the same particle history, and event i has
+ * the index event_index + i within that history.
+ */
+//===========================================================================//
+struct TallyEventBatch
+{
+    /// Type of all events in this batch (COLLISION or TRACK)
+    TallyEvent::EventType type;
+
+    /// Type of particle being tallied: NEUTRON = 1, PHOTON = 2, ELECTRON = 3.
+    unsigned int particle;
+
+    /// Number of events in this batch
+    unsigned int num_events;
+
+    /// Position of particle (x, y, z) for each event
+    const double* x;
+    const double* y;
+    const double* z;
+
+    /// Direction in which particle is traveling (u, v, w) for each event
+    const double* u;
+    const double* v;
+    const double* w;
+
+    /// Energy and weight of particle for each event
+    const double* particle_energy;
+    const double* particle_weight;
+
+    /// Total length of track segment for each event
+    const double* track_length;
+
+    /// Total macroscopic cross section for each event
+    const double* total_cross_section;
+
+    /// Geometric cell in which each event occurred
+    const int* current_cell;
+
+    /// Energy-dependent tally multipliers for each event
+    const double* multipliers;
+    unsigned int num_multipliers;
+    unsigned int multiplier_stride;
+
+    /// Number of the particle history and index of the first event within it
+    unsigned long long int history;
+    unsigned int event_index;
+
+    /**
+     * \brief Constructor
+     */
+    TallyEventBatch() { clear(); }
+
+    /**
+     * \brief size()
+     * \return number of events in this batch
+     */
+    unsigned int size() const
+    {
+        return num_events;
+    }
+
+    /**
+     * \brief Removes all events from this batch
+     */
+    void clear()
+    {
+        type = TallyEvent::NONE;
+        particle = 0;
+        num_events = 0;
+        x = y = z = NULL;
+        u = v = w = NULL;
+        particle_energy = NULL;
+        particle_weight = NULL;
+        track_length = NULL;
+        total_cross_section = NULL;
+        current_cell = NULL;
+        multipliers = NULL;
+        num_multipliers = 0;
+        multiplier_stride = 0;
+        history = 0;
+        event_index = 0;
+    }
+
+    /**
+     * \brief returns multiplier * particle_weight for the ith event
+     * \param[in] i the index of the event in this batch
+     * \param[in] multiplier_index the index of the multiplier to access
+     * \return the score multiplier
+     *
+     * Note that if the multiplier_index is invalid or the tally does not use
+     * multipliers, then only the particle weight will be returned.
+     */
+    double get_score_multiplier(unsigned int i, int multiplier_index) const
+    {
+        int size = num_multipliers;
+
+        if (multiplier_index <= -1 || multiplier_index >= size)
+        {
+            return particle_weight[i];
+        }
+
+        return multipliers[i * multiplier_stride + multiplier_index] *
+               particle_weight[i];
+    }
+
+    /**
+     * \brief Copies the ith event in this batch into a TallyEvent
+     * \param[in] i the index of the event in this batch
+     * \param[out] event the TallyEvent to be overwritten
+     */
+    void get_event(unsigned int i, TallyEvent& event) const
+    {
+        event.type = type;
+        event.particle = particle;
+        event.current_cell = current_cell[i];
+        event.position = moab::CartVect(x[i], y[i], z[i]);
+        event.particle_energy = particle_energy[i];
+        event.particle_weight = particle_weight[i];
+        event.history = history;
+        event.event_index = event_index + i;
+
+        if (type == TallyEvent::TRACK)
+        {
+            event.direction = moab::CartVect(u[i], v[i], w[i]);
+            event.track_length = track_length[i];
+            event.total_cross_section = 0.0;
+        }
+        else
+        {
+            event.direction = moab::CartVect(0.0, 0.0, 0.0);
+            event.track_length = 0.0;
+            event.total_cross_section = total_cross_section[i];
+        }
+
+        if (num_multipliers > 0)
+        {
+            const double* first = multipliers + i * multiplier_stride;
+            event.multipliers.assign(first, first + num_multipliers);
+        }
+        else
+        {
+            event.multipliers.clear();
+        }
+    }
+};
+
 #endif // DAGMC_TALLY_EVENT_HPP
 
 // end of MCNP5/dagmc/TallyEvent.hpp
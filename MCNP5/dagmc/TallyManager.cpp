@@ -1,5 +1,7 @@
 // MCNP5/dagmc/TallyManager.cpp
 
+#include <cassert>
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
 
@@ -9,9 +11,14 @@
 //---------------------------------------------------------------------------//
 // CONSTRUCTOR
 //---------------------------------------------------------------------------//
-TallyManager::TallyManager() 
+TallyManager::TallyManager()
+    : num_threads(1), histories_ended(1, 0), counted_history_used(false)
 {
-    event.type = TallyEvent::NONE;
+    events.resize(1);
+    unit_directions.resize(1);
+    events[0].type = TallyEvent::NONE;
+    events[0].history = 0;
+    events[0].event_index = 0;
 }
 //---------------------------------------------------------------------------//
 // PUBLIC INTERFACE
@@ -27,7 +34,15 @@ void TallyManager::addNewTally(unsigned int tally_id,
 
     if (newTally != NULL)
     {
+        newTally->set_num_threads(num_threads);
         observers.insert(std::pair<int, Tally*>(tally_id, newTally));   
+
+#ifdef _OPENMP
+        if (tally_locks.find(tally_id) == tally_locks.end())
+        {
+            omp_init_lock(&tally_locks[tally_id]);
+        }
+#endif
     }
     else
     {
@@ -39,9 +54,14 @@ void TallyManager::addNewMultiplier(unsigned int multiplier_id)
 {
     // pad multipliers vector up to a size one greater than the multiplier_id
     // NOTE: this would not be needed if we use an unordered map over a vector
-    while (event.multipliers.size() <= multiplier_id)
+    for (unsigned int i = 0; i < events.size(); ++i)
     {
-        event.multipliers.push_back(1.0);
+        std::vector<double>& multipliers = events[i].multipliers;
+
+        while (multipliers.size() <= multiplier_id)
+        {
+            multipliers.push_back(1.0);
+        }
     }
 }
 //---------------------------------------------------------------------------//
@@ -51,7 +71,7 @@ void TallyManager::addMultiplierToTally(unsigned int multiplier_id,
     std::map<int, Tally *>::iterator it;	
     it = observers.find(tally_id);
 
-    if (event.multipliers.size() > multiplier_id && it != observers.end())
+    if (events[0].multipliers.size() > multiplier_id && it != observers.end())
     {
         Tally *tally = it->second;  
         tally->input_data.multiplier_id = multiplier_id;
@@ -65,6 +85,8 @@ void TallyManager::addMultiplierToTally(unsigned int multiplier_id,
 //---------------------------------------------------------------------------//
 void TallyManager::updateMultiplier(unsigned int multiplier_id, double value)
 {
+    TallyEvent& event = getEvent();
+
     if (event.multipliers.size() > multiplier_id)
     {
         event.multipliers.at(multiplier_id) = value; 
@@ -86,6 +108,11 @@ void TallyManager::removeTally(unsigned int tally_id)
         // release memory allocated to Tally and remove it from the map
         delete it->second;
         observers.erase(it);
+
+#ifdef _OPENMP
+        omp_destroy_lock(&tally_locks[tally_id]);
+        tally_locks.erase(tally_id);
+#endif
     }
     else
     {
@@ -135,6 +162,8 @@ bool TallyManager::setTrackEvent(unsigned int particle,
 //---------------------------------------------------------------------------//
 void TallyManager::clearLastEvent()
 {
+    TallyEvent& event = getEvent();
+
     event.type = TallyEvent::NONE;
     event.particle  = 0;
     event.position  = moab::CartVect(0.0, 0.0, 0.0);
@@ -149,28 +178,96 @@ void TallyManager::clearLastEvent()
 // Note: the event is set just before updateTallies is called
 void TallyManager::updateTallies()
 {
+    TallyEvent& event = getEvent();
+    if (event.history == 0) setCountedHistory(event);
+
     std::map<int, Tally*>::iterator map_it;
     for (map_it = observers.begin(); map_it != observers.end(); ++map_it)
     {
         Tally *tally = map_it->second;
 
         // skip events involving particles not expected by the tally
-        if (tally->input_data.particle == event.particle)
-        { 
-           tally->compute_score(event);
+        if (tally->input_data.particle != event.particle) continue;
+
+        if (tally->is_thread_safe())
+        {
+            tally->compute_score(event);
+        }
+        else // only one thread at a time can compute scores
+        {
+            lockTally(map_it->first);
+            tally->compute_score(event);
+            unlockTally(map_it->first);
         }
     }
+    ++event.event_index;
     clearLastEvent();
 }
 //---------------------------------------------------------------------------//
+unsigned int TallyManager::scoreTrackEvents(unsigned int particle,
+                                            unsigned int num_events,
+                                            const double* x, const double* y,
+                                            const double* z, const double* u,
+                                            const double* v, const double* w,
+                                            const double* particle_energy,
+                                            const double* particle_weight,
+                                            const double* track_length,
+                                            const int* cell_id,
+                                            const double* multipliers)
+{
+    return scoreEventBatch(TallyEvent::TRACK, particle, num_events,
+                           x, y, z, u, v, w,
+                           particle_energy, particle_weight,
+                           track_length, NULL,
+                           cell_id, multipliers);
+}
+//---------------------------------------------------------------------------//
+unsigned int TallyManager::scoreCollisionEvents(unsigned int particle,
+                                                unsigned int num_events,
+                                                const double* x, const double* y,
+                                                const double* z,
+                                                const double* particle_energy,
+                                                const double* particle_weight,
+                                                const double* total_cross_section,
+                                                const int* cell_id,
+                                                const double* multipliers)
+{
+    return scoreEventBatch(TallyEvent::COLLISION, particle, num_events,
+                           x, y, z, NULL, NULL, NULL,
+                           particle_energy, particle_weight,
+                           NULL, total_cross_section,
+                           cell_id, multipliers);
+}
+//---------------------------------------------------------------------------//
+void TallyManager::startHistory(unsigned long long int history)
+{
+    TallyEvent& event = getEvent();
+    event.history = history;
+    event.event_index = 0;
+}
+//---------------------------------------------------------------------------//
 void TallyManager::endHistory()
 {
     std::map<int, Tally*>::iterator map_it;
     for (map_it = observers.begin(); map_it != observers.end(); ++map_it)
     {
         Tally *tally = map_it->second;
-	tally->end_history();
+
+        if (tally->is_thread_safe())
+        {
+            tally->end_history();
+        }
+        else // only one thread at a time can update tally
+        {
+            lockTally(map_it->first);
+            tally->end_history();
+            unlockTally(map_it->first);
+        }
     }
+
+    // the next history is numbered by TallyManager unless it sets its own
+    ++histories_ended.at(TallyData::get_thread_id());
+    startHistory(0);
 }
 //---------------------------------------------------------------------------//
 void TallyManager::writeData(double num_histories)
@@ -183,6 +280,35 @@ void TallyManager::writeData(double num_histories)
     }
 }
 //---------------------------------------------------------------------------//
+void TallyManager::setNumThreads(unsigned int num_threads)
+{
+    assert(num_threads >= 1);
+    this->num_threads = num_threads;
+
+    // new threads start with the same multipliers as the first thread
+    TallyEvent new_event;
+    new_event.type = TallyEvent::NONE;
+    new_event.multipliers = events[0].multipliers;
+    new_event.history = 0;
+    new_event.event_index = 0;
+
+    events.resize(num_threads, new_event);
+    unit_directions.resize(num_threads);
+    histories_ended.resize(num_threads, 0);
+
+    std::map<int, Tally*>::iterator map_it;
+    for (map_it = observers.begin(); map_it != observers.end(); ++map_it)
+    {
+        Tally *tally = map_it->second;
+        tally->set_num_threads(num_threads);
+    }
+}
+//---------------------------------------------------------------------------//
+unsigned int TallyManager::getNumThreads()
+{
+    return num_threads;
+}
+//---------------------------------------------------------------------------//
 // TALLY DATA ACCESS METHODS
 //---------------------------------------------------------------------------//
 // TODO: These will only work if TallyData is used to store all data.
@@ -306,6 +432,8 @@ bool TallyManager::setEvent(TallyEvent::EventType type, unsigned int particle,
                            double track_length, double total_cross_section,
                            int cell_id) 
 {
+    TallyEvent& event = getEvent();
+
     // Test whether an error condition has occurred for this event
     bool errflag = false;
 
@@ -359,5 +487,221 @@ bool TallyManager::setEvent(TallyEvent::EventType type, unsigned int particle,
     return event_is_set;
 }
 //---------------------------------------------------------------------------//
+unsigned int TallyManager::scoreEventBatch(TallyEvent::EventType type,
+                                           unsigned int particle,
+                                           unsigned int num_events,
+                                           const double* x, const double* y,
+                                           const double* z, const double* u,
+                                           const double* v, const double* w,
+                                           const double* particle_energy,
+                                           const double* particle_weight,
+                                           const double* track_length,
+                                           const double* total_cross_section,
+                                           const int* cell_id,
+                                           const double* multipliers)
+{
+    TallyEvent& event = getEvent();
+    if (event.history == 0) setCountedHistory(event);
+
+    // Refer to the arrays of event data directly rather than copying them
+    TallyEventBatch batch;
+    batch.type = type;
+    batch.particle = particle;
+    batch.num_events = num_events;
+    batch.x = x;
+    batch.y = y;
+    batch.z = z;
+    batch.u = u;
+    batch.v = v;
+    batch.w = w;
+    batch.particle_energy = particle_energy;
+    batch.particle_weight = particle_weight;
+    batch.track_length = track_length;
+    batch.total_cross_section = total_cross_section;
+    batch.current_cell = cell_id;
+    batch.num_multipliers = event.multipliers.size();
+    batch.history = event.history;
+
+    // Use per-event multipliers if given, otherwise the current values
+    if (multipliers != NULL)
+    {
+        batch.multipliers = multipliers;
+        batch.multiplier_stride = batch.num_multipliers;
+    }
+    else if (batch.num_multipliers > 0)
+    {
+        batch.multipliers = &event.multipliers[0];
+        batch.multiplier_stride = 0;
+    }
+
+    // Score each run of valid events, skipping any events with invalid data
+    unsigned int num_scored = 0;
+    unsigned int first = 0;
+
+    for (unsigned int i = 0; i < num_events; ++i)
+    {
+        if (type == TallyEvent::TRACK && track_length[i] < 0.0)
+        {
+            std::cerr << "Warning: track_length, " << track_length[i]
+                      << ", cannot be less than zero." << std::endl;
+        }
+        else if (type == TallyEvent::COLLISION && total_cross_section[i] < 0.0)
+        {
+            std::cerr << "Warning: total_cross_section, " << total_cross_section[i]
+                      << ", cannot be less than zero." << std::endl;
+        }
+        else if (particle_energy[i] < 0.0)
+        {
+            std::cerr << "Warning: particle_energy, " << particle_energy[i]
+                      << ", cannot be less than zero." << std::endl;
+        }
+        else if (particle_weight[i] < 0.0)
+        {
+            std::cerr << "Warning: particle_weight, " << particle_weight[i]
+                      << ", cannot be less than zero." << std::endl;
+        }
+        else // valid event
+        {
+            continue;
+        }
+
+        num_scored += scoreBatchEvents(batch, first, i);
+        first = i + 1;
+    }
+
+    num_scored += scoreBatchEvents(batch, first, num_events);
+    return num_scored;
+}
+//---------------------------------------------------------------------------//
+unsigned int TallyManager::scoreBatchEvents(const TallyEventBatch& events,
+                                            unsigned int first,
+                                            unsigned int last)
+{
+    if (last <= first) return 0;
+
+    TallyEvent& event = getEvent();
+    unsigned int num_events = last - first;
+
+    // Set up a batch for the events in [first, last)
+    TallyEventBatch batch = events;
+    batch.num_events = num_events;
+    batch.x += first;
+    batch.y += first;
+    batch.z += first;
+    batch.particle_energy += first;
+    batch.particle_weight += first;
+    batch.current_cell += first;
+    batch.multipliers += first * batch.multiplier_stride;
+    batch.event_index = event.event_index;
+
+    if (batch.type == TallyEvent::TRACK)
+    {
+        batch.u += first;
+        batch.v += first;
+        batch.w += first;
+        batch.track_length += first;
+
+        // These should already be normalized, so only copy them if not
+        unsigned int i = 0;
+        while (i < num_events && fabs(batch.u[i] * batch.u[i] +
+                                      batch.v[i] * batch.v[i] +
+                                      batch.w[i] * batch.w[i] - 1.0) < 1e-12)
+        {
+            ++i;
+        }
+
+        if (i < num_events)
+        {
+            std::vector<double>& directions =
+                unit_directions.at(TallyData::get_thread_id());
+            directions.resize(3 * num_events);
+
+            for (i = 0; i < num_events; ++i)
+            {
+                moab::CartVect direction(batch.u[i], batch.v[i], batch.w[i]);
+                direction.normalize();
+
+                directions[i] = direction[0];
+                directions[num_events + i] = direction[1];
+                directions[2 * num_events + i] = direction[2];
+            }
+
+            batch.u = &directions[0];
+            batch.v = &directions[num_events];
+            batch.w = &directions[2 * num_events];
+        }
+    }
+    else
+    {
+        batch.total_cross_section += first;
+    }
+
+    std::map<int, Tally*>::iterator map_it;
+    for (map_it = observers.begin(); map_it != observers.end(); ++map_it)
+    {
+        Tally *tally = map_it->second;
+
+        // skip events involving particles not expected by the tally
+        if (tally->input_data.particle != batch.particle) continue;
+
+        if (tally->is_thread_safe())
+        {
+            tally->compute_scores(batch);
+        }
+        else // only one thread at a time can compute scores
+        {
+            lockTally(map_it->first);
+            tally->compute_scores(batch);
+            unlockTally(map_it->first);
+        }
+    }
+
+    event.event_index += num_events;
+    return num_events;
+}
+//---------------------------------------------------------------------------//
+TallyEvent& TallyManager::getEvent()
+{
+    return events.at(TallyData::get_thread_id());
+}
+//---------------------------------------------------------------------------//
+void TallyManager::setCountedHistory(TallyEvent& event)
+{
+    unsigned int thread_id = TallyData::get_thread_id();
+    event.history = histories_ended.at(thread_id) * num_threads + thread_id + 1;
+
+#ifdef _OPENMP
+    #pragma omp critical(DAGMC_COUNTED_HISTORY)
+#endif
+    {
+        if (!counted_history_used)
+        {
+            std::cerr << "Warning: startHistory() was not called, so history "
+                      << "numbers are counted by each thread." << std::endl;
+            std::cerr << "    Tallies that use random numbers will depend on "
+                      << "the number of threads." << std::endl;
+            counted_history_used = true;
+        }
+    }
+}
+//---------------------------------------------------------------------------//
+void TallyManager::lockTally(int tally_id)
+{
+#ifdef _OPENMP
+    std::map<int, omp_lock_t>::iterator it = tally_locks.find(tally_id);
+    assert(it != tally_locks.end());
+    omp_set_lock(&it->second);
+#endif
+}
+//---------------------------------------------------------------------------//
+void TallyManager::unlockTally(int tally_id)
+{
+#ifdef _OPENMP
+    std::map<int, omp_lock_t>::iterator it = tally_locks.find(tally_id);
+    assert(it != tally_locks.end());
+    omp_unset_lock(&it->second);
+#endif
+}
+//---------------------------------------------------------------------------//
 
 // end of MCNP5/dagmc/TallyManager.cpp
@@ -3,6 +3,10 @@
 #ifndef DAGMC_TALLY_MANAGER_HPP
 #define DAGMC_TALLY_MANAGER_HPP
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "Tally.hpp"
 #include "TallyEvent.hpp"
 
@@ -54,6 +58,13 @@
  * when updateTallies() has updated all of the tallies it will then reset the
  * event data using clearLastEvent().
  *
+ * If the physics code can buffer many events before they need to be scored,
+ * then scoreTrackEvents() or scoreCollisionEvents() can be used instead.
+ * These methods take arrays of event data for a single particle type and
+ * event type, and call compute_scores() once for each active tally.  This
+ * avoids the overhead of setting and dispatching every event individually.
+ * Note that all events in a batch are assumed to belong to the same history.
+ *
  * As each particle history is completed, the endHistory() method should be
  * called through the TallyManager.  This adds the current sum of scores to
  * the total for each tally that is currently active.  It is also important
@@ -65,6 +76,23 @@
  * relative standard errors to an output file.  These results are typically
  * normalized by the number of histories reported by the physics code.
  *
+ * ===============
+ * History Numbers
+ * ===============
+ *
+ * Each event is identified by the number of its particle history and its
+ * index within that history, which are used by tallies that need random
+ * numbers (such as KDE sub-track tallies) to obtain the same results no
+ * matter how histories are divided between threads or MPI tasks.  The
+ * event index is counted automatically for every event that is scored, and
+ * the physics code should use startHistory() to set its own history number at
+ * the start of each history.  History numbers start from one.
+ *
+ * If startHistory() is not called for a history, then TallyManager numbers
+ * that history itself from the number of histories each thread has ended.
+ * These numbers are unique, but they depend on how histories are divided
+ * between threads, so a warning is printed the first time one is used.
+ *
  * =================
  * Tally Multipliers
  * =================
@@ -79,6 +107,22 @@
  * multiplier ID in the Tally so that it has access to that multiplier during
  * the transport process for computing its scores.  As the multiplier values
  * change, use updateMultiplier() to update their values in the TallyManager.
+ *
+ * ================
+ * Threaded Tallies
+ * ================
+ *
+ * If particle histories are tracked by multiple OpenMP threads, then use
+ * setNumThreads() before any histories are started.  Each thread is given its
+ * own TallyEvent, direction buffer and multiplier values, and each Tally is
+ * given its own per-thread scratch data for the current history through
+ * Tally::set_num_threads().  Cell and mesh tallies all compute their scores
+ * from several threads at the same time, except for KDE mesh tallies during
+ * their adaptive warm-up histories.  Tallies that are not thread-safe
+ * (see Tally::is_thread_safe()) are still supported, but only one thread at a
+ * time is allowed to compute their scores.  Each of these tallies has its own
+ * lock, so different threads can still score different tallies at the same
+ * time.
  */
 //===========================================================================//
 class TallyManager
@@ -188,7 +232,8 @@ class TallyManager
     /**
      *  \brief Reset a tally event
      *
-     *  Sets event type to NONE and clears all event data.
+     *  Sets event type to NONE and clears all event data.  The history number
+     *  and event index are not changed.
      */
     void clearLastEvent();
 
@@ -199,8 +244,80 @@ class TallyManager
      */
     void updateTallies();
 
+    /**
+     * \brief Score a batch of track events for all active DAGMC tallies
+     * \param[in] particle the type of particle to be tallied
+     * \param[in] num_events the number of track events in the batch
+     * \param[in] x, y, z coordinates of the start of each track
+     * \param[in] u, v, w current direction of the particle for each track
+     * \param[in] particle_energy the energy of the particle for each track
+     * \param[in] particle_weight the weight of the particle for each track
+     * \param[in] track_length the length of each track
+     * \param[in] cell_id the unique ID for the current cell of each track
+     * \param[in] multipliers optional multiplier values for each track
+     * \return the number of track events that were scored
+     *
+     * All arrays must have num_events values.  If multipliers is not NULL, it
+     * must contain a value for every multiplier ID for each event, ordered
+     * first by event and then by multiplier ID.  Otherwise the current values
+     * set by updateMultiplier() are used for all events.  Events with invalid
+     * data are skipped with the same warnings as setTrackEvent().
+     *
+     * The arrays are passed to the tallies without being copied, except for
+     * directions that are not unit vectors, which are normalized first.
+     */
+    unsigned int scoreTrackEvents(unsigned int particle,
+                                  unsigned int num_events,
+                                  const double* x, const double* y,
+                                  const double* z, const double* u,
+                                  const double* v, const double* w,
+                                  const double* particle_energy,
+                                  const double* particle_weight,
+                                  const double* track_length,
+                                  const int* cell_id,
+                                  const double* multipliers = NULL);
+
+    /**
+     * \brief Score a batch of collision events for all active DAGMC tallies
+     * \param[in] particle the type of particle to be tallied
+     * \param[in] num_events the number of collision events in the batch
+     * \param[in] x, y, z coordinates of each collision point
+     * \param[in] particle_energy the energy of the particle for each collision
+     * \param[in] particle_weight the weight of the particle for each collision
+     * \param[in] total_cross_section the macroscopic cross section for each cell
+     * \param[in] cell_id the unique ID for the current cell of each collision
+     * \param[in] multipliers optional multiplier values for each collision
+     * \return the number of collision events that were scored
+     *
+     * See scoreTrackEvents() for the layout of the multipliers array.  Events
+     * with invalid data are skipped with the same warnings as
+     * setCollisionEvent().
+     */
+    unsigned int scoreCollisionEvents(unsigned int particle,
+                                      unsigned int num_events,
+                                      const double* x, const double* y,
+                                      const double* z,
+                                      const double* particle_energy,
+                                      const double* particle_weight,
+                                      const double* total_cross_section,
+                                      const int* cell_id,
+                                      const double* multipliers = NULL);
+
+    /**
+     * \brief Set the number of the history tracked by the calling thread
+     * \param[in] history the history number defined by the physics code
+     *
+     * Also resets the event index so that the next event scored is the first
+     * event in this history.
+     */
+    void startHistory(unsigned long long int history);
+
     /**
      * \brief Call end_history() for all active DAGMC tallies
+     *
+     * Also clears the history number of the calling thread.  If startHistory()
+     * is not called before the next history is scored, then TallyManager
+     * numbers that history itself (see History Numbers above).
      */
     void endHistory();
 
@@ -210,6 +327,20 @@ class TallyManager
      */
     void writeData(double num_histories);
 
+    /**
+     * \brief Set the number of threads that will be used to score events
+     * \param[in] num_threads the maximum number of OpenMP threads
+     *
+     * Multiplier values that have already been set are copied to all threads.
+     */
+    void setNumThreads(unsigned int num_threads);
+
+    /**
+     * \brief Get the number of threads that can be used to score events
+     * \return the number of threads
+     */
+    unsigned int getNumThreads();
+
     // >>> TALLY DATA ACCESS METHODS
 
     /**
@@ -236,11 +367,50 @@ class TallyManager
     // Keep a record of the currently active Tally Observers
     std::map<int, Tally*> observers; 
 
-    // Store event data read by all active DAGMC tallies
-    TallyEvent event;
+    // Number of threads that can be used to score events
+    unsigned int num_threads;
+
+    // Store event data read by all active DAGMC tallies, one per thread
+    std::vector<TallyEvent> events;
+
+    // Unit directions for batches of track events that were not normalized,
+    // stored as (u, v, w) arrays and reused by each thread
+    std::vector<std::vector<double> > unit_directions;
+
+    // Number of histories ended by each thread, used to number histories for
+    // which startHistory() was not called
+    std::vector<unsigned long long int> histories_ended;
+
+    // Whether a history has been numbered by TallyManager yet
+    bool counted_history_used;
+
+#ifdef _OPENMP
+    // Locks for scoring Tally Observers that are not thread-safe, one per Tally
+    std::map<int, omp_lock_t> tally_locks;
+#endif
 
     // >>> PRIVATE METHODS
 
+    /**
+     * \brief lockTally(), unlockTally()
+     * \param[in] tally_id the unique ID of the Tally to lock or unlock
+     *
+     * Used to allow only one thread at a time to compute scores for a Tally
+     * that is not thread-safe.  Does nothing if OpenMP is not enabled.
+     */
+    void lockTally(int tally_id);
+    void unlockTally(int tally_id);
+
+    /**
+     * \brief Sets a history number for the calling thread if none was set
+     * \param[in, out] event the TallyEvent of the calling thread
+     *
+     * If startHistory() was not called for the current history, then the
+     * history after the first n histories ended by thread t is numbered
+     * n * num_threads + t + 1.  Prints a warning the first time this is done.
+     */
+    void setCountedHistory(TallyEvent& event);
+
     /**
      * \brief Create a new DAGMC Tally
      * \param[in] tally_id the unique ID for this Tally
@@ -276,6 +446,56 @@ class TallyManager
                    double particle_energy, double particle_weight,
                    double track_length, double total_cross_section,
                    int cell_id); 
+
+    /**
+     * \brief Sets up TallyEventBatch and calls compute_scores() for all tallies
+     * \param[in] type the type of events to be tallied
+     * \param[in] particle the type of particle to be tallied
+     * \param[in] num_events the number of events in the batch
+     * \param[in] x, y, z the position of the particle for each event
+     * \param[in] u, v, w direction of the particle for each event (TRACK only)
+     * \param[in] particle_energy the energy of the particle for each event
+     * \param[in] particle_weight the weight of the particle for each event
+     * \param[in] track_length the length of each track (TRACK only)
+     * \param[in] total_cross_section the cross section for each event
+     *            (COLLISION only)
+     * \param[in] cell_id the unique ID for the current cell of each event
+     * \param[in] multipliers optional multiplier values for each event
+     * \return the number of events that were scored
+     *
+     * Each run of consecutive valid events is scored by scoreBatchEvents().
+     */
+    unsigned int scoreEventBatch(TallyEvent::EventType type,
+                                 unsigned int particle,
+                                 unsigned int num_events,
+                                 const double* x, const double* y,
+                                 const double* z, const double* u,
+                                 const double* v, const double* w,
+                                 const double* particle_energy,
+                                 const double* particle_weight,
+                                 const double* track_length,
+                                 const double* total_cross_section,
+                                 const int* cell_id,
+                                 const double* multipliers);
+
+    /**
+     * \brief Calls compute_scores() for all tallies on part of a batch
+     * \param[in] events the batch of events defined by scoreEventBatch()
+     * \param[in] first, last the range of events [first, last) to be scored
+     * \return the number of events that were scored
+     *
+     * Only the batch pointers are offset to the first event, with directions
+     * copied into unit_directions if any of them need to be normalized.
+     */
+    unsigned int scoreBatchEvents(const TallyEventBatch& events,
+                                  unsigned int first,
+                                  unsigned int last);
+
+    /**
+     * \brief Get the TallyEvent for the calling thread
+     * \return reference to the TallyEvent
+     */
+    TallyEvent& getEvent();
 };
 
 #endif // DAGMC_TALLY_MANAGER_HPP
@@ -1,10 +1,19 @@
 // MCNP5/dagmc/TrackLengthMeshTally.cpp
 
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <cmath> 
+#include <cstdio>
+#include <cstring>
 #include <set>
 
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "moab/Core.hpp"
 #include "moab/Range.hpp"
 #include "moab/GeomUtil.hpp"
@@ -38,10 +47,36 @@
 // (note: this paramater is ignored by GeomUtil, so don't bother trying to tune it)
 #define TRIANGLE_INTERSECTION_TOL 1e-6
 
-// used to store the intersection data
-struct ray_data {
-  double intersect;
-  moab::EntityHandle triangle;
+// names of the tags on the cached tally mesh set, which store the cache key
+// and the root set of the KD tree
+#define CACHE_KEY_TAG "TLMT_CACHE_KEY"
+#define CACHE_ROOT_TAG "TLMT_KDTREE_ROOT"
+
+// number of bytes at the start and at the end of the input file that are
+// added to the cache key
+#define CACHE_KEY_BYTES 65536
+
+// header of the tet data cache file, followed by the TetRecords at
+// CACHE_DATA_OFFSET and then the tet neighbors
+struct cache_header {
+  char magic[8];         // CACHE_MAGIC, includes the format version
+  uint64_t key;          // cache key of the input file, see compute_cache_key()
+  uint64_t num_tets;
+  uint64_t first_tet;    // handle of the first tet, which fixes all handles
+  uint64_t record_size;  // sizeof(TetRecord)
+  uint64_t handle_size;  // sizeof(EntityHandle)
+};
+
+#define CACHE_MAGIC "DAGTLMT2"
+
+// keeps the TetRecords in the cache file aligned to a cache line
+#define CACHE_DATA_OFFSET 64
+
+// used to match the faces that are shared by two tets
+struct tet_face {
+  moab::EntityHandle verts[3]; // sorted vertex handles
+  moab::EntityHandle tet;      // tet that owns this face
+  unsigned int local_face;     // index of the tet vertex opposite this face
 };
 
 //---------------------------------------------------------------------------//
@@ -49,11 +84,39 @@ struct ray_data {
 //---------------------------------------------------------------------------/
 /* sorting function */
 // used to sort the ray triangle intersection data
-inline static bool compare(const ray_data &a, const ray_data &b)
+inline static bool compare(const moab::ray_data &a, const moab::ray_data &b)
 {
     return a.intersect < b.intersect;
 }
 
+// used to sort tet faces so that shared faces are next to each other
+inline static bool compare_faces(const tet_face &a, const tet_face &b)
+{
+  for( int i = 0; i < 3; ++i )
+  {
+    if( a.verts[i] != b.verts[i] ) return a.verts[i] < b.verts[i];
+  }
+  return false;
+}
+
+inline static bool same_face(const tet_face &a, const tet_face &b)
+{
+  return a.verts[0] == b.verts[0] && a.verts[1] == b.verts[1] &&
+         a.verts[2] == b.verts[2];
+}
+
+// adds the given bytes to a 64-bit FNV-1a hash
+static void hash_bytes(uint64_t& hash, const void* data, size_t size)
+{
+  const uint64_t prime = (static_cast<uint64_t>(0x100) << 32) | 0x1B3;
+  const unsigned char* bytes = static_cast<const unsigned char*>( data );
+
+  for( size_t i = 0; i < size; ++i )
+  {
+    hash = (hash ^ bytes[i]) * prime;
+  }
+}
+
 // Adapted from MOAB's convert.cpp
 // Parse list of integer ranges, e.g. "1,2,5-10,12"
 static bool parse_int_list(const char* string, std::set<int>& results)
@@ -104,14 +167,6 @@ static bool parse_int_list(const char* string, std::set<int>& results)
   return okay;    
 }
 
-/* Tetrahedron volume code taken from MOAB/tools/measure.cpp */
-inline static double tet_volume(const moab::CartVect& v0,
-                                const moab::CartVect& v1,
-                                const moab::CartVect& v2,
-                                const moab::CartVect& v3)
-{
-  return 1./6. * ( ((v1 - v0) * (v2 - v0)) % (v3 - v0) );
-}
 //---------------------------------------------------------------------------//
 static inline bool tris_eq(const moab::EntityHandle *t1,
                            const moab::EntityHandle *t2)
@@ -127,50 +182,105 @@ namespace moab {
 TrackLengthMeshTally::TrackLengthMeshTally(const TallyInput& input)
     : MeshTally(input),
       mb (new moab::Core()),  
+      kdtree(NULL),
       obb_tool(new OrientedBoxTreeTool(mb)),
-      last_visited_tet(0),
-      last_cell(-1),
       convex(false),
-      conformal_surface_source(false)
+      conformal_surface_source(false),
+      walk(false),
+      tet_records(NULL),
+      tet_neighbors(NULL),
+      cache_key(0),
+      cache_map(NULL),
+      cache_map_size(0),
+      workspaces(1)
 {
    std::cout << "Creating dagmc mesh tally" << input.tally_id 
             << ", input: " << input_filename 
             << ", output: " << output_filename << std::endl;
 
    parse_tally_options();
-   set_tally_meshset();
 
-   // reduce the loaded MOAB mesh set to include only 3D elements
-   Range all_tets;
-   ErrorCode rval = reduce_meshset_to_3D(mb, tally_mesh_set, all_tets);  
-   if(rval != MB_SUCCESS)
+   if( !cache_filename.empty() )
+   {
+     cache_key = compute_cache_key();
+     if( cache_key == 0 )
      {
-       std::cout << "Failed to reduce meshset to 3d" << std::endl;
-       exit(1);
+       std::cerr << "Warning: could not read " << input_filename
+                 << ", ignoring tally cache " << cache_filename << std::endl;
+       cache_filename.clear();
      }
-   assert (rval == MB_SUCCESS);
+   }
+
+   // use the mesh and KD tree from the cache if it matches the input file
+   bool cached = !cache_filename.empty() && load_cached_mesh();
+
+   if( !cached )
+   {
+     set_tally_meshset();
+
+     // reduce the loaded MOAB mesh set to include only 3D elements
+     Range all_tets;
+     ErrorCode rval = reduce_meshset_to_3D(mb, tally_mesh_set, all_tets);  
+     if(rval != MB_SUCCESS)
+       {
+         std::cout << "Failed to reduce meshset to 3d" << std::endl;
+         exit(1);
+       }
+     assert (rval == MB_SUCCESS);
+
+     build_trees(all_tets);
+
+     // reload the mesh from a new cache, so that its entity handles are the
+     // same as in later runs that load the cache
+     if( !cache_filename.empty() && save_cached_mesh() )
+     {
+       reset_mesh();
+       cached = load_cached_mesh();
+       if( !cached )
+       {
+         std::cerr << "Error: could not reload tally cache " << cache_filename << std::endl;
+         exit(EXIT_FAILURE);
+       }
+     }
+   }
 
    // initialize MeshTally::tally_points to include all mesh cells
-   set_tally_points(all_tets);
-   // build the kdtree
-   // Does not change all_tets
-   rval = compute_barycentric_data(all_tets);
+   Range all_tets;
+   ErrorCode rval = mb->get_entities_by_dimension(tally_mesh_set, 3, all_tets);
    assert (rval == MB_SUCCESS);
+   set_tally_points(all_tets);
+
+   // map the tet data from the cache, or compute it if it was not saved yet
+   if( !cached || !load_tet_data() )
+   {
+     // Does not change all_tets
+     rval = compute_barycentric_data(all_tets);
+     assert (rval == MB_SUCCESS);
+
+     // adjacency data is always cached, in case a later run uses walk
+     if( walk || cached )
+     {
+       rval = compute_adjacency_data(all_tets);
+       assert (rval == MB_SUCCESS);
+     }
+
+     if( cached ) save_tet_data();
+   }
   
    // Perform tasks
    rval = setup_tags( mb );
    assert (rval == MB_SUCCESS);
-
-   build_trees(all_tets);
-
 }
 //---------------------------------------------------------------------------//
 // DESTRUCTOR
 //---------------------------------------------------------------------------//
 TrackLengthMeshTally::~TrackLengthMeshTally()
 {
-  delete mb;
+  delete kdtree;
   delete obb_tool;
+  delete mb;
+
+  if( cache_map != NULL ) munmap( cache_map, cache_map_size );
 }
 
 //---------------------------------------------------------------------------//
@@ -188,45 +298,30 @@ void TrackLengthMeshTally::compute_score(const TallyEvent& event)
   }
   
   double weight = event.get_score_multiplier(input_data.multiplier_id);
+  TrackWorkspace& workspace = workspaces.at(TallyData::get_thread_id());
+  score_track(event.position, event.direction, event.track_length,
+              ebin, weight, workspace);
+}
+//---------------------------------------------------------------------------//
+void TrackLengthMeshTally::compute_scores(const TallyEventBatch& batch)
+{
+  // If it's not the type we want leave immediately
+  if (batch.type != TallyEvent::TRACK) return;
 
-  std::vector<double> intersections;     // vector of distance to triangular facet intersections
-  std::vector< EntityHandle > triangles; // vector of entityhandles that belong to the triangles hit
-  //  std::vector<ray_data> hit_information; // vector of reformated ray triangle intersections
-
-  // get all ray-triangle intersections along the ray 
-  ErrorCode rval = get_all_intersections(event.position,event.direction,event.track_length,triangles,intersections);
-  if (rval != MB_SUCCESS )
-    {
-      std::cout << "we have a problem finding intersections" << std::endl;
-      exit(1);
-    }
+  TrackWorkspace& workspace = workspaces.at(TallyData::get_thread_id());
 
-  EntityHandle tet; // tet 
-  if( intersections.size() == 0 )
-    // ray is so short it either does not intersect a triangular face, or it inside the mesh
-    // but can't reach
-    {
-       tet = point_in_which_tet(event.position);
-      // if tet value is greater than 0 then in a tet, otherwise not
-      if( tet == 0 )
-	{
-	  return;
-	}
-      else
-	{
-	  // determine tracklength to return
-          add_score_to_mesh_tally(tet, weight, event.track_length, ebin);
-	  //	  found_crossing = true;
-	  return;
-	}
-    }
+  for( unsigned int i = 0; i < batch.size(); ++i )
+  {
+    unsigned int ebin;
+    if( !get_energy_bin(batch.particle_energy[i], ebin) ) continue;
 
-  // sort the intersection data
-  sort_intersection_data(intersections,triangles);
-  // compute the tracklengths
-  compute_tracklengths(event, ebin, weight, intersections, triangles);
+    double weight = batch.get_score_multiplier(i, input_data.multiplier_id);
 
-  return;
+    CartVect position( batch.x[i], batch.y[i], batch.z[i] );
+    CartVect direction( batch.u[i], batch.v[i], batch.w[i] );
+    score_track(position, direction, batch.track_length[i],
+                ebin, weight, workspace);
+  }
 }
 
 
@@ -235,7 +330,20 @@ void TrackLengthMeshTally::compute_score(const TallyEvent& event)
 void TrackLengthMeshTally::end_history () 
 {
   MeshTally::end_history();
-  if( !conformality.empty() ){ last_cell = -1; } 
+  if( !conformality.empty() ){
+    workspaces.at(TallyData::get_thread_id()).last_cell = -1;
+  }
+}
+//---------------------------------------------------------------------------//
+bool TrackLengthMeshTally::is_thread_safe() const
+{
+  return true;
+}
+//---------------------------------------------------------------------------//
+void TrackLengthMeshTally::set_num_threads(unsigned int num_threads)
+{
+  MeshTally::set_num_threads(num_threads);
+  workspaces.resize(num_threads);
 }
 
 //---------------------------------------------------------------------------//
@@ -243,59 +351,22 @@ void TrackLengthMeshTally::write_data(double num_histories)
 {
   ErrorCode rval;
 
-  Range all_tets;
-  rval = mb->get_entities_by_dimension( tally_mesh_set, 3, all_tets );
-  if(rval != MB_SUCCESS )
-    {
-      std::cout << "Failed to get 3d entities" << std::endl;
-      exit(1);
-    }
-  assert( rval == MB_SUCCESS );
-
-  for( Range::const_iterator i=all_tets.begin(); i!=all_tets.end(); ++i){
-    EntityHandle t = *i;
-
-    CartVect v[4];
-
-    std::vector<EntityHandle> vtx;    
-    mb->get_connectivity( &t, 1, vtx );
-    assert( vtx.size() == 4);
-
-    int k = 0;
-    for( std::vector<EntityHandle>::iterator j = vtx.begin(); j!=vtx.end(); ++j)
-    {
-      EntityHandle vertex = *j;
-      mb->get_coords( &vertex, 1, v[k++].array() );
-    }
-
-    double volume = tet_volume( v[0], v[1], v[2], v[3] );
-    unsigned int tet_index = get_entity_index(t);
-
-    for( unsigned j = 0; j < data->get_num_energy_bins(); ++j )
-    {
-      std::pair <double,double> tally_data = data->get_data(tet_index,j);
-      double tally = tally_data.first;
-      double error = tally_data.second;
-      // double tally = get_data( tally_data, t, j );
-      // double error = get_data( error_data, t, j );
-      double score = (tally / (volume*num_histories));
-      
-      rval = mb->tag_set_data( tally_tags[j], &t, 1, &score );
-      assert( rval == MB_SUCCESS );
-
-      // Use 0 as the error output value if nothing has been computed for this mesh cell;
-      // this reflects MCNP's approach to avoiding a divide-by-zero situation.
-      double rel_err = 0;
-      if( error != 0 )
-      {
-        rel_err = sqrt( (error / (tally*tally)) - (1./num_histories) );
-      }        
+  // compute the volume of each tet from its inverse barycentric matrix
+  unsigned int num_tets = tally_points.size();
+  std::vector<double> volumes(num_tets);
 
-      rval = mb->tag_set_data( error_tags[j], &t, 1, &rel_err );
-      assert( rval == MB_SUCCESS );
-    }
+  for( unsigned int i = 0; i < num_tets; ++i )
+  {
+    const double* a = tet_records[i].a_inverse;
+    double det = a[0] * (a[4]*a[8] - a[5]*a[7])
+               - a[1] * (a[3]*a[8] - a[5]*a[6])
+               + a[2] * (a[3]*a[7] - a[4]*a[6]);
+    volumes[i] = 1.0 / (6.0 * det);
   }
 
+  rval = set_result_tags( mb, num_histories, &volumes[0] );
+  assert( rval == MB_SUCCESS );
+
   std::vector<Tag> output_tags = tally_tags;
   output_tags.insert( output_tags.end(), error_tags.begin(), error_tags.end() );
 
@@ -318,6 +389,8 @@ void TrackLengthMeshTally::parse_tally_options()
     else if( key == "tagval" ) tag_values.push_back(val);
     else if( key == "convex" && (val == "t" || val == "true" ) ) convex = true; 
     else if( key == "conf_surf_src" && (val == "t" || val == "true" ) ) conformal_surface_source = true;
+    else if( key == "walk" && (val == "t" || val == "true" ) ) walk = true;
+    else if( key == "cache" ) cache_filename = val;
     else if( key == "conformal" ) 
     { 
       // Since the options are a multimap, the conformal tag could (illogically) occur more than once
@@ -430,10 +503,13 @@ ErrorCode TrackLengthMeshTally::compute_barycentric_data(const Range& all_tets)
   int num_tets = all_tets.size();
   std::cerr << "  There are " << num_tets << " tetrahedrons in this tally mesh." << std::endl;
 
-  if (num_tets != 0)
-  {
-     tet_baryc_data.resize (num_tets);  
-  }
+  // allocate enough memory to align the first record to a cache line
+  const size_t alignment = 64;
+  tet_record_buffer.assign(num_tets * sizeof(TetRecord) + alignment, 0);
+
+  size_t address = reinterpret_cast<size_t>(&tet_record_buffer[0]);
+  size_t offset = (alignment - address % alignment) % alignment;
+  tet_records = reinterpret_cast<TetRecord*>(&tet_record_buffer[offset]);
 
   for( Range::const_iterator i=all_tets.begin(); i!=all_tets.end(); ++i)
   {
@@ -467,11 +543,288 @@ ErrorCode TrackLengthMeshTally::compute_barycentric_data(const Range& all_tets)
 
     Matrix3 a( p[1]-p[0], p[2]-p[0], p[3]-p[0] );
     a = a.transpose().inverse();
-    tet_baryc_data.at( get_entity_index(tet) ) = a;
+
+    TetRecord& record = tet_records[ get_entity_index(tet) ];
+
+    for( int j = 0; j < 3; ++j )
+    {
+      record.v0[j] = p[0][j];
+      for( int k = 0; k < 3; ++k ) record.a_inverse[3*j + k] = a(j,k);
+    }
+  }
+  return MB_SUCCESS;
+}
+//---------------------------------------------------------------------------//
+ErrorCode TrackLengthMeshTally::compute_adjacency_data(const Range& all_tets)
+{
+  ErrorCode rval;
+
+  // collect all four faces of every tet, each defined by its sorted vertices
+  std::vector<tet_face> faces;
+  faces.reserve( 4 * all_tets.size() );
+
+  for( Range::const_iterator i=all_tets.begin(); i!=all_tets.end(); ++i)
+  {
+    const EntityHandle* verts;
+    int num_verts;
+    rval = mb->get_connectivity (*i, verts, num_verts);
+    if( rval != MB_SUCCESS ) return rval;
+    if( num_verts != 4 ) return MB_NOT_IMPLEMENTED;
+
+    for( unsigned int j = 0; j < 4; ++j )
+    {
+      tet_face face;
+      face.tet = *i;
+      face.local_face = j;
+
+      // face j is opposite vertex j
+      int k = 0;
+      for( unsigned int v = 0; v < 4; ++v )
+      {
+        if( v != j ) face.verts[k++] = verts[v];
+      }
+
+      std::sort( face.verts, face.verts + 3 );
+      faces.push_back( face );
+    }
+  }
+
+  std::sort( faces.begin(), faces.end(), compare_faces );
+
+  // faces that are not shared by two tets are on the skin of the mesh
+  tet_neighbor_buffer.assign( 4 * all_tets.size(), 0 );
+  if( tet_neighbor_buffer.empty() ) return MB_SUCCESS;
+  tet_neighbors = &tet_neighbor_buffer[0];
+
+  for( unsigned int i = 0; i + 1 < faces.size(); ++i )
+  {
+    if( same_face(faces[i], faces[i+1]) )
+    {
+      const tet_face& a = faces[i];
+      const tet_face& b = faces[i+1];
+      tet_neighbors[ 4*get_entity_index(a.tet) + a.local_face ] = b.tet;
+      tet_neighbors[ 4*get_entity_index(b.tet) + b.local_face ] = a.tet;
+      ++i;
+    }
   }
+
   return MB_SUCCESS;
 }
 //---------------------------------------------------------------------------//
+uint64_t TrackLengthMeshTally::compute_cache_key() const
+{
+  struct stat file_info;
+  if( stat(input_filename.c_str(), &file_info) != 0 ) return 0;
+
+  std::ifstream file( input_filename.c_str(), std::ios::binary );
+  if( !file ) return 0;
+
+  // 64-bit FNV-1a hash of the file size and modification time, and the
+  // bytes at the start and end of the file, which hold the file header and
+  // the connectivity and coordinates of most small meshes
+  uint64_t key = (static_cast<uint64_t>(0xCBF29CE4) << 32) | 0x84222325;
+  uint64_t file_size = file_info.st_size;
+  uint64_t file_time = file_info.st_mtime;
+  hash_bytes( key, &file_size, sizeof(file_size) );
+  hash_bytes( key, &file_time, sizeof(file_time) );
+
+  std::vector<char> buffer( CACHE_KEY_BYTES );
+  file.read( &buffer[0], buffer.size() );
+  hash_bytes( key, &buffer[0], file.gcount() );
+
+  if( file_size > CACHE_KEY_BYTES )
+  {
+    file.clear();
+    file.seekg( -CACHE_KEY_BYTES, std::ios::end );
+    file.read( &buffer[0], buffer.size() );
+    hash_bytes( key, &buffer[0], file.gcount() );
+  }
+
+  // the tag options choose which tets are in the tally mesh
+  hash_bytes( key, tag_name.c_str(), tag_name.size() + 1 );
+  for( unsigned int i = 0; i < tag_values.size(); ++i )
+  {
+    hash_bytes( key, tag_values[i].c_str(), tag_values[i].size() + 1 );
+  }
+
+  return key;
+}
+//---------------------------------------------------------------------------//
+bool TrackLengthMeshTally::load_cached_mesh()
+{
+  // no cache has been written yet
+  struct stat file_info;
+  if( stat(cache_filename.c_str(), &file_info) != 0 ) return false;
+
+  EntityHandle file_set;
+  ErrorCode rval = mb->create_meshset( MESHSET_SET, file_set );
+  if( rval == MB_SUCCESS ) rval = mb->load_file( cache_filename.c_str(), &file_set );
+
+  // the tally mesh set stores the cache key and the KD tree root
+  Tag key_tag, root_tag;
+  Range sets;
+  uint64_t key = 0;
+
+  if( rval == MB_SUCCESS )
+    rval = mb->tag_get_handle( CACHE_KEY_TAG, sizeof(key), MB_TYPE_OPAQUE, key_tag );
+  if( rval == MB_SUCCESS )
+    rval = mb->tag_get_handle( CACHE_ROOT_TAG, 1, MB_TYPE_HANDLE, root_tag );
+  if( rval == MB_SUCCESS )
+    rval = mb->get_entities_by_type_and_tag( file_set, MBENTITYSET, &key_tag, NULL, 1, sets );
+  if( rval == MB_SUCCESS && sets.size() == 1 )
+  {
+    tally_mesh_set = sets.front();
+    rval = mb->tag_get_data( key_tag, &tally_mesh_set, 1, &key );
+  }
+  if( rval == MB_SUCCESS && key == cache_key )
+    rval = mb->tag_get_data( root_tag, &tally_mesh_set, 1, &kdtree_root );
+
+  if( rval != MB_SUCCESS || key != cache_key )
+  {
+    std::cout << "  Cache " << cache_filename << " does not match the input mesh." << std::endl;
+    reset_mesh();
+    return false;
+  }
+
+  // the KD tree finds its split planes in the tags that were loaded
+  kdtree = new AdaptiveKDTree( mb );
+
+  std::cout << "  Loaded mesh and KD tree from cache " << cache_filename << std::endl;
+  return true;
+}
+//---------------------------------------------------------------------------//
+bool TrackLengthMeshTally::save_cached_mesh()
+{
+  Tag key_tag, root_tag;
+  ErrorCode rval = mb->tag_get_handle( CACHE_KEY_TAG, sizeof(cache_key), MB_TYPE_OPAQUE,
+                                       key_tag, MB_TAG_SPARSE|MB_TAG_CREAT );
+  if( rval == MB_SUCCESS )
+    rval = mb->tag_get_handle( CACHE_ROOT_TAG, 1, MB_TYPE_HANDLE,
+                               root_tag, MB_TAG_SPARSE|MB_TAG_CREAT );
+  if( rval == MB_SUCCESS )
+    rval = mb->tag_set_data( key_tag, &tally_mesh_set, 1, &cache_key );
+  if( rval == MB_SUCCESS )
+    rval = mb->tag_set_data( root_tag, &tally_mesh_set, 1, &kdtree_root );
+
+  // write the whole MOAB instance, including the sets and tags of the KD
+  // tree, to a temporary file first, so that other processes never read a
+  // partially written cache
+  std::stringstream temp_name;
+  temp_name << cache_filename << "." << getpid() << ".tmp";
+
+  if( rval == MB_SUCCESS )
+    rval = mb->write_file( temp_name.str().c_str(), "MOAB" );
+
+  if( rval != MB_SUCCESS || std::rename(temp_name.str().c_str(), cache_filename.c_str()) != 0 )
+  {
+    std::cerr << "Warning: could not write tally cache " << cache_filename << std::endl;
+    std::remove( temp_name.str().c_str() );
+    return false;
+  }
+
+  std::cout << "  Saved mesh and KD tree to cache " << cache_filename << std::endl;
+  return true;
+}
+//---------------------------------------------------------------------------//
+void TrackLengthMeshTally::reset_mesh()
+{
+  delete kdtree;
+  delete obb_tool;
+  delete mb;
+
+  kdtree = NULL;
+  mb = new moab::Core();
+  obb_tool = new OrientedBoxTreeTool(mb);
+}
+//---------------------------------------------------------------------------//
+bool TrackLengthMeshTally::load_tet_data()
+{
+  std::string filename = cache_filename + ".tets";
+  int fd = open( filename.c_str(), O_RDONLY );
+  if( fd < 0 ) return false;
+
+  struct stat file_info;
+  size_t num_tets = tally_points.size();
+  size_t expected_size = CACHE_DATA_OFFSET + num_tets * sizeof(TetRecord)
+                       + 4 * num_tets * sizeof(EntityHandle);
+
+  if( num_tets == 0 || fstat(fd, &file_info) != 0 ||
+      size_t(file_info.st_size) != expected_size )
+  {
+    close( fd );
+    std::cout << "  Cache " << filename << " does not match the input mesh." << std::endl;
+    return false;
+  }
+
+  // the data is never changed, so the pages are shared by all processes
+  // that use the same cache on this node
+  void* map = mmap( NULL, expected_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( map == MAP_FAILED ) return false;
+
+  const cache_header* header = static_cast<const cache_header*>( map );
+
+  if( strncmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->key != cache_key ||
+      header->num_tets != num_tets ||
+      header->first_tet != tally_points.front() ||
+      header->record_size != sizeof(TetRecord) ||
+      header->handle_size != sizeof(EntityHandle) )
+  {
+    munmap( map, expected_size );
+    std::cout << "  Cache " << filename << " does not match the input mesh." << std::endl;
+    return false;
+  }
+
+  cache_map = map;
+  cache_map_size = expected_size;
+
+  char* data = static_cast<char*>( map ) + CACHE_DATA_OFFSET;
+  tet_records = reinterpret_cast<TetRecord*>( data );
+  tet_neighbors = reinterpret_cast<EntityHandle*>( data + num_tets * sizeof(TetRecord) );
+
+  std::cout << "  Loaded tet data from cache " << filename << std::endl;
+  return true;
+}
+//---------------------------------------------------------------------------//
+void TrackLengthMeshTally::save_tet_data()
+{
+  size_t num_tets = tally_points.size();
+  if( num_tets == 0 ) return;
+
+  cache_header header;
+  memset( &header, 0, sizeof(header) );
+  memcpy( header.magic, CACHE_MAGIC, sizeof(header.magic) );
+  header.key = cache_key;
+  header.num_tets = num_tets;
+  header.first_tet = tally_points.front();
+  header.record_size = sizeof(TetRecord);
+  header.handle_size = sizeof(EntityHandle);
+
+  // write to a temporary file first, as for the mesh cache
+  std::string filename = cache_filename + ".tets";
+  std::stringstream temp_name;
+  temp_name << filename << "." << getpid() << ".tmp";
+
+  std::ofstream file( temp_name.str().c_str(), std::ios::binary );
+  std::vector<char> padding( CACHE_DATA_OFFSET - sizeof(header), 0 );
+
+  file.write( reinterpret_cast<const char*>(&header), sizeof(header) );
+  file.write( &padding[0], padding.size() );
+  file.write( reinterpret_cast<const char*>(tet_records), num_tets * sizeof(TetRecord) );
+  file.write( reinterpret_cast<const char*>(tet_neighbors), 4 * num_tets * sizeof(EntityHandle) );
+  file.close();
+
+  if( !file || std::rename(temp_name.str().c_str(), filename.c_str()) != 0 )
+  {
+    std::cerr << "Warning: could not write tally cache " << filename << std::endl;
+    std::remove( temp_name.str().c_str() );
+    return;
+  }
+
+  std::cout << "  Saved tet data to cache " << filename << std::endl;
+}
+//---------------------------------------------------------------------------//
 void TrackLengthMeshTally::build_trees (Range& all_tets)
 {
   // prepare to build KD tree and OBB tree
@@ -492,37 +845,203 @@ void TrackLengthMeshTally::build_trees (Range& all_tets)
 }
 //---------------------------------------------------------------------------//
 bool TrackLengthMeshTally::point_in_tet(const CartVect& point,
-                                        const EntityHandle* tet)
+                                        const EntityHandle* tet) const
 { 
-  ErrorCode rval;
-                    
-  const EntityHandle* verts;
-  int num_verts;
-  rval = mb->get_connectivity( *tet, verts, num_verts );
-  if(rval != MB_SUCCESS)
+  const TetRecord& record = tet_records[ get_entity_index(*tet) ];
+  const double* a = record.a_inverse;
+
+  double d0 = point[0] - record.v0[0];
+  double d1 = point[1] - record.v0[1];
+  double d2 = point[2] - record.v0[2];
+
+  // barycentric coordinates of the point relative to the first vertex
+  double b0 = a[0]*d0 + a[1]*d1 + a[2]*d2;
+  double b1 = a[3]*d0 + a[4]*d1 + a[5]*d2;
+  double b2 = a[6]*d0 + a[7]*d1 + a[8]*d2;
+
+  bool in_tet = ( b0 >= 0 && b1 >= 0 && b2 >= 0 && b0+b1+b2 <= 1. );
+
+  return in_tet;
+}
+//---------------------------------------------------------------------------//
+void TrackLengthMeshTally::score_track(const CartVect& position,
+                                       const CartVect& direction,
+                                       double length,
+                                       unsigned int ebin, double weight,
+                                       TrackWorkspace& workspace)
+{
+  // walk the track through the mesh if requested; this only fails to score
+  // the whole track if it starts outside the mesh or leaves a non-convex mesh
+  double distance = 0.0;
+
+  if( walk && walk_track(position, direction, length, ebin, weight,
+                         workspace, distance) )
+  {
+    return;
+  }
+
+  // fire a ray along the part of the track that was not walked
+  CartVect start = position + direction * distance;
+  fire_ray(start, direction, length - distance, ebin, weight, workspace);
+}
+//---------------------------------------------------------------------------//
+void TrackLengthMeshTally::fire_ray(const CartVect& position,
+                                    const CartVect& direction,
+                                    double length,
+                                    unsigned int ebin, double weight,
+                                    TrackWorkspace& workspace)
+{
+  std::vector<double>& intersections = workspace.intersections;
+  std::vector<EntityHandle>& triangles = workspace.triangles;
+
+  // get all ray-triangle intersections along the ray 
+  ErrorCode rval = get_all_intersections(position,direction,length,triangles,intersections);
+  if (rval != MB_SUCCESS )
     {
-      std::cout << "Failed to get connectivity information" << std::endl;
+      std::cout << "we have a problem finding intersections" << std::endl;
       exit(1);
     }
-  assert( rval == MB_SUCCESS );
-  
-  CartVect p0;
-  rval = mb->get_coords( verts, 1, p0.array() );
-  if(rval != MB_SUCCESS)
+
+  EntityHandle tet; // tet 
+  if( intersections.size() == 0 )
+    // ray is so short it either does not intersect a triangular face, or it inside the mesh
+    // but can't reach
     {
-      std::cout << "Failed to get coordinate information" << std::endl;
-      exit(1);
+       tet = point_in_which_tet(position, workspace);
+      // if tet value is greater than 0 then in a tet, otherwise not
+      if( tet == 0 )
+	{
+	  return;
+	}
+      else
+	{
+	  // determine tracklength to return
+          add_score_to_mesh_tally(tet, weight, length, ebin);
+	  return;
+	}
     }
-  assert( rval == MB_SUCCESS );
 
-  Matrix3& Ainverse = tet_baryc_data[ get_entity_index(*tet) ];
+  // sort the intersection data
+  sort_intersection_data(intersections,triangles,workspace.hit_information);
+  // compute the tracklengths
+  compute_tracklengths(position, direction, length, ebin, weight, workspace);
+}
+//---------------------------------------------------------------------------//
+bool TrackLengthMeshTally::walk_track(const CartVect& position,
+                                      const CartVect& direction,
+                                      double length,
+                                      unsigned int ebin, double weight,
+                                      TrackWorkspace& workspace,
+                                      double& distance)
+{
+  distance = 0.0;
+
+  EntityHandle tet = find_start_tet(position, workspace);
+  if( tet == 0 ) return false;
 
-  CartVect bary = (Ainverse) * (point-p0);
-  
-  bool in_tet = ( bary[0]>= 0 && bary[1] >= 0 && bary[2] >= 0 &&
-                  bary[0]+bary[1]+bary[2] <= 1. );
+  // a straight track cannot visit more tets than there are in the mesh
+  unsigned int num_tets = tally_points.size();
+  unsigned int entry_face = 4; // the first tet was not entered through a face
 
-  return in_tet;
+  for( unsigned int step = 0; step < num_tets; ++step )
+  {
+    unsigned int tet_index = get_entity_index(tet);
+    const TetRecord& record = tet_records[tet_index];
+    const double* a = record.a_inverse;
+
+    // barycentric coordinates of the current point and their rate of change
+    // along the track; b[j] is the coordinate for vertex j of the tet
+    CartVect d = position + direction * distance;
+    d[0] -= record.v0[0];
+    d[1] -= record.v0[1];
+    d[2] -= record.v0[2];
+
+    double b[4], db[4];
+    for( int j = 1; j < 4; ++j )
+    {
+      const double* row = a + 3*(j-1);
+      b[j]  = row[0]*d[0] + row[1]*d[1] + row[2]*d[2];
+      db[j] = row[0]*direction[0] + row[1]*direction[1] + row[2]*direction[2];
+    }
+    b[0]  = 1.0 - b[1] - b[2] - b[3];
+    db[0] = -db[1] - db[2] - db[3];
+
+    // the track leaves through the first face whose opposite coordinate
+    // reaches zero, ignoring the face it came in through
+    unsigned int exit_face = 4;
+    double exit_distance = length - distance;
+
+    for( unsigned int j = 0; j < 4; ++j )
+    {
+      if( j == entry_face || db[j] >= 0.0 ) continue;
+
+      double t = std::max( 0.0, -b[j] / db[j] );
+      if( t < exit_distance )
+      {
+        exit_distance = t;
+        exit_face = j;
+      }
+    }
+
+    if( exit_distance > 0.0 )
+    {
+      data->add_score_to_tally(tet_index, weight * exit_distance, ebin);
+      distance += exit_distance;
+    }
+
+    // track ends inside this tet
+    if( exit_face == 4 )
+    {
+      workspace.last_visited_tet = tet;
+      distance = length;
+      return true;
+    }
+
+    EntityHandle next_tet = tet_neighbors[ 4*tet_index + exit_face ];
+
+    // track leaves the mesh, and can only re-enter if it is not convex
+    if( next_tet == 0 )
+    {
+      workspace.last_visited_tet = tet;
+      return convex;
+    }
+
+    // find the face of the next tet that the track enters through
+    unsigned int next_index = get_entity_index(next_tet);
+    entry_face = 0;
+    while( entry_face < 3 && tet_neighbors[ 4*next_index + entry_face ] != tet )
+    {
+      ++entry_face;
+    }
+
+    tet = next_tet;
+  }
+
+  std::cerr << "Warning: tet walk did not finish for tally "
+            << input_data.tally_id << std::endl;
+  return false;
+}
+//---------------------------------------------------------------------------//
+EntityHandle TrackLengthMeshTally::find_start_tet(const CartVect& point,
+                                                  TrackWorkspace& workspace)
+{
+  const EntityHandle& last_visited_tet = workspace.last_visited_tet;
+
+  // tracks usually start in the tet where the last track ended, or next to it
+  if( last_visited_tet != 0 )
+  {
+    if( point_in_tet(point, &last_visited_tet) ) return last_visited_tet;
+
+    unsigned int tet_index = get_entity_index(last_visited_tet);
+
+    for( unsigned int j = 0; j < 4; ++j )
+    {
+      const EntityHandle& neighbor = tet_neighbors[ 4*tet_index + j ];
+      if( neighbor != 0 && point_in_tet(point, &neighbor) ) return neighbor;
+    }
+  }
+
+  return point_in_which_tet(point, workspace);
 }
 //---------------------------------------------------------------------------//
 /*
@@ -531,6 +1050,10 @@ bool TrackLengthMeshTally::point_in_tet(const CartVect& point,
 ErrorCode TrackLengthMeshTally::get_all_intersections(const CartVect& position, const CartVect& direction, double track_length, 
 				std::vector<EntityHandle> &triangles,std::vector<double> &intersections)
   {
+    // keep the capacity of the workspaces from previous tracks
+    triangles.clear();
+    intersections.clear();
+
     
     ErrorCode result = kdtree->ray_intersect_triangles( kdtree_root, TRIANGLE_INTERSECTION_TOL, 
 					    direction.array(), position.array(), triangles,
@@ -542,24 +1065,26 @@ ErrorCode TrackLengthMeshTally::get_all_intersections(const CartVect& position,
 /*
  * loop through all tets to find which one we are in
  */
-EntityHandle TrackLengthMeshTally::point_in_which_tet (const CartVect& point)
+EntityHandle TrackLengthMeshTally::point_in_which_tet (const CartVect& point,
+                                                       TrackWorkspace& workspace)
 {
   ErrorCode rval;
-  AdaptiveKDTreeIter tree_iter;
+  AdaptiveKDTreeIter& tree_iter = workspace.tree_iter;
+  std::vector<EntityHandle>& candidate_tets = workspace.candidate_tets;
   
   // Check to see if starting point begins inside a tet
   rval = kdtree->leaf_containing_point( kdtree_root, point.array(), tree_iter );
   if( rval == MB_SUCCESS )
     {
       EntityHandle leaf = tree_iter.handle();
-      Range candidate_tets;
+      candidate_tets.clear();
       rval = mb->get_entities_by_dimension( leaf, 3, candidate_tets, false );
       assert( rval == MB_SUCCESS );
-      for( Range::const_iterator i = candidate_tets.begin(); i!=candidate_tets.end(); ++i)
+      for( unsigned int i = 0; i < candidate_tets.size(); ++i )
 	{
-	  if( point_in_tet( point,&(*i)) )
+	  if( point_in_tet( point, &candidate_tets[i] ) )
 	    {
-	      return *i;
+	      return candidate_tets[i];
 	    }
 	}
     }
@@ -569,10 +1094,11 @@ EntityHandle TrackLengthMeshTally::point_in_which_tet (const CartVect& point)
 /*
  * Returns the tet in which the remaining length to score ends in
  */
-EntityHandle TrackLengthMeshTally::remainder(const CartVect& start, const CartVect& dir, double distance, double left_over)
+EntityHandle TrackLengthMeshTally::remainder(const CartVect& start, const CartVect& dir, double distance, double left_over,
+                                             TrackWorkspace& workspace)
 {
   CartVect pos_check = start+(dir*(distance+left_over));
-  return point_in_which_tet (pos_check);
+  return point_in_which_tet (pos_check, workspace);
 }
 
 /* 
@@ -601,18 +1127,17 @@ Range TrackLengthMeshTally::get_adjacency_info(const Range& input_handles)
 
 // function to sort the ray-mesh intersection data
 void TrackLengthMeshTally::sort_intersection_data(std::vector<double> &intersections,
-						  std::vector<EntityHandle> &triangles)
+						  std::vector<EntityHandle> &triangles,
+						  std::vector<ray_data> &hit_information)
 {
-  std::vector<ray_data> hit_information; // vector of reformated ray triangle intersections)
+  // copy the data from intersections and triangles to the workspace array of structs
+  // for the purpose of sorting the intersection data
+  hit_information.resize(intersections.size());
 
-  // copy the data from intersections and triangles to temporary array of structs for the
-  // purpose of sorting the intersection data
   for ( unsigned int i = 0 ; i < intersections.size() ; i++ ) 
     {
-      ray_data data;
-      data.intersect=intersections[i];
-      data.triangle=triangles[i];
-      hit_information.push_back(data);
+      hit_information[i].intersect=intersections[i];
+      hit_information[i].triangle=triangles[i];
     }
   // at some point the sort will be done by moab rather than by us
   std::sort(hit_information.begin(), hit_information.end(), compare); // sort the intersections
@@ -628,30 +1153,32 @@ void TrackLengthMeshTally::sort_intersection_data(std::vector<double> &intersect
 }
 
 // function to compute the track lengths
-void TrackLengthMeshTally::compute_tracklengths(const TallyEvent& event, 
+void TrackLengthMeshTally::compute_tracklengths(const CartVect& position,
+                                                const CartVect& direction,
+                                                double length,
                                                 unsigned int ebin, double weight,
-						const std::vector<double>& intersections,
-						const std::vector<EntityHandle>& triangles)
+                                                TrackWorkspace& workspace)
 {
+  const std::vector<double>& intersections = workspace.intersections;
+
   double track_length; // track_length to add to the tet
   CartVect hit_p; //position on the triangular face of the hit
-  std::vector<CartVect> hit_point; // array of all hit points
+  CartVect last_hit_p = position; // previous hit point, starting at the origin of the ray
   CartVect tet_centroid; // centroid position between intersect point
   EntityHandle tet;
-  hit_point.push_back(event.position); // add the origin of the ray to the point to the list
 
   EntityHandle next_tet = 0;
   // loop over all intersections
   for (unsigned int i = 0 ; i < intersections.size() ; i++) 
     {
       // hit point
-      //      std::cout << "pos " << event.position << std::endl;
-      hit_p = (event.direction*intersections[i]) + event.position;
-      hit_point.push_back(hit_p); // add to list of hit points
-      tet_centroid = ((hit_point[i+1]-hit_point[i])/2.0)+hit_point[i]; // centre of the tet
+      //      std::cout << "pos " << position << std::endl;
+      hit_p = (direction*intersections[i]) + position;
+      tet_centroid = ((hit_p-last_hit_p)/2.0)+last_hit_p; // centre of the tet
+      last_hit_p = hit_p;
       //      std::cout << "centroid " << tet_centroid << std::endl;
       // determine the tet that the point belongs to
-      tet = point_in_which_tet(tet_centroid);
+      tet = point_in_which_tet(tet_centroid, workspace);
       //      std::cout << tet << std::endl;
       if ( tet > 0 )
 	{
@@ -675,16 +1202,16 @@ void TrackLengthMeshTally::compute_tracklengths(const TallyEvent& event,
 
   // it is possible that there is some tracklength left to allocate at the end, where the ray ends in the middle of a tet
   // or the ray could end in free space
-  if ( intersections[intersections.size()-1] < event.track_length )
+  if ( intersections[intersections.size()-1] < length )
     {
-      track_length = event.track_length-intersections[intersections.size()-1];
-      tet = remainder(event.position,event.direction,
+      track_length = length-intersections[intersections.size()-1];
+      tet = remainder(position,direction,
 		      intersections[intersections.size()-1],
-	              track_length);
+	              track_length, workspace);
       if (track_length < 0.0 )
 	{
 	  std::cout << "Negative Track Length!!" << std::endl;
-	  std::cout << track_length << " " << intersections[intersections.size()-1] << " " <<  event.track_length << std::endl;
+	  std::cout << track_length << " " << intersections[intersections.size()-1] << " " <<  length << std::endl;
 	  std::cout << tet << " " << next_tet << std::endl;
 	}
       
@@ -7,7 +7,10 @@
 #include <cassert>
 #include <set>
 
+#include <stdint.h>
+
 #include "moab/Interface.hpp"
+#include "moab/AdaptiveKDTree.hpp"
 #include "moab/CartVect.hpp"
 #include "moab/Range.hpp"
 
@@ -18,9 +21,14 @@
 namespace moab{
 
 /* Forward Declarations */
-class AdaptiveKDTree;
 class OrientedBoxTreeTool;
 
+// used to store the intersection data
+struct ray_data {
+  double intersect;
+  EntityHandle triangle;
+};
+
 //===========================================================================//
 /**
  * \class TrackLengthMeshTally
@@ -79,6 +87,31 @@ class OrientedBoxTreeTool;
  * on the input mesh itself using the MOAB tagging feature.  Note that "tag"
  * name can only be set once, whereas multiple "tagval" values can be added.
  * This option is only used during setup to define the set of tally points.
+ *
+ * 6) "walk"="t/f", "walk"="true/false"
+ * ------------------------------------
+ * If the walk option is set to true, then the face adjacencies of all tets are
+ * computed during setup.  Each particle track is then scored by locating the
+ * tet that contains the start of the track, and walking from tet to tet
+ * through the faces that the track crosses.  This avoids firing a ray through
+ * the KD tree and searching it at every mesh cell crossing.  The start tet is
+ * usually found from the tet in which the previous track ended.  If a track
+ * starts outside the mesh, or leaves a mesh that is not convex, then the rest
+ * of the track is scored by firing a ray instead.  The default value for this
+ * option is false.
+ *
+ * 7) "cache"="filename"
+ * ---------------------
+ * The cache option saves the setup data of this tally, so that it does not
+ * need to be computed again on later runs.  The tally mesh, its triangles and
+ * the sets and tags of the KD tree are written by MOAB to the given file,
+ * which should be an .h5m file.  The barycentric data and face adjacencies of
+ * all tets are written to "filename.tets", which is memory-mapped when it is
+ * loaded.  Both files store a key computed from the size, modification time
+ * and the first and last 64 KiB of the input file, and from the "tag" and
+ * "tagval" options.  A cache with a different key is ignored and replaced.
+ * The mesh is always loaded from the cache after it is written, so that its
+ * entity handles are the same as in later runs.
  */
 //===========================================================================//
 class TrackLengthMeshTally : public MeshTally
@@ -103,14 +136,41 @@ class TrackLengthMeshTally : public MeshTally
      */
     virtual void compute_score(const TallyEvent& event);
 
+    /**
+     * \brief Computes scores for this TrackLengthMeshTally based on a batch of events
+     * \param[in] batch the parameters needed to compute the scores
+     *
+     * Scores each track directly from the batch arrays, without copying it
+     * into a TallyEvent first.
+     */
+    virtual void compute_scores(const TallyEventBatch& batch);
+
     /**
      * \brief Updates TrackLengthMeshTally when a particle history ends
      *
      * Calls MeshTally::end_history() and if input mesh is conformal sets the
-     * last_cell to -1 to indicate that a new particle will be born.
+     * last_cell of the calling thread to -1 to indicate that a new particle
+     * will be born.
      */
     virtual void end_history();
 
+    /**
+     * \brief Check if this TrackLengthMeshTally can score events from multiple threads
+     * \return true, as each thread uses its own TrackWorkspace
+     *
+     * The mesh, kd-tree and TetRecord data are only read while scoring, and
+     * all scores are added to per-thread TallyData arrays.
+     */
+    virtual bool is_thread_safe() const;
+
+    /**
+     * \brief Sets the number of threads that can score this TrackLengthMeshTally
+     * \param[in] num_threads the number of threads (must be at least 1)
+     *
+     * Sets up a TrackWorkspace for each thread in addition to the TallyData.
+     */
+    virtual void set_num_threads(unsigned int num_threads);
+
     /**
      * \brief Write results to the output file for this TrackLengthMeshTally
      * \param[in] num_histories the number of particle histories tracked
@@ -140,20 +200,66 @@ class TrackLengthMeshTally : public MeshTally
     OrientedBoxTreeTool* obb_tool;
     EntityHandle obbtree_root;
 
-    // Variables needed to keep track of mesh cells visited
-    EntityHandle last_visited_tet;
-    int last_cell;
-    
     // Optional convex mesh and conformal surface source flags
     bool convex;
     bool conformal_surface_source;
 
+    // Optional flag to score tracks by walking through adjacent tets
+    bool walk;
+
     // If not empty, user has asserted mesh tally geometry
     // conforms to the cells identified in this set
     std::set<int> conformality;
 
-    // Stores barycentric data for tetrahedrons
-    std::vector<Matrix3> tet_baryc_data;
+    // Packed point location data for one tetrahedron, padded to fill exactly
+    // two 64-byte cache lines
+    struct TetRecord
+    {
+        double v0[3];        // coordinates of the first vertex
+        double a_inverse[9]; // inverse barycentric matrix, stored by row
+        double padding[4];
+    };
+
+    // Stores barycentric data for tetrahedrons, indexed by entity index;
+    // tet_records points to the first cache-aligned record in the buffer
+    std::vector<char> tet_record_buffer;
+    TetRecord* tet_records;
+
+    // Stores the tet across each face of every tet, indexed by 4 times the
+    // entity index plus the index of the vertex opposite the face; 0 if the
+    // face is on the skin of the mesh (only used if walk is true)
+    std::vector<EntityHandle> tet_neighbor_buffer;
+    EntityHandle* tet_neighbors;
+
+    // Optional cache file for the setup data, the key of the input file, and
+    // the memory-mapped tet data; if it was loaded, then tet_records and
+    // tet_neighbors point into cache_map
+    std::string cache_filename;
+    uint64_t cache_key;
+    void* cache_map;
+    size_t cache_map_size;
+
+    // Data that changes while one thread scores its tracks.  The vectors are
+    // reused by every track, so that no memory needs to be allocated for
+    // each event once they have grown large enough.
+    struct TrackWorkspace
+    {
+        // Variables needed to keep track of mesh cells visited
+        EntityHandle last_visited_tet;
+        int last_cell;
+
+        // Workspaces for firing a ray and searching the KD tree
+        std::vector<double> intersections;
+        std::vector<EntityHandle> triangles;
+        std::vector<ray_data> hit_information;
+        std::vector<EntityHandle> candidate_tets;
+        AdaptiveKDTreeIter tree_iter;
+
+        TrackWorkspace() : last_visited_tet(0), last_cell(-1) {}
+    };
+
+    // One TrackWorkspace for each thread, indexed by TallyData::get_thread_id()
+    std::vector<TrackWorkspace> workspaces;
 
     // Stores tag name and values expected in input mesh
     std::string tag_name; 
@@ -181,9 +287,62 @@ class TrackLengthMeshTally : public MeshTally
      * \brief Computes the barycentric matrices for all tetrahedrons
      * \param[in] all_tets the set of tets extracted from the input mesh
      * \return the MOAB ErrorCode value
+     *
+     * Stores a TetRecord for each tet, so that point_in_tet() does not need
+     * to access any MOAB data.
      */
     ErrorCode compute_barycentric_data (const Range& all_tets);
 
+    /**
+     * \brief Computes the neighbors across the faces of all tetrahedrons
+     * \param[in] all_tets the set of tets extracted from the input mesh
+     * \return the MOAB ErrorCode value
+     */
+    ErrorCode compute_adjacency_data (const Range& all_tets);
+
+    /**
+     * \brief Computes the key that identifies the input file in the cache
+     * \return the key, or zero if the input file could not be read
+     *
+     * Only reads the file size, modification time and the bytes at the start
+     * and the end of the input file, so the key is cheap to compute for any
+     * size of mesh.
+     */
+    uint64_t compute_cache_key () const;
+
+    /**
+     * \brief Loads the tally mesh and KD tree from the cache file
+     * \return true if the cache file exists and matches cache_key
+     *
+     * Sets tally_mesh_set, kdtree and kdtree_root.  If the cache cannot be
+     * used, then the MOAB instance is reset.
+     */
+    bool load_cached_mesh ();
+
+    /**
+     * \brief Writes the MOAB instance to the cache file
+     * \return true if the cache file was written
+     *
+     * Must be called after build_trees().
+     */
+    bool save_cached_mesh ();
+
+    /**
+     * \brief Deletes all mesh data by replacing the MOAB instance
+     */
+    void reset_mesh ();
+
+    /**
+     * \brief Memory-maps the tet data from the tet cache file
+     * \return true if the tet cache file exists and matches the tally points
+     */
+    bool load_tet_data ();
+
+    /**
+     * \brief Writes the tet data to the tet cache file
+     */
+    void save_tet_data ();
+
     /**
      * \brief Constructs the KD and OBB trees from the mesh data
      * \param[in, out] all_tets the set of tets extracted from the input mesh
@@ -212,14 +371,73 @@ class TrackLengthMeshTally : public MeshTally
      *
      * Assumes that tet is part of this TrackLengthMeshTally.
      */                 
-    bool point_in_tet(const CartVect& point, const EntityHandle* tet);
+    bool point_in_tet(const CartVect& point, const EntityHandle* tet) const;
+
+  /**
+   * \brief score a track by walking it through the mesh or firing a ray
+   * \param[in] position the start of the track
+   * \param[in] direction unit direction vector of the track
+   * \param[in] length the length of the track
+   * \param[in] ebin the energy bin index corresponding to the energy
+   * \param[in] weight the multiplier value for the score to be tallied
+   * \param[in, out] workspace the TrackWorkspace of the calling thread
+   *
+   * Uses walk_track() if the walk option is set, and fire_ray() for any
+   * part of the track that was not walked.
+   */
+  void score_track(const CartVect& position, const CartVect& direction,
+                   double length, unsigned int ebin, double weight,
+                   TrackWorkspace& workspace);
+
+  /**
+   * \brief score a track by firing a ray through the KD tree
+   * \param[in] position the start of the track
+   * \param[in] direction unit direction vector of the track
+   * \param[in] length the length of the track
+   * \param[in] ebin the energy bin index corresponding to the energy
+   * \param[in] weight the multiplier value for the score to be tallied
+   * \param[in, out] workspace the TrackWorkspace of the calling thread
+   */
+  void fire_ray(const CartVect& position, const CartVect& direction,
+                double length, unsigned int ebin, double weight,
+                TrackWorkspace& workspace);
+
+  /**
+   * \brief score a track by walking through adjacent tets
+   * \param[in] position the start of the track
+   * \param[in] direction unit direction vector of the track
+   * \param[in] length the length of the track
+   * \param[in] ebin the energy bin index corresponding to the energy
+   * \param[in] weight the multiplier value for the score to be tallied
+   * \param[in, out] workspace the TrackWorkspace of the calling thread
+   * \param[out] distance the length of the track that was scored
+   * \return true if no more of the track needs to be scored
+   *
+   * Returns false if the track does not start inside the mesh, or if it
+   * leaves a mesh that is not convex.
+   */
+  bool walk_track(const CartVect& position, const CartVect& direction,
+                  double length, unsigned int ebin, double weight,
+                  TrackWorkspace& workspace, double& distance);
+
+  /**
+   * \brief find the tet that contains the start of a track
+   * \param[in] point the start of the track
+   * \param[in, out] workspace the TrackWorkspace of the calling thread
+   * \return the tet that contains the point, zero if none found
+   *
+   * Checks last_visited_tet and its neighbors before searching the KD tree.
+   */
+  EntityHandle find_start_tet(const CartVect& point, TrackWorkspace& workspace);
 
   /**
    * \brief loop through all tets to find which tet, the point belong to
    * \param [in] point point to test
+   * \param [in, out] workspace the TrackWorkspace of the calling thread
    * \return entity handle to the tet which the point belongs to
    */
-  EntityHandle point_in_which_tet (const CartVect& point);
+  EntityHandle point_in_which_tet (const CartVect& point,
+                                   TrackWorkspace& workspace);
 
   /**
    * \brief return the tet_element in which the ray ends
@@ -227,9 +445,11 @@ class TrackLengthMeshTally : public MeshTally
    * \param[in] dir unit direction vector of the ray
    * \param[in] distance to the last intersecction
    * \param[in] left_over remaining track_length
+   * \param[in, out] workspace the TrackWorkspace of the calling thread
    * \return the tet which the end point of the ray belongs to, zero if none found
    */
-  EntityHandle remainder(const CartVect& start, const CartVect& dir, double distance, double left_over);
+  EntityHandle remainder(const CartVect& start, const CartVect& dir, double distance, double left_over,
+                         TrackWorkspace& workspace);
 
   /** 
    * \brief return the MBRange of triangles that belong in the tet mesh there are no repliacted surfaces in this list
@@ -242,23 +462,27 @@ class TrackLengthMeshTally : public MeshTally
    * \brief return the sorted (by distance) list of triangles and intersections
    * \param[in, out] vector<double> intersections list of all the intersections
    * \param[in, out] vector<EntityHandle> intersections list of the triangle entity handles that correspond to the intersections
+   * \param[out] vector<ray_data> hit_information workspace used for sorting
    * \return void
    */
-  void sort_intersection_data(std::vector<double> &intersections, std::vector<EntityHandle> &triangles);
+  void sort_intersection_data(std::vector<double> &intersections, std::vector<EntityHandle> &triangles,
+                              std::vector<ray_data> &hit_information);
 
   /** 
    * \brief return the tracklengths of the ray in each tet
-   * \param[in] event the tally event, direction, position, track_length, etc
+   * \param[in] position the start of the ray
+   * \param[in] direction unit direction vector of the ray
+   * \param[in] length the length of the ray
    * \param[in] ebin the energy bin index corresponding to the energy
    * \param[in] weight the multiplier value for the score to be tallied
-   * \param[in] vector<double> intersections list of all the intersections
-   * \param[in] vector<EntityHandle> triangles list of the triangle entity handles that correspond to the intersections
+   * \param[in, out] workspace the TrackWorkspace of the calling thread, which
+   *                 stores the sorted intersections
    * \return void
    */
-  void compute_tracklengths(const TallyEvent& event, 
+  void compute_tracklengths(const CartVect& position,
+                            const CartVect& direction, double length,
                             unsigned int ebin, double weight,
-   			    const std::vector<double>& intersections,
-			    const std::vector<EntityHandle>& triangles);
+                            TrackWorkspace& workspace);
 
 };
 
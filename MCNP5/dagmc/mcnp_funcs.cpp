@@ -18,6 +18,10 @@ using moab::DagMC;
 
 #ifdef CUBIT_LIBS_PRESENT
 #include <fenv.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
 #endif
 
   // globals
@@ -38,17 +42,72 @@ static std::ostream* raystat_dump = NULL;
 #endif 
 
 
-/* Static values used by dagmctrack_ */
+/* State of the particle being tracked, used by dagmctrack_ and the other
+ * tracking functions.  Every thread that tracks particles has its own
+ * ParticleState, which is found by particle_state().
+ */
+struct ParticleState {
+
+  DagMC::RayHistory history;
+  int last_nps;
+  double last_uvw[3];
+  std::vector< DagMC::RayHistory > history_bank;
+  std::vector< DagMC::RayHistory > pblcm_history_stack;
+  bool visited_surface;
+  double dist_limit;
+
+  /* values used by dagmcchkcel_ */
+  std::vector<unsigned int> tested_in; // last search that tested each cell
+  unsigned int search_number;
+  int last_cell;                       // cell the last particle was found in
+  double chkcel_xyz[3], chkcel_uvw[3]; // point of the last failed check
+  int chkcel_first;                    // cell tested first at that point
+  int chkcel_found;                    // cell found at that point, or -1
+
+  ParticleState() : last_nps(0), visited_surface(false), dist_limit(0),
+                    search_number(0), last_cell(0), chkcel_first(0), chkcel_found(-1)
+  {
+    last_uvw[0] = last_uvw[1] = last_uvw[2] = 0;
+  }
+};
 
-static DagMC::RayHistory history;
-static int last_nps = 0;
-static double last_uvw[3] = {0,0,0};
-static std::vector< DagMC::RayHistory > history_bank;
-static std::vector< DagMC::RayHistory > pblcm_history_stack;
-static bool visited_surface = false;
+static std::vector< ParticleState > particle_states( 1 );
 
 static bool use_dist_limit = false;
-static double dist_limit; // needs to be thread-local
+
+/* Static values used by dagmcchkcel_ */
+
+static std::vector<int> neighbor_start;    // first neighbor of each cell
+static std::vector<int> neighbor_cells;    // cells that share a surface
+
+static void build_cell_neighbors();
+
+/* Get the particle state of the calling thread */
+static ParticleState& particle_state()
+{
+#ifdef _OPENMP
+  unsigned int thread = omp_get_thread_num();
+
+  // states only exist for the threads that were counted by dagmcinit_
+  if( thread >= particle_states.size() ){
+    std::cerr << "DAGMC has no particle state for OpenMP thread " << thread
+              << "; only " << particle_states.size()
+              << " threads were set up by dagmcinit" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // threads of a nested team would share the states of the outer team
+  if( omp_get_active_level() > 1 ){
+    std::cerr << "DAGMC cannot track particles in nested OpenMP parallel regions"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  return particle_states[ thread ];
+#else
+  return particle_states[0];
+#endif
+}
 
 
 void dagmcinit_(char *cfile, int *clen,  // geom
@@ -103,7 +162,16 @@ void dagmcinit_(char *cfile, int *clen,  // geom
     exit(EXIT_FAILURE);
   }
 
-  pblcm_history_stack.resize( *max_pbl+1 ); // fortran will index from 1
+#ifdef _OPENMP
+  // every thread that MCNP may use to track particles needs its own state
+  particle_states.resize( omp_get_max_threads() );
+#endif
+
+  for( unsigned int i = 0; i < particle_states.size(); ++i ){
+    particle_states[i].pblcm_history_stack.resize( *max_pbl+1 ); // fortran will index from 1
+  }
+
+  build_cell_neighbors();
 
 }
 
@@ -422,9 +490,10 @@ void dagmcwritemcnp_(char *lfile, int *llen)  // file with cell/surface cards
 
 void dagmcangl_(int *jsu, double *xxx, double *yyy, double *zzz, double *ang)
 {
+  ParticleState& state = particle_state();
   MBEntityHandle surf = DAG->entity_by_index( 2, *jsu );
   double xyz[3] = {*xxx, *yyy, *zzz};
-  MBErrorCode rval = DAG->get_angle(surf, xyz, ang, &history );
+  MBErrorCode rval = DAG->get_angle(surf, xyz, ang, &state.history );
   if (MB_SUCCESS != rval) {
     std::cerr << "DAGMC: failed in calling get_angle" <<  std::endl;
     exit(EXIT_FAILURE);
@@ -433,7 +502,7 @@ void dagmcangl_(int *jsu, double *xxx, double *yyy, double *zzz, double *ang)
 #ifdef TRACE_DAGMC_CALLS
   std::cout << "angl: " << *xxx << ", " << *yyy << ", " << *zzz << " --> " 
             << ang[0] <<", " << ang[1] << ", " << ang[2] << std::endl;
-  MBCartVect uvw(last_uvw);
+  MBCartVect uvw(state.last_uvw);
   MBCartVect norm(ang);
   double aa = angle(uvw,norm) * (180.0/M_PI);
   std::cout << "    : " << aa << " deg to uvw" << (aa>90.0? " (!)":"")  << std::endl;
@@ -445,6 +514,7 @@ void dagmcchkcel_by_angle_( double *uuu, double *vvv, double *www,
                             double *xxx, double *yyy, double *zzz,
                             int *jsu, int *i1, int *j)
 {
+  ParticleState& state = particle_state();
 
 
 #ifdef TRACE_DAGMC_CALLS
@@ -461,7 +531,7 @@ void dagmcchkcel_by_angle_( double *uuu, double *vvv, double *www,
   MBEntityHandle vol  = DAG->entity_by_index( 3, *i1 );
 
   int result;
-  MBErrorCode rval = DAG->test_volume_boundary( vol, surf, xyz, uvw, result, &history );
+  MBErrorCode rval = DAG->test_volume_boundary( vol, surf, xyz, uvw, result, &state.history );
   if( MB_SUCCESS != rval ){
     std::cerr << "DAGMC: failed calling test_volume_boundary" << std::endl;
     exit(EXIT_FAILURE);
@@ -486,9 +556,119 @@ void dagmcchkcel_by_angle_( double *uuu, double *vvv, double *www,
 
 }
 
+/**
+ * Finds the cells that share a surface with each cell, using the parent
+ * volumes of the child surfaces of every cell.  Called by dagmcinit_.
+ */
+static void build_cell_neighbors()
+{
+  int num_cells = DAG->num_entities( 3 );
+  std::vector< std::vector<int> > neighbors( num_cells+1 );
+
+  for( int i = 1; i <= num_cells; ++i ){
+    MBEntityHandle vol = DAG->entity_by_index( 3, i );
+    std::vector<MBEntityHandle> surfs;
+    MBErrorCode rval = DAG->moab_instance()->get_child_meshsets( vol, surfs );
+    if( MB_SUCCESS != rval ){
+      std::cerr << "DAGMC: failed to get surfaces of cell " << DAG->id_by_index(3,i) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    for( unsigned int k = 0; k < surfs.size(); ++k ){
+      MBEntityHandle other = 0;
+      rval = DAG->next_vol( surfs[k], vol, other );
+      if( MB_SUCCESS != rval || 0 == other ) continue;
+
+      int n = DAG->index_by_handle( other );
+      if( n > 0 && n != i ) neighbors[i].push_back( n );
+    }
+
+    std::sort( neighbors[i].begin(), neighbors[i].end() );
+    neighbors[i].erase( std::unique( neighbors[i].begin(), neighbors[i].end() ), neighbors[i].end() );
+  }
+
+  // copy neighbors into one array for all cells
+  neighbor_start.assign( num_cells+2, 0 );
+  neighbor_cells.clear();
+  for( int i = 1; i <= num_cells; ++i ){
+    neighbor_cells.insert( neighbor_cells.end(), neighbors[i].begin(), neighbors[i].end() );
+    neighbor_start[i+1] = neighbor_cells.size();
+  }
+
+  for( unsigned int i = 0; i < particle_states.size(); ++i ){
+    ParticleState& state = particle_states[i];
+    state.tested_in.assign( num_cells+1, 0 );
+    state.search_number = 0;
+    state.last_cell = 0;
+    state.chkcel_first = 0;
+  }
+}
+
+void dagmc_cell_neighbors_( int *icl, int *max_neighbors, int *neighbors, int *num_neighbors )
+{
+  *num_neighbors = 0;
+  if( *icl <= 0 || *icl+1 >= (int)neighbor_start.size() ) return;
+
+  *num_neighbors = neighbor_start[*icl+1] - neighbor_start[*icl];
+  for( int k = 0; k < *num_neighbors && k < *max_neighbors; ++k ){
+    neighbors[k] = neighbor_cells[ neighbor_start[*icl] + k ];
+  }
+}
+
+/**
+ * Tests cell i for a search, unless it was already tested by that search.
+ * Returns true if the point is inside the cell.
+ */
+static bool search_cell( ParticleState& state, int i, const double xyz[3], const double uvw[3] )
+{
+  if( state.tested_in[i] == state.search_number ) return false;
+  state.tested_in[i] = state.search_number;
+
+  int inside;
+  MBErrorCode rval = DAG->point_in_volume( DAG->entity_by_index( 3, i ), xyz, inside, uvw );
+  if( MB_SUCCESS != rval ){
+    std::cerr << "DAGMC: failed in point_in_volume" <<  std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  return ( 1 == inside );
+}
+
+/**
+ * Searches for the cell containing the point, skipping the cell skip.
+ * The cell the last particle was found in is tested first, then the cells that
+ * share a surface with it, and finally all other cells.  Returns 0 if the
+ * point is not inside any cell.
+ */
+static int find_cell( ParticleState& state, const double xyz[3], const double uvw[3], int skip )
+{
+  // start a new search, in which no cells have been tested
+  if( ++state.search_number == 0 ){
+    std::fill( state.tested_in.begin(), state.tested_in.end(), 0 );
+    state.search_number = 1;
+  }
+  state.tested_in[skip] = state.search_number;
+
+  if( state.last_cell > 0 ){
+    if( search_cell( state, state.last_cell, xyz, uvw ) ) return state.last_cell;
+
+    for( int k = neighbor_start[state.last_cell]; k < neighbor_start[state.last_cell+1]; ++k ){
+      if( search_cell( state, neighbor_cells[k], xyz, uvw ) ) return neighbor_cells[k];
+    }
+  }
+
+  int num_cells = DAG->num_entities( 3 );
+  for( int i = 1; i <= num_cells; ++i ){
+    if( search_cell( state, i, xyz, uvw ) ) return i;
+  }
+
+  return 0;
+}
+
 void dagmcchkcel_(double *uuu,double *vvv,double *www,double *xxx,
                   double *yyy,double *zzz, int *i1, int *j)
 {
+  ParticleState& state = particle_state();
 
 
 #ifdef TRACE_DAGMC_CALLS
@@ -498,10 +678,41 @@ void dagmcchkcel_(double *uuu,double *vvv,double *www,double *xxx,
   std::cout<< "      : uvw = " << *uuu << " " << *vvv << " " << *www << std::endl;
 #endif
 
-  int inside;
-  MBEntityHandle vol = DAG->entity_by_index( 3, *i1 );
   double xyz[3] = {*xxx, *yyy, *zzz};
   double uvw[3] = {*uuu, *vvv, *www};
+
+  // MCNP calls chkcel for one cell after another when searching for the cell
+  // that contains a point.  If the point is the same as for the last failed
+  // check, then MCNP is searching, so search all cells at once starting with
+  // the neighbors of the last cell found, and answer from that result.  This
+  // assumes that cells do not overlap, since MCNP takes the first cell in its
+  // own order that contains the point.
+  bool same_point = ( state.chkcel_first > 0 && *i1 != state.chkcel_first &&
+                      std::equal( xyz, xyz+3, state.chkcel_xyz ) && 
+                      std::equal( uvw, uvw+3, state.chkcel_uvw ) );
+
+  if( same_point ){
+    if( state.chkcel_found < 0 ){
+      state.chkcel_found = find_cell( state, xyz, uvw, state.chkcel_first );
+      if( state.chkcel_found > 0 ) state.last_cell = state.chkcel_found;
+    }
+
+    if( *i1 == state.chkcel_found ){
+      *j = 0; // found inside volume -> j=0
+      state.chkcel_first = 0;
+    }
+    else{
+      *j = 1; // outside volume -> j=1
+    }
+
+#ifdef TRACE_DAGMC_CALLS
+    std::cout<< "chkcel: j=" << *j << " (found cell " << state.chkcel_found << ")" << std::endl;
+#endif
+    return;
+  }
+
+  int inside;
+  MBEntityHandle vol = DAG->entity_by_index( 3, *i1 );
   MBErrorCode rval = DAG->point_in_volume( vol, xyz, inside, uvw );
 
   if (MB_SUCCESS != rval) {
@@ -526,6 +737,18 @@ void dagmcchkcel_(double *uuu,double *vvv,double *www,double *xxx,
         std::cerr << "Impossible result in dagmcchkcel" << std::endl;
         exit(EXIT_FAILURE);
       }
+
+  // remember the cell found, or the point if this is the first failed check
+  if( 0 == *j ){
+    state.last_cell = *i1;
+    state.chkcel_first = 0;
+  }
+  else{
+    std::copy( xyz, xyz+3, state.chkcel_xyz );
+    std::copy( uvw, uvw+3, state.chkcel_uvw );
+    state.chkcel_first = *i1;
+    state.chkcel_found = -1;
+  }
   
 #ifdef TRACE_DAGMC_CALLS
   std::cout<< "chkcel: j=" << *j << std::endl;
@@ -558,6 +781,7 @@ void dagmcdbmin_( int *ih, double *xxx, double *yyy, double *zzz, double *huge,
 
 void dagmcnewcel_( int *jsu, int *icl, int *iap )
 {
+  ParticleState& state = particle_state();
 
   MBEntityHandle surf = DAG->entity_by_index( 2, *jsu );
   MBEntityHandle vol  = DAG->entity_by_index( 3, *icl );
@@ -570,8 +794,9 @@ void dagmcnewcel_( int *jsu, int *icl, int *iap )
   }
   
   *iap = DAG->index_by_handle( newvol );
+  if( *iap > 0 ) state.last_cell = *iap;
 
-  visited_surface = true;
+  state.visited_surface = true;
   
 #ifdef TRACE_DAGMC_CALLS
   std::cout<< "newcel: prev_vol=" << DAG->id_by_index(3,*icl) << " surf= " 
@@ -582,30 +807,31 @@ void dagmcnewcel_( int *jsu, int *icl, int *iap )
 
 void dagmc_surf_reflection_( double *uuu, double *vvv, double *www, int* verify_dir_change )
 {
+  ParticleState& state = particle_state();
 
 
 #ifdef TRACE_DAGMC_CALLS
   // compute and report the angle between old and new
-  MBCartVect oldv(last_uvw);
+  MBCartVect oldv(state.last_uvw);
   MBCartVect newv( *uuu, *vvv, *www );
   
   std::cout << "surf_reflection: " << angle(oldv,newv)*(180.0/M_PI) << std::endl;;
 #endif
 
   // a surface was visited
-  visited_surface = true;
+  state.visited_surface = true;
 
   bool update = true;
   if( *verify_dir_change ){
-    if( last_uvw[0] == *uuu && last_uvw[1] == *vvv && last_uvw[2] == *www  )
+    if( state.last_uvw[0] == *uuu && state.last_uvw[1] == *vvv && state.last_uvw[2] == *www  )
       update = false;
   }
 
   if( update ){
-    last_uvw[0] = *uuu;
-    last_uvw[1] = *vvv;
-    last_uvw[2] = *www;
-    history.reset_to_last_intersection();  
+    state.last_uvw[0] = *uuu;
+    state.last_uvw[1] = *vvv;
+    state.last_uvw[2] = *www;
+    state.history.reset_to_last_intersection();  
   }
 
 #ifdef TRACE_DAGMC_CALLS
@@ -621,7 +847,8 @@ void dagmc_surf_reflection_( double *uuu, double *vvv, double *www, int* verify_
 
 void dagmc_particle_terminate_( )
 {
-  history.reset();
+  ParticleState& state = particle_state();
+  state.history.reset();
 
 #ifdef TRACE_DAGMC_CALLS
   std::cout << "particle_terminate:" << std::endl;
@@ -639,6 +866,7 @@ void dagmctrack_(int *ih, double *uuu,double *vvv,double *www,double *xxx,
                  double *yyy,double *zzz,double *huge,double *dls,int *jap,int *jsu,
                  int *nps )
 {
+  ParticleState& state = particle_state();
     // Get data from IDs
   MBEntityHandle vol = DAG->entity_by_index( 3, *ih );
   MBEntityHandle prev = DAG->entity_by_index( 2, *jsu );
@@ -653,30 +881,30 @@ void dagmctrack_(int *ih, double *uuu,double *vvv,double *www,double *xxx,
   double dir[3]   = {*uuu,*vvv,*www};  
 
   /* detect streaming or reflecting situations */
-  if( last_nps != *nps || prev == 0 ){
+  if( state.last_nps != *nps || prev == 0 ){
     // not streaming or reflecting: reset history
-    history.reset(); 
+    state.history.reset(); 
 #ifdef TRACE_DAGMC_CALLS
     std::cout << "track: new history" << std::endl;
 #endif
 
   }
-  else if( last_uvw[0] == *uuu && last_uvw[1] == *vvv && last_uvw[2] == *www ){
+  else if( state.last_uvw[0] == *uuu && state.last_uvw[1] == *vvv && state.last_uvw[2] == *www ){
     // streaming -- use history without change 
     // unless a surface was not visited
-    if( !visited_surface ){ 
-      history.rollback_last_intersection();
+    if( !state.visited_surface ){ 
+      state.history.rollback_last_intersection();
 #ifdef TRACE_DAGMC_CALLS
       std::cout << "     : (rbl)" << std::endl;
 #endif
     }
 #ifdef TRACE_DAGMC_CALLS
-    std::cout << "track: streaming " << history.size() << std::endl;
+    std::cout << "track: streaming " << state.history.size() << std::endl;
 #endif
   }
   else{
     // not streaming or reflecting
-    history.reset();
+    state.history.reset();
 
 #ifdef TRACE_DAGMC_CALLS
     std::cout << "track: reset" << std::endl;
@@ -685,8 +913,8 @@ void dagmctrack_(int *ih, double *uuu,double *vvv,double *www,double *xxx,
   }
 
   MBErrorCode result = DAG->ray_fire(vol, point, dir, 
-                                     next_surf, next_surf_dist, &history, 
-                                     (use_dist_limit ? dist_limit : 0 )
+                                     next_surf, next_surf_dist, &state.history, 
+                                     (use_dist_limit ? state.dist_limit : 0 )
 #ifdef ENABLE_RAYSTAT_DUMPS
                                      , raystat_dump ? &trv : NULL 
 #endif
@@ -699,8 +927,8 @@ void dagmctrack_(int *ih, double *uuu,double *vvv,double *www,double *xxx,
   }
 
   
-  for( int i = 0; i < 3; ++i ){ last_uvw[i] = dir[i]; } 
-  last_nps = *nps;
+  for( int i = 0; i < 3; ++i ){ state.last_uvw[i] = dir[i]; } 
+  state.last_nps = *nps;
 
   // Return results: if next_surf exists, then next_surf_dist will be nearer than dist_limit (if any)
   if( next_surf != 0 ){
@@ -712,7 +940,7 @@ void dagmctrack_(int *ih, double *uuu,double *vvv,double *www,double *xxx,
     *jap = 0;
     if( use_dist_limit ){
       // Dist limit on: return a number bigger than dist_limit
-      *dls = dist_limit * 2.0;
+      *dls = state.dist_limit * 2.0;
     }
     else{
       // Dist limit off: return huge value, triggering lost particle
@@ -720,7 +948,7 @@ void dagmctrack_(int *ih, double *uuu,double *vvv,double *www,double *xxx,
     }
   }
 
-  visited_surface = false;
+  state.visited_surface = false;
   
 #ifdef ENABLE_RAYSTAT_DUMPS
   if( raystat_dump ){
@@ -747,10 +975,11 @@ void dagmctrack_(int *ih, double *uuu,double *vvv,double *www,double *xxx,
 
 void dagmc_bank_push_( int* nbnk )
 {
-  if( ((unsigned)*nbnk) != history_bank.size() ){
-    std::cerr << "bank push size mismatch: F" << *nbnk << " C" << history_bank.size() << std::endl;
+  ParticleState& state = particle_state();
+  if( ((unsigned)*nbnk) != state.history_bank.size() ){
+    std::cerr << "bank push size mismatch: F" << *nbnk << " C" << state.history_bank.size() << std::endl;
   }
-  history_bank.push_back( history );
+  state.history_bank.push_back( state.history );
 
 #ifdef TRACE_DAGMC_CALLS
   std::cout << "bank_push (" << *nbnk+1 << ")" << std::endl;
@@ -759,13 +988,14 @@ void dagmc_bank_push_( int* nbnk )
 
 void dagmc_bank_usetop_( ) 
 {
+  ParticleState& state = particle_state();
 
 #ifdef TRACE_DAGMC_CALLS
   std::cout << "bank_usetop" << std::endl;
 #endif
 
-  if( history_bank.size() ){
-    history = history_bank.back();
+  if( state.history_bank.size() ){
+    state.history = state.history_bank.back();
   }
   else{
     std::cerr << "dagmc_bank_usetop_() called without bank history!" << std::endl;
@@ -774,13 +1004,14 @@ void dagmc_bank_usetop_( )
 
 void dagmc_bank_pop_( int* nbnk )
 {
+  ParticleState& state = particle_state();
 
-  if( ((unsigned)*nbnk) != history_bank.size() ){
-    std::cerr << "bank pop size mismatch: F" << *nbnk << " C" << history_bank.size() << std::endl;
+  if( ((unsigned)*nbnk) != state.history_bank.size() ){
+    std::cerr << "bank pop size mismatch: F" << *nbnk << " C" << state.history_bank.size() << std::endl;
   }
 
-  if( history_bank.size() ){
-    history_bank.pop_back( ); 
+  if( state.history_bank.size() ){
+    state.history_bank.pop_back( ); 
   }
 
 #ifdef TRACE_DAGMC_CALLS
@@ -791,7 +1022,8 @@ void dagmc_bank_pop_( int* nbnk )
 
 void dagmc_bank_clear_( )
 {
-  history_bank.clear();
+  ParticleState& state = particle_state();
+  state.history_bank.clear();
 #ifdef TRACE_DAGMC_CALLS
   std::cout << "bank_clear" << std::endl;
 #endif
@@ -799,18 +1031,20 @@ void dagmc_bank_clear_( )
 
 void dagmc_savpar_( int* n )
 {
+  ParticleState& state = particle_state();
 #ifdef TRACE_DAGMC_CALLS
-  std::cout << "savpar: " << *n << " ("<< history.size() << ")" << std::endl;
+  std::cout << "savpar: " << *n << " ("<< state.history.size() << ")" << std::endl;
 #endif
-  pblcm_history_stack[*n] = history;
+  state.pblcm_history_stack[*n] = state.history;
 }
 
 void dagmc_getpar_( int* n )
 {
+  ParticleState& state = particle_state();
 #ifdef TRACE_DAGMC_CALLS
-  std::cout << "getpar: " << *n << " (" << pblcm_history_stack[*n].size() << ")" << std::endl;
+  std::cout << "getpar: " << *n << " (" << state.pblcm_history_stack[*n].size() << ")" << std::endl;
 #endif
-  history = pblcm_history_stack[*n];
+  state.history = state.pblcm_history_stack[*n];
 }
 
 
@@ -842,7 +1076,8 @@ void dagmcvolume_(int* mxa, double* vols, int* mxj, double* aras)
 
 void dagmc_setdis_(double *d)
 {
-  dist_limit = *d;
+  ParticleState& state = particle_state();
+  state.dist_limit = *d;
 #ifdef TRACE_DAGMC_CALLS
   std::cout << "setdis: " << *d << std::endl;
 #endif
@@ -8,6 +8,11 @@ extern "C" {
 /* initialize DAGMC from FORTRAN main 
  * @param max_pbl - The maximum index of the pblcm (temporary particle state) array
  *                  This is the largest n that will arrive in calls to savpar and getpar
+ *
+ * With OpenMP, one particle state is created for each of omp_get_max_threads()
+ * threads, so the number of threads must be set before this is called and must
+ * not be increased later.  Particles must not be tracked in nested parallel
+ * regions; DAGMC exits with an error if either requirement is broken.
  */
   void dagmcinit_(char *cfile, int *clen,  
                   char *ftol,  int *ftlen, 
@@ -56,11 +61,24 @@ extern "C" {
 
   /* Point-in-volume query.  Determine if the particle at given coordinates
    * is inside or outside of cell i1.  Return j=1 if outside or on boundary,
-   * and j=0 if inside.  
+   * and j=0 if inside.  If a second cell is checked for the same point, all
+   * cells are searched at once, starting with the last cell a particle was
+   * found in and its neighbors, and later checks use that result.  The
+   * search assumes that cells do not overlap: a point inside two cells may
+   * be reported in a different one than MCNP's own cell order would give.
    */
   void dagmcchkcel_(double *uuu,double *vvv,double *www,double *xxx,
                     double *yyy,double *zzz, int *i1, int *j);
 
+/* Get the cells that share a surface with a cell
+ * *icl - Cell index
+ * *max_neighbors - Size of the neighbors array
+ * *neighbors - Output, indices of the neighboring cells
+ * *num_neighbors - Output, number of neighboring cells, which may be more 
+ *                  than *max_neighbors
+ */
+  void dagmc_cell_neighbors_( int *icl, int *max_neighbors, int *neighbors, int *num_neighbors );
+
 /* Determine distance to nearest surface
  * *ih - current RefVolume ID
  * *xxx, *yyy, *zzz - current point
@@ -9,6 +9,10 @@
 #include <cassert>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "meshtal_funcs.h"
 #include "TallyManager.hpp"
 
@@ -185,6 +189,11 @@ void dagmc_fmesh_setup_mesh_(int* fm_ipt, int* id, int* fmesh_idx,
         *is_collision_tally = false;
     } 
 
+#ifdef _OPENMP
+    // Allow all threads that MCNP may use to score events
+    tallyManager.setNumThreads(omp_get_max_threads());
+#endif
+
     tallyManager.addNewTally(*id, type, *fm_ipt, energy_boundaries, fc_settings);
 
     // Add tally multiplier, if it exists  
@@ -310,6 +319,20 @@ void dagmc_fmesh_add_scratch_to_error_(int* tally_id)
 //---------------------------------------------------------------------------//
 // ROUTINE FMESH METHODS
 //---------------------------------------------------------------------------//
+/**
+ * \brief Called from fortran when a particle history starts
+ * \param[in] nps the number of the particle history
+ *
+ * Sets the history number that is used to make tallies that need random
+ * numbers independent of how histories are divided between threads.  This
+ * should be called at the start of every history, before any events are
+ * scored.
+ */
+void dagmc_fmesh_start_history_(long long* nps)
+{
+    tallyManager.startHistory(*nps);
+}
+//---------------------------------------------------------------------------//
 /**
  * \brief Called from fortran when a particle history ends
  */
@@ -383,6 +406,54 @@ void dagmc_collision_score_(int* ipt,
     tallyManager.updateTallies();
 }
 //---------------------------------------------------------------------------//
+/**
+ * \brief Called from fortran to score a batch of track events
+ * \param[in] ipt the type of particle to be tallied
+ * \param[in] n the number of track events in each array
+ * \param[in] x, y, z the position of the particle for each track
+ * \param[in] u, v, w the direction of the particle for each track
+ * \param[in] erg the energy of the particle for each track
+ * \param[in] wgt the weight of the particle for each track
+ * \param[in] d the track length for each track
+ * \param[in] icl the current cell ID for each track
+ *
+ * Equivalent to calling dagmc_fmesh_score_ once for each track, using the
+ * current tally multiplier values for all of them.
+ */
+void dagmc_fmesh_score_batch_(int* ipt, int* n,
+                              double* x, double* y, double* z,
+                              double* u, double* v, double* w,
+                              double* erg, double* wgt,
+                              double* d, int* icl)
+{
+    if (*n <= 0) return;
+
+    tallyManager.scoreTrackEvents(*ipt, *n, x, y, z, u, v, w, erg, wgt, d, icl);
+}
+//---------------------------------------------------------------------------//
+/**
+ * \brief Called from fortran to score a batch of collision events
+ * \param[in] ipt the type of particle to be tallied
+ * \param[in] n the number of collision events in each array
+ * \param[in] x, y, z the position of the particle for each collision
+ * \param[in] erg the energy of the particle for each collision
+ * \param[in] wgt the weight of the particle for each collision
+ * \param[in] ple the total macroscopic cross section for each collision
+ * \param[in] icl the current cell ID for each collision
+ *
+ * Equivalent to calling dagmc_collision_score_ once for each collision, using
+ * the current tally multiplier values for all of them.
+ */
+void dagmc_collision_score_batch_(int* ipt, int* n,
+                                  double* x, double* y, double* z,
+                                  double* erg, double* wgt,
+                                  double* ple, int* icl)
+{
+    if (*n <= 0) return;
+
+    tallyManager.scoreCollisionEvents(*ipt, *n, x, y, z, erg, wgt, ple, icl);
+}
+//---------------------------------------------------------------------------//
 /**
  * \brief Called from fmesh_mod.F90 to update tally multipliers
  * \param[in] fmesh_idx the fmesh index for multiplier to be updated
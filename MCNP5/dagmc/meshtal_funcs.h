@@ -54,6 +54,8 @@ void dagmc_fmesh_setup_mesh_(int* fm_ipt, int* id, int* fmesh_idx,
                              double* energy_mesh, int* n_energy_mesh, int* tot_energy_bin, 
                              char* comment, int* n_comment_lines, int* is_collision_tally);
 
+void dagmc_fmesh_start_history_(long long* nps);
+
 void dagmc_fmesh_end_history_();
 
 void dagmc_fmesh_score_(int* ipt,
@@ -69,6 +71,17 @@ void dagmc_collision_score_(int* ipt,
                             double* erg, double* wgt,
                             double* ple, int* icl);
 
+void dagmc_fmesh_score_batch_(int* ipt, int* n,
+                              double* x, double* y, double* z,
+                              double* u, double* v, double* w,
+                              double* erg, double* wgt,
+                              double* d, int* icl);
+
+void dagmc_collision_score_batch_(int* ipt, int* n,
+                                  double* x, double* y, double* z,
+                                  double* erg, double* wgt,
+                                  double* ple, int* icl);
+
 void dagmc_update_multiplier_(int* fmesh_idx, double* value);
 
 void dagmc_fmesh_get_tally_data_(int* tally_id, void* fortran_data_pointer);
@@ -340,5 +340,91 @@ TEST_F(CellTallyTest, TallyMultiplier)
     EXPECT_DOUBLE_EQ(1578.631824, result.second);
 }
 //---------------------------------------------------------------------------//
+// Tests batch of track events gives same result as single track events
+TEST_F(CellTallyTest, TrackEventBatchScore)
+{
+    // three track events, only two of which are in cell 45
+    double zeros[] = {0.0, 0.0, 0.0};
+    double ones[] = {1.0, 1.0, 1.0};
+    double energies[] = {5.3, 5.3, 5.3};
+    int cells[] = {45, 10, 45};
+    double lengths[] = {2.8, 1.0, 0.5};
+
+    TallyEventBatch batch;
+    batch.type = TallyEvent::TRACK;
+    batch.num_events = 3;
+    batch.x = zeros;
+    batch.y = zeros;
+    batch.z = zeros;
+    batch.u = zeros;
+    batch.v = ones;
+    batch.w = zeros;
+    batch.particle_energy = energies;
+    batch.particle_weight = ones;
+    batch.track_length = lengths;
+    batch.current_cell = cells;
+
+    // Collision-based tally ignores track events
+    EXPECT_NO_THROW(cell_tally2->compute_scores(batch));
+    EXPECT_NO_THROW(cell_tally2->end_history());
+
+    const TallyData& data2 = cell_tally2->getTallyData();
+    std::pair<double, double> result = data2.get_data(0,0);
+    EXPECT_DOUBLE_EQ(0.0, result.first);
+    EXPECT_DOUBLE_EQ(0.0, result.second);
+
+    // Track-based tally
+    EXPECT_NO_THROW(cell_tally3->compute_scores(batch));
+    EXPECT_NO_THROW(cell_tally3->end_history());
+
+    const TallyData& data3 = cell_tally3->getTallyData();
+    result = data3.get_data(0,0);
+    EXPECT_DOUBLE_EQ(3.3,  result.first);
+    EXPECT_DOUBLE_EQ(10.89, result.second);
+}
+//---------------------------------------------------------------------------//
+// Tests batch of collision events with a different multiplier for each event
+TEST_F(CellTallyTest, CollisionEventBatchMultipliers)
+{
+    // Use a multiplier with the collision-based tally
+    delete cell_tally2;
+    input.tally_id = 2;
+    input.options.clear();
+    input.options.insert(std::make_pair("cell", "10"));
+    input.multiplier_id = 1;
+    cell_tally2 = new CellTally(input, TallyEvent::COLLISION);
+
+    // two collision events with two multipliers each
+    double zeros[] = {0.0, 0.0};
+    double energies[] = {5.3, 5.3};
+    double weights[] = {1.5, 1.5};
+    double cross_sections[] = {0.5, 0.5};
+    int cells[] = {10, 10};
+    double multipliers[] = {100.0, 1.0, 100.0, 2.0};
+
+    TallyEventBatch batch;
+    batch.type = TallyEvent::COLLISION;
+    batch.num_events = 2;
+    batch.x = zeros;
+    batch.y = zeros;
+    batch.z = zeros;
+    batch.particle_energy = energies;
+    batch.particle_weight = weights;
+    batch.total_cross_section = cross_sections;
+    batch.current_cell = cells;
+    batch.multipliers = multipliers;
+    batch.num_multipliers = 2;
+    batch.multiplier_stride = 2;
+
+    EXPECT_NO_THROW(cell_tally2->compute_scores(batch));
+    EXPECT_NO_THROW(cell_tally2->end_history());
+
+    // scores are (1.0 * 1.5 / 0.5) + (2.0 * 1.5 / 0.5)
+    const TallyData& data2 = cell_tally2->getTallyData();
+    std::pair<double, double> result = data2.get_data(0,0);
+    EXPECT_DOUBLE_EQ(9.0,  result.first);
+    EXPECT_DOUBLE_EQ(81.0, result.second);
+}
+//---------------------------------------------------------------------------//
 
 // end of MCNP5/dagmc/test/test_CellTally.cpp
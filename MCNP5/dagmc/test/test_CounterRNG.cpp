@@ -0,0 +1,129 @@
+// MCNP5/dagmc/test/test_CounterRNG.cpp
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../CounterRNG.hpp"
+
+//---------------------------------------------------------------------------//
+// SIMPLE TESTS
+//---------------------------------------------------------------------------//
+// Compares Philox4x32-10 output to the known-answer vectors that were
+// published with the Random123 library
+TEST(CounterRNGTest, PhiloxKnownAnswers)
+{
+    const uint32_t counters[3][4] = {
+        {0x00000000, 0x00000000, 0x00000000, 0x00000000},
+        {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+        {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}};
+
+    const uint32_t keys[3][2] = {
+        {0x00000000, 0x00000000},
+        {0xffffffff, 0xffffffff},
+        {0xa4093822, 0x299f31d0}};
+
+    const uint32_t expected[3][4] = {
+        {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+        {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+        {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+
+    for (int i = 0; i < 3; ++i)
+    {
+        uint32_t output[4];
+        CounterRNG::philox(counters[i], keys[i], output);
+
+        for (int j = 0; j < 4; ++j)
+        {
+            EXPECT_EQ(expected[i][j], output[j]);
+        }
+    }
+}
+//---------------------------------------------------------------------------//
+TEST(CounterRNGTest, UniformRange)
+{
+    CounterRNG rng(1, 0);
+    double sum = 0.0;
+    const int num_values = 100000;
+
+    for (int history = 0; history < 100; ++history)
+    {
+        for (int event = 0; event < 10; ++event)
+        {
+            rng.set_position(history, event);
+
+            for (int i = 0; i < num_values / 1000; ++i)
+            {
+                double value = rng.uniform();
+                EXPECT_GE(value, 0.0);
+                EXPECT_LT(value, 1.0);
+                sum += value;
+            }
+        }
+    }
+
+    // mean of uniform values should be close to 0.5
+    EXPECT_NEAR(0.5, sum / num_values, 0.005);
+}
+//---------------------------------------------------------------------------//
+// Tests that random numbers for an event only depend on the key and the
+// position, and not on any other random numbers that were generated before
+TEST(CounterRNGTest, ReproducibleInAnyOrder)
+{
+    const unsigned int num_events = 20;
+    const unsigned int num_values = 7;
+
+    // generate random numbers for all events in order
+    CounterRNG rng1(5, 12345);
+    std::vector<double> values;
+
+    for (unsigned int event = 0; event < num_events; ++event)
+    {
+        rng1.set_position(1000000000000ULL, event);
+
+        for (unsigned int i = 0; i < num_values; ++i)
+        {
+            values.push_back(rng1.uniform());
+        }
+    }
+
+    // generate them again in reverse order using a different generator
+    CounterRNG rng2(5, 12345);
+    rng2.uniform();
+
+    for (unsigned int event = num_events; event > 0; --event)
+    {
+        rng2.set_position(1000000000000ULL, event - 1);
+
+        for (unsigned int i = 0; i < num_values; ++i)
+        {
+            EXPECT_EQ(values[(event - 1) * num_values + i], rng2.uniform());
+        }
+    }
+}
+//---------------------------------------------------------------------------//
+TEST(CounterRNGTest, IndependentStreams)
+{
+    // every part of the key and position should change the random numbers
+    CounterRNG reference(1, 0);
+    reference.set_position(1, 0);
+    double value = reference.uniform();
+
+    CounterRNG other_stream(2, 0);
+    other_stream.set_position(1, 0);
+    EXPECT_NE(value, other_stream.uniform());
+
+    CounterRNG other_seed(1, 1);
+    other_seed.set_position(1, 0);
+    EXPECT_NE(value, other_seed.uniform());
+
+    CounterRNG other_position(1, 0);
+    other_position.set_position(1ULL << 32 | 1, 0);
+    EXPECT_NE(value, other_position.uniform());
+
+    other_position.set_position(1, 1);
+    EXPECT_NE(value, other_position.uniform());
+}
+//---------------------------------------------------------------------------//
+
+// end of MCNP5/dagmc/test/test_CounterRNG.cpp
@@ -1,5 +1,7 @@
 // MCNP5/dagmc/test/test_KDEKernel.cpp
 
+#include <cmath>
+
 #include "gtest/gtest.h"
 #include "../KDEKernel.hpp"
 
@@ -576,5 +578,41 @@ TEST_F(BoundaryKernel3DTest, InvalidKernelMomentsForVW)
     EXPECT_DOUBLE_EQ(0.0, value);
 }
 //---------------------------------------------------------------------------//
+TEST_F(BoundaryKernel3DTest, PolynomialKernelMatchesQuadrature)
+{
+    // epanechnikov kernel that computes its moments exactly
+    KDEKernel* polynomial_kernel = KDEKernel::createKernel("epanechnikov");
+    ASSERT_TRUE(polynomial_kernel != NULL);
+
+    // compare correction factors with moments computed using quadrature
+    for (int i = 0; i < 100; ++i)
+    {
+        u[0] = -1.0 + 0.02 * i;
+        u[1] = 0.8 - 0.017 * i;
+        u[2] = 0.3 * cos(0.5 * i);
+        p[0] = 0.013 * i;
+        p[1] = 1.2 - 0.011 * i;
+        p[2] = 0.5 + 0.3 * sin(0.9 * i);
+
+        for (int j = 0; j < 3; ++j)
+        {
+            sides[j] = (i + j) % 2;
+        }
+
+        for (unsigned int n = 1; n <= 3; ++n)
+        {
+            double expected = kernel->boundary_correction(&u[0], &p[0],
+                                                          &sides[0], n);
+
+            double value = polynomial_kernel->boundary_correction(&u[0], &p[0],
+                                                                  &sides[0], n);
+
+            EXPECT_NEAR(expected, value, 1e-9 * (1.0 + fabs(expected)));
+        }
+    }
+
+    delete polynomial_kernel;
+}
+//---------------------------------------------------------------------------//
 
 // end of MCNP5/dagmc/test/test_KDEKernel.cpp
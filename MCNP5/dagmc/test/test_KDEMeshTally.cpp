@@ -1,6 +1,7 @@
 // MCNP5/dagmc/test/test_KDEMeshTally.cpp
 
 #include <cmath>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -66,6 +67,15 @@ class KDEMeshTallyTest : public ::testing::Test
         return kde_tally->subtrack_score(X, points);
     }
 
+    // wrapper for the KDEMeshTally::choose_points method
+    std::vector<moab::CartVect> test_choose_points(unsigned int p,
+                                                   const TallyEvent& event)
+    {
+        std::vector<moab::CartVect> points;
+        kde_tally->choose_points(p, event, points);
+        return points;
+    }
+
     // wrapper for the KDEMeshTally::evaluate_kernel method
     double test_evaluate_kernel(const moab::CartVect& coords,
                                 const moab::CartVect& observation,                               
@@ -93,11 +103,45 @@ class KDEMeshTallyTest : public ::testing::Test
         kde_tally->bandwidth = new_bandwidth;
     }
 
+    // accessor method to get the current KDEMeshTally::bandwidth value
+    moab::CartVect get_bandwidth()
+    {
+        return kde_tally->bandwidth;
+    }
+
+    // accessor method to get the KDEMeshTally::discarded_histories value
+    long long int get_discarded_histories()
+    {
+        return kde_tally->discarded_histories;
+    }
+
+    // returns the sum of the tally and error data for all tally points
+    double get_data_total()
+    {
+        int length = 0;
+        double total = 0.0;
+        double* tally_data = kde_tally->data->get_tally_data(length);
+        double* error_data = kde_tally->data->get_error_data(length);
+
+        for (int i = 0; i < length; ++i)
+        {
+            total += tally_data[i] + error_data[i];
+        }
+
+        return total;
+    }
+
     // force KDEMeshTally::use_boundary_correction value to be true
     void force_boundary_correction()
     {
         kde_tally->use_boundary_correction = true;
     }
+
+    // force integral-track scores to be computed using quadrature
+    void force_quadrature()
+    {
+        kde_tally->kernel_polynomial.clear();
+    }
 };
 //---------------------------------------------------------------------------//
 // Tests the private integral_track_score method in KDEMeshTally
@@ -160,6 +204,30 @@ class KDECollisionTest : public KDEMeshTallyTest
     moab::CartVect calculation_point;
 };
 //---------------------------------------------------------------------------//
+// Helper function to compute the optimal bandwidth for a set of points
+moab::CartVect optimal_bandwidth(const std::vector<moab::CartVect>& points)
+{
+    int n = points.size();
+    moab::CartVect mean(0.0, 0.0, 0.0);
+    moab::CartVect bandwidth(0.0, 0.0, 0.0);
+
+    for (int j = 0; j < n; ++j) mean += points[j] / n;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        double variance = 0.0;
+
+        for (int j = 0; j < n; ++j)
+        {
+            variance += pow(points[j][i] - mean[i], 2) / (n - 1);
+        }
+
+        bandwidth[i] = 0.968625 * sqrt(variance) * pow(double(n), -1.0/7.0);
+    }
+
+    return bandwidth;
+}
+//---------------------------------------------------------------------------//
 // SIMPLE TESTS
 //---------------------------------------------------------------------------//
 TEST(KDEMeshTallyDeathTest, MissingInputMesh)
@@ -237,6 +305,98 @@ TEST_F(KDEMeshTallyTest, InvalidBandwidth)
     EXPECT_NO_THROW(kde_tally = new KDEMeshTally(input, type));
 }
 //---------------------------------------------------------------------------//
+TEST_F(KDEMeshTallyTest, AdaptiveBandwidth)
+{
+    // switch to optimal bandwidth after two histories
+    input.options.insert(std::make_pair("adaptive", "2"));
+    kde_tally = new KDEMeshTally(input, KDEMeshTally::COLLISION);
+
+    // set up collision points for two histories
+    std::vector<moab::CartVect> points;
+    points.push_back(moab::CartVect(1.0, 0.0, 0.0));
+    points.push_back(moab::CartVect(2.0, 0.2, -0.1));
+    points.push_back(moab::CartVect(3.0, -0.2, 0.1));
+    points.push_back(moab::CartVect(4.0, 0.1, 0.3));
+
+    TallyEvent event;
+    event.type = TallyEvent::COLLISION;
+    event.total_cross_section = 1.0;
+    event.particle_energy = 5.0;
+    event.particle_weight = 1.0;
+
+    for (unsigned int i = 0; i < points.size(); ++i)
+    {
+        event.position = points[i];
+        kde_tally->compute_score(event);
+
+        if (i % 2 == 0) continue;
+
+        // verify bandwidth is only changed after the last warm-up history
+        for (int j = 0; j < 3; ++j)
+        {
+            EXPECT_DOUBLE_EQ(0.1, get_bandwidth()[j]);
+        }
+
+        kde_tally->end_history();
+    }
+
+    moab::CartVect expected = optimal_bandwidth(points);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        EXPECT_DOUBLE_EQ(expected[i], get_bandwidth()[i]);
+    }
+
+    // verify scores from the warm-up histories were discarded
+    EXPECT_DOUBLE_EQ(0.0, get_data_total());
+    EXPECT_EQ(2, get_discarded_histories());
+
+    // verify bandwidth is not changed again by later histories
+    event.position = moab::CartVect(0.5, -0.4, 0.4);
+    kde_tally->compute_score(event);
+    kde_tally->end_history();
+
+    for (int i = 0; i < 3; ++i)
+    {
+        EXPECT_DOUBLE_EQ(expected[i], get_bandwidth()[i]);
+    }
+
+    EXPECT_EQ(2, get_discarded_histories());
+}
+//---------------------------------------------------------------------------//
+// Tests that integral-track tallies use the track midpoints
+TEST_F(KDEMeshTallyTest, AdaptiveBandwidthForTracks)
+{
+    // switch to optimal bandwidth after one history
+    input.options.insert(std::make_pair("adaptive", "1"));
+    kde_tally = new KDEMeshTally(input, KDEMeshTally::INTEGRAL_TRACK);
+
+    // set up tracks in the z = 0 plane
+    TallyEvent event;
+    event.type = TallyEvent::TRACK;
+    event.direction = moab::CartVect(1.0, 0.0, 0.0);
+    event.track_length = 1.0;
+    event.particle_energy = 5.0;
+    event.particle_weight = 1.0;
+
+    std::vector<moab::CartVect> midpoints;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        event.position = moab::CartVect(i, 0.1 * i * i, 0.0);
+        kde_tally->compute_score(event);
+        midpoints.push_back(event.position + moab::CartVect(0.5, 0.0, 0.0));
+    }
+
+    kde_tally->end_history();
+
+    // verify initial value of hz is kept as all midpoints have z = 0
+    moab::CartVect expected = optimal_bandwidth(midpoints);
+    EXPECT_DOUBLE_EQ(expected[0], get_bandwidth()[0]);
+    EXPECT_DOUBLE_EQ(expected[1], get_bandwidth()[1]);
+    EXPECT_DOUBLE_EQ(0.1, get_bandwidth()[2]);
+}
+//---------------------------------------------------------------------------//
 // FIXTURE-BASED TESTS: KDEIntegralTrackTest
 //---------------------------------------------------------------------------//
 // Tests cases that have a valid [Smin, Smax] interval with Smin != Smax
@@ -369,6 +529,62 @@ TEST_F(KDEIntegralTrackTest, InvalidLimits)
     EXPECT_DOUBLE_EQ(0.0, test_integral_track_score(coords5, event));
 }
 //---------------------------------------------------------------------------//
+// Tests exact integration of polynomial kernels matches quadrature results
+TEST_F(KDEIntegralTrackTest, ExactIntegrationMatchesQuadrature)
+{
+    // set up tally event
+    TallyEvent event;
+    event.type = TallyEvent::TRACK;
+    event.position = moab::CartVect(-0.1, 0.2, 0.05);
+    event.direction = moab::CartVect(0.6, -0.3, sqrt(0.55));
+    event.track_length = 0.4;
+
+    const char* kernel_types[] = {"uniform", "epanechnikov",
+                                  "biweight", "triweight"};
+
+    const char* kernel_orders[] = {"2", "4", "6"};
+
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            // create kde mesh tally with the next kernel
+            delete kde_tally;
+            input.options.erase("kernel");
+            input.options.erase("order");
+            input.options.insert(std::make_pair("kernel", kernel_types[i]));
+            input.options.insert(std::make_pair("order", kernel_orders[j]));
+            kde_tally = new KDEMeshTally(input, KDEMeshTally::INTEGRAL_TRACK);
+            change_bandwidth(moab::CartVect(0.1, 0.15, 0.2));
+
+            // compute exact scores for calculation points near the track
+            std::vector<moab::CartVect> coords;
+            std::vector<double> exact_scores;
+
+            for (int k = 0; k < 100; ++k)
+            {
+                double s = 0.005 * k;
+                coords.push_back(event.position + s * event.direction
+                    + moab::CartVect(0.1 * cos(1.3 * k),
+                                     0.12 * sin(0.7 * k),
+                                     0.15 * cos(2.1 * k)));
+
+                exact_scores.push_back(test_integral_track_score(coords[k],
+                                                                 event));
+            }
+
+            // test quadrature gives the same scores
+            force_quadrature();
+
+            for (int k = 0; k < 100; ++k)
+            {
+                double score = test_integral_track_score(coords[k], event);
+                EXPECT_NEAR(score, exact_scores[k], 1e-9 * (1.0 + fabs(score)));
+            }
+        }
+    }
+}
+//---------------------------------------------------------------------------//
 // FIXTURE-BASED TESTS: KDESubtrackTest
 //---------------------------------------------------------------------------//
 TEST_F(KDESubtrackTest, NoSubtracks)
@@ -438,6 +654,58 @@ TEST_F(KDESubtrackTest, MultipleSubtracks)
     EXPECT_NEAR(143.051063, test_subtrack_score(coords6, points), 1e-6);
 }
 //---------------------------------------------------------------------------//
+// Tests that sub-track points only depend on the tally, history and event
+TEST_F(KDESubtrackTest, ReproduciblePoints)
+{
+    // set up tally event
+    TallyEvent event;
+    event.type = TallyEvent::TRACK;
+    event.position = moab::CartVect(0.0, 0.0, 0.0);
+    event.direction = moab::CartVect(1.0, 0.0, 0.0);
+    event.track_length = 3.0;
+    event.history = 42;
+    event.event_index = 3;
+
+    std::vector<moab::CartVect> points1 = test_choose_points(3, event);
+    ASSERT_EQ(3u, points1.size());
+
+    // verify one point is chosen from each sub-track
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        EXPECT_GE(points1[i][0], i);
+        EXPECT_LT(points1[i][0], i + 1.0);
+        EXPECT_DOUBLE_EQ(0.0, points1[i][1]);
+        EXPECT_DOUBLE_EQ(0.0, points1[i][2]);
+    }
+
+    // verify different points are chosen for a different event or history
+    event.event_index = 4;
+    std::vector<moab::CartVect> points2 = test_choose_points(3, event);
+    EXPECT_NE(points1[0][0], points2[0][0]);
+
+    event.event_index = 3;
+    event.history = 43;
+    std::vector<moab::CartVect> points3 = test_choose_points(3, event);
+    EXPECT_NE(points1[0][0], points3[0][0]);
+
+    // verify the same points are chosen again for the original event
+    event.history = 42;
+    std::vector<moab::CartVect> points4 = test_choose_points(3, event);
+
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(points1[i][0], points4[i][0]);
+    }
+
+    // verify different points are chosen by a tally with a different seed
+    delete kde_tally;
+    input.options.insert(std::make_pair("seed", "12345"));
+    kde_tally = new KDEMeshTally(input, KDEMeshTally::SUB_TRACK);
+
+    std::vector<moab::CartVect> points5 = test_choose_points(3, event);
+    EXPECT_NE(points1[0][0], points5[0][0]);
+}
+//---------------------------------------------------------------------------//
 // FIXTURE-BASED TESTS: KDECollisionTest
 //---------------------------------------------------------------------------//
 // Tests standard evaluate method for different calculation points
@@ -1,8 +1,10 @@
 // MCNP5/dagmc/test/test_KDENeighborhood.cpp
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <set>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -30,20 +32,68 @@ void load_default_mesh(moab::Interface* mbi, moab::Range& mesh_nodes)
     assert(rval == moab::MB_SUCCESS);
 }
 //---------------------------------------------------------------------------//
-// check all points are valid for given neighborhood region
-bool check_all_points(const KDENeighborhood& region,
+// check all points are calculation points in the given neighborhood region
+bool check_all_points(const std::vector<unsigned int>& calculation_points,
+                      const moab::Range& mesh_nodes,
                       const std::set<moab::EntityHandle>& points)
 {
     std::set<moab::EntityHandle>::iterator it;
 
     for (it = points.begin(); it != points.end(); ++it)
     {
-        if (!region.is_calculation_point(*it)) return false;
+        unsigned int index = mesh_nodes.index(*it);
+
+        if (!std::binary_search(calculation_points.begin(),
+                                calculation_points.end(),
+                                index))
+        {
+            return false;
+        }
     }
 
     return true;
 }
 //---------------------------------------------------------------------------//
+// check calculation points are sorted by index with no duplicates
+bool check_sorted(const std::vector<unsigned int>& calculation_points)
+{
+    for (unsigned int i = 1; i < calculation_points.size(); ++i)
+    {
+        if (calculation_points[i - 1] >= calculation_points[i]) return false;
+    }
+
+    return true;
+}
+//---------------------------------------------------------------------------//
+// check point is within one bandwidth box of some point on the track
+bool point_near_track(const TallyEvent& event,
+                      const moab::CartVect& bandwidth,
+                      const double* coords)
+{
+    // sample the track at intervals of at most 0.005
+    int num_samples = 500;
+
+    for (int n = 0; n <= num_samples; ++n)
+    {
+        double s = event.track_length * n / num_samples;
+        bool inside_box = true;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            double center = event.position[i] + s * event.direction[i];
+
+            if (fabs(coords[i] - center) > bandwidth[i])
+            {
+                inside_box = false;
+            }
+        }
+
+        if (inside_box) return true;
+    }
+
+    return false;
+}
+//---------------------------------------------------------------------------//
 // TEST FIXTURES
 //---------------------------------------------------------------------------//
 class GetPointsTest : public ::testing::Test
@@ -55,12 +105,12 @@ class GetPointsTest : public ::testing::Test
         mbi = new moab::Core();
 
         // load the default mesh and get all mesh nodes
-        moab::Range mesh_nodes;
         load_default_mesh(mbi, mesh_nodes);
 
-        // create neighborhood regions with and without kd-trees
-        region1 = new KDENeighborhood(mbi, mesh_nodes, false);
-        region2 = new KDENeighborhood(mbi, mesh_nodes, true);
+        // create neighborhood regions with each search method
+        region1 = new KDENeighborhood(mbi, mesh_nodes, KDENeighborhood::ALL_POINTS);
+        region2 = new KDENeighborhood(mbi, mesh_nodes, KDENeighborhood::KD_TREE);
+        region3 = new KDENeighborhood(mbi, mesh_nodes, KDENeighborhood::GRID);
     }
 
     // deallocate memory resources
@@ -69,13 +119,19 @@ class GetPointsTest : public ::testing::Test
         delete mbi;
         delete region1;
         delete region2;
+        delete region3;
     }
 
   protected:
     // data needed for each test
     moab::Interface* mbi;
+    moab::Range mesh_nodes;
     KDENeighborhood* region1;
     KDENeighborhood* region2;
+    KDENeighborhood* region3;
+    std::vector<unsigned int> points1;
+    std::vector<unsigned int> points2;
+    std::vector<unsigned int> points3;
 };
 //---------------------------------------------------------------------------//
 class IsCalculationPointTest : public ::testing::Test
@@ -122,10 +178,10 @@ TEST(KDENeighborhoodDeathTest, NullMOABInstance)
     moab::Range mesh_nodes;
 
     // check no errors occur if the kd-tree is set to off
-    EXPECT_NO_THROW(KDENeighborhood(mbi, mesh_nodes, false));
+    EXPECT_NO_THROW(KDENeighborhood(mbi, mesh_nodes, KDENeighborhood::ALL_POINTS));
 
     // check program exits if kd-tree is set on with NULL MOAB instance
-    EXPECT_EXIT(KDENeighborhood(mbi, mesh_nodes, true),
+    EXPECT_EXIT(KDENeighborhood(mbi, mesh_nodes, KDENeighborhood::KD_TREE),
                 ::testing::ExitedWithCode(EXIT_FAILURE),
                 "\nError: invalid moab::Interface for building KD-tree");
 }
@@ -148,16 +204,14 @@ TEST(KDENeighborhoodDeathTest, InvalidTallyEvent)
     event.type = TallyEvent::NONE;
     
     // create neighborhood regions with and without kd-trees
-    KDENeighborhood region1(mbi, mesh_nodes, false);
-    KDENeighborhood region2(mbi, mesh_nodes, true);
-
-    // check default number of points
-    EXPECT_EQ(2025, region1.get_points().size());
-    EXPECT_EQ(0, region2.get_points().size());
+    KDENeighborhood region1(mbi, mesh_nodes, KDENeighborhood::ALL_POINTS);
+    KDENeighborhood region2(mbi, mesh_nodes, KDENeighborhood::KD_TREE);
 
     // check NULL tally event behavior
-    EXPECT_NO_THROW(region1.update_neighborhood(event, bandwidth));
-    EXPECT_EXIT(region2.update_neighborhood(event, bandwidth),
+    std::vector<unsigned int> points;
+    EXPECT_NO_THROW(region1.update_neighborhood(event, bandwidth, points));
+    EXPECT_EQ(2025, points.size());
+    EXPECT_EXIT(region2.update_neighborhood(event, bandwidth, points),
                 ::testing::ExitedWithCode(EXIT_FAILURE),
                  "\nError: Could not define neighborhood for tally event");
 }
@@ -176,17 +230,25 @@ TEST(KDENeighborhoodTest, NoMeshNodes)
     moab::Range mesh_nodes;
 
     // make sure no errors occur on construction with or without kd-tree
-    EXPECT_NO_THROW(KDENeighborhood(mbi, mesh_nodes, false));
-    EXPECT_NO_THROW(KDENeighborhood(mbi, mesh_nodes, true));
+    EXPECT_NO_THROW(KDENeighborhood(mbi, mesh_nodes, KDENeighborhood::ALL_POINTS));
+    EXPECT_NO_THROW(KDENeighborhood(mbi, mesh_nodes, KDENeighborhood::KD_TREE));
 
-    // check default number of points in region1
-    KDENeighborhood region1(mbi, mesh_nodes, false);
-    std::set<moab::EntityHandle> points1 = region1.get_points();
+    // define neighborhood based on collision event
+    TallyEvent event;
+    event.type = TallyEvent::COLLISION;
+    event.position = moab::CartVect(0.0, 0.0, 0.0);
+    moab::CartVect bandwidth(0.1, 0.1, 0.1);
+
+    // check number of points in region1
+    KDENeighborhood region1(mbi, mesh_nodes, KDENeighborhood::ALL_POINTS);
+    std::vector<unsigned int> points1(10, 0);
+    region1.update_neighborhood(event, bandwidth, points1);
     EXPECT_EQ(0, points1.size());
 
-    // check default number of points in region2
-    KDENeighborhood region2(mbi, mesh_nodes, true);
-    std::set<moab::EntityHandle> points2 = region2.get_points();
+    // check number of points in region2
+    KDENeighborhood region2(mbi, mesh_nodes, KDENeighborhood::KD_TREE);
+    std::vector<unsigned int> points2(10, 0);
+    region2.update_neighborhood(event, bandwidth, points2);
     EXPECT_EQ(0, points2.size());
 }
 //---------------------------------------------------------------------------//
@@ -200,12 +262,14 @@ TEST_F(GetPointsTest, GetAllPointsInBox)
     event.type = TallyEvent::COLLISION;
     event.position = moab::CartVect(2.5, 0.0, 0.0);
     moab::CartVect bandwidth(2.5, 0.5, 0.5);
-    region1->update_neighborhood(event, bandwidth);
-    region2->update_neighborhood(event, bandwidth);
-
-    // test region1 and region2 return all points
-    EXPECT_EQ(2025, region1->get_points().size());
-    EXPECT_EQ(2025, region2->get_points().size());
+    region1->update_neighborhood(event, bandwidth, points1);
+    region2->update_neighborhood(event, bandwidth, points2);
+    region3->update_neighborhood(event, bandwidth, points3);
+
+    // test region1, region2 and region3 return all points
+    EXPECT_EQ(2025, points1.size());
+    EXPECT_EQ(2025, points2.size());
+    EXPECT_TRUE(points2 == points3);
     
     // change to a conformal neighborhood based on track event
     event.type = TallyEvent::TRACK;
@@ -213,12 +277,14 @@ TEST_F(GetPointsTest, GetAllPointsInBox)
     event.direction = moab::CartVect(1.0, 0.0, 0.0);
     event.track_length = 1.0;
     bandwidth[0] = 2.0;
-    region1->update_neighborhood(event, bandwidth);
-    region2->update_neighborhood(event, bandwidth);
-
-    // test region1 and region2 return all points
-    EXPECT_EQ(2025, region1->get_points().size());
-    EXPECT_EQ(2025, region2->get_points().size());
+    region1->update_neighborhood(event, bandwidth, points1);
+    region2->update_neighborhood(event, bandwidth, points2);
+    region3->update_neighborhood(event, bandwidth, points3);
+
+    // test region1, region2 and region3 return all points
+    EXPECT_EQ(2025, points1.size());
+    EXPECT_EQ(2025, points2.size());
+    EXPECT_TRUE(points2 == points3);
 }
 //---------------------------------------------------------------------------//
 // Tests no points are returned if neighborhood exists outside mesh
@@ -229,23 +295,27 @@ TEST_F(GetPointsTest, GetNoPointsOutsideBox)
     event.type = TallyEvent::COLLISION;
     event.position = moab::CartVect(-5.0, 0.0, 0.0);
     moab::CartVect bandwidth(1.0, 0.5, 0.5);
-    region1->update_neighborhood(event, bandwidth);
-    region2->update_neighborhood(event, bandwidth);
+    region1->update_neighborhood(event, bandwidth, points1);
+    region2->update_neighborhood(event, bandwidth, points2);
+    region3->update_neighborhood(event, bandwidth, points3);
 
-    // test region1 still returns all points and region2 returns no points
-    EXPECT_EQ(2025, region1->get_points().size());
-    EXPECT_EQ(0, region2->get_points().size());
+    // test region1 still returns all points and region2, region3 return none
+    EXPECT_EQ(2025, points1.size());
+    EXPECT_EQ(0, points2.size());
+    EXPECT_EQ(0, points3.size());
 
     // change to neighborhood based on track event
     event.type = TallyEvent::TRACK;
     event.direction = moab::CartVect(1.0, 0.0, 0.0);
     event.track_length = 1.0;
-    region1->update_neighborhood(event, bandwidth);
-    region2->update_neighborhood(event, bandwidth);
+    region1->update_neighborhood(event, bandwidth, points1);
+    region2->update_neighborhood(event, bandwidth, points2);
+    region3->update_neighborhood(event, bandwidth, points3);
 
-    // test region1 still returns all points and region2 returns no points
-    EXPECT_EQ(2025, region1->get_points().size());
-    EXPECT_EQ(0, region2->get_points().size());
+    // test region1 still returns all points and region2, region3 return none
+    EXPECT_EQ(2025, points1.size());
+    EXPECT_EQ(0, points2.size());
+    EXPECT_EQ(0, points3.size());
 }
 //---------------------------------------------------------------------------//
 // Tests no points are returned if mesh cell is bigger than neighborhood
@@ -256,23 +326,27 @@ TEST_F(GetPointsTest, GetNoPointsInBox)
     event.type = TallyEvent::COLLISION;
     event.position = moab::CartVect(2.6, -0.06, 0.06);
     moab::CartVect bandwidth(0.05, 0.05, 0.05);
-    region1->update_neighborhood(event, bandwidth);
-    region2->update_neighborhood(event, bandwidth);
+    region1->update_neighborhood(event, bandwidth, points1);
+    region2->update_neighborhood(event, bandwidth, points2);
+    region3->update_neighborhood(event, bandwidth, points3);
 
-    // test region1 still returns all points and region2 returns no points
-    EXPECT_EQ(2025, region1->get_points().size());
-    EXPECT_EQ(0, region2->get_points().size());
+    // test region1 still returns all points and region2, region3 return none
+    EXPECT_EQ(2025, points1.size());
+    EXPECT_EQ(0, points2.size());
+    EXPECT_EQ(0, points3.size());
 
     // change to neighborhood based on track event
     event.type = TallyEvent::TRACK;
     event.direction = moab::CartVect(1.0, 0.0, 0.0);
     event.track_length = 0.1;
-    region1->update_neighborhood(event, bandwidth);
-    region2->update_neighborhood(event, bandwidth);
+    region1->update_neighborhood(event, bandwidth, points1);
+    region2->update_neighborhood(event, bandwidth, points2);
+    region3->update_neighborhood(event, bandwidth, points3);
 
-    // test region1 still returns all points and region2 returns no points
-    EXPECT_EQ(2025, region1->get_points().size());
-    EXPECT_EQ(0, region2->get_points().size());
+    // test region1 still returns all points and region2, region3 return none
+    EXPECT_EQ(2025, points1.size());
+    EXPECT_EQ(0, points2.size());
+    EXPECT_EQ(0, points3.size());
 }
 //---------------------------------------------------------------------------//
 // Tests correct points are returned for normal cases
@@ -286,29 +360,248 @@ TEST_F(GetPointsTest, GetPointsInBox)
     event.direction = moab::CartVect(uvw_val, 0.0, -1.0 * uvw_val);
     event.track_length = 2.3;
     moab::CartVect bandwidth(0.2, 0.2, 0.2);
-    region1->update_neighborhood(event, bandwidth);
-    region2->update_neighborhood(event, bandwidth);
+    region1->update_neighborhood(event, bandwidth, points1);
+    region2->update_neighborhood(event, bandwidth, points2);
+    region3->update_neighborhood(event, bandwidth, points3);
 
     // test region1 still returns all points
-    EXPECT_EQ(2025, region1->get_points().size());
+    EXPECT_EQ(2025, points1.size());
 
-    // test number of points returned by region2 and check all are valid
-    std::set<moab::EntityHandle> points1 = region2->get_points();
-    EXPECT_EQ(320, points1.size());
-    EXPECT_TRUE(check_all_points(*region2, points1));
+    // test points returned by region2 are sorted and match region3
+    EXPECT_EQ(120, points2.size());
+    EXPECT_TRUE(check_sorted(points2));
+    EXPECT_TRUE(points2 == points3);
 
     // change to neighborhood based on collision event (region inside mesh)
     event.type = TallyEvent::COLLISION;
-    region1->update_neighborhood(event, bandwidth);
-    region2->update_neighborhood(event, bandwidth);
+    region1->update_neighborhood(event, bandwidth, points1);
+    region2->update_neighborhood(event, bandwidth, points2);
+    region3->update_neighborhood(event, bandwidth, points3);
 
     // test region1 still returns all points
-    EXPECT_EQ(2025, region1->get_points().size());
+    EXPECT_EQ(2025, points1.size());
+
+    // test points returned by region2 are sorted and match region3
+    EXPECT_EQ(32, points2.size());
+    EXPECT_TRUE(check_sorted(points2));
+    EXPECT_TRUE(points2 == points3);
+}
+//---------------------------------------------------------------------------//
+// Tests calculation points are indices of the mesh nodes inside the box
+TEST_F(GetPointsTest, GetPointIndices)
+{
+    // define neighborhood using a collision event (region inside mesh)
+    TallyEvent event;
+    event.type = TallyEvent::COLLISION;
+    event.position = moab::CartVect(0.2, -0.2, 0.2);
+    moab::CartVect bandwidth(0.2, 0.2, 0.2);
+    region2->update_neighborhood(event, bandwidth, points2);
+
+    // count mesh nodes inside the box using their MOAB coordinates
+    std::set<unsigned int> expected_points;
+    unsigned int index = 0;
+    moab::Range::iterator it;
+
+    for (it = mesh_nodes.begin(); it != mesh_nodes.end(); ++it, ++index)
+    {
+        moab::CartVect coords;
+        moab::EntityHandle point = *it;
+        mbi->get_coords(&point, 1, coords.array());
+
+        bool inside_box = true;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            double min = event.position[i] - bandwidth[i];
+            double max = event.position[i] + bandwidth[i];
+
+            if (coords[i] < min - 1e-12 || coords[i] > max + 1e-12)
+            {
+                inside_box = false;
+            }
+        }
+
+        if (inside_box) expected_points.insert(index);
+    }
+
+    // test region2 returns the indices of exactly these mesh nodes
+    EXPECT_EQ(32, expected_points.size());
+    std::vector<unsigned int> expected(expected_points.begin(),
+                                       expected_points.end());
+    EXPECT_TRUE(expected == points2);
+}
+//---------------------------------------------------------------------------//
+// Tests grid search is used for the structured mesh
+TEST_F(GetPointsTest, GridSearchMethod)
+{
+    EXPECT_EQ(KDENeighborhood::ALL_POINTS, region1->get_search_method());
+    EXPECT_EQ(KDENeighborhood::KD_TREE, region2->get_search_method());
+    EXPECT_EQ(KDENeighborhood::GRID, region3->get_search_method());
+
+    // compare grid and kd-tree search for a set of collision events
+    TallyEvent event;
+    event.type = TallyEvent::COLLISION;
+    moab::CartVect bandwidth(0.3, 0.15, 0.25);
+
+    for (int i = 0; i < 50; ++i)
+    {
+        event.position = moab::CartVect(-0.5 + 0.13 * i,
+                                        -0.6 + 0.029 * i,
+                                         0.6 - 0.031 * i);
+
+        region2->update_neighborhood(event, bandwidth, points2);
+        region3->update_neighborhood(event, bandwidth, points3);
+        EXPECT_TRUE(points2 == points3);
+    }
+}
+//---------------------------------------------------------------------------//
+// Tests grid and kd-tree search agree for mesh nodes on the box boundaries
+TEST_F(GetPointsTest, GridSearchOnBoxFaces)
+{
+    // get coordinates of all mesh nodes
+    std::vector<double> coords(3 * mesh_nodes.size());
+    mbi->get_coords(mesh_nodes, &coords[0]);
+
+    // move box faces onto mesh nodes, and to either side of the tolerance
+    const double offsets[5] = {0.0, 1e-12, -1e-12, 0.5e-12, -0.5e-12};
+    moab::CartVect bandwidth(0.25, 0.2, 0.15);
+    TallyEvent event;
+
+    for (int i = 0; i < 100; ++i)
+    {
+        const double* node1 = &coords[3 * ((37 * i) % mesh_nodes.size())];
+        const double* node2 = &coords[3 * ((101 * i + 7) % mesh_nodes.size())];
+        double offset = offsets[i % 5];
+
+        // collision event with min x face and max y face on mesh nodes
+        event.type = TallyEvent::COLLISION;
+        event.position = moab::CartVect(node1[0] + bandwidth[0] + offset,
+                                        node2[1] - bandwidth[1] - offset,
+                                        node1[2] + bandwidth[2]);
+
+        region2->update_neighborhood(event, bandwidth, points2);
+        region3->update_neighborhood(event, bandwidth, points3);
+        EXPECT_TRUE(points2 == points3);
+
+        // track event starting with its min x face on a mesh node
+        event.type = TallyEvent::TRACK;
+        event.position = moab::CartVect(node1[0] + bandwidth[0] + offset,
+                                        node1[1],
+                                        node2[2] - bandwidth[2] + offset);
+
+        event.direction = moab::CartVect(i % 3 - 1.0, 0.3 * (i % 7 - 3), 0.5);
+        event.direction.normalize();
+        event.track_length = 0.05 * (i % 13);
+
+        region2->update_neighborhood(event, bandwidth, points2);
+        region3->update_neighborhood(event, bandwidth, points3);
+        EXPECT_TRUE(points2 == points3);
+    }
+}
+//---------------------------------------------------------------------------//
+// Tests only points inside the region swept along a track are returned
+TEST_F(GetPointsTest, SweptTrackRegion)
+{
+    // get coordinates of all mesh nodes
+    std::vector<double> coords(3 * mesh_nodes.size());
+    mbi->get_coords(mesh_nodes, &coords[0]);
+
+    // compare grid and kd-tree search for a set of diagonal tracks
+    TallyEvent event;
+    event.type = TallyEvent::TRACK;
+    moab::CartVect bandwidth(0.3, 0.15, 0.25);
+
+    for (int i = 0; i < 20; ++i)
+    {
+        event.position = moab::CartVect(-0.5 + 0.29 * i,
+                                        -0.6 + 0.061 * i,
+                                         0.6 - 0.059 * i);
+
+        event.direction = moab::CartVect(cos(0.7 * i), sin(0.7 * i), 0.3 * i - 3.0);
+        event.direction.normalize();
+        event.track_length = 0.4 + 0.1 * i;
+
+        region2->update_neighborhood(event, bandwidth, points2);
+        region3->update_neighborhood(event, bandwidth, points3);
+        EXPECT_TRUE(check_sorted(points2));
+        EXPECT_TRUE(points2 == points3);
+
+        // test no points that are well inside the swept region are missing
+        moab::CartVect smaller_bandwidth = bandwidth - moab::CartVect(0.01);
+        unsigned int num_missing = 0;
+
+        for (unsigned int j = 0; j < mesh_nodes.size(); ++j)
+        {
+            if (point_near_track(event, smaller_bandwidth, &coords[3 * j]) &&
+                !std::binary_search(points2.begin(), points2.end(), j))
+            {
+                ++num_missing;
+            }
+        }
+
+        EXPECT_EQ(0, num_missing);
+
+        // test all points returned are close to the swept region
+        moab::CartVect bigger_bandwidth = bandwidth + moab::CartVect(0.01);
+
+        for (unsigned int j = 0; j < points2.size(); ++j)
+        {
+            EXPECT_TRUE(point_near_track(event, bigger_bandwidth,
+                                         &coords[3 * points2[j]]));
+        }
+    }
+}
+//---------------------------------------------------------------------------//
+// Tests the buffer of calculation points is reused for each tally event
+TEST_F(GetPointsTest, ReusePointBuffer)
+{
+    // define neighborhood that includes all points
+    TallyEvent event;
+    event.type = TallyEvent::COLLISION;
+    event.position = moab::CartVect(2.5, 0.0, 0.0);
+    moab::CartVect bandwidth(2.5, 0.5, 0.5);
+    region2->update_neighborhood(event, bandwidth, points2);
+
+    EXPECT_EQ(2025, points2.size());
+    const unsigned int* buffer = &points2[0];
+    unsigned int capacity = points2.capacity();
+
+    // change to a smaller neighborhood and check buffer was not reallocated
+    event.position = moab::CartVect(0.2, -0.2, 0.2);
+    bandwidth = moab::CartVect(0.2, 0.2, 0.2);
+    region2->update_neighborhood(event, bandwidth, points2);
 
-    // test number of points returned by region2 and check all are valid
-    std::set<moab::EntityHandle> points2 = region2->get_points();
     EXPECT_EQ(32, points2.size());
-    EXPECT_TRUE(check_all_points(*region2, points2));
+    EXPECT_EQ(capacity, points2.capacity());
+    EXPECT_EQ(buffer, &points2[0]);
+    EXPECT_TRUE(check_sorted(points2));
+}
+//---------------------------------------------------------------------------//
+// Tests the same points are returned using coordinates given by the caller
+TEST_F(GetPointsTest, GivenNodeCoords)
+{
+    std::vector<double> coords(3 * mesh_nodes.size());
+    mbi->get_coords(mesh_nodes, &coords[0]);
+
+    KDENeighborhood region4(mbi, mesh_nodes, KDENeighborhood::KD_TREE, &coords);
+    KDENeighborhood region5(mbi, mesh_nodes, KDENeighborhood::GRID, &coords);
+    EXPECT_EQ(KDENeighborhood::GRID, region5.get_search_method());
+
+    TallyEvent event;
+    event.type = TallyEvent::COLLISION;
+    moab::CartVect bandwidth(0.3, 0.15, 0.25);
+    std::vector<unsigned int> points4, points5;
+
+    for (int i = 0; i < 10; ++i)
+    {
+        event.position = moab::CartVect(-0.5 + 0.6 * i, -0.2, 0.1);
+
+        region2->update_neighborhood(event, bandwidth, points2);
+        region4.update_neighborhood(event, bandwidth, points4);
+        region5.update_neighborhood(event, bandwidth, points5);
+        EXPECT_TRUE(points2 == points4);
+        EXPECT_TRUE(points2 == points5);
+    }
 }
 //---------------------------------------------------------------------------//
 // FIXTURE-BASED TESTS: IsCalculationPointTest
@@ -325,17 +618,16 @@ TEST_F(IsCalculationPointTest, NoKDTree)
     std::set<moab::EntityHandle> mesh_set(mesh_nodes.begin(), mesh_nodes.end());
     EXPECT_EQ(2025, mesh_set.size());
 
-    // create neighborhood with no kd-tree and check default calculation points
-    KDENeighborhood region(mbi, mesh_nodes, false);
+    // create neighborhood with no kd-tree
+    KDENeighborhood region(mbi, mesh_nodes, KDENeighborhood::ALL_POINTS);
 
-    EXPECT_EQ(2025, region.get_points().size());
-    EXPECT_TRUE(check_all_points(region, mesh_set));
+    // update neighborhood region and check it includes all points
+    std::vector<unsigned int> points;
+    region.update_neighborhood(event, bandwidth, points);
 
-    // update neighborhood region and check it still includes all points
-    region.update_neighborhood(event, bandwidth);
-
-    EXPECT_EQ(2025, region.get_points().size());
-    EXPECT_TRUE(check_all_points(region, mesh_set));
+    EXPECT_EQ(2025, points.size());
+    EXPECT_TRUE(check_sorted(points));
+    EXPECT_TRUE(check_all_points(points, mesh_nodes, mesh_set));
 }
 //---------------------------------------------------------------------------//
 // Tests corners of neighborhood are valid calculation points
@@ -370,15 +662,23 @@ TEST_F(IsCalculationPointTest, ValidCornerPoints)
 
     EXPECT_EQ(2033, mesh_nodes.size());
 
-    // create neighborhood with kd-tree and check default calculation points
-    KDENeighborhood region(mbi, mesh_nodes, true);
-    EXPECT_EQ(0, region.get_points().size());
+    // create neighborhood with kd-tree
+    KDENeighborhood region(mbi, mesh_nodes, KDENeighborhood::KD_TREE);
+    std::vector<unsigned int> points;
 
     // update neighborhood region and check it includes corner set
-    region.update_neighborhood(event, bandwidth);
+    region.update_neighborhood(event, bandwidth, points);
+
+    EXPECT_TRUE(points.size() > 0);
+    EXPECT_TRUE(check_all_points(points, mesh_nodes, corner_set));
+
+    // check grid search uses kd-tree since nodes are not a regular lattice
+    KDENeighborhood grid_region(mbi, mesh_nodes, KDENeighborhood::GRID);
+    EXPECT_EQ(KDENeighborhood::KD_TREE, grid_region.get_search_method());
 
-    EXPECT_TRUE(region.get_points().size() > 0);
-    EXPECT_TRUE(check_all_points(region, corner_set));
+    std::vector<unsigned int> grid_points;
+    grid_region.update_neighborhood(event, bandwidth, grid_points);
+    EXPECT_TRUE(points == grid_points);
 }
 //---------------------------------------------------------------------------//
 // Tests points along edges of neighborhood are valid calculation points
@@ -413,15 +713,15 @@ TEST_F(IsCalculationPointTest, ValidEdgePoints)
 
     EXPECT_EQ(2033, mesh_nodes.size());
 
-    // create neighborhood with kd-tree and check default calculation points
-    KDENeighborhood region(mbi, mesh_nodes, true);
-    EXPECT_EQ(0, region.get_points().size());
+    // create neighborhood with kd-tree
+    KDENeighborhood region(mbi, mesh_nodes, KDENeighborhood::KD_TREE);
+    std::vector<unsigned int> points;
 
     // update neighborhood region and check it includes edge set
-    region.update_neighborhood(event, bandwidth);
+    region.update_neighborhood(event, bandwidth, points);
 
-    EXPECT_TRUE(region.get_points().size() > 0);
-    EXPECT_TRUE(check_all_points(region, edge_set));
+    EXPECT_TRUE(points.size() > 0);
+    EXPECT_TRUE(check_all_points(points, mesh_nodes, edge_set));
 }
 //---------------------------------------------------------------------------//
 // Tests points inside neighborhood are valid calculation points
@@ -452,15 +752,15 @@ TEST_F(IsCalculationPointTest, ValidInteriorPoints)
 
     EXPECT_EQ(2029, mesh_nodes.size());
 
-    // create neighborhood with kd-tree and check default calculation points
-    KDENeighborhood region(mbi, mesh_nodes, true);
-    EXPECT_EQ(0, region.get_points().size());
+    // create neighborhood with kd-tree
+    KDENeighborhood region(mbi, mesh_nodes, KDENeighborhood::KD_TREE);
+    std::vector<unsigned int> points;
 
     // update neighborhood region and check it includes edge set
-    region.update_neighborhood(event, bandwidth);
+    region.update_neighborhood(event, bandwidth, points);
 
-    EXPECT_TRUE(region.get_points().size() > 0);
-    EXPECT_TRUE(check_all_points(region, interior_set));
+    EXPECT_TRUE(points.size() > 0);
+    EXPECT_TRUE(check_all_points(points, mesh_nodes, interior_set));
 }
 //---------------------------------------------------------------------------//
 // Tests points that are NOT in neighborhood are NOT valid calculation points
@@ -498,17 +798,18 @@ TEST_F(IsCalculationPointTest, InvalidPoints)
 
     EXPECT_EQ(2036, mesh_nodes.size());
 
-    // create neighborhood with kd-tree and check default calculation points
-    KDENeighborhood region(mbi, mesh_nodes, true);
-    EXPECT_EQ(0, region.get_points().size());
+    // create neighborhood with kd-tree
+    KDENeighborhood region(mbi, mesh_nodes, KDENeighborhood::KD_TREE);
+    std::vector<unsigned int> points;
 
     // update neighborhood region and check invalid points are all still invalid
-    region.update_neighborhood(event, bandwidth);
+    region.update_neighborhood(event, bandwidth, points);
 
     std::set<moab::EntityHandle>::iterator it;
     for(it = invalid_set.begin(); it != invalid_set.end(); ++it)
     {
-        EXPECT_FALSE(region.is_calculation_point(*it));
+        unsigned int index = mesh_nodes.index(*it);
+        EXPECT_FALSE(std::binary_search(points.begin(), points.end(), index));
     }
 }
 //---------------------------------------------------------------------------//
@@ -1,5 +1,11 @@
 // MCNP5/dagmc/test/test_PolynomialKernel.cpp
 
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "../PolynomialKernel.hpp"
 
@@ -24,6 +30,46 @@ class PolynomialKernelTest : public ::testing::Test
   protected:
     // data needed for each test
     PolynomialKernel* kernel;
+
+    // compares evaluate_product to the product of three evaluate calls for
+    // a grid of points, some of which are on or outside the kernel domain
+    void test_evaluate_product()
+    {
+        double observation[3] = {0.1, -0.2, 0.3};
+        double bandwidth[3] = {0.5, 1.0, 2.0};
+        std::vector<double> x, y, z;
+
+        for (int i = 0; i <= 12; ++i)
+        {
+            for (int j = 0; j <= 12; ++j)
+            {
+                for (int k = 0; k <= 12; ++k)
+                {
+                    x.push_back(observation[0] + 0.125 * (i - 6));
+                    y.push_back(observation[1] + 0.25 * (j - 6));
+                    z.push_back(observation[2] + 0.5 * (k - 6));
+                }
+            }
+        }
+
+        unsigned int n = x.size();
+        std::vector<double> values(n, -1.0);
+        kernel->evaluate_product(&x[0], &y[0], &z[0], n,
+                                 observation, bandwidth, &values[0]);
+
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            double u = (x[i] - observation[0]) / bandwidth[0];
+            double v = (y[i] - observation[1]) / bandwidth[1];
+            double w = (z[i] - observation[2]) / bandwidth[2];
+
+            double expected = kernel->evaluate(u) / bandwidth[0]
+                            * kernel->evaluate(v) / bandwidth[1]
+                            * kernel->evaluate(w) / bandwidth[2];
+
+            EXPECT_NEAR(expected, values[i], 1e-12);
+        }
+    }
 };
 //---------------------------------------------------------------------------//
 class IntegrateMomentTest : public ::testing::Test
@@ -381,6 +427,64 @@ TEST_F(PolynomialKernelTest, Evaluate6thOrderTriweight)
     EXPECT_DOUBLE_EQ(0.0, kernel->evaluate(2.0));
 }
 //---------------------------------------------------------------------------//
+// Tests evaluate_product for the specialized 2nd-order kernels
+TEST_F(PolynomialKernelTest, EvaluateProduct2ndOrderKernels)
+{
+    for (unsigned int s = 0; s <= 3; ++s)
+    {
+        kernel = new PolynomialKernel(s, 1);
+        test_evaluate_product();
+        delete kernel;
+        kernel = NULL;
+    }
+}
+//---------------------------------------------------------------------------//
+// Tests evaluate_product for a 2nd-order general polynomial kernel
+TEST_F(PolynomialKernelTest, EvaluateProductGeneralPolynomialKernel)
+{
+    kernel = new PolynomialKernel(4, 1);
+    test_evaluate_product();
+}
+//---------------------------------------------------------------------------//
+// Tests evaluate_product for a 4th-order epanechnikov kernel
+TEST_F(PolynomialKernelTest, EvaluateProduct4thOrderEpanechnikov)
+{
+    kernel = new PolynomialKernel(1, 2);
+    test_evaluate_product();
+}
+//---------------------------------------------------------------------------//
+// Tests expanded polynomial matches evaluate for kernels up to 6th-order
+TEST_F(PolynomialKernelTest, GetPolynomial)
+{
+    for (unsigned int s = 0; s <= 4; ++s)
+    {
+        for (unsigned int r = 1; r <= 3; ++r)
+        {
+            kernel = new PolynomialKernel(s, r);
+            std::vector<double> coefficients;
+            EXPECT_TRUE(kernel->get_polynomial(coefficients));
+            EXPECT_EQ(2 * (s + r - 1) + 1, coefficients.size());
+
+            // evaluate polynomial using Horner's method
+            for (int i = -10; i <= 10; ++i)
+            {
+                double u = 0.1 * i;
+                double value = 0.0;
+
+                for (unsigned int j = coefficients.size(); j > 0; --j)
+                {
+                    value = value * u + coefficients[j - 1];
+                }
+
+                EXPECT_NEAR(kernel->evaluate(u), value, 1e-12);
+            }
+
+            delete kernel;
+            kernel = NULL;
+        }
+    }
+}
+//---------------------------------------------------------------------------//
 // FIXTURE-BASED TESTS: IntegrateMomentTest
 //---------------------------------------------------------------------------//
 TEST_F(IntegrateMomentTest, Integrate0thMoment)
@@ -499,5 +603,128 @@ TEST_F(IntegrateMomentTest, IntegrateWithValidLimits)
     EXPECT_NEAR(-0.047619, kernel4->integrate_moment(a, b, i), 1e-6);
 }
 //---------------------------------------------------------------------------//
+// Tests moments do not depend on the order in which they are integrated
+TEST_F(IntegrateMomentTest, AlternatingMomentOrders)
+{
+    // compute exact moments of the epanechnikov kernel for [a, b]
+    a = -0.3;
+    b = 0.8;
+    double expected[5];
+
+    for (i = 0; i <= 4; ++i)
+    {
+        expected[i] = 0.75 * (pow(b, i + 1) - pow(a, i + 1)) / (i + 1)
+                    - 0.75 * (pow(b, i + 3) - pow(a, i + 3)) / (i + 3);
+    }
+
+    // integrate moments repeatedly in alternating orders
+    int orders[8] = {0, 4, 1, 3, 2, 4, 0, 2};
+
+    for (int k = 0; k < 8; ++k)
+    {
+        i = orders[k];
+        EXPECT_NEAR(expected[i], kernel2->integrate_moment(a, b, i), 1e-14);
+    }
+}
+//---------------------------------------------------------------------------//
+// Tests moments computed in parallel match those computed in serial
+TEST_F(IntegrateMomentTest, ParallelMoments)
+{
+#ifndef _OPENMP
+    std::cout << "Skipping ParallelMoments: not compiled with OpenMP"
+              << std::endl;
+    return;
+#endif
+
+    const int num_values = 1000;
+    std::vector<double> serial(num_values);
+    std::vector<double> parallel(num_values);
+
+    for (int k = 0; k < num_values; ++k)
+    {
+        serial[k] = kernel4->integrate_moment(-1.0, 0.002 * k - 1.0, k % 5);
+    }
+
+    // all threads share the same kernel
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(4)
+#endif
+    for (int k = 0; k < num_values; ++k)
+    {
+        parallel[k] = kernel4->integrate_moment(-1.0, 0.002 * k - 1.0, k % 5);
+    }
+
+    for (int k = 0; k < num_values; ++k)
+    {
+        EXPECT_DOUBLE_EQ(serial[k], parallel[k]);
+    }
+}
+//---------------------------------------------------------------------------//
+// BENCHMARK TESTS
+//---------------------------------------------------------------------------//
+// Compares the time needed to evaluate a 3D epanechnikov kernel for many
+// calculation points using evaluate and evaluate_product.  This is disabled
+// by default; use --gtest_also_run_disabled_tests to run it.
+TEST_F(PolynomialKernelTest, DISABLED_EvaluateProduct)
+{
+    kernel = new PolynomialKernel(1, 1);
+
+    const unsigned int num_points = 4096;
+    const unsigned int num_events = 2000;
+    double observation[3] = {0.0, 0.0, 0.0};
+    double bandwidth[3] = {1.0, 1.0, 1.0};
+    std::vector<double> x(num_points), y(num_points), z(num_points);
+    std::vector<double> values(num_points);
+
+    srand(12345);
+
+    for (unsigned int i = 0; i < num_points; ++i)
+    {
+        x[i] = 2.0 * rand() / RAND_MAX - 1.0;
+        y[i] = 2.0 * rand() / RAND_MAX - 1.0;
+        z[i] = 2.0 * rand() / RAND_MAX - 1.0;
+    }
+
+    // evaluate each dimension separately for one point at a time
+    double scalar_sum = 0.0;
+    clock_t start = clock();
+
+    for (unsigned int j = 0; j < num_events; ++j)
+    {
+        observation[0] = 0.001 * j;
+
+        for (unsigned int i = 0; i < num_points; ++i)
+        {
+            values[i] = kernel->evaluate((x[i] - observation[0]) / bandwidth[0])
+                      * kernel->evaluate((y[i] - observation[1]) / bandwidth[1])
+                      * kernel->evaluate((z[i] - observation[2]) / bandwidth[2]);
+        }
+
+        scalar_sum += values[j % num_points];
+    }
+
+    double scalar_time = double(clock() - start) / CLOCKS_PER_SEC;
+
+    // evaluate all points at once
+    double product_sum = 0.0;
+    start = clock();
+
+    for (unsigned int j = 0; j < num_events; ++j)
+    {
+        observation[0] = 0.001 * j;
+        kernel->evaluate_product(&x[0], &y[0], &z[0], num_points,
+                                 observation, bandwidth, &values[0]);
+
+        product_sum += values[j % num_points];
+    }
+
+    double product_time = double(clock() - start) / CLOCKS_PER_SEC;
+
+    std::cout << "    evaluate: " << scalar_time << " s" << std::endl;
+    std::cout << "    evaluate_product: " << product_time << " s" << std::endl;
+
+    EXPECT_NEAR(scalar_sum, product_sum, 1e-9);
+}
+//---------------------------------------------------------------------------//
 
 // end of MCNP5/dagmc/test/test_PolynomialKernel.cpp
@@ -46,6 +46,40 @@ class PolynomialFunction : public Function
     unsigned int order;
 };
 //---------------------------------------------------------------------------//
+class BatchFunction : public Function
+{
+  public:
+    /**
+     * \brief Defines f(x) = x^2, counting how often it is evaluated
+     */
+    BatchFunction() : num_batches(0), num_values(0) {}
+
+    /**
+     * \brief evaluate f(x) for a single value
+     */
+    double evaluate(double x) const
+    {
+        return x * x;
+    }
+
+    /**
+     * \brief evaluate f(x) for n values at once
+     */
+    void evaluate_batch(const double* x, unsigned int n, double* values) const
+    {
+        ++num_batches;
+        num_values += n;
+
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            values[i] = x[i] * x[i];
+        }
+    }
+
+    mutable unsigned int num_batches;
+    mutable unsigned int num_values;
+};
+//---------------------------------------------------------------------------//
 // TEST FIXTURES
 //---------------------------------------------------------------------------//
 class QuadratureTest : public ::testing::Test
@@ -87,10 +121,98 @@ class QuadratureTest : public ::testing::Test
 //---------------------------------------------------------------------------//
 TEST(InvalidQuadratureTest, InvalidQuadPoints)
 {
-    Quadrature quadrature(50);
+    Quadrature quadrature(0);
     EXPECT_EQ(10, quadrature.get_num_quad_points());
 }
 //---------------------------------------------------------------------------//
+TEST(GaussLegendreTest, GeneratedRulesMatchTable)
+{
+    // 10-point rule from standard tables, for the positive points only
+    double points[5] = {0.1488743389816312, 0.4333953941292472,
+                        0.6794095682990244, 0.8650633666889845,
+                        0.9739065285171717};
+
+    double weights[5] = {0.2955242247147529, 0.2692667193099963,
+                         0.2190863625159820, 0.1494513491505806,
+                         0.0666713443086881};
+
+    Quadrature quadrature(10);
+    const double* quad_points = quadrature.get_quad_points();
+    const double* quad_weights = quadrature.get_quad_weights();
+
+    for (int i = 0; i < 5; ++i)
+    {
+        EXPECT_NEAR(-points[i], quad_points[4 - i], 1e-15);
+        EXPECT_NEAR(points[i], quad_points[5 + i], 1e-15);
+        EXPECT_NEAR(weights[i], quad_weights[4 - i], 1e-15);
+        EXPECT_NEAR(weights[i], quad_weights[5 + i], 1e-15);
+    }
+}
+//---------------------------------------------------------------------------//
+TEST(GaussLegendreTest, HighOrderRules)
+{
+    for (unsigned int n = 1; n <= 100; ++n)
+    {
+        Quadrature quadrature(n);
+        EXPECT_EQ(n, quadrature.get_num_quad_points());
+
+        // test points are increasing and weights sum to 2
+        const double* points = quadrature.get_quad_points();
+        const double* weights = quadrature.get_quad_weights();
+        double sum = 0.0;
+
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            if (i > 0)
+            {
+                EXPECT_LT(points[i - 1], points[i]);
+            }
+
+            sum += weights[i];
+        }
+
+        EXPECT_NEAR(2.0, sum, 1e-13);
+
+        // test x^(2n - 2) is integrated exactly on [-1, 1]
+        std::vector<double> coefficients(2 * n - 1, 0.0);
+        coefficients.back() = 1.0;
+        PolynomialFunction function(coefficients, 2 * n - 2);
+        double exact = 2.0 / (2 * n - 1);
+        EXPECT_NEAR(exact, quadrature.integrate(-1.0, 1.0, function), 1e-13);
+    }
+}
+//---------------------------------------------------------------------------//
+TEST(GaussLegendreTest, SharedAlignedRules)
+{
+    Quadrature quadrature1(7);
+    Quadrature quadrature2(3);
+    quadrature2.change_quadrature_set(7);
+
+    // test both quadratures use the same rule from the cache
+    EXPECT_EQ(quadrature1.get_quad_points(), quadrature2.get_quad_points());
+    EXPECT_EQ(quadrature1.get_quad_weights(), quadrature2.get_quad_weights());
+
+    // test rule is aligned to 64 bytes
+    EXPECT_EQ(0, (size_t) quadrature1.get_quad_points() % 64);
+    EXPECT_EQ(0, (size_t) quadrature1.get_quad_weights() % 64);
+}
+//---------------------------------------------------------------------------//
+TEST(GaussLegendreTest, EvaluateBatch)
+{
+    BatchFunction function;
+
+    // test a small rule is evaluated in a single batch
+    Quadrature quadrature(5);
+    EXPECT_NEAR(2.0 / 3.0, quadrature.integrate(-1.0, 1.0, function), 1e-15);
+    EXPECT_EQ(1, function.num_batches);
+    EXPECT_EQ(5, function.num_values);
+
+    // test every point of a large rule is evaluated exactly once
+    quadrature.change_quadrature_set(150);
+    EXPECT_NEAR(9.0, quadrature.integrate(0.0, 3.0, function), 1e-12);
+    EXPECT_EQ(155, function.num_values);
+}
+//---------------------------------------------------------------------------//
 // FIXTURE-BASED TESTS: QuadratureTest
 //---------------------------------------------------------------------------//
 TEST_F(QuadratureTest, IntegrateZeroFunction)
@@ -1,5 +1,10 @@
 // MCNP5/dagmc/test/test_TallyData.cpp
 
+#include <ctime>
+#include <iostream>
+#include <set>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 #include "../TallyData.hpp"
@@ -58,6 +63,48 @@ void fillTally(TallyData& tallyData)
     } 
 }
 //---------------------------------------------------------------------------//
+// Reference implementation of the scratch data using a std::set to track the
+// tally points visited in each history, used to benchmark TallyData
+class SetTallyData
+{
+  public:
+    SetTallyData(unsigned int num_points, unsigned int num_ebins)
+        : num_ebins(num_ebins),
+          tally_data(num_points * num_ebins, 0.0),
+          error_data(num_points * num_ebins, 0.0),
+          temp_tally_data(num_points * num_ebins, 0.0) {}
+
+    void add_score_to_tally(unsigned int point, double score, unsigned int ebin)
+    {
+        temp_tally_data[point * num_ebins + ebin] += score;
+        visited.insert(point);
+    }
+
+    void end_history()
+    {
+        std::set<unsigned int>::iterator it;
+
+        for (it = visited.begin(); it != visited.end(); ++it)
+        {
+            for (unsigned int j = 0; j < num_ebins; ++j)
+            {
+                double& score = temp_tally_data[(*it) * num_ebins + j];
+                tally_data[(*it) * num_ebins + j] += score;
+                error_data[(*it) * num_ebins + j] += score * score;
+                score = 0.0;
+            }
+        }
+
+        visited.clear();
+    }
+
+    unsigned int num_ebins;
+    std::vector<double> tally_data;
+    std::vector<double> error_data;
+    std::vector<double> temp_tally_data;
+    std::set<unsigned int> visited;
+};
+//---------------------------------------------------------------------------//
 // SIMPLE TESTS
 //---------------------------------------------------------------------------//
 TEST(TallyDataInputTest, TotalEnergyBinLogic)
@@ -346,5 +393,186 @@ TEST_F(TallyDataTest, AddScoreToTally)
       EXPECT_DOUBLE_EQ(0.0, scratch_data[10]);
 }
 //---------------------------------------------------------------------------//
+TEST_F(TallyDataTest, SetNumThreads)
+{
+      int length;
+
+      EXPECT_EQ(1, tallyData1->get_num_threads());
+
+      // scratch data for new threads is sized to match the existing arrays
+      tallyData2->resize_data_arrays(2);
+      tallyData2->set_num_threads(4);
+      EXPECT_EQ(4, tallyData2->get_num_threads());
+
+      double* scratch_data = tallyData2->get_scratch_data(length);
+      EXPECT_EQ(12, length);
+
+      // resizing after setting threads updates all scratch arrays
+      tallyData2->resize_data_arrays(3);
+      scratch_data = tallyData2->get_scratch_data(length);
+      EXPECT_EQ(18, length);
+
+      for (int i = 0; i < length; ++i)
+      {
+         EXPECT_DOUBLE_EQ(0.0, scratch_data[i]);
+      }
+
+      tallyData2->set_num_threads(1);
+      EXPECT_EQ(1, tallyData2->get_num_threads());
+}
+//---------------------------------------------------------------------------//
+TEST_F(TallyDataTest, ThreadedEndHistory)
+{
+      int length;
+
+      // 'Normal' case with single energy bin and one tally point
+      tallyData1->resize_data_arrays(1);
+      tallyData1->set_num_threads(4);
+
+      // outside of a parallel region all scores belong to thread 0
+      EXPECT_EQ(0, TallyData::get_thread_id());
+
+      tallyData1->add_score_to_tally(0, 5.6, 0);
+      tallyData1->end_history();
+      tallyData1->add_score_to_tally(0, 1.2, 0);
+      tallyData1->end_history();
+
+      double* tally_data = tallyData1->get_tally_data(length);
+      double* error_data = tallyData1->get_error_data(length);
+      double* scratch_data = tallyData1->get_scratch_data(length);
+
+      EXPECT_DOUBLE_EQ(6.8, tally_data[0]);
+      EXPECT_DOUBLE_EQ(32.8, error_data[0]);
+      EXPECT_DOUBLE_EQ(0.0, scratch_data[0]);
+
+      // zeroing the tally also clears scratch data for all threads
+      tallyData1->add_score_to_tally(0, 3.0, 0);
+      tallyData1->zero_tally_data();
+      tallyData1->end_history();
+      EXPECT_DOUBLE_EQ(0.0, tally_data[0]);
+      EXPECT_DOUBLE_EQ(0.0, error_data[0]);
+}
+//---------------------------------------------------------------------------//
+TEST_F(TallyDataTest, RepeatedScoresInHistory)
+{
+      int length;
+
+      // Two tally points, 5 energy bins, total
+      tallyData2->resize_data_arrays(2);
+
+      // scoring the same tally point many times only folds it in once
+      for (int i = 0; i < 100; ++i)
+      {
+         tallyData2->add_score_to_tally(1, 0.5, 2);
+      }
+
+      tallyData2->end_history();
+      double* tally_data = tallyData2->get_tally_data(length);
+      double* error_data = tallyData2->get_error_data(length);
+
+      EXPECT_DOUBLE_EQ(50.0, tally_data[8]);
+      EXPECT_DOUBLE_EQ(2500.0, error_data[8]);
+      EXPECT_DOUBLE_EQ(50.0, tally_data[11]);
+      EXPECT_DOUBLE_EQ(2500.0, error_data[11]);
+
+      // tally point can be visited again in the next history
+      tallyData2->add_score_to_tally(1, 2.0, 2);
+      tallyData2->end_history();
+
+      EXPECT_DOUBLE_EQ(52.0, tally_data[8]);
+      EXPECT_DOUBLE_EQ(2504.0, error_data[8]);
+}
+//---------------------------------------------------------------------------//
+TEST_F(TallyDataTest, ResizeDuringHistory)
+{
+      int length;
+
+      // Multiple energy bins without total energy bin
+      tallyData3->resize_data_arrays(4);
+      tallyData3->add_score_to_tally(1, 1.5, 0);
+      tallyData3->add_score_to_tally(3, 2.5, 0);
+
+      // visited tally point 3 no longer exists after resizing
+      tallyData3->resize_data_arrays(2);
+      tallyData3->end_history();
+
+      double* tally_data = tallyData3->get_tally_data(length);
+      EXPECT_EQ(18, length);
+      EXPECT_DOUBLE_EQ(1.5, tally_data[9]);
+      EXPECT_DOUBLE_EQ(0.0, tally_data[0]);
+}
+//---------------------------------------------------------------------------//
+// BENCHMARK TESTS
+//---------------------------------------------------------------------------//
+// Compares TallyData with the std::set reference for a KDE-like workload,
+// where each event scores a few hundred neighboring tally points.  This is
+// disabled by default; use --gtest_also_run_disabled_tests to run it.
+TEST(TallyDataBenchmark, DISABLED_VisitedTracking)
+{
+      const unsigned int num_points = 20000;
+      const unsigned int num_ebins = 2;
+      const unsigned int num_histories = 2000;
+      const unsigned int events_per_history = 10;
+      const unsigned int points_per_event = 300;
+
+      TallyData tally(num_ebins, false);
+      tally.resize_data_arrays(num_points);
+      SetTallyData reference(num_points, num_ebins);
+
+      // fixed linear congruential sequence so both workloads are identical
+      unsigned int seed = 12345;
+      std::vector<unsigned int> points;
+
+      for (unsigned int i = 0; i < events_per_history * points_per_event; ++i)
+      {
+         seed = 1103515245 * seed + 12345;
+         points.push_back((seed >> 8) % num_points);
+      }
+
+      clock_t start = clock();
+
+      for (unsigned int h = 0; h < num_histories; ++h)
+      {
+         for (unsigned int i = 0; i < points.size(); ++i)
+         {
+            unsigned int point = (points[i] + h) % num_points;
+            tally.add_score_to_tally(point, 1.0, h % num_ebins);
+         }
+
+         tally.end_history();
+      }
+
+      double dirty_list_time = double(clock() - start) / CLOCKS_PER_SEC;
+      start = clock();
+
+      for (unsigned int h = 0; h < num_histories; ++h)
+      {
+         for (unsigned int i = 0; i < points.size(); ++i)
+         {
+            unsigned int point = (points[i] + h) % num_points;
+            reference.add_score_to_tally(point, 1.0, h % num_ebins);
+         }
+
+         reference.end_history();
+      }
+
+      double set_time = double(clock() - start) / CLOCKS_PER_SEC;
+
+      std::cout << "    dirty list: " << dirty_list_time << " s" << std::endl;
+      std::cout << "    std::set:   " << set_time << " s" << std::endl;
+
+      // both methods must produce the same results
+      int length;
+      double* tally_data = tally.get_tally_data(length);
+      double* error_data = tally.get_error_data(length);
+      ASSERT_EQ(num_points * num_ebins, length);
+
+      for (int i = 0; i < length; ++i)
+      {
+         EXPECT_DOUBLE_EQ(reference.tally_data[i], tally_data[i]);
+         EXPECT_DOUBLE_EQ(reference.error_data[i], error_data[i]);
+      }
+}
+//---------------------------------------------------------------------------//
 
 // end of MCNP5/dagmc/test/test_TallyData.cpp
@@ -128,5 +128,84 @@ TEST_F(TallyEventTest, ValidMultiplierIndex)
     EXPECT_DOUBLE_EQ(4.187, score_multiplier);
 }
 //---------------------------------------------------------------------------//
+// SIMPLE TESTS
+//---------------------------------------------------------------------------//
+// Tests copying events out of a TallyEventBatch
+TEST(TallyEventBatchTest, GetEvent)
+{
+    double x[3], y[3], z[3], u[3], v[3], w[3];
+    double energies[3], weights[3], lengths[3], multipliers[6];
+    int cells[3];
+
+    for (int i = 0; i < 3; ++i)
+    {
+        x[i] = i;
+        y[i] = 2.0 * i;
+        z[i] = 3.0 * i;
+        u[i] = 1.0;
+        v[i] = 0.0;
+        w[i] = 0.0;
+        energies[i] = 0.5 * i;
+        weights[i] = 1.0 + i;
+        lengths[i] = 4.0 + i;
+        cells[i] = 10 + i;
+        multipliers[2 * i] = 0.1 * i;
+        multipliers[2 * i + 1] = 7.0 + i;
+    }
+
+    TallyEventBatch batch;
+    batch.type = TallyEvent::TRACK;
+    batch.particle = 2;
+    batch.num_events = 3;
+    batch.x = x;
+    batch.y = y;
+    batch.z = z;
+    batch.u = u;
+    batch.v = v;
+    batch.w = w;
+    batch.particle_energy = energies;
+    batch.particle_weight = weights;
+    batch.track_length = lengths;
+    batch.current_cell = cells;
+    batch.multipliers = multipliers;
+    batch.num_multipliers = 2;
+    batch.multiplier_stride = 2;
+
+    EXPECT_EQ(3, batch.size());
+
+    TallyEvent event;
+    batch.get_event(2, event);
+
+    EXPECT_EQ(TallyEvent::TRACK, event.type);
+    EXPECT_EQ(2, event.particle);
+    EXPECT_EQ(12, event.current_cell);
+    EXPECT_DOUBLE_EQ(2.0, event.position[0]);
+    EXPECT_DOUBLE_EQ(4.0, event.position[1]);
+    EXPECT_DOUBLE_EQ(6.0, event.position[2]);
+    EXPECT_DOUBLE_EQ(1.0, event.direction[0]);
+    EXPECT_DOUBLE_EQ(1.0, event.particle_energy);
+    EXPECT_DOUBLE_EQ(3.0, event.particle_weight);
+    EXPECT_DOUBLE_EQ(6.0, event.track_length);
+    EXPECT_EQ(2, event.multipliers.size());
+
+    // score multipliers should match between the batch and the event
+    EXPECT_DOUBLE_EQ(3.0, batch.get_score_multiplier(2, -1));
+    EXPECT_DOUBLE_EQ(0.6, batch.get_score_multiplier(2, 0));
+    EXPECT_DOUBLE_EQ(27.0, batch.get_score_multiplier(2, 1));
+    EXPECT_DOUBLE_EQ(3.0, batch.get_score_multiplier(2, 2));
+    EXPECT_DOUBLE_EQ(0.6, event.get_score_multiplier(0));
+    EXPECT_DOUBLE_EQ(27.0, event.get_score_multiplier(1));
+
+    // events can share the same multipliers
+    batch.multiplier_stride = 0;
+    EXPECT_DOUBLE_EQ(0.0, batch.get_score_multiplier(2, 0));
+    EXPECT_DOUBLE_EQ(21.0, batch.get_score_multiplier(2, 1));
+
+    // clearing the batch removes all events
+    batch.clear();
+    EXPECT_EQ(0, batch.size());
+    EXPECT_EQ(0, batch.num_multipliers);
+}
+//---------------------------------------------------------------------------//
 
 // end of MCNP5/dagmc/test/test_TallyEvent.cpp
@@ -0,0 +1,391 @@
+// MCNP5/dagmc/test/test_TallyManager.cpp
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "moab/CartVect.hpp"
+#include "moab/Core.hpp"
+#include "moab/Range.hpp"
+
+#include "../Tally.hpp"
+#include "../TallyManager.hpp"
+
+//---------------------------------------------------------------------------//
+// HELPER FUNCTIONS
+//---------------------------------------------------------------------------//
+// Number of particle histories scored by each TallyManager
+static const int NUM_HISTORIES = 400;
+
+// Number of track and collision events scored in each history
+static const int EVENTS_PER_HISTORY = 6;
+
+// Returns a repeatable number in [0, 1) that depends only on the given key
+double uniform(unsigned int key)
+{
+    key = ((key >> 16) ^ key) * 0x45d9f3b;
+    key = ((key >> 16) ^ key) * 0x45d9f3b;
+    key = (key >> 16) ^ key;
+
+    return (key & 0xffffff) / 16777216.0;
+}
+//---------------------------------------------------------------------------//
+// Scores the same events on each history using num_threads threads; each
+// event only depends on its history number, not the thread that scores it.
+// If start_histories is false, then TallyManager numbers the histories.
+void score_histories(TallyManager& manager,
+                     int num_threads,
+                     const moab::CartVect& box_min,
+                     const moab::CartVect& box_max,
+                     bool start_histories = true)
+{
+    manager.setNumThreads(num_threads);
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+#endif
+    for (int i = 0; i < NUM_HISTORIES; ++i)
+    {
+        if (start_histories) manager.startHistory(i + 1);
+
+        for (int j = 0; j < EVENTS_PER_HISTORY; ++j)
+        {
+            unsigned int key = 16 * (i * EVENTS_PER_HISTORY + j);
+            moab::CartVect position;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                double width = box_max[k] - box_min[k];
+                position[k] = box_min[k] + width * uniform(key + k);
+            }
+
+            moab::CartVect direction(uniform(key + 3) - 0.5,
+                                     uniform(key + 4) - 0.5,
+                                     uniform(key + 5) - 0.5);
+            direction.normalize();
+
+            double energy = 10.0 * uniform(key + 6);
+            double weight = 0.5 + uniform(key + 7);
+            double track_length = (box_max - box_min).length()
+                                * uniform(key + 8);
+            int cell_id = 1 + j % 2;
+
+            manager.setTrackEvent(TallyInput::NEUTRON,
+                                  position[0], position[1], position[2],
+                                  direction[0], direction[1], direction[2],
+                                  energy, weight, track_length, cell_id);
+            manager.updateTallies();
+
+            manager.setCollisionEvent(TallyInput::NEUTRON,
+                                      position[0], position[1], position[2],
+                                      energy, weight, 0.25, cell_id);
+            manager.updateTallies();
+        }
+
+        manager.endHistory();
+    }
+}
+//---------------------------------------------------------------------------//
+// TEST FIXTURES
+//---------------------------------------------------------------------------//
+class TallyManagerTest : public ::testing::Test
+{
+  protected:
+    // initialize variables for each test
+    virtual void SetUp()
+    {
+        energy_bin_bounds.push_back(0.0);
+        energy_bin_bounds.push_back(5.0);
+        energy_bin_bounds.push_back(10.0);
+
+        serial_manager = new TallyManager();
+        threaded_manager = new TallyManager();
+
+        // scores are spread over the mesh bounding box
+        box_min = moab::CartVect(-1.0, -1.0, -1.0);
+        box_max = moab::CartVect(1.0, 1.0, 1.0);
+    }
+
+    // deallocate memory resources
+    virtual void TearDown()
+    {
+        delete serial_manager;
+        delete threaded_manager;
+    }
+
+    // adds the same Tally to both TallyManagers
+    void add_tally(unsigned int tally_id,
+                   std::string tally_type,
+                   const std::multimap<std::string, std::string>& options)
+    {
+        serial_manager->addNewTally(tally_id, tally_type, TallyInput::NEUTRON,
+                                    energy_bin_bounds, options);
+
+        threaded_manager->addNewTally(tally_id, tally_type, TallyInput::NEUTRON,
+                                      energy_bin_bounds, options);
+    }
+
+    // sets box_min and box_max to the bounding box of the mesh vertices
+    void find_mesh_box(const std::string& filename)
+    {
+        moab::Core mbi;
+        moab::EntityHandle file_set;
+        mbi.create_meshset(moab::MESHSET_SET, file_set);
+        ASSERT_EQ(moab::MB_SUCCESS, mbi.load_file(filename.c_str(), &file_set));
+
+        moab::Range vertices;
+        mbi.get_entities_by_type(file_set, moab::MBVERTEX, vertices);
+        std::vector<double> coords(3 * vertices.size());
+        mbi.get_coords(vertices, &coords[0]);
+
+        box_min = moab::CartVect(coords[0], coords[1], coords[2]);
+        box_max = box_min;
+
+        for (unsigned int i = 0; i < vertices.size(); ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                box_min[j] = std::min(box_min[j], coords[3*i + j]);
+                box_max[j] = std::max(box_max[j], coords[3*i + j]);
+            }
+        }
+    }
+
+    // checks that both TallyManagers have the same results for a Tally; only
+    // the order in which threads add their scores can change the results
+    void compare_results(int tally_id)
+    {
+        int serial_length = 0;
+        int threaded_length = 0;
+
+        double* serial_tally = serial_manager->getTallyData(tally_id,
+                                                            serial_length);
+        double* threaded_tally = threaded_manager->getTallyData(tally_id,
+                                                                threaded_length);
+        ASSERT_TRUE(serial_tally != NULL);
+        ASSERT_TRUE(threaded_tally != NULL);
+        ASSERT_EQ(serial_length, threaded_length);
+
+        double* serial_error = serial_manager->getErrorData(tally_id,
+                                                            serial_length);
+        double* threaded_error = threaded_manager->getErrorData(tally_id,
+                                                                threaded_length);
+
+        double total = 0.0;
+
+        for (int i = 0; i < serial_length; ++i)
+        {
+            total += serial_tally[i];
+
+            EXPECT_NEAR(serial_tally[i], threaded_tally[i],
+                        1e-12 * std::fabs(serial_tally[i]));
+            EXPECT_NEAR(serial_error[i], threaded_error[i],
+                        1e-12 * std::fabs(serial_error[i]));
+        }
+
+        // make sure the events actually scored something
+        EXPECT_GT(total, 0.0);
+    }
+
+  protected:
+    // data needed for each test
+    std::vector<double> energy_bin_bounds;
+    TallyManager* serial_manager;
+    TallyManager* threaded_manager;
+    moab::CartVect box_min, box_max;
+};
+//---------------------------------------------------------------------------//
+// FIXTURE-BASED TESTS: TallyManagerTest
+//---------------------------------------------------------------------------//
+// Thread-safe tallies are scored by several threads at the same time
+TEST_F(TallyManagerTest, ThreadedCellTallies)
+{
+    std::multimap<std::string, std::string> options;
+    options.insert(std::make_pair("cell", "1"));
+    add_tally(1, "cell_track", options);
+
+    options.clear();
+    options.insert(std::make_pair("cell", "2"));
+    add_tally(2, "cell_coll", options);
+
+    score_histories(*serial_manager, 1, box_min, box_max);
+    score_histories(*threaded_manager, 4, box_min, box_max);
+
+    compare_results(1);
+    compare_results(2);
+}
+//---------------------------------------------------------------------------//
+// Mesh tallies are scored by all threads at once, each using its own workspace
+TEST_F(TallyManagerTest, ThreadedMeshTally)
+{
+    std::multimap<std::string, std::string> options;
+    options.insert(std::make_pair("inp", "../unstructured_mesh.h5m"));
+    add_tally(1, "unstr_track", options);
+
+    options.clear();
+    options.insert(std::make_pair("cell", "1"));
+    add_tally(2, "cell_track", options);
+
+    options.clear();
+    options.insert(std::make_pair("inp", "../unstructured_mesh.h5m"));
+    options.insert(std::make_pair("hx", "0.2"));
+    options.insert(std::make_pair("hy", "0.2"));
+    options.insert(std::make_pair("hz", "0.2"));
+    options.insert(std::make_pair("subtracks", "3"));
+    add_tally(3, "kde_subtrack", options);
+
+    find_mesh_box("../unstructured_mesh.h5m");
+
+    score_histories(*serial_manager, 1, box_min, box_max);
+    score_histories(*threaded_manager, 4, box_min, box_max);
+
+    compare_results(1);
+    compare_results(2);
+    compare_results(3);
+}
+//---------------------------------------------------------------------------//
+// Histories are numbered by TallyManager if startHistory() is not called,
+// which gives the same numbers as the physics code for a single thread
+TEST_F(TallyManagerTest, CountedHistoryNumbers)
+{
+    std::multimap<std::string, std::string> options;
+    options.insert(std::make_pair("inp", "../structured_mesh.h5m"));
+    options.insert(std::make_pair("hx", "0.2"));
+    options.insert(std::make_pair("hy", "0.2"));
+    options.insert(std::make_pair("hz", "0.2"));
+    options.insert(std::make_pair("subtracks", "3"));
+    add_tally(1, "kde_subtrack", options);
+
+    find_mesh_box("../structured_mesh.h5m");
+
+    score_histories(*serial_manager, 1, box_min, box_max, true);
+    score_histories(*threaded_manager, 1, box_min, box_max, false);
+
+    compare_results(1);
+}
+//---------------------------------------------------------------------------//
+// Batches of events give the same results as scoring each event on its own,
+// even if some events are invalid or directions are not unit vectors
+TEST_F(TallyManagerTest, BatchedEvents)
+{
+    std::multimap<std::string, std::string> options;
+    options.insert(std::make_pair("inp", "../structured_mesh.h5m"));
+    options.insert(std::make_pair("hx", "0.2"));
+    options.insert(std::make_pair("hy", "0.2"));
+    options.insert(std::make_pair("hz", "0.2"));
+    options.insert(std::make_pair("subtracks", "3"));
+    add_tally(1, "kde_subtrack", options);
+
+    options.clear();
+    options.insert(std::make_pair("cell", "1"));
+    add_tally(2, "cell_track", options);
+
+    options.clear();
+    options.insert(std::make_pair("cell", "2"));
+    add_tally(3, "cell_coll", options);
+
+    find_mesh_box("../structured_mesh.h5m");
+
+    const int n = EVENTS_PER_HISTORY;
+
+    for (int i = 0; i < NUM_HISTORIES; ++i)
+    {
+        double x[n], y[n], z[n], u[n], v[n], w[n];
+        double energy[n], weight[n], track_length[n], cross_section[n];
+        int cell_id[n];
+
+        for (int j = 0; j < n; ++j)
+        {
+            unsigned int key = 16 * (i * n + j);
+
+            x[j] = box_min[0] + (box_max[0] - box_min[0]) * uniform(key);
+            y[j] = box_min[1] + (box_max[1] - box_min[1]) * uniform(key + 1);
+            z[j] = box_min[2] + (box_max[2] - box_min[2]) * uniform(key + 2);
+
+            moab::CartVect direction(uniform(key + 3) - 0.5,
+                                     uniform(key + 4) - 0.5,
+                                     uniform(key + 5) - 0.5);
+            direction.normalize();
+            u[j] = direction[0];
+            v[j] = direction[1];
+            w[j] = direction[2];
+
+            energy[j] = 10.0 * uniform(key + 6);
+            weight[j] = 0.5 + uniform(key + 7);
+            track_length[j] = (box_max - box_min).length() * uniform(key + 8);
+            cross_section[j] = 0.25;
+            cell_id[j] = 1 + j % 2;
+        }
+
+        // one invalid event of each type
+        track_length[2] = -1.0;
+        cross_section[3] = -0.25;
+
+        // score each event on its own with the serial manager
+        serial_manager->startHistory(i + 1);
+
+        for (int j = 0; j < n; ++j)
+        {
+            if (serial_manager->setTrackEvent(TallyInput::NEUTRON,
+                                              x[j], y[j], z[j],
+                                              u[j], v[j], w[j],
+                                              energy[j], weight[j],
+                                              track_length[j], cell_id[j]))
+            {
+                serial_manager->updateTallies();
+            }
+        }
+
+        for (int j = 0; j < n; ++j)
+        {
+            if (serial_manager->setCollisionEvent(TallyInput::NEUTRON,
+                                                  x[j], y[j], z[j],
+                                                  energy[j], weight[j],
+                                                  cross_section[j], cell_id[j]))
+            {
+                serial_manager->updateTallies();
+            }
+        }
+
+        serial_manager->endHistory();
+
+        // score the same events in batches, with directions that need to
+        // be normalized for the first history
+        if (i == 0)
+        {
+            for (int j = 0; j < n; ++j)
+            {
+                u[j] *= 2.0;
+                v[j] *= 2.0;
+                w[j] *= 2.0;
+            }
+        }
+
+        threaded_manager->startHistory(i + 1);
+
+        EXPECT_EQ(n - 1, threaded_manager->scoreTrackEvents(TallyInput::NEUTRON,
+                                                            n, x, y, z, u, v, w,
+                                                            energy, weight,
+                                                            track_length,
+                                                            cell_id));
+
+        EXPECT_EQ(n - 1, threaded_manager->scoreCollisionEvents(TallyInput::NEUTRON,
+                                                                n, x, y, z,
+                                                                energy, weight,
+                                                                cross_section,
+                                                                cell_id));
+
+        threaded_manager->endHistory();
+    }
+
+    compare_results(1);
+    compare_results(2);
+    compare_results(3);
+}
+//---------------------------------------------------------------------------//
+
+// end of MCNP5/dagmc/test/test_TallyManager.cpp
@@ -0,0 +1,447 @@
+// MCNP5/dagmc/test/test_TrackLengthMeshTally.cpp
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "moab/CartVect.hpp"
+#include "moab/Core.hpp"
+#include "moab/Range.hpp"
+
+#include "../Tally.hpp"
+#include "../TallyData.hpp"
+#include "../TallyEvent.hpp"
+
+//---------------------------------------------------------------------------//
+// ALLOCATION COUNTING
+//---------------------------------------------------------------------------//
+// Counts calls to operator new while counting is turned on
+static bool count_allocations = false;
+static unsigned long num_allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    if (count_allocations) ++num_allocations;
+
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) throw()
+{
+    std::free(ptr);
+}
+//---------------------------------------------------------------------------//
+// TEST FIXTURES
+//---------------------------------------------------------------------------//
+class TrackLengthMeshTallyTest : public ::testing::Test
+{
+  protected:
+    // initialize variables for each test
+    virtual void SetUp()
+    {
+        input.tally_id = 1;
+        input.tally_type = "unstr_track";
+        input.particle = TallyInput::NEUTRON;
+        input.energy_bin_bounds.push_back(0.0);
+        input.energy_bin_bounds.push_back(10.0);
+        input.multiplier_id = -1;
+        input.options.insert(std::make_pair("inp", "../unstructured_mesh.h5m"));
+
+        ray_tally = NULL;
+        walk_tally = NULL;
+
+        // find the bounding box of the mesh vertices
+        moab::Core mbi;
+        moab::EntityHandle file_set;
+        mbi.create_meshset(moab::MESHSET_SET, file_set);
+        ASSERT_EQ(moab::MB_SUCCESS,
+                  mbi.load_file("../unstructured_mesh.h5m", &file_set));
+
+        moab::Range vertices;
+        mbi.get_entities_by_type(file_set, moab::MBVERTEX, vertices);
+        std::vector<double> coords(3 * vertices.size());
+        mbi.get_coords(vertices, &coords[0]);
+
+        box_min = moab::CartVect(coords[0], coords[1], coords[2]);
+        box_max = box_min;
+
+        for (unsigned int i = 0; i < vertices.size(); ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                box_min[j] = std::min(box_min[j], coords[3*i + j]);
+                box_max[j] = std::max(box_max[j], coords[3*i + j]);
+            }
+        }
+    }
+
+    // deallocate memory resources
+    virtual void TearDown()
+    {
+        delete ray_tally;
+        delete walk_tally;
+    }
+
+  protected:
+    // data needed for each test
+    TallyInput input;
+    Tally* ray_tally;
+    Tally* walk_tally;
+    moab::CartVect box_min, box_max;
+
+    // creates a chain of tracks that stay in the middle half of the mesh
+    // bounding box, with each track starting where the previous one ended
+    void make_tracks(unsigned int num_tracks, std::vector<TallyEvent>& events)
+    {
+        moab::CartVect center = (box_min + box_max) / 2.0;
+        moab::CartVect half_width = (box_max - box_min) / 4.0;
+        double length = half_width.length() / 5.0;
+
+        TallyEvent event;
+        event.type = TallyEvent::TRACK;
+        event.particle = TallyInput::NEUTRON;
+        event.current_cell = 1;
+        event.track_length = length;
+        event.total_cross_section = 0.0;
+        event.particle_energy = 5.0;
+        event.particle_weight = 1.0;
+        event.position = center;
+
+        srand(12345);
+
+        for (unsigned int i = 0; i < num_tracks; ++i)
+        {
+            // choose directions until the track stays inside the region
+            moab::CartVect end;
+
+            do
+            {
+                for (int j = 0; j < 3; ++j)
+                {
+                    event.direction[j] = 2.0 * rand() / RAND_MAX - 1.0;
+                }
+
+                event.direction.normalize();
+                end = event.position + event.direction * length;
+            }
+            while (fabs(end[0] - center[0]) > half_width[0] ||
+                   fabs(end[1] - center[1]) > half_width[1] ||
+                   fabs(end[2] - center[2]) > half_width[2]);
+
+            events.push_back(event);
+            event.position = end;
+        }
+    }
+
+    // creates tracks that enter the mesh bounding box, leave it, cross all
+    // of it or miss it completely; the tracks that miss are kept separately
+    void make_boundary_tracks(unsigned int num_tracks,
+                              std::vector<TallyEvent>& events,
+                              std::vector<TallyEvent>& missed_events)
+    {
+        moab::CartVect center = (box_min + box_max) / 2.0;
+        moab::CartVect width = box_max - box_min;
+
+        TallyEvent event;
+        event.type = TallyEvent::TRACK;
+        event.particle = TallyInput::NEUTRON;
+        event.current_cell = 1;
+        event.total_cross_section = 0.0;
+        event.particle_energy = 5.0;
+        event.particle_weight = 1.0;
+
+        srand(54321);
+
+        for (unsigned int i = 0; i < num_tracks; ++i)
+        {
+            int axis = i % 3;
+            int other_axis = (axis + 1) % 3;
+            int track_type = (i / 3) % 4;
+
+            // choose a point in the middle half of the box, and a direction
+            // that is nearly parallel to one axis
+            moab::CartVect point;
+
+            for (int j = 0; j < 3; ++j)
+            {
+                point[j] = center[j] + width[j] * (0.5 * rand() / RAND_MAX - 0.25);
+                event.direction[j] = 0.2 * rand() / RAND_MAX - 0.1;
+            }
+
+            event.direction[axis] = 1.0;
+            event.direction.normalize();
+
+            // distances along the axis from outside the box to the point, and
+            // from the point to outside the box
+            double before = point[axis] - box_min[axis] + 0.25 * width[axis];
+            double after = box_max[axis] - point[axis] + 0.25 * width[axis];
+            double scale = 1.0 / event.direction[axis];
+
+            if (track_type == 0) // enters the box and stops at the point
+            {
+                event.position = point - event.direction * (before * scale);
+                event.track_length = before * scale;
+            }
+            else if (track_type == 1) // starts at the point and leaves the box
+            {
+                event.position = point;
+                event.track_length = after * scale;
+            }
+            else // crosses the whole box, or misses it to one side
+            {
+                event.position = point - event.direction * (before * scale);
+                event.track_length = (before + after) * scale;
+            }
+
+            if (track_type == 3)
+            {
+                // move the track far enough to the side to miss the box,
+                // allowing for the small tilt of its direction
+                event.position[other_axis] += width[other_axis]
+                                            + 0.2 * width[axis];
+                missed_events.push_back(event);
+            }
+            else
+            {
+                events.push_back(event);
+            }
+        }
+    }
+
+    // returns the sum of the tally results for all tets
+    double get_total(Tally* tally)
+    {
+        TallyData data = tally->getTallyData();
+
+        int length;
+        double* results = data.get_tally_data(length);
+        double total = 0.0;
+
+        for (int i = 0; i < length; ++i)
+        {
+            total += results[i];
+        }
+
+        return total;
+    }
+};
+//---------------------------------------------------------------------------//
+// FIXTURE-BASED TESTS: TrackLengthMeshTallyTest
+//---------------------------------------------------------------------------//
+TEST_F(TrackLengthMeshTallyTest, WalkMatchesRayFire)
+{
+    ray_tally = Tally::create_tally(input);
+    input.options.insert(std::make_pair("walk", "true"));
+    walk_tally = Tally::create_tally(input);
+    ASSERT_TRUE(ray_tally != NULL);
+    ASSERT_TRUE(walk_tally != NULL);
+
+    std::vector<TallyEvent> events;
+    make_tracks(50, events);
+
+    for (unsigned int i = 0; i < events.size(); ++i)
+    {
+        ray_tally->compute_score(events[i]);
+        walk_tally->compute_score(events[i]);
+    }
+
+    ray_tally->end_history();
+    walk_tally->end_history();
+
+    // both methods should score the same track length in every tet
+    TallyData ray_data = ray_tally->getTallyData();
+    TallyData walk_data = walk_tally->getTallyData();
+
+    int ray_length, walk_length;
+    double* ray_results = ray_data.get_tally_data(ray_length);
+    double* walk_results = walk_data.get_tally_data(walk_length);
+    ASSERT_EQ(ray_length, walk_length);
+
+    double total_length = 0.0;
+
+    for (int i = 0; i < walk_length; ++i)
+    {
+        EXPECT_NEAR(ray_results[i], walk_results[i], 1e-6);
+        total_length += walk_results[i];
+    }
+
+    EXPECT_NEAR(50 * events[0].track_length, total_length, 1e-6);
+}
+//---------------------------------------------------------------------------//
+TEST_F(TrackLengthMeshTallyTest, WalkMatchesRayFireAtMeshBoundary)
+{
+    ray_tally = Tally::create_tally(input);
+    input.options.insert(std::make_pair("walk", "true"));
+    walk_tally = Tally::create_tally(input);
+    ASSERT_TRUE(ray_tally != NULL);
+    ASSERT_TRUE(walk_tally != NULL);
+
+    std::vector<TallyEvent> events, missed_events;
+    make_boundary_tracks(48, events, missed_events);
+    ASSERT_FALSE(missed_events.empty());
+
+    // tracks that miss the mesh should not score anything
+    for (unsigned int i = 0; i < missed_events.size(); ++i)
+    {
+        ray_tally->compute_score(missed_events[i]);
+        walk_tally->compute_score(missed_events[i]);
+    }
+
+    ray_tally->end_history();
+    walk_tally->end_history();
+
+    EXPECT_DOUBLE_EQ(0.0, get_total(ray_tally));
+    EXPECT_DOUBLE_EQ(0.0, get_total(walk_tally));
+
+    // tracks that enter, leave or cross the mesh
+    for (unsigned int i = 0; i < events.size(); ++i)
+    {
+        ray_tally->compute_score(events[i]);
+        walk_tally->compute_score(events[i]);
+    }
+
+    ray_tally->end_history();
+    walk_tally->end_history();
+
+    // both methods should score the same track length in every tet
+    TallyData ray_data = ray_tally->getTallyData();
+    TallyData walk_data = walk_tally->getTallyData();
+
+    int ray_length, walk_length;
+    double* ray_results = ray_data.get_tally_data(ray_length);
+    double* walk_results = walk_data.get_tally_data(walk_length);
+    ASSERT_EQ(ray_length, walk_length);
+
+    for (int i = 0; i < walk_length; ++i)
+    {
+        EXPECT_NEAR(ray_results[i], walk_results[i], 1e-6);
+    }
+
+    EXPECT_GT(get_total(walk_tally), 0.0);
+}
+//---------------------------------------------------------------------------//
+TEST_F(TrackLengthMeshTallyTest, CachedSetupData)
+{
+    const char* cache_file = "test_tally_cache.h5m";
+    const char* tet_cache_file = "test_tally_cache.h5m.tets";
+    std::remove(cache_file);
+    std::remove(tet_cache_file);
+
+    // first tally does not use the cache
+    input.options.insert(std::make_pair("walk", "true"));
+    ray_tally = Tally::create_tally(input);
+    ASSERT_TRUE(ray_tally != NULL);
+
+    // second tally builds the setup data and writes both cache files
+    input.options.insert(std::make_pair("cache", cache_file));
+    Tally* cache_tally = Tally::create_tally(input);
+    ASSERT_TRUE(cache_tally != NULL);
+    delete cache_tally;
+
+    const char* files[2] = {cache_file, tet_cache_file};
+
+    for (int i = 0; i < 2; ++i)
+    {
+        FILE* file = fopen(files[i], "rb");
+        ASSERT_TRUE(file != NULL);
+        fclose(file);
+    }
+
+    // third tally loads the mesh, KD tree and tet data from the cache
+    walk_tally = Tally::create_tally(input);
+    ASSERT_TRUE(walk_tally != NULL);
+
+    std::vector<TallyEvent> events;
+    std::vector<TallyEvent> missed_events;
+    make_tracks(50, events);
+    make_boundary_tracks(24, events, missed_events);
+
+    for (unsigned int i = 0; i < events.size(); ++i)
+    {
+        ray_tally->compute_score(events[i]);
+        walk_tally->compute_score(events[i]);
+    }
+
+    ray_tally->end_history();
+    walk_tally->end_history();
+
+    TallyData computed_data = ray_tally->getTallyData();
+    TallyData cached_data = walk_tally->getTallyData();
+
+    int computed_length, cached_length;
+    double* computed_results = computed_data.get_tally_data(computed_length);
+    double* cached_results = cached_data.get_tally_data(cached_length);
+    ASSERT_EQ(computed_length, cached_length);
+
+    for (int i = 0; i < cached_length; ++i)
+    {
+        EXPECT_NEAR(computed_results[i], cached_results[i], 1e-10);
+    }
+
+    std::remove(cache_file);
+    std::remove(tet_cache_file);
+}
+//---------------------------------------------------------------------------//
+// BENCHMARK TESTS
+//---------------------------------------------------------------------------//
+// Counts the number of memory allocations per track once the workspaces
+// have grown to their steady state size.  This is disabled by default; use
+// --gtest_also_run_disabled_tests to run it.
+TEST_F(TrackLengthMeshTallyTest, DISABLED_AllocationsPerTrack)
+{
+    ray_tally = Tally::create_tally(input);
+    input.options.insert(std::make_pair("walk", "true"));
+    walk_tally = Tally::create_tally(input);
+    ASSERT_TRUE(ray_tally != NULL);
+    ASSERT_TRUE(walk_tally != NULL);
+
+    const unsigned int num_tracks = 10000;
+    std::vector<TallyEvent> events;
+    make_tracks(num_tracks, events);
+
+    Tally* tallies[2] = {ray_tally, walk_tally};
+    const char* names[2] = {"ray fire", "walk"};
+    unsigned long allocations[2];
+
+    for (int t = 0; t < 2; ++t)
+    {
+        // warm up the workspaces with the same set of tracks
+        for (unsigned int i = 0; i < num_tracks; ++i)
+        {
+            tallies[t]->compute_score(events[i]);
+        }
+
+        num_allocations = 0;
+        count_allocations = true;
+        clock_t start = clock();
+
+        for (unsigned int i = 0; i < num_tracks; ++i)
+        {
+            tallies[t]->compute_score(events[i]);
+        }
+
+        double time = double(clock() - start) / CLOCKS_PER_SEC;
+        count_allocations = false;
+        allocations[t] = num_allocations;
+
+        std::cout << "    " << names[t] << ": " << time << " s, "
+                  << double(num_allocations) / num_tracks
+                  << " allocations per track" << std::endl;
+    }
+
+    // the ray fire count includes allocations made inside the MOAB KD tree,
+    // but walking through the mesh should not allocate any memory
+    EXPECT_EQ(0u, allocations[1]);
+}
+//---------------------------------------------------------------------------//
+
+// end of MCNP5/dagmc/test/test_TrackLengthMeshTally.cpp